@@ -0,0 +1,251 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares the time taken to write entries to a page with a single call to
+// |Page.PutMany()|, with one call to |Page.Put()| per entry in a transaction,
+// and with one call to |Page.Put()| per entry outside of transactions. The
+// ledger runs in-process, on its own thread.
+
+#include <stdio.h>
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "apps/ledger/services/internal/internal.fidl.h"
+#include "apps/ledger/services/public/ledger.fidl.h"
+#include "apps/ledger/src/app/ledger_repository_factory_impl.h"
+#include "apps/ledger/src/configuration/configuration.h"
+#include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/environment/environment.h"
+#include "lib/fidl/cpp/bindings/binding.h"
+#include "lib/ftl/command_line.h"
+#include "lib/ftl/files/scoped_temp_dir.h"
+#include "lib/ftl/functional/make_copyable.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/strings/string_printf.h"
+#include "lib/ftl/time/time_point.h"
+#include "lib/mtl/tasks/message_loop.h"
+#include "lib/mtl/threading/create_thread.h"
+
+namespace ledger {
+namespace {
+
+const char kHelpArg[] = "help";
+const char kEntryCountArg[] = "entry_count";
+const char kValueSizeArg[] = "value_size";
+
+void PrintHelp() {
+  printf("Compares Page.PutMany() with one Page.Put() per entry.\n");
+  printf("\n");
+  printf("  --entry_count=<N>: number of entries written (default: 1000).\n");
+  printf("  --value_size=<N>: size of each value in bytes (default: 100).\n");
+  printf("  --help: prints this help.\n");
+}
+
+void PrintResult(const char* name,
+                 size_t entry_count,
+                 ftl::TimeDelta duration) {
+  printf("%-24s %8.1f ms %10.0f entries/s\n", name, duration.ToMillisecondsF(),
+         entry_count / duration.ToSecondsF());
+}
+
+bool GetSizeArg(const ftl::CommandLine& command_line,
+                ftl::StringView name,
+                size_t* value) {
+  std::string string_value;
+  if (command_line.GetOptionValue(name, &string_value) &&
+      !ftl::StringToNumberWithError(string_value, value)) {
+    FTL_LOG(ERROR) << "Invalid " << name << ": " << string_value;
+    return false;
+  }
+  return true;
+}
+
+// Runs the ledger on the thread of |task_runner|.
+class LedgerRepositoryFactoryContainer {
+ public:
+  LedgerRepositoryFactoryContainer(
+      ftl::RefPtr<ftl::TaskRunner> task_runner,
+      fidl::InterfaceRequest<LedgerRepositoryFactory> request)
+      : environment_(configuration::Configuration(), task_runner, nullptr),
+        factory_impl_(&environment_),
+        factory_binding_(&factory_impl_, std::move(request)) {}
+  ~LedgerRepositoryFactoryContainer() {}
+
+ private:
+  Environment environment_;
+  LedgerRepositoryFactoryImpl factory_impl_;
+  fidl::Binding<LedgerRepositoryFactory> factory_binding_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(LedgerRepositoryFactoryContainer);
+};
+
+class Benchmark {
+ public:
+  Benchmark(size_t entry_count, size_t value_size)
+      : entry_count_(entry_count), value_(value_size, 'v') {}
+
+  int Run() {
+    std::thread thread = mtl::CreateThread(&task_runner_);
+    task_runner_->PostTask(ftl::MakeCopyable(
+        [ this, request = factory_.NewRequest() ]() mutable {
+          container_ = std::make_unique<LedgerRepositoryFactoryContainer>(
+              task_runner_, std::move(request));
+        }));
+
+    bool success = GetLedger() && RunTransactionPuts() && RunPutMany() &&
+                   RunImplicitPuts();
+
+    task_runner_->PostTask([this] {
+      mtl::MessageLoop::GetCurrent()->QuitNow();
+      container_.reset();
+    });
+    thread.join();
+    return success ? 0 : 1;
+  }
+
+ private:
+  // Returns a callback recording the status of a call, if it is an error.
+  std::function<void(Status)> Check() {
+    return [this](Status status) {
+      if (status != Status::OK) {
+        status_ = status;
+      }
+    };
+  }
+
+  // Waits for the responses to the |count| calls made on |ptr|, and returns
+  // false if one of them did not arrive or did not return |OK|.
+  template <typename Interface>
+  bool WaitForResponses(fidl::InterfacePtr<Interface>* ptr, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      if (!ptr->WaitForIncomingResponse()) {
+        FTL_LOG(ERROR) << "Connection closed";
+        return false;
+      }
+    }
+    if (status_ != Status::OK) {
+      FTL_LOG(ERROR) << "Call failed with status " << status_;
+      return false;
+    }
+    return true;
+  }
+
+  bool GetLedger() {
+    factory_->GetRepository(tmp_dir_.path(), repository_.NewRequest(),
+                            Check());
+    if (!WaitForResponses(&factory_, 1)) {
+      return false;
+    }
+    repository_->GetLedger(convert::ToArray("benchmark"), ledger_.NewRequest(),
+                           Check());
+    return WaitForResponses(&repository_, 1);
+  }
+
+  bool NewPage(PagePtr* page) {
+    ledger_->NewPage(page->NewRequest(), Check());
+    return WaitForResponses(&ledger_, 1);
+  }
+
+  fidl::Array<uint8_t> Key(size_t i) {
+    return convert::ToArray(ftl::StringPrintf("key%08zu", i));
+  }
+
+  bool RunTransactionPuts() {
+    PagePtr page;
+    if (!NewPage(&page)) {
+      return false;
+    }
+    ftl::TimePoint start = ftl::TimePoint::Now();
+    page->StartTransaction(Check());
+    for (size_t i = 0; i < entry_count_; ++i) {
+      page->Put(Key(i), convert::ToArray(value_), Check());
+    }
+    page->Commit(Check());
+    if (!WaitForResponses(&page, entry_count_ + 2)) {
+      return false;
+    }
+    PrintResult("Put in a transaction", entry_count_,
+                ftl::TimePoint::Now() - start);
+    return true;
+  }
+
+  bool RunPutMany() {
+    PagePtr page;
+    if (!NewPage(&page)) {
+      return false;
+    }
+    ftl::TimePoint start = ftl::TimePoint::Now();
+    fidl::Array<EntryToPutPtr> entries = fidl::Array<EntryToPutPtr>::New(0);
+    for (size_t i = 0; i < entry_count_; ++i) {
+      EntryToPutPtr entry = EntryToPut::New();
+      entry->key = Key(i);
+      entry->value = convert::ToArray(value_);
+      entry->priority = Priority::EAGER;
+      entries.push_back(std::move(entry));
+    }
+    page->PutMany(std::move(entries), Check());
+    if (!WaitForResponses(&page, 1)) {
+      return false;
+    }
+    PrintResult("PutMany", entry_count_, ftl::TimePoint::Now() - start);
+    return true;
+  }
+
+  bool RunImplicitPuts() {
+    PagePtr page;
+    if (!NewPage(&page)) {
+      return false;
+    }
+    ftl::TimePoint start = ftl::TimePoint::Now();
+    for (size_t i = 0; i < entry_count_; ++i) {
+      page->Put(Key(i), convert::ToArray(value_), Check());
+    }
+    if (!WaitForResponses(&page, entry_count_)) {
+      return false;
+    }
+    PrintResult("Put outside transactions", entry_count_,
+                ftl::TimePoint::Now() - start);
+    return true;
+  }
+
+  const size_t entry_count_;
+  const std::string value_;
+  files::ScopedTempDir tmp_dir_;
+  ftl::RefPtr<ftl::TaskRunner> task_runner_;
+  std::unique_ptr<LedgerRepositoryFactoryContainer> container_;
+  LedgerRepositoryFactoryPtr factory_;
+  LedgerRepositoryPtr repository_;
+  LedgerPtr ledger_;
+  Status status_ = Status::OK;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(Benchmark);
+};
+
+int Run(const ftl::CommandLine& command_line) {
+  size_t entry_count = 1000;
+  size_t value_size = 100;
+  if (!GetSizeArg(command_line, kEntryCountArg, &entry_count) ||
+      !GetSizeArg(command_line, kValueSizeArg, &value_size)) {
+    return 1;
+  }
+  printf("%zu entries with %zu-byte values\n", entry_count, value_size);
+  mtl::MessageLoop message_loop;
+  return Benchmark(entry_count, value_size).Run();
+}
+
+}  // namespace
+}  // namespace ledger
+
+int main(int argc, const char** argv) {
+  ftl::CommandLine command_line = ftl::CommandLineFromArgcArgv(argc, argv);
+  if (command_line.HasOption(ledger::kHelpArg)) {
+    ledger::PrintHelp();
+    return 0;
+  }
+  return ledger::Run(command_line);
+}
@@ -172,6 +172,8 @@ BranchTracker::BranchTracker(PageManager* manager,
     this->SetTransactionInProgress(false);
     CheckEmpty();
   });
+  // The page is kept once closed until its pending changes are applied.
+  interface_.impl()->set_on_empty([this] { CheckEmpty(); });
   watchers_.set_on_empty([this] { CheckEmpty(); });
   std::vector<storage::CommitId> commit_ids;
   // TODO(etiennej): Fail more nicely.
@@ -250,7 +252,8 @@ void BranchTracker::RegisterPageWatcher(PageWatcherPtr page_watcher_ptr,
 }
 
 void BranchTracker::CheckEmpty() {
-  if (on_empty_callback_ && !interface_.is_bound() && watchers_.empty())
+  if (on_empty_callback_ && !interface_.is_bound() &&
+      interface_.impl()->IsEmpty() && watchers_.empty())
     on_empty_callback_();
 }
 
@@ -7,6 +7,7 @@
 
 #include "apps/ledger/src/storage/public/types.h"
 #include "lib/ftl/strings/string_view.h"
+#include "lib/ftl/time/time_delta.h"
 
 namespace ledger {
 
@@ -16,6 +17,34 @@ constexpr size_t kPageIdSize = 16;
 // Maximal size of data that will be returned inline.
 constexpr size_t kMaxInlineDataSize = 2048;
 
+// Maximal size of values that are stored in the page database together with
+// the journal entry referencing them. Larger values are streamed to the object
+// store.
+constexpr size_t kMaxInlineObjectSize = 2048;
+
+// Maximal size of the keys and inline values returned by one call to
+// |PageSnapshot.GetEntries()|, |PageSnapshot.GetKeys()|, their range variants
+// or |PageSnapshot.GetMany()|, so that responses stay well below the maximal
+// message size. Larger results are paginated.
+constexpr size_t kMaxResultSize = 32 * 1024;
+
+// Maximal number of VMOs returned by one call to |PageSnapshot.GetEntries()|,
+// |PageSnapshot.GetEntriesInRange()| or |PageSnapshot.GetMany()|, below the
+// maximal number of handles of a message.
+constexpr size_t kMaxResultHandles = 32;
+
+// Maximal number of values read concurrently by |PageSnapshot.GetMany()|.
+constexpr size_t kMaxConcurrentValueReads = 16;
+
+// Delay after which the changes made outside of transactions are committed.
+// Changes received in the meantime are part of the same commit. With no delay,
+// the changes already queued on the message loop are committed together.
+constexpr ftl::TimeDelta kImplicitCommitDelay = ftl::TimeDelta::Zero();
+
+// Maximal number of changes made outside of transactions that are committed
+// together.
+constexpr size_t kImplicitCommitMaxChanges = 1000;
+
 // The root id. The array size must be equal to kPageIdSize.
 extern const ftl::StringView kRootPageId;
 
@@ -27,6 +27,8 @@ class BoundInterface {
 
   bool is_bound() { return binding_.is_bound(); }
 
+  Impl* impl() { return &impl_; }
+
  private:
   Impl impl_;
   fidl::Binding<Interface> binding_;
@@ -14,20 +14,58 @@
 #include "apps/ledger/src/app/page_snapshot_impl.h"
 #include "apps/ledger/src/app/page_utils.h"
 #include "apps/ledger/src/callback/trace_callback.h"
+#include "apps/ledger/src/callback/waiter.h"
 #include "apps/ledger/src/convert/convert.h"
 #include "apps/tracing/lib/trace/event.h"
 #include "lib/ftl/functional/make_copyable.h"
 #include "lib/ftl/logging.h"
 #include "lib/mtl/socket/strings.h"
+#include "lib/mtl/tasks/message_loop.h"
 
 namespace ledger {
 
 PageImpl::PageImpl(storage::PageStorage* storage,
                    PageManager* manager,
                    BranchTracker* branch_tracker)
-    : storage_(storage), manager_(manager), branch_tracker_(branch_tracker) {}
+    : storage_(storage),
+      manager_(manager),
+      branch_tracker_(branch_tracker),
+      implicit_batch_delay_(kImplicitCommitDelay),
+      implicit_batch_max_changes_(kImplicitCommitMaxChanges),
+      weak_ptr_factory_(this) {}
+
+PageImpl::~PageImpl() {
+  // The callbacks of the pending changes belong to the closed connection, and
+  // are dropped without being called. The page is only deleted with changes
+  // still waiting to be applied if its manager is deleted: these are dropped.
+  bool has_changes = !implicit_callbacks_.empty();
+  implicit_callbacks_.clear();
+  if (!implicit_journal_) {
+    return;
+  }
+  if (!has_changes) {
+    implicit_journal_->Rollback();
+    return;
+  }
+  // The pending changes made outside of transactions are committed even
+  // though the page is gone, by the manager, which owns the page storage. The
+  // branch head is not updated.
+  manager_->CommitClosedPageJournal(std::move(implicit_journal_));
+}
+
+void PageImpl::SetImplicitBatching(ftl::TimeDelta delay, size_t max_changes) {
+  FTL_DCHECK(max_changes > 0);
+  implicit_batch_delay_ = delay;
+  implicit_batch_max_changes_ = max_changes;
+}
 
-PageImpl::~PageImpl() {}
+void PageImpl::set_on_empty(ftl::Closure on_empty_callback) {
+  on_empty_callback_ = std::move(on_empty_callback);
+}
+
+bool PageImpl::IsEmpty() {
+  return pending_changes_.empty();
+}
 
 // GetId() => (array<uint8> id);
 void PageImpl::GetId(const GetIdCallback& callback) {
@@ -37,7 +75,8 @@ void PageImpl::GetId(const GetIdCallback& callback) {
 }
 
 const storage::CommitId& PageImpl::GetCurrentCommitId() {
-  // TODO(etiennej): Commit implicit transactions when we have those.
+  // The changes of the pending implicit journal are not part of the current
+  // commit: their callbacks are only called once the journal is committed.
   if (!journal_) {
     return branch_tracker_->GetBranchHeadId();
   } else {
@@ -73,6 +112,21 @@ void PageImpl::Watch(fidl::InterfaceHandle<PageWatcher> watcher,
                                        std::move(snapshot));
 }
 
+// SetTreeType(TreeType tree_type) => (Status status);
+void PageImpl::SetTreeType(TreeType tree_type,
+                           const SetTreeTypeCallback& callback) {
+  TRACE_DURATION("page", "set_tree_type");
+
+  storage::Status status = storage_->SetTreeType(
+      tree_type == TreeType::HASH_TREE ? storage::TreeType::HASH_TREE
+                                       : storage::TreeType::BTREE);
+  if (status == storage::Status::ILLEGAL_STATE) {
+    callback(Status::ILLEGAL_STATE);
+    return;
+  }
+  callback(PageUtils::ConvertStatus(status));
+}
+
 void PageImpl::RunInTransaction(
     std::function<Status(storage::Journal* journal)> runnable,
     std::function<void(Status)> callback) {
@@ -81,46 +135,150 @@ void PageImpl::RunInTransaction(
     callback(runnable(journal_.get()));
     return;
   }
-  // No transaction is in progress; create one just for this change.
-  // TODO(etiennej): Add a change batching strategy for operations outside
-  // transactions. Currently, we create a commit for every change; we would
-  // like to group changes that happen "close enough" together in one commit.
+  // No transaction is in progress; add this change to the batch of changes
+  // made outside of transactions, and start a new batch if needed.
+  Status status = StartImplicitJournal();
+  if (status != Status::OK) {
+    callback(status);
+    return;
+  }
+  // A failed change is not part of the commit, but does not prevent the other
+  // changes of an implicit journal from being committed.
+  status = runnable(implicit_journal_.get());
+  if (status != Status::OK) {
+    callback(status);
+    return;
+  }
+  AddImplicitCallback(std::move(callback));
+}
+
+void PageImpl::RunManyInTransaction(
+    std::function<Status(storage::Journal* journal)> runnable,
+    std::function<void(Status)> callback) {
+  if (journal_) {
+    // A failed change prevents the transaction from being committed, so that
+    // the other changes of |runnable| are not committed either.
+    callback(runnable(journal_.get()));
+    return;
+  }
+  // The pending batch is committed first, so that the changes of |runnable|
+  // can be rolled back on their own.
+  CommitImplicitJournal();
+  Status status = StartImplicitJournal();
+  if (status != Status::OK) {
+    callback(status);
+    return;
+  }
+  status = runnable(implicit_journal_.get());
+  if (status != Status::OK) {
+    ++implicit_batch_id_;
+    std::unique_ptr<storage::Journal> journal = std::move(implicit_journal_);
+    journal->Rollback();
+    callback(status);
+    return;
+  }
+  AddImplicitCallback(std::move(callback));
+}
+
+Status PageImpl::StartImplicitJournal() {
+  if (implicit_journal_) {
+    return Status::OK;
+  }
   storage::CommitId commit_id = branch_tracker_->GetBranchHeadId();
-  std::unique_ptr<storage::Journal> journal;
   storage::Status status = storage_->StartCommit(
-      commit_id, storage::JournalType::IMPLICIT, &journal);
+      commit_id, storage::JournalType::IMPLICIT, &implicit_journal_);
   if (status != storage::Status::OK) {
-    callback(PageUtils::ConvertStatus(status));
-    journal->Rollback();
+    implicit_journal_.reset();
+    return PageUtils::ConvertStatus(status);
+  }
+  mtl::MessageLoop::GetCurrent()->task_runner()->PostDelayedTask(
+      [ weak_this_ptr = weak_ptr_factory_.GetWeakPtr(),
+        batch_id = implicit_batch_id_ ]() {
+        if (weak_this_ptr && weak_this_ptr->implicit_batch_id_ == batch_id) {
+          weak_this_ptr->CommitImplicitJournal();
+        }
+      },
+      implicit_batch_delay_);
+  return Status::OK;
+}
+
+void PageImpl::AddImplicitCallback(std::function<void(Status)> callback) {
+  implicit_callbacks_.push_back(std::move(callback));
+  if (implicit_callbacks_.size() >= implicit_batch_max_changes_) {
+    CommitImplicitJournal();
+  }
+}
+
+void PageImpl::CommitImplicitJournal() {
+  if (!implicit_journal_) {
     return;
   }
-  Status ledger_status = runnable(journal.get());
-  if (ledger_status != Status::OK) {
-    callback(ledger_status);
+  ++implicit_batch_id_;
+  std::unique_ptr<storage::Journal> journal = std::move(implicit_journal_);
+  std::vector<std::function<void(Status)>> callbacks;
+  callbacks.swap(implicit_callbacks_);
+  if (callbacks.empty()) {
+    // All the changes of the batch failed.
     journal->Rollback();
     return;
   }
-
-  CommitJournal(std::move(journal), callback);
+  // The changes are acknowledged once committed.
+  CommitJournal(std::move(journal),
+                [callbacks = std::move(callbacks)](Status status) {
+                  for (const auto& callback : callbacks) {
+                    callback(status);
+                  }
+                });
 }
 
 void PageImpl::CommitJournal(std::unique_ptr<storage::Journal> journal,
                              std::function<void(Status)> callback) {
+  // The commit owns the journal, so that it completes even if the page is
+  // closed meanwhile. The callback then belongs to the closed connection and
+  // is not called.
   storage::Journal* journal_ptr = journal.get();
-  in_progress_journals_.push_back(std::move(journal));
-
-  journal_ptr->Commit([this, callback, journal_ptr](
-      storage::Status status, const storage::CommitId& commit_id) {
-    in_progress_journals_.erase(std::remove_if(
-        in_progress_journals_.begin(), in_progress_journals_.end(),
-        [&journal_ptr](const std::unique_ptr<storage::Journal>& journal) {
-          return journal_ptr == journal.get();
-        }));
+  journal_ptr->Commit(ftl::MakeCopyable([
+    weak_this_ptr = weak_ptr_factory_.GetWeakPtr(),
+    journal = std::move(journal), callback = std::move(callback)
+  ](storage::Status status, const storage::CommitId& commit_id) mutable {
+    DeleteJournalLater(std::move(journal));
+    if (!weak_this_ptr) {
+      return;
+    }
     if (status == storage::Status::OK) {
-      branch_tracker_->SetBranchHead(commit_id);
+      weak_this_ptr->branch_tracker_->SetBranchHead(commit_id);
     }
     callback(PageUtils::ConvertStatus(status));
-  });
+  }));
+}
+
+void PageImpl::DeleteJournalLater(std::unique_ptr<storage::Journal> journal) {
+  // The journal cannot be deleted while it runs its commit callback.
+  mtl::MessageLoop::GetCurrent()->task_runner()->PostTask(
+      ftl::MakeCopyable([journal = std::move(journal)]() {}));
+}
+
+uint64_t PageImpl::ReserveChange() {
+  pending_changes_.emplace_back();
+  return first_pending_change_id_ + pending_changes_.size() - 1;
+}
+
+void PageImpl::ApplyChange(uint64_t change_id, ftl::Closure apply) {
+  FTL_DCHECK(apply);
+  FTL_DCHECK(change_id >= first_pending_change_id_ &&
+             change_id - first_pending_change_id_ < pending_changes_.size());
+  pending_changes_[change_id - first_pending_change_id_] = std::move(apply);
+  while (!pending_changes_.empty() && pending_changes_.front()) {
+    ftl::Closure next_change = std::move(pending_changes_.front());
+    pending_changes_.pop_front();
+    ++first_pending_change_id_;
+    next_change();
+  }
+  // This may delete the page, if its connection is closed.
+  if (pending_changes_.empty() && on_empty_callback_) {
+    ftl::Closure on_empty_callback = on_empty_callback_;
+    on_empty_callback();
+  }
 }
 
 // Put(array<uint8> key, array<uint8> value) => (Status status);
@@ -140,26 +298,131 @@ void PageImpl::PutWithPriority(fidl::Array<uint8_t> key,
   auto timed_callback =
       TRACE_CALLBACK(std::move(callback), "page", "put_with_priority");
 
+  storage::KeyPriority storage_priority = priority == Priority::EAGER
+                                              ? storage::KeyPriority::EAGER
+                                              : storage::KeyPriority::LAZY;
+  uint64_t change_id = ReserveChange();
+  if (value.size() <= kMaxInlineObjectSize) {
+    ApplyChange(change_id, ftl::MakeCopyable([
+      this, key = std::move(key), value = std::move(value), storage_priority,
+      callback = std::move(timed_callback)
+    ]() {
+      RunInTransaction(
+          [&key, &value, storage_priority](storage::Journal* journal) {
+            return PageUtils::ConvertStatus(
+                journal->PutValue(key, value, storage_priority));
+          },
+          callback);
+    }));
+    return;
+  }
+
   // TODO(etiennej): Use asynchronous write, otherwise the run loop may block
   // until the socket is drained.
   mx::socket socket = mtl::WriteStringToSocket(convert::ToStringView(value));
   storage_->AddObjectFromLocal(
       std::move(socket), value.size(), ftl::MakeCopyable([
-        this, key = std::move(key), priority,
+        weak_this_ptr = weak_ptr_factory_.GetWeakPtr(), change_id,
+        key = std::move(key), storage_priority,
         callback = std::move(timed_callback)
-      ](storage::Status status, storage::ObjectId object_id) {
-        if (status != storage::Status::OK) {
-          callback(PageUtils::ConvertStatus(status));
+      ](storage::Status status, storage::ObjectId object_id) mutable {
+        if (!weak_this_ptr) {
           return;
         }
-
-        PutInCommit(key, object_id,
-                    priority == Priority::EAGER ? storage::KeyPriority::EAGER
-                                                : storage::KeyPriority::LAZY,
-                    callback);
+        PageImpl* page = weak_this_ptr.get();
+        page->ApplyChange(change_id, ftl::MakeCopyable([
+          page, status, key = std::move(key), object_id = std::move(object_id),
+          storage_priority, callback = std::move(callback)
+        ]() {
+          if (status != storage::Status::OK) {
+            callback(PageUtils::ConvertStatus(status));
+            return;
+          }
+          page->PutInCommit(key, object_id, storage_priority, callback);
+        }));
       }));
 }
 
+// PutMany(array<EntryToPut> entries) => (Status status);
+void PageImpl::PutMany(fidl::Array<EntryToPutPtr> entries,
+                       const PutManyCallback& callback) {
+  auto timed_callback = TRACE_CALLBACK(std::move(callback), "page", "put_many");
+
+  // Values too large to be stored inline are added to the storage first; the
+  // entries are then all written in a single journal operation, in the order
+  // of the calls to the page.
+  uint64_t change_id = ReserveChange();
+  auto waiter = callback::Waiter<storage::Status, storage::ObjectId>::Create(
+      storage::Status::OK);
+  std::vector<size_t> large_value_indexes;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const fidl::Array<uint8_t>& value = entries[i]->value;
+    if (value.size() <= kMaxInlineObjectSize) {
+      continue;
+    }
+    large_value_indexes.push_back(i);
+    // TODO(etiennej): Use asynchronous write, otherwise the run loop may block
+    // until the socket is drained.
+    mx::socket socket = mtl::WriteStringToSocket(convert::ToStringView(value));
+    storage_->AddObjectFromLocal(
+        std::move(socket), value.size(),
+        [callback = waiter->NewCallback()](storage::Status status,
+                                           storage::ObjectId object_id) {
+          callback(status,
+                   std::make_unique<storage::ObjectId>(std::move(object_id)));
+        });
+  }
+
+  waiter->Finalize(ftl::MakeCopyable([
+    weak_this_ptr = weak_ptr_factory_.GetWeakPtr(), change_id,
+    entries = std::move(entries),
+    large_value_indexes = std::move(large_value_indexes),
+    callback = std::move(timed_callback)
+  ](storage::Status status,
+    std::vector<std::unique_ptr<storage::ObjectId>> object_ids) mutable {
+    if (!weak_this_ptr) {
+      return;
+    }
+    PageImpl* page = weak_this_ptr.get();
+    page->ApplyChange(change_id, ftl::MakeCopyable([
+      page, status, entries = std::move(entries),
+      large_value_indexes = std::move(large_value_indexes),
+      object_ids = std::move(object_ids), callback = std::move(callback)
+    ]() {
+      if (status != storage::Status::OK) {
+        callback(PageUtils::ConvertStatus(status));
+        return;
+      }
+      page->RunManyInTransaction(
+          [&entries, &large_value_indexes,
+           &object_ids](storage::Journal* journal) {
+            size_t next_large_value = 0;
+            for (size_t i = 0; i < entries.size(); ++i) {
+              const EntryToPutPtr& entry = entries[i];
+              storage::KeyPriority priority =
+                  entry->priority == Priority::EAGER
+                      ? storage::KeyPriority::EAGER
+                      : storage::KeyPriority::LAZY;
+              storage::Status status;
+              if (next_large_value < large_value_indexes.size() &&
+                  large_value_indexes[next_large_value] == i) {
+                status = journal->Put(entry->key,
+                                      *object_ids[next_large_value], priority);
+                ++next_large_value;
+              } else {
+                status = journal->PutValue(entry->key, entry->value, priority);
+              }
+              if (status != storage::Status::OK) {
+                return PageUtils::ConvertStatus(status);
+              }
+            }
+            return Status::OK;
+          },
+          callback);
+    }));
+  }));
+}
+
 // PutReference(array<uint8> key, Reference? reference, Priority priority)
 //   => (Status status);
 void PageImpl::PutReference(fidl::Array<uint8_t> key,
@@ -169,11 +432,16 @@ void PageImpl::PutReference(fidl::Array<uint8_t> key,
   auto timed_callback =
       TRACE_CALLBACK(std::move(callback), "page", "put_reference");
 
-  storage::ObjectIdView object_id(reference->opaque_id);
-  PutInCommit(key, object_id,
-              priority == Priority::EAGER ? storage::KeyPriority::EAGER
-                                          : storage::KeyPriority::LAZY,
-              std::move(timed_callback));
+  ApplyChange(ReserveChange(), ftl::MakeCopyable([
+    this, key = std::move(key), reference = std::move(reference), priority,
+    callback = std::move(timed_callback)
+  ]() {
+    storage::ObjectIdView object_id(reference->opaque_id);
+    PutInCommit(key, object_id,
+                priority == Priority::EAGER ? storage::KeyPriority::EAGER
+                                            : storage::KeyPriority::LAZY,
+                callback);
+  }));
 }
 
 void PageImpl::PutInCommit(convert::ExtendedStringView key,
@@ -190,12 +458,80 @@ void PageImpl::PutInCommit(convert::ExtendedStringView key,
 // Delete(array<uint8> key) => (Status status);
 void PageImpl::Delete(fidl::Array<uint8_t> key,
                       const DeleteCallback& callback) {
-  RunInTransaction(
-      [&key](storage::Journal* journal) {
-        return PageUtils::ConvertStatus(journal->Delete(key),
-                                        Status::KEY_NOT_FOUND);
-      },
-      TRACE_CALLBACK(std::move(callback), "page", "delete"));
+  ApplyChange(ReserveChange(), ftl::MakeCopyable([
+    this, key = std::move(key),
+    callback = TRACE_CALLBACK(std::move(callback), "page", "delete")
+  ]() {
+    RunInTransaction(
+        [&key](storage::Journal* journal) {
+          return PageUtils::ConvertStatus(journal->Delete(key),
+                                          Status::KEY_NOT_FOUND);
+        },
+        callback);
+  }));
+}
+
+// DeleteMany(array<array<uint8>> keys) => (Status status);
+void PageImpl::DeleteMany(fidl::Array<fidl::Array<uint8_t>> keys,
+                          const DeleteManyCallback& callback) {
+  ApplyChange(ReserveChange(), ftl::MakeCopyable([
+    this, keys = std::move(keys),
+    callback = TRACE_CALLBACK(std::move(callback), "page", "delete_many")
+  ]() {
+    RunManyInTransaction(
+        [&keys](storage::Journal* journal) {
+          for (size_t i = 0; i < keys.size(); ++i) {
+            Status status = PageUtils::ConvertStatus(journal->Delete(keys[i]),
+                                                     Status::KEY_NOT_FOUND);
+            if (status != Status::OK) {
+              return status;
+            }
+          }
+          return Status::OK;
+        },
+        callback);
+  }));
+}
+
+// DeleteRange(array<uint8>? start, array<uint8>? end)
+//   => (Status status);
+void PageImpl::DeleteRange(fidl::Array<uint8_t> start,
+                           fidl::Array<uint8_t> end,
+                           const DeleteRangeCallback& callback) {
+  // The storage reads an empty |end| as the end of the page: only a NULL |end|
+  // is unbounded here, and other empty ranges delete nothing.
+  if (!end.is_null() &&
+      convert::ToStringView(start) >= convert::ToStringView(end)) {
+    callback(Status::OK);
+    return;
+  }
+  ApplyChange(ReserveChange(), ftl::MakeCopyable([
+    this, start = std::move(start), end = std::move(end),
+    callback = TRACE_CALLBACK(std::move(callback), "page", "delete_range")
+  ]() {
+    RunInTransaction(
+        [&start, &end](storage::Journal* journal) {
+          return PageUtils::ConvertStatus(journal->DeleteRange(start, end));
+        },
+        callback);
+  }));
+}
+
+// DeletePrefix(array<uint8> key_prefix) => (Status status);
+void PageImpl::DeletePrefix(fidl::Array<uint8_t> key_prefix,
+                            const DeletePrefixCallback& callback) {
+  ApplyChange(ReserveChange(), ftl::MakeCopyable([
+    this, key_prefix = std::move(key_prefix),
+    callback = TRACE_CALLBACK(std::move(callback), "page", "delete_prefix")
+  ]() {
+    std::string end = PageUtils::GetPrefixEnd(key_prefix);
+    RunInTransaction(
+        [&key_prefix, &end](storage::Journal* journal) {
+          return PageUtils::ConvertStatus(
+              journal->DeleteRange(key_prefix, end));
+        },
+        callback);
+  }));
 }
 
 // CreateReference(int64 size, handle<socket> data)
@@ -221,47 +557,55 @@ void PageImpl::CreateReference(int64_t size,
 
 // StartTransaction() => (Status status);
 void PageImpl::StartTransaction(const StartTransactionCallback& callback) {
-  TRACE_DURATION("page", "start_transaction");
+  // The transaction starts after the changes requested before it.
+  ApplyChange(ReserveChange(), [this, callback] {
+    TRACE_DURATION("page", "start_transaction");
 
-  if (journal_) {
-    callback(Status::TRANSACTION_ALREADY_IN_PROGRESS);
-    return;
-  }
-  storage::CommitId commit_id = branch_tracker_->GetBranchHeadId();
-  branch_tracker_->SetTransactionInProgress(true);
-  storage::Status status = storage_->StartCommit(
-      commit_id, storage::JournalType::EXPLICIT, &journal_);
-  journal_parent_commit_ = commit_id;
-  callback(PageUtils::ConvertStatus(status));
+    if (journal_) {
+      callback(Status::TRANSACTION_ALREADY_IN_PROGRESS);
+      return;
+    }
+    // The changes made before the transaction are committed first.
+    CommitImplicitJournal();
+    storage::CommitId commit_id = branch_tracker_->GetBranchHeadId();
+    branch_tracker_->SetTransactionInProgress(true);
+    storage::Status status = storage_->StartCommit(
+        commit_id, storage::JournalType::EXPLICIT, &journal_);
+    journal_parent_commit_ = commit_id;
+    callback(PageUtils::ConvertStatus(status));
+  });
 }
 
 // Commit() => (Status status);
 void PageImpl::Commit(const CommitCallback& callback) {
-  auto timed_callback =
-      TRACE_CALLBACK(std::move(callback), "page", "put_with_priority");
-
-  if (!journal_) {
-    timed_callback(Status::NO_TRANSACTION_IN_PROGRESS);
-    return;
-  }
-  journal_parent_commit_.clear();
-  CommitJournal(std::move(journal_), std::move(timed_callback));
-  branch_tracker_->SetTransactionInProgress(false);
+  ApplyChange(ReserveChange(), [
+    this, callback = TRACE_CALLBACK(std::move(callback), "page", "commit")
+  ] {
+    if (!journal_) {
+      callback(Status::NO_TRANSACTION_IN_PROGRESS);
+      return;
+    }
+    journal_parent_commit_.clear();
+    CommitJournal(std::move(journal_), callback);
+    branch_tracker_->SetTransactionInProgress(false);
+  });
 }
 
 // Rollback() => (Status status);
 void PageImpl::Rollback(const RollbackCallback& callback) {
-  TRACE_DURATION("page", "rollback");
+  ApplyChange(ReserveChange(), [this, callback] {
+    TRACE_DURATION("page", "rollback");
 
-  if (!journal_) {
-    callback(Status::NO_TRANSACTION_IN_PROGRESS);
-    return;
-  }
-  storage::Status status = journal_->Rollback();
-  journal_.reset();
-  journal_parent_commit_.clear();
-  callback(PageUtils::ConvertStatus(status));
-  branch_tracker_->SetTransactionInProgress(false);
+    if (!journal_) {
+      callback(Status::NO_TRANSACTION_IN_PROGRESS);
+      return;
+    }
+    storage::Status status = journal_->Rollback();
+    journal_.reset();
+    journal_parent_commit_.clear();
+    callback(PageUtils::ConvertStatus(status));
+    branch_tracker_->SetTransactionInProgress(false);
+  });
 }
 
 }  // namespace ledger
@@ -5,6 +5,8 @@
 #ifndef APPS_LEDGER_SRC_APP_PAGE_IMPL_H_
 #define APPS_LEDGER_SRC_APP_PAGE_IMPL_H_
 
+#include <deque>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -14,7 +16,10 @@
 #include "apps/ledger/src/storage/public/journal.h"
 #include "apps/ledger/src/storage/public/page_storage.h"
 #include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/functional/closure.h"
 #include "lib/ftl/macros.h"
+#include "lib/ftl/memory/weak_ptr.h"
+#include "lib/ftl/time/time_delta.h"
 
 namespace ledger {
 class PageManager;
@@ -28,24 +33,71 @@ class PageImpl : public Page {
            BranchTracker* branch_tracker);
   ~PageImpl() override;
 
+  // Sets how changes made outside of transactions are batched: they are
+  // committed together once |delay| has elapsed since the first of them, or
+  // as soon as there are |max_changes| of them.
+  void SetImplicitBatching(ftl::TimeDelta delay, size_t max_changes);
+
+  void set_on_empty(ftl::Closure on_empty_callback);
+
+  // Returns true if no change is waiting to be applied, e.g. for its values to
+  // be written to the storage. The page must be kept until then, even if its
+  // connection is closed, so that the changes are not dropped.
+  bool IsEmpty();
+
  private:
   const storage::CommitId& GetCurrentCommitId();
 
+  // Reserves the position of a change in the order in which the changes are
+  // applied to the page, and returns its id. Changes are applied in the order
+  // of the calls to this method, even when they first write their values to
+  // the storage asynchronously.
+  uint64_t ReserveChange();
+
+  // Runs |apply| once all the changes reserved before |change_id| have been
+  // applied. |apply| must make its change synchronously.
+  void ApplyChange(uint64_t change_id, ftl::Closure apply);
+
   void PutInCommit(convert::ExtendedStringView key,
                    storage::ObjectIdView value,
                    storage::KeyPriority priority,
                    std::function<void(Status)> callback);
 
   // Run |runnable| in a transaction, and notifies |callback| of the result. If
-  // a transaction is currently in progress, reuses it, otherwise creates a new
-  // one and commit it before calling |callback|.
+  // a transaction is currently in progress, reuses it, otherwise adds the
+  // change to the current implicit journal and calls |callback| once that
+  // journal is committed. |runnable| must make a single change, so that it
+  // leaves the journal unchanged if it fails.
   void RunInTransaction(
       std::function<Status(storage::Journal* journal)> runnable,
       std::function<void(Status)> callback);
 
+  // Same as |RunInTransaction|, for a |runnable| making several changes. None
+  // of its changes are committed if it fails: outside of transactions, it runs
+  // in a new implicit journal, which is rolled back on failure.
+  void RunManyInTransaction(
+      std::function<Status(storage::Journal* journal)> runnable,
+      std::function<void(Status)> callback);
+
+  // Starts a new implicit journal if none is in progress, and schedules its
+  // commit.
+  Status StartImplicitJournal();
+
+  // Adds |callback| to the callbacks of the current implicit journal, and
+  // commits it if it holds enough changes.
+  void AddImplicitCallback(std::function<void(Status)> callback);
+
   void CommitJournal(std::unique_ptr<storage::Journal> journal,
                      std::function<void(Status)> callback);
 
+  // Deletes |journal| from the message loop, once its commit callback
+  // returned.
+  static void DeleteJournalLater(std::unique_ptr<storage::Journal> journal);
+
+  // Commits the current batch of changes made outside of transactions, and
+  // notifies the callbacks of all its changes of the result.
+  void CommitImplicitJournal();
+
   // Page:
   void GetId(const GetIdCallback& callback) override;
 
@@ -55,6 +107,9 @@ class PageImpl : public Page {
   void Watch(fidl::InterfaceHandle<PageWatcher> watcher,
              const WatchCallback& callback) override;
 
+  void SetTreeType(TreeType tree_type,
+                   const SetTreeTypeCallback& callback) override;
+
   void Put(fidl::Array<uint8_t> key,
            fidl::Array<uint8_t> value,
            const PutCallback& callback) override;
@@ -69,9 +124,22 @@ class PageImpl : public Page {
                     Priority priority,
                     const PutReferenceCallback& callback) override;
 
+  void PutMany(fidl::Array<EntryToPutPtr> entries,
+               const PutManyCallback& callback) override;
+
   void Delete(fidl::Array<uint8_t> key,
               const DeleteCallback& callback) override;
 
+  void DeleteMany(fidl::Array<fidl::Array<uint8_t>> keys,
+                  const DeleteManyCallback& callback) override;
+
+  void DeleteRange(fidl::Array<uint8_t> start,
+                   fidl::Array<uint8_t> end,
+                   const DeleteRangeCallback& callback) override;
+
+  void DeletePrefix(fidl::Array<uint8_t> key_prefix,
+                    const DeletePrefixCallback& callback) override;
+
   void CreateReference(int64_t size,
                        mx::socket data,
                        const CreateReferenceCallback& callback) override;
@@ -87,7 +155,26 @@ class PageImpl : public Page {
   BranchTracker* branch_tracker_;
   storage::CommitId journal_parent_commit_;
   std::unique_ptr<storage::Journal> journal_;
-  std::vector<std::unique_ptr<storage::Journal>> in_progress_journals_;
+
+  // The journal collecting the changes made outside of transactions, and the
+  // callbacks of these changes, called once the journal is committed.
+  std::unique_ptr<storage::Journal> implicit_journal_;
+  std::vector<std::function<void(Status)>> implicit_callbacks_;
+  // Incremented each time the implicit journal is committed, so that the
+  // commit scheduled for a batch does not apply to the next one.
+  uint64_t implicit_batch_id_ = 0;
+  ftl::TimeDelta implicit_batch_delay_;
+  size_t implicit_batch_max_changes_;
+
+  // The changes reserved with |ReserveChange()| and not applied yet, in order.
+  // A change waiting for its values to be written has no |apply| closure yet.
+  std::deque<ftl::Closure> pending_changes_;
+  // The id of the first change of |pending_changes_|.
+  uint64_t first_pending_change_id_ = 0;
+  ftl::Closure on_empty_callback_;
+
+  // WeakPtrFactory must be the last field of the class.
+  ftl::WeakPtrFactory<PageImpl> weak_ptr_factory_;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(PageImpl);
 };
@@ -5,6 +5,9 @@
 #include "apps/ledger/src/app/page_impl.h"
 
 #include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
 #include "apps/ledger/src/app/constants.h"
 #include "apps/ledger/src/app/merging/merge_resolver.h"
@@ -16,6 +19,7 @@
 #include "gtest/gtest.h"
 #include "lib/fidl/cpp/bindings/binding.h"
 #include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_printf.h"
 #include "lib/mtl/socket/strings.h"
 #include "lib/mtl/tasks/message_loop.h"
 #include "lib/mtl/vmo/strings.h"
@@ -108,6 +112,232 @@ TEST_F(PageImplTest, PutNoTransaction) {
   message_loop_.Run();
 }
 
+TEST_F(PageImplTest, PutsBatchedNoTransaction) {
+  std::string value("a small value");
+  size_t key_count = 10;
+  size_t callback_count = 0;
+
+  // Changes made outside of transactions can be batched, but are only
+  // acknowledged once committed.
+  for (size_t i = 0; i < key_count; ++i) {
+    std::string key = "key" + std::to_string(i);
+    page_ptr_->Put(
+        convert::ToArray(key), convert::ToArray(value),
+        [this, key, key_count, &callback_count](Status status) {
+          EXPECT_EQ(Status::OK, status);
+          bool committed = false;
+          for (const auto& journal : fake_storage_->GetJournals()) {
+            if (journal.second->GetData().count(key)) {
+              committed = journal.second->IsCommitted();
+            }
+          }
+          EXPECT_TRUE(committed);
+          if (++callback_count == key_count) {
+            message_loop_.PostQuitTask();
+          }
+        });
+  }
+  message_loop_.Run();
+
+  EXPECT_EQ(key_count, callback_count);
+  size_t entry_count = 0;
+  for (const auto& journal : fake_storage_->GetJournals()) {
+    EXPECT_TRUE(journal.second->IsCommitted());
+    entry_count += journal.second->GetData().size();
+  }
+  EXPECT_EQ(key_count, entry_count);
+}
+
+TEST_F(PageImplTest, ClosePageWithPendingChanges) {
+  std::string key("some_key");
+  std::string value("a small value");
+  bool called = false;
+  page_ptr_->Put(convert::ToArray(key), convert::ToArray(value),
+                 [&called](Status status) { called = true; });
+  // GetId() is answered once the change is in the pending batch.
+  page_ptr_->GetId([this](fidl::Array<uint8_t> page_id) {
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  manager_->set_on_empty([this] { message_loop_.PostQuitTask(); });
+  page_ptr_.reset();
+  message_loop_.Run();
+
+  // The pending change is committed, but not acknowledged to the closed
+  // connection.
+  const std::map<std::string,
+                 std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+      journals = fake_storage_->GetJournals();
+  ASSERT_EQ(1u, journals.size());
+  EXPECT_TRUE(journals.begin()->second->IsCommitted());
+  EXPECT_EQ(1u, journals.begin()->second->GetData().count(key));
+  EXPECT_FALSE(called);
+}
+
+TEST_F(PageImplTest, DeleteManagerOnceClosedPageChangesAreCommitted) {
+  page_ptr_->Put(convert::ToArray("some_key"), convert::ToArray("some_value"),
+                 [](Status status) {});
+  page_ptr_->GetId([this](fidl::Array<uint8_t> page_id) {
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  // The manager is deleted as soon as it is empty, as done by the ledger
+  // manager: the pending change must be committed by then.
+  bool committed = false;
+  manager_->set_on_empty([this, &committed] {
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    committed =
+        journals.size() == 1u && journals.begin()->second->IsCommitted();
+    manager_.reset();
+    message_loop_.PostQuitTask();
+  });
+  page_ptr_.reset();
+  message_loop_.Run();
+  EXPECT_TRUE(committed);
+}
+
+TEST_F(PageImplTest, PutLargeValueNoTransaction) {
+  std::string key("some_key");
+  std::string value(kMaxInlineObjectSize + 1, 'a');
+  auto callback = [this, &key, &value](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    auto objects = fake_storage_->GetObjects();
+    EXPECT_EQ(1u, objects.size());
+    storage::ObjectId object_id = objects.begin()->first;
+    EXPECT_EQ(value, objects.begin()->second);
+
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    EXPECT_EQ(1u, journals.size());
+    auto it = journals.begin();
+    EXPECT_TRUE(it->second->IsCommitted());
+    storage::fake::FakeJournalDelegate::Entry entry =
+        it->second->GetData().at(key);
+    EXPECT_EQ(object_id, entry.value);
+    message_loop_.PostQuitTask();
+  };
+  page_ptr_->Put(convert::ToArray(key), convert::ToArray(value), callback);
+  message_loop_.Run();
+}
+
+TEST_F(PageImplTest, PutLargeThenSmallValue) {
+  // Large values are written to the storage asynchronously, and small ones
+  // are not: the changes are still applied in the order of the calls.
+  fake_storage_->set_async_object_writes(true);
+  std::string key("some_key");
+  std::string large_value(kMaxInlineObjectSize + 1, 'a');
+  std::string small_value("a small value");
+  std::vector<std::string> acknowledged;
+  page_ptr_->Put(convert::ToArray(key), convert::ToArray(large_value),
+                 [&acknowledged](Status status) {
+                   EXPECT_EQ(Status::OK, status);
+                   acknowledged.push_back("large");
+                 });
+  page_ptr_->Put(convert::ToArray(key), convert::ToArray(small_value),
+                 [this, &acknowledged](Status status) {
+                   EXPECT_EQ(Status::OK, status);
+                   acknowledged.push_back("small");
+                   message_loop_.PostQuitTask();
+                 });
+  message_loop_.Run();
+  EXPECT_EQ((std::vector<std::string>{"large", "small"}), acknowledged);
+
+  PageSnapshotPtr snapshot;
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  ValuePtr actual_value;
+  snapshot->Get(convert::ToArray(key),
+                [this, &actual_value](Status status, ValuePtr value) {
+                  EXPECT_EQ(Status::OK, status);
+                  actual_value = std::move(value);
+                  message_loop_.PostQuitTask();
+                });
+  message_loop_.Run();
+  ASSERT_TRUE(actual_value);
+  ASSERT_TRUE(actual_value->is_bytes());
+  EXPECT_EQ(small_value,
+            convert::ExtendedStringView(actual_value->get_bytes()));
+}
+
+TEST_F(PageImplTest, PutManyLargeThenPutSmallValue) {
+  // Same as above, with the large value written by |PutMany()|.
+  fake_storage_->set_async_object_writes(true);
+  std::string key("some_key");
+  std::string large_value(kMaxInlineObjectSize + 1, 'a');
+  std::string small_value("a small value");
+  std::vector<std::string> acknowledged;
+  fidl::Array<EntryToPutPtr> entries = fidl::Array<EntryToPutPtr>::New(0);
+  EntryToPutPtr entry = EntryToPut::New();
+  entry->key = convert::ToArray(key);
+  entry->value = convert::ToArray(large_value);
+  entry->priority = Priority::EAGER;
+  entries.push_back(std::move(entry));
+  page_ptr_->PutMany(std::move(entries), [&acknowledged](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    acknowledged.push_back("large");
+  });
+  page_ptr_->Put(convert::ToArray(key), convert::ToArray(small_value),
+                 [this, &acknowledged](Status status) {
+                   EXPECT_EQ(Status::OK, status);
+                   acknowledged.push_back("small");
+                   message_loop_.PostQuitTask();
+                 });
+  message_loop_.Run();
+  EXPECT_EQ((std::vector<std::string>{"large", "small"}), acknowledged);
+
+  PageSnapshotPtr snapshot;
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  ValuePtr actual_value;
+  snapshot->Get(convert::ToArray(key),
+                [this, &actual_value](Status status, ValuePtr value) {
+                  EXPECT_EQ(Status::OK, status);
+                  actual_value = std::move(value);
+                  message_loop_.PostQuitTask();
+                });
+  message_loop_.Run();
+  ASSERT_TRUE(actual_value);
+  ASSERT_TRUE(actual_value->is_bytes());
+  EXPECT_EQ(small_value,
+            convert::ExtendedStringView(actual_value->get_bytes()));
+}
+
+TEST_F(PageImplTest, ClosePageWhileWritingLargeValue) {
+  // The page is closed while the large value is still being written: both
+  // changes are still committed, in order.
+  fake_storage_->set_async_object_writes(true);
+  std::string large_value(kMaxInlineObjectSize + 1, 'a');
+  page_ptr_->Put(convert::ToArray("key1"), convert::ToArray(large_value),
+                 [](Status status) {});
+  page_ptr_->Put(convert::ToArray("key2"), convert::ToArray("a small value"),
+                 [](Status status) {});
+  manager_->set_on_empty([this] { message_loop_.PostQuitTask(); });
+  page_ptr_.reset();
+  message_loop_.Run();
+
+  std::set<std::string> committed_keys;
+  for (const auto& journal : fake_storage_->GetJournals()) {
+    EXPECT_TRUE(journal.second->IsCommitted());
+    for (const auto& entry : journal.second->GetData()) {
+      committed_keys.insert(entry.first);
+    }
+  }
+  EXPECT_EQ((std::set<std::string>{"key1", "key2"}), committed_keys);
+}
+
 TEST_F(PageImplTest, PutReferenceNoTransaction) {
   std::string key("some_key");
   storage::ObjectId object_id("some_id");
@@ -139,6 +369,45 @@ TEST_F(PageImplTest, PutReferenceNoTransaction) {
   message_loop_.Run();
 }
 
+TEST_F(PageImplTest, PutManyNoTransaction) {
+  std::string small_value("a small value");
+  std::string large_value(kMaxInlineObjectSize + 1, 'a');
+  fidl::Array<EntryToPutPtr> entries = fidl::Array<EntryToPutPtr>::New(0);
+  for (const auto& key_value :
+       std::vector<std::pair<std::string, std::string>>{
+           {"key2", small_value}, {"key1", large_value}, {"key2", "other"}}) {
+    EntryToPutPtr entry = EntryToPut::New();
+    entry->key = convert::ToArray(key_value.first);
+    entry->value = convert::ToArray(key_value.second);
+    entry->priority = Priority::LAZY;
+    entries.push_back(std::move(entry));
+  }
+
+  page_ptr_->PutMany(std::move(entries), [this, &large_value](Status status) {
+    EXPECT_EQ(Status::OK, status);
+
+    // All the entries are part of the same commit, and the last entry for
+    // "key2" is kept.
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    EXPECT_EQ(1u, journals.size());
+    auto it = journals.begin();
+    EXPECT_TRUE(it->second->IsCommitted());
+    EXPECT_EQ(2u, it->second->GetData().size());
+    auto objects = fake_storage_->GetObjects();
+    EXPECT_EQ(3u, objects.size());
+    storage::fake::FakeJournalDelegate::Entry entry =
+        it->second->GetData().at("key1");
+    EXPECT_EQ(large_value, objects[entry.value]);
+    EXPECT_EQ(storage::KeyPriority::LAZY, entry.priority);
+    entry = it->second->GetData().at("key2");
+    EXPECT_EQ("other", objects[entry.value]);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+}
+
 TEST_F(PageImplTest, DeleteNoTransaction) {
   std::string key("some_key");
 
@@ -163,6 +432,152 @@ TEST_F(PageImplTest, DeleteNoTransaction) {
   message_loop_.Run();
 }
 
+TEST_F(PageImplTest, DeleteManyNoTransaction) {
+  fidl::Array<fidl::Array<uint8_t>> keys =
+      fidl::Array<fidl::Array<uint8_t>>::New(0);
+  keys.push_back(convert::ToArray("key1"));
+  keys.push_back(convert::ToArray("key2"));
+
+  page_ptr_->DeleteMany(std::move(keys), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    EXPECT_EQ(1u, journals.size());
+    auto it = journals.begin();
+    EXPECT_TRUE(it->second->IsCommitted());
+    EXPECT_EQ(2u, it->second->GetData().size());
+    EXPECT_TRUE(it->second->GetData().at("key1").deleted);
+    EXPECT_TRUE(it->second->GetData().at("key2").deleted);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+}
+
+TEST_F(PageImplTest, SetTreeType) {
+  page_ptr_->SetTreeType(TreeType::HASH_TREE, [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+  EXPECT_EQ(storage::TreeType::HASH_TREE, fake_storage_->GetTreeType());
+
+  page_ptr_->Delete(convert::ToArray("key"), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  // The tree type cannot be changed once the page has commits.
+  page_ptr_->SetTreeType(TreeType::BTREE, [this](Status status) {
+    EXPECT_EQ(Status::ILLEGAL_STATE, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+  EXPECT_EQ(storage::TreeType::HASH_TREE, fake_storage_->GetTreeType());
+}
+
+TEST_F(PageImplTest, DeletePrefix) {
+  std::vector<std::string> keys = {"prefix/a", "prefix/b", "prefix0"};
+  std::string value("a small value");
+
+  page_ptr_->StartTransaction([this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  for (const std::string& key : keys) {
+    page_ptr_->Put(convert::ToArray(key), convert::ToArray(value),
+                   [this](Status status) {
+                     EXPECT_EQ(Status::OK, status);
+                     message_loop_.PostQuitTask();
+                   });
+    message_loop_.Run();
+  }
+
+  page_ptr_->DeletePrefix(convert::ToArray("prefix/"), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  page_ptr_->Commit([this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    EXPECT_EQ(1u, journals.size());
+    auto it = journals.begin();
+    EXPECT_TRUE(it->second->IsCommitted());
+    EXPECT_EQ(3u, it->second->GetData().size());
+    EXPECT_TRUE(it->second->GetData().at("prefix/a").deleted);
+    EXPECT_TRUE(it->second->GetData().at("prefix/b").deleted);
+    EXPECT_FALSE(it->second->GetData().at("prefix0").deleted);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+}
+
+TEST_F(PageImplTest, DeleteEmptyRange) {
+  std::vector<std::string> keys = {"a", "b", "c"};
+  std::string value("a small value");
+
+  page_ptr_->StartTransaction([this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  for (const std::string& key : keys) {
+    page_ptr_->Put(convert::ToArray(key), convert::ToArray(value),
+                   [this](Status status) {
+                     EXPECT_EQ(Status::OK, status);
+                     message_loop_.PostQuitTask();
+                   });
+    message_loop_.Run();
+  }
+
+  // A non-null empty end does not mean that the range is unbounded.
+  page_ptr_->DeleteRange(convert::ToArray("b"), fidl::Array<uint8_t>::New(0),
+                         [this](Status status) {
+                           EXPECT_EQ(Status::OK, status);
+                           message_loop_.PostQuitTask();
+                         });
+  message_loop_.Run();
+  page_ptr_->DeleteRange(convert::ToArray("c"), convert::ToArray("b"),
+                         [this](Status status) {
+                           EXPECT_EQ(Status::OK, status);
+                           message_loop_.PostQuitTask();
+                         });
+  message_loop_.Run();
+  // A null end does.
+  page_ptr_->DeleteRange(convert::ToArray("c"), nullptr,
+                         [this](Status status) {
+                           EXPECT_EQ(Status::OK, status);
+                           message_loop_.PostQuitTask();
+                         });
+  message_loop_.Run();
+
+  page_ptr_->Commit([this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+
+    const std::map<std::string,
+                   std::unique_ptr<storage::fake::FakeJournalDelegate>>&
+        journals = fake_storage_->GetJournals();
+    EXPECT_EQ(1u, journals.size());
+    auto it = journals.begin();
+    EXPECT_TRUE(it->second->IsCommitted());
+    EXPECT_EQ(3u, it->second->GetData().size());
+    EXPECT_FALSE(it->second->GetData().at("a").deleted);
+    EXPECT_FALSE(it->second->GetData().at("b").deleted);
+    EXPECT_TRUE(it->second->GetData().at("c").deleted);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+}
+
 TEST_F(PageImplTest, TransactionCommit) {
   std::string key1("some_key1");
   storage::ObjectId object_id1;
@@ -385,6 +800,206 @@ TEST_F(PageImplTest, PutGetSnapshotGetEntries) {
             convert::ExtendedStringView(actual_entries[0]->value->get_bytes()));
 }
 
+TEST_F(PageImplTest, SnapshotGetEntriesPagination) {
+  // Enough entries to exceed the size of a response.
+  size_t key_count = 500;
+  std::string value(100, 'v');
+  fidl::Array<EntryToPutPtr> entries_to_put =
+      fidl::Array<EntryToPutPtr>::New(0);
+  for (size_t i = 0; i < key_count; ++i) {
+    EntryToPutPtr entry = EntryToPut::New();
+    entry->key = convert::ToArray(ftl::StringPrintf("key%03zu", i));
+    entry->value = convert::ToArray(value);
+    entry->priority = Priority::EAGER;
+    entries_to_put.push_back(std::move(entry));
+  }
+  EntryToPutPtr other_entry = EntryToPut::New();
+  other_entry->key = convert::ToArray("other");
+  other_entry->value = convert::ToArray(value);
+  other_entry->priority = Priority::EAGER;
+  entries_to_put.push_back(std::move(other_entry));
+  page_ptr_->PutMany(std::move(entries_to_put), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  PageSnapshotPtr snapshot;
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  std::vector<std::string> keys;
+  size_t page_count = 0;
+  fidl::Array<uint8_t> token;
+  do {
+    Status status;
+    fidl::Array<EntryPtr> entries;
+    snapshot->GetEntries(
+        convert::ToArray("key"), std::move(token),
+        [this, &status, &entries, &token](Status s, fidl::Array<EntryPtr> e,
+                                          fidl::Array<uint8_t> next_token) {
+          status = s;
+          entries = std::move(e);
+          token = std::move(next_token);
+          message_loop_.PostQuitTask();
+        });
+    message_loop_.Run();
+    EXPECT_EQ(token.is_null() ? Status::OK : Status::PARTIAL_RESULT, status);
+    ASSERT_FALSE(entries.empty());
+    for (const auto& entry : entries) {
+      keys.push_back(convert::ToString(entry->key));
+      EXPECT_EQ(value, convert::ExtendedStringView(entry->value->get_bytes()));
+    }
+    ++page_count;
+  } while (!token.is_null());
+
+  EXPECT_LT(1u, page_count);
+  ASSERT_EQ(key_count, keys.size());
+  for (size_t i = 0; i < key_count; ++i) {
+    EXPECT_EQ(ftl::StringPrintf("key%03zu", i), keys[i]);
+  }
+
+  // A token is only valid for the prefix it was returned for.
+  Status status;
+  snapshot->GetKeys(convert::ToArray("key"), convert::ToArray("other"),
+                    [this, &status](Status s,
+                                    fidl::Array<fidl::Array<uint8_t>> keys,
+                                    fidl::Array<uint8_t> next_token) {
+                      status = s;
+                      message_loop_.PostQuitTask();
+                    });
+  message_loop_.Run();
+  EXPECT_EQ(Status::INVALID_TOKEN, status);
+}
+
+TEST_F(PageImplTest, SnapshotGetEntriesInRangePagination) {
+  // Enough entries to exceed the size of a response.
+  size_t key_count = 500;
+  std::string value(100, 'v');
+  fidl::Array<EntryToPutPtr> entries_to_put =
+      fidl::Array<EntryToPutPtr>::New(0);
+  for (size_t i = 0; i < key_count; ++i) {
+    EntryToPutPtr entry = EntryToPut::New();
+    entry->key = convert::ToArray(ftl::StringPrintf("key%03zu", i));
+    entry->value = convert::ToArray(value);
+    entry->priority = Priority::EAGER;
+    entries_to_put.push_back(std::move(entry));
+  }
+  page_ptr_->PutMany(std::move(entries_to_put), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  PageSnapshotPtr snapshot;
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  // Reads a range in both orders, resuming each call with the token returned
+  // by the previous one.
+  for (bool reverse : {false, true}) {
+    std::vector<std::string> keys;
+    size_t page_count = 0;
+    Status status;
+    fidl::Array<uint8_t> token;
+    do {
+      fidl::Array<EntryPtr> entries;
+      snapshot->GetEntriesInRange(
+          convert::ToArray("key001"), convert::ToArray("key499"), reverse, 0,
+          std::move(token),
+          [this, &status, &entries, &token](Status s, fidl::Array<EntryPtr> e,
+                                            fidl::Array<uint8_t> next_token) {
+            status = s;
+            entries = std::move(e);
+            token = std::move(next_token);
+            message_loop_.PostQuitTask();
+          });
+      message_loop_.Run();
+      ASSERT_TRUE(status == Status::OK || status == Status::PARTIAL_RESULT);
+      EXPECT_EQ(status == Status::OK, token.is_null());
+      ASSERT_FALSE(entries.empty());
+      for (const auto& entry : entries) {
+        keys.push_back(convert::ToString(entry->key));
+        EXPECT_EQ(value,
+                  convert::ExtendedStringView(entry->value->get_bytes()));
+      }
+      ++page_count;
+    } while (status == Status::PARTIAL_RESULT);
+
+    EXPECT_LT(1u, page_count);
+    ASSERT_EQ(key_count - 2, keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      size_t index = reverse ? key_count - 2 - i : i + 1;
+      EXPECT_EQ(ftl::StringPrintf("key%03zu", index), keys[i]);
+    }
+  }
+
+  // A token out of the range is rejected.
+  Status status;
+  snapshot->GetKeysInRange(
+      convert::ToArray("key001"), convert::ToArray("key499"), false, 0,
+      convert::ToArray("key499"),
+      [this, &status](Status s, fidl::Array<fidl::Array<uint8_t>> keys,
+                      fidl::Array<uint8_t> next_token) {
+        status = s;
+        message_loop_.PostQuitTask();
+      });
+  message_loop_.Run();
+  EXPECT_EQ(Status::INVALID_TOKEN, status);
+
+  // The scan also stops at the limit, and is resumed in the same way.
+  std::vector<std::string> keys;
+  size_t page_count = 0;
+  fidl::Array<uint8_t> token;
+  do {
+    fidl::Array<fidl::Array<uint8_t>> page_keys;
+    snapshot->GetKeysInRange(
+        convert::ToArray("key001"), convert::ToArray("key026"), false, 10,
+        std::move(token),
+        [this, &status, &page_keys, &token](
+            Status s, fidl::Array<fidl::Array<uint8_t>> k,
+            fidl::Array<uint8_t> next_token) {
+          status = s;
+          page_keys = std::move(k);
+          token = std::move(next_token);
+          message_loop_.PostQuitTask();
+        });
+    message_loop_.Run();
+    ASSERT_TRUE(status == Status::OK || status == Status::PARTIAL_RESULT);
+    EXPECT_EQ(status == Status::OK, token.is_null());
+    EXPECT_GE(10u, page_keys.size());
+    for (const auto& key : page_keys) {
+      keys.push_back(convert::ToString(key));
+    }
+    ++page_count;
+  } while (status == Status::PARTIAL_RESULT);
+  EXPECT_EQ(3u, page_count);
+  ASSERT_EQ(25u, keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    EXPECT_EQ(ftl::StringPrintf("key%03zu", i + 1), keys[i]);
+  }
+
+  // A limit reached at the end of the range is not a partial result.
+  snapshot->GetEntriesInRange(
+      convert::ToArray("key001"), convert::ToArray("key011"), false, 10,
+      nullptr,
+      [this, &status](Status s, fidl::Array<EntryPtr> entries,
+                      fidl::Array<uint8_t> next_token) {
+        status = s;
+        EXPECT_EQ(10u, entries.size());
+        EXPECT_TRUE(next_token.is_null());
+        message_loop_.PostQuitTask();
+      });
+  message_loop_.Run();
+  EXPECT_EQ(Status::OK, status);
+}
+
 TEST_F(PageImplTest, PutGetSnapshotGetKeys) {
   std::string key1("some_key");
   std::string value1("a small value");
@@ -431,6 +1046,159 @@ TEST_F(PageImplTest, PutGetSnapshotGetKeys) {
   EXPECT_EQ(key2, convert::ExtendedStringView(actual_keys[1]));
 }
 
+TEST_F(PageImplTest, PutGetSnapshotGetInRange) {
+  std::vector<std::string> keys{"key0", "key1", "key2", "key3", "key4"};
+  PageSnapshotPtr snapshot;
+
+  auto callback_statusok = [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  };
+  page_ptr_->StartTransaction(callback_statusok);
+  message_loop_.Run();
+  for (const std::string& key : keys) {
+    page_ptr_->Put(convert::ToArray(key), convert::ToArray("value_" + key),
+                   callback_statusok);
+    message_loop_.Run();
+  }
+  page_ptr_->Commit(callback_statusok);
+  message_loop_.Run();
+
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), callback_statusok);
+  message_loop_.Run();
+
+  fidl::Array<EntryPtr> actual_entries;
+  auto callback_getentries = [this, &actual_entries](
+      Status status, fidl::Array<EntryPtr> entries,
+      fidl::Array<uint8_t> next_token) {
+    EXPECT_EQ(Status::OK, status);
+    EXPECT_TRUE(next_token.is_null());
+    actual_entries = std::move(entries);
+    message_loop_.PostQuitTask();
+  };
+  snapshot->GetEntriesInRange(convert::ToArray("key1"),
+                              convert::ToArray("key4"), false, 0, nullptr,
+                              callback_getentries);
+  message_loop_.Run();
+  ASSERT_EQ(3u, actual_entries.size());
+  for (size_t i = 0; i < actual_entries.size(); ++i) {
+    EXPECT_EQ(keys[i + 1], convert::ExtendedStringView(actual_entries[i]->key));
+    EXPECT_EQ("value_" + keys[i + 1],
+              convert::ExtendedStringView(
+                  actual_entries[i]->value->get_bytes()));
+  }
+
+  // The last two entries before "key3", in reverse order. The first entry
+  // left out is the continuation token.
+  snapshot->GetEntriesInRange(
+      nullptr, convert::ToArray("key3"), true, 2, nullptr,
+      [this, &actual_entries](Status status, fidl::Array<EntryPtr> entries,
+                              fidl::Array<uint8_t> next_token) {
+        EXPECT_EQ(Status::PARTIAL_RESULT, status);
+        EXPECT_EQ("key0", convert::ToString(next_token));
+        actual_entries = std::move(entries);
+        message_loop_.PostQuitTask();
+      });
+  message_loop_.Run();
+  ASSERT_EQ(2u, actual_entries.size());
+  EXPECT_EQ(keys[2], convert::ExtendedStringView(actual_entries[0]->key));
+  EXPECT_EQ(keys[1], convert::ExtendedStringView(actual_entries[1]->key));
+
+  fidl::Array<fidl::Array<uint8_t>> actual_keys;
+  auto callback_getkeys = [this, &actual_keys](
+      Status status, fidl::Array<fidl::Array<uint8_t>> keys,
+      fidl::Array<uint8_t> next_token) {
+    EXPECT_EQ(Status::OK, status);
+    EXPECT_TRUE(next_token.is_null());
+    actual_keys = std::move(keys);
+    message_loop_.PostQuitTask();
+  };
+  snapshot->GetKeysInRange(convert::ToArray("key2"), nullptr, true, 0, nullptr,
+                           callback_getkeys);
+  message_loop_.Run();
+  ASSERT_EQ(3u, actual_keys.size());
+  EXPECT_EQ(keys[4], convert::ExtendedStringView(actual_keys[0]));
+  EXPECT_EQ(keys[3], convert::ExtendedStringView(actual_keys[1]));
+  EXPECT_EQ(keys[2], convert::ExtendedStringView(actual_keys[2]));
+
+  // A non-null empty end does not mean that the range is unbounded.
+  snapshot->GetEntriesInRange(convert::ToArray("key2"),
+                              fidl::Array<uint8_t>::New(0), false, 0, nullptr,
+                              callback_getentries);
+  message_loop_.Run();
+  EXPECT_EQ(0u, actual_entries.size());
+  snapshot->GetKeysInRange(nullptr, fidl::Array<uint8_t>::New(0), true, 0,
+                           nullptr, callback_getkeys);
+  message_loop_.Run();
+  EXPECT_EQ(0u, actual_keys.size());
+}
+
+TEST_F(PageImplTest, SnapshotGetCountAndKeyAtOffset) {
+  std::vector<std::string> keys{"key0", "key1", "key2", "key3", "key4"};
+  PageSnapshotPtr snapshot;
+
+  auto callback_statusok = [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  };
+  page_ptr_->StartTransaction(callback_statusok);
+  message_loop_.Run();
+  for (const std::string& key : keys) {
+    page_ptr_->Put(convert::ToArray(key), convert::ToArray("value_" + key),
+                   callback_statusok);
+    message_loop_.Run();
+  }
+  page_ptr_->Commit(callback_statusok);
+  message_loop_.Run();
+
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), callback_statusok);
+  message_loop_.Run();
+
+  Status status;
+  uint64_t count;
+  auto get_count = [this, &snapshot, &status, &count](
+      fidl::Array<uint8_t> start, fidl::Array<uint8_t> end) {
+    snapshot->GetCountInRange(std::move(start), std::move(end),
+                              [this, &status, &count](Status s, uint64_t c) {
+                                status = s;
+                                count = c;
+                                message_loop_.PostQuitTask();
+                              });
+    message_loop_.Run();
+  };
+  get_count(nullptr, nullptr);
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(5u, count);
+  get_count(convert::ToArray("key1"), convert::ToArray("key4"));
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(3u, count);
+  // A non-null empty end does not mean that the range is unbounded.
+  get_count(convert::ToArray("key1"), fidl::Array<uint8_t>::New(0));
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(0u, count);
+
+  fidl::Array<uint8_t> key;
+  auto get_key = [this, &snapshot, &status, &key](fidl::Array<uint8_t> start,
+                                                  fidl::Array<uint8_t> end,
+                                                  uint64_t offset) {
+    snapshot->GetKeyAtOffset(
+        std::move(start), std::move(end), offset,
+        [this, &status, &key](Status s, fidl::Array<uint8_t> k) {
+          status = s;
+          key = std::move(k);
+          message_loop_.PostQuitTask();
+        });
+    message_loop_.Run();
+  };
+  get_key(convert::ToArray("key1"), nullptr, 2);
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ("key3", convert::ToString(key));
+  get_key(convert::ToArray("key1"), convert::ToArray("key3"), 2);
+  EXPECT_EQ(Status::KEY_NOT_FOUND, status);
+  get_key(nullptr, fidl::Array<uint8_t>::New(0), 0);
+  EXPECT_EQ(Status::KEY_NOT_FOUND, status);
+}
+
 TEST_F(PageImplTest, SnapshotGetReferenceSmall) {
   std::string key("some_key");
   std::string value("a small value");
@@ -503,6 +1271,141 @@ TEST_F(PageImplTest, SnapshotGetReferenceLarge) {
   EXPECT_EQ(value_string, content);
 }
 
+TEST_F(PageImplTest, SnapshotGetMany) {
+  std::string small_value("a small value");
+  std::string large_value(kMaxInlineDataSize + 1, 'a');
+  ReferencePtr reference = Reference::New();
+  reference->opaque_id = convert::ToArray(AddObjectToStorage(large_value));
+
+  auto callback_put = [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  };
+  page_ptr_->Put(convert::ToArray("small"), convert::ToArray(small_value),
+                 callback_put);
+  message_loop_.Run();
+  page_ptr_->PutReference(convert::ToArray("large"), std::move(reference),
+                          Priority::EAGER, callback_put);
+  message_loop_.Run();
+
+  PageSnapshotPtr snapshot;
+  auto callback_getsnapshot = [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  };
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), callback_getsnapshot);
+  message_loop_.Run();
+
+  fidl::Array<fidl::Array<uint8_t>> keys =
+      fidl::Array<fidl::Array<uint8_t>>::New(0);
+  keys.push_back(convert::ToArray("small"));
+  keys.push_back(convert::ToArray("missing"));
+  keys.push_back(convert::ToArray("large"));
+  fidl::Array<ValueResultPtr> values;
+  auto callback_get_many = [this, &values](Status status,
+                                           fidl::Array<ValueResultPtr> result) {
+    EXPECT_EQ(Status::OK, status);
+    values = std::move(result);
+    message_loop_.PostQuitTask();
+  };
+  snapshot->GetMany(std::move(keys), callback_get_many);
+  message_loop_.Run();
+
+  ASSERT_EQ(3u, values.size());
+  EXPECT_EQ(Status::OK, values[0]->status);
+  ASSERT_TRUE(values[0]->value->is_bytes());
+  EXPECT_EQ(small_value,
+            convert::ExtendedStringView(values[0]->value->get_bytes()));
+  EXPECT_EQ(Status::KEY_NOT_FOUND, values[1]->status);
+  EXPECT_FALSE(values[1]->value);
+  EXPECT_EQ(Status::OK, values[2]->status);
+  ASSERT_TRUE(values[2]->value->is_buffer());
+  std::string content;
+  EXPECT_TRUE(mtl::StringFromVmo(values[2]->value->get_buffer(), &content));
+  EXPECT_EQ(large_value, content);
+}
+
+TEST_F(PageImplTest, SnapshotGetManyPagination) {
+  // More values returned in VMOs than handles in a response, and more inline
+  // values than bytes in a response.
+  size_t key_count = 40;
+  std::string large_value(kMaxInlineDataSize + 1, 'l');
+  std::string inline_value(kMaxInlineDataSize - 48, 'i');
+  ASSERT_LT(kMaxResultHandles, key_count);
+  ASSERT_LT(kMaxResultSize, key_count * inline_value.size());
+  fidl::Array<EntryToPutPtr> entries_to_put =
+      fidl::Array<EntryToPutPtr>::New(0);
+  for (size_t i = 0; i < key_count; ++i) {
+    for (const std::string* value : {&large_value, &inline_value}) {
+      EntryToPutPtr entry = EntryToPut::New();
+      entry->key = convert::ToArray(ftl::StringPrintf(
+          "%s%02zu", value == &large_value ? "large" : "inline", i));
+      entry->value = convert::ToArray(*value);
+      entry->priority = Priority::EAGER;
+      entries_to_put.push_back(std::move(entry));
+    }
+  }
+  page_ptr_->PutMany(std::move(entries_to_put), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  PageSnapshotPtr snapshot;
+  page_ptr_->GetSnapshot(snapshot.NewRequest(), [this](Status status) {
+    EXPECT_EQ(Status::OK, status);
+    message_loop_.PostQuitTask();
+  });
+  message_loop_.Run();
+
+  for (const std::string& prefix : {"large", "inline"}) {
+    // Reads the values, calling GetMany() again with the keys whose values
+    // were left out of the previous response.
+    std::vector<std::string> contents;
+    size_t call_count = 0;
+    Status status;
+    do {
+      fidl::Array<fidl::Array<uint8_t>> keys =
+          fidl::Array<fidl::Array<uint8_t>>::New(0);
+      for (size_t i = contents.size(); i < key_count; ++i) {
+        keys.push_back(
+            convert::ToArray(ftl::StringPrintf("%s%02zu", prefix.c_str(), i)));
+      }
+      fidl::Array<ValueResultPtr> values;
+      snapshot->GetMany(std::move(keys),
+                        [this, &status, &values](
+                            Status s, fidl::Array<ValueResultPtr> result) {
+                          status = s;
+                          values = std::move(result);
+                          message_loop_.PostQuitTask();
+                        });
+      message_loop_.Run();
+      ASSERT_TRUE(status == Status::OK || status == Status::PARTIAL_RESULT);
+      ASSERT_FALSE(values.empty());
+      size_t handle_count = 0;
+      for (const auto& value : values) {
+        ASSERT_EQ(Status::OK, value->status);
+        if (value->value->is_bytes()) {
+          contents.push_back(convert::ToString(value->value->get_bytes()));
+          continue;
+        }
+        ++handle_count;
+        std::string content;
+        EXPECT_TRUE(mtl::StringFromVmo(value->value->get_buffer(), &content));
+        contents.push_back(content);
+      }
+      EXPECT_GE(kMaxResultHandles, handle_count);
+      ++call_count;
+    } while (status == Status::PARTIAL_RESULT);
+
+    EXPECT_LT(1u, call_count);
+    ASSERT_EQ(key_count, contents.size());
+    for (const std::string& content : contents) {
+      EXPECT_EQ(prefix == "large" ? large_value : inline_value, content);
+    }
+  }
+}
+
 TEST_F(PageImplTest, SnapshotGetPartial) {
   std::string key("some_key");
   std::string value("a small value");
@@ -9,6 +9,7 @@
 #include "apps/ledger/services/public/ledger.fidl.h"
 #include "apps/ledger/src/app/branch_tracker.h"
 #include "lib/ftl/logging.h"
+#include "lib/mtl/tasks/message_loop.h"
 
 namespace ledger {
 
@@ -19,7 +20,8 @@ PageManager::PageManager(
     : page_storage_(std::move(page_storage)),
       page_sync_context_(std::move(page_sync_context)),
       merge_resolver_(std::move(merge_resolver)),
-      sync_backlog_downloaded_(false) {
+      sync_backlog_downloaded_(false),
+      weak_ptr_factory_(this) {
   pages_.set_on_empty([this] { CheckEmpty(); });
   snapshots_.set_on_empty([this] { CheckEmpty(); });
   if (page_sync_context) {
@@ -36,7 +38,11 @@ PageManager::PageManager(
   merge_resolver_->set_on_empty([this] { CheckEmpty(); });
 }
 
-PageManager::~PageManager() {}
+PageManager::~PageManager() {
+  // The pages are deleted with the members, after this point: their pending
+  // journals are left to be committed when the page storage is next opened.
+  deleting_ = true;
+}
 
 void PageManager::BindPage(fidl::InterfaceRequest<Page> page_request) {
   if (sync_backlog_downloaded_) {
@@ -53,14 +59,51 @@ void PageManager::BindPageSnapshot(
                      std::move(contents));
 }
 
+void PageManager::CommitClosedPageJournal(
+    std::unique_ptr<storage::Journal> journal) {
+  if (deleting_) {
+    return;
+  }
+  storage::Journal* journal_ptr = journal.get();
+  closed_page_journals_.push_back(std::move(journal));
+  journal_ptr->Commit([
+    weak_this = weak_ptr_factory_.GetWeakPtr(), journal_ptr
+  ](storage::Status status, const storage::CommitId& commit_id) {
+    if (status != storage::Status::OK) {
+      FTL_LOG(ERROR) << "Unable to commit the pending changes of a closed "
+                     << "page: " << status;
+    }
+    // The journal cannot be deleted while it runs its commit callback, and
+    // the page closing may still be in progress.
+    mtl::MessageLoop::GetCurrent()->task_runner()->PostTask(
+        [weak_this, journal_ptr] {
+          if (weak_this) {
+            weak_this->OnClosedPageJournalCommitted(journal_ptr);
+          }
+        });
+  });
+}
+
 void PageManager::CheckEmpty() {
   if (on_empty_callback_ && pages_.empty() && snapshots_.empty() &&
-      page_requests_.empty() && merge_resolver_->IsEmpty() &&
+      page_requests_.empty() && closed_page_journals_.empty() &&
+      merge_resolver_->IsEmpty() &&
       (!page_sync_context_ || page_sync_context_->page_sync->IsIdle())) {
     on_empty_callback_();
   }
 }
 
+void PageManager::OnClosedPageJournalCommitted(storage::Journal* journal) {
+  auto it = std::find_if(
+      closed_page_journals_.begin(), closed_page_journals_.end(),
+      [journal](const std::unique_ptr<storage::Journal>& closed_page_journal) {
+        return closed_page_journal.get() == journal;
+      });
+  FTL_DCHECK(it != closed_page_journals_.end());
+  closed_page_journals_.erase(it);
+  CheckEmpty();
+}
+
 void PageManager::OnSyncBacklogDownloaded() {
   sync_backlog_downloaded_ = true;
   for (auto& request : page_requests_) {
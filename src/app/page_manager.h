@@ -14,10 +14,12 @@
 #include "apps/ledger/src/app/page_snapshot_impl.h"
 #include "apps/ledger/src/callback/auto_cleanable.h"
 #include "apps/ledger/src/cloud_sync/public/ledger_sync.h"
+#include "apps/ledger/src/storage/public/journal.h"
 #include "apps/ledger/src/storage/public/page_storage.h"
 #include "apps/ledger/src/storage/public/page_sync_delegate.h"
 #include "lib/fidl/cpp/bindings/interface_request.h"
 #include "lib/ftl/functional/closure.h"
+#include "lib/ftl/memory/weak_ptr.h"
 
 namespace ledger {
 // Manages a ledger page.
@@ -27,8 +29,8 @@ namespace ledger {
 // to delete it at any point - this closes all channels, deletes PageImpls and
 // tears down the storage.
 //
-// When the set of PageImpls becomes empty, client is notified through
-// |on_empty_callback|.
+// When the set of PageImpls becomes empty, and the changes left pending by the
+// closed ones are committed, client is notified through |on_empty_callback|.
 class PageManager {
  public:
   // Both |page_storage| and |page_sync| are owned by PageManager and are
@@ -47,17 +49,30 @@ class PageManager {
   void BindPageSnapshot(std::unique_ptr<storage::CommitContents> contents,
                         fidl::InterfaceRequest<PageSnapshot> snapshot_request);
 
+  // Commits |journal|, holding the changes made outside of transactions on a
+  // page whose connection is closed. The journal is owned by the PageManager
+  // until its commit completes. If the PageManager is deleted first, the
+  // journal is deleted uncommitted, before the page storage: implicit journals
+  // are committed when the page storage is next opened.
+  void CommitClosedPageJournal(std::unique_ptr<storage::Journal> journal);
+
   void set_on_empty(const ftl::Closure& on_empty_callback) {
     on_empty_callback_ = on_empty_callback;
   }
 
  private:
   void CheckEmpty();
+  void OnClosedPageJournalCommitted(storage::Journal* journal);
   void OnSyncBacklogDownloaded();
 
   std::unique_ptr<storage::PageStorage> page_storage_;
   std::unique_ptr<cloud_sync::PageSyncContext> page_sync_context_;
   std::unique_ptr<MergeResolver> merge_resolver_;
+  // The journals of closed pages being committed.
+  std::vector<std::unique_ptr<storage::Journal>> closed_page_journals_;
+  // Set once the PageManager is being deleted: the pages closed then do not
+  // commit their journals.
+  bool deleting_ = false;
   callback::AutoCleanableSet<BoundInterface<PageSnapshot, PageSnapshotImpl>>
       snapshots_;
   callback::AutoCleanableSet<BranchTracker> pages_;
@@ -66,6 +81,9 @@ class PageManager {
   bool sync_backlog_downloaded_;
   std::vector<fidl::InterfaceRequest<Page>> page_requests_;
 
+  // WeakPtrFactory must be the last field of the class.
+  ftl::WeakPtrFactory<PageManager> weak_ptr_factory_;
+
   FTL_DISALLOW_COPY_AND_ASSIGN(PageManager);
 };
 
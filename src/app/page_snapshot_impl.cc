@@ -2,8 +2,11 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <algorithm>
 #include <functional>
+#include <memory>
 #include <queue>
+#include <string>
 #include <vector>
 
 #include "apps/ledger/src/app/page_snapshot_impl.h"
@@ -18,6 +21,367 @@
 #include "lib/ftl/tasks/task_runner.h"
 
 namespace ledger {
+namespace {
+
+// Approximate size of an entry or key in a response, besides its contents.
+constexpr size_t kResultEntryOverhead = 32;
+
+// Reads the values of the given entries, at most |kMaxConcurrentValueReads|
+// ahead of the first value not yet added to the response, and calls |callback|
+// with the values of the leading entries that fit in a response, in the same
+// order. The status is |PARTIAL_RESULT| if values are left out. Null entries
+// are reported as not found.
+class ValuesFetcher : public ftl::RefCountedThreadSafe<ValuesFetcher> {
+ public:
+  static ftl::RefPtr<ValuesFetcher> Create(
+      storage::PageStorage* page_storage,
+      std::vector<std::unique_ptr<storage::Entry>> entries,
+      std::function<void(Status, fidl::Array<ValueResultPtr>)> callback) {
+    return ftl::AdoptRef(new ValuesFetcher(page_storage, std::move(entries),
+                                           std::move(callback)));
+  }
+
+  void Start() {
+    for (const auto& entry : entries_) {
+      ValueResultPtr result = ValueResult::New();
+      result->status = entry ? Status::OK : Status::KEY_NOT_FOUND;
+      results_.push_back(std::move(result));
+      read_.push_back(!entry);
+    }
+    FetchNext();
+  }
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(ValuesFetcher);
+
+  ValuesFetcher(
+      storage::PageStorage* page_storage,
+      std::vector<std::unique_ptr<storage::Entry>> entries,
+      std::function<void(Status, fidl::Array<ValueResultPtr>)> callback)
+      : page_storage_(page_storage),
+        entries_(std::move(entries)),
+        results_(fidl::Array<ValueResultPtr>::New(0)),
+        callback_(std::move(callback)) {}
+
+  ~ValuesFetcher() {}
+
+  // Starts reading values, and adds the values read to the response, until
+  // the reads started are pending. Reads completing synchronously are handled
+  // by the loop rather than by nested calls.
+  void FetchNext() {
+    if (fetching_ || !callback_) {
+      return;
+    }
+    fetching_ = true;
+    do {
+      while (next_ < entries_.size() &&
+             next_ < result_count_ + kMaxConcurrentValueReads) {
+        size_t index = next_++;
+        if (!entries_[index]) {
+          continue;
+        }
+        ftl::RefPtr<ValuesFetcher> self(this);
+        PageUtils::GetReferenceAsValuePtr(
+            page_storage_, entries_[index]->object_id,
+            [self, index](Status status, ValuePtr value) {
+              self->results_[index]->status = status;
+              self->results_[index]->value = std::move(value);
+              self->read_[index] = true;
+              self->FetchNext();
+            });
+      }
+    } while (AddResults());
+    fetching_ = false;
+  }
+
+  // Adds the leading values read to the response, and calls the callback once
+  // all of them are added, or one of them does not fit. Values are no longer
+  // read once the response is full. Returns true if more values can be read.
+  bool AddResults() {
+    size_t previous_count = result_count_;
+    while (result_count_ < entries_.size() && read_[result_count_]) {
+      const ValuePtr& value = results_[result_count_]->value;
+      size_t result_size = kResultEntryOverhead;
+      size_t result_handles = 0;
+      if (value && value->is_bytes()) {
+        result_size += value->get_bytes().size();
+      } else if (value) {
+        result_handles = 1;
+      }
+      if (result_count_ > 0 &&
+          (size_ + result_size > kMaxResultSize ||
+           handles_ + result_handles > kMaxResultHandles)) {
+        Finish(Status::PARTIAL_RESULT);
+        return false;
+      }
+      size_ += result_size;
+      handles_ += result_handles;
+      ++result_count_;
+    }
+    if (result_count_ == entries_.size()) {
+      Finish(Status::OK);
+      return false;
+    }
+    return result_count_ > previous_count && next_ < entries_.size();
+  }
+
+  void Finish(Status status) {
+    fidl::Array<ValueResultPtr> results = fidl::Array<ValueResultPtr>::New(0);
+    for (size_t i = 0; i < result_count_; ++i) {
+      results.push_back(std::move(results_[i]));
+    }
+    auto callback = std::move(callback_);
+    callback_ = nullptr;
+    callback(status, std::move(results));
+  }
+
+  storage::PageStorage* const page_storage_;
+  const std::vector<std::unique_ptr<storage::Entry>> entries_;
+  fidl::Array<ValueResultPtr> results_;
+  // Whether the value of each entry is read.
+  std::vector<bool> read_;
+  std::function<void(Status, fidl::Array<ValueResultPtr>)> callback_;
+  size_t next_ = 0;
+  // The number of leading values added to the response, and their size.
+  size_t result_count_ = 0;
+  size_t size_ = 0;
+  size_t handles_ = 0;
+  bool fetching_ = false;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(ValuesFetcher);
+};
+
+// Reads asynchronously the entries of |contents| with keys in [|start|,
+// |end|), in the given order, and calls |callback| with them. The scan stops
+// after |limit| entries if |limit| is not 0, or once the keys read exceed
+// |kMaxResultSize|, so that one page of results is read at a time. If entries
+// are left out, |truncated| is true and |next_key| is the key of the first of
+// them. At least one entry is returned, if any.
+void CollectEntries(
+    const storage::CommitContents& contents,
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    bool reverse,
+    uint32_t limit,
+    std::function<void(storage::Status,
+                       std::vector<storage::Entry>,
+                       bool truncated,
+                       std::string next_key)> callback) {
+  struct Page {
+    std::vector<storage::Entry> entries;
+    size_t size = 0;
+    bool truncated = false;
+    std::string next_key;
+  };
+  auto page = std::make_unique<Page>();
+  auto on_next = [ page = page.get(), limit ](storage::Entry entry) {
+    // The entry after the last one returned is read, to know whether the
+    // range has more entries.
+    size_t entry_size = entry.key.size() + kResultEntryOverhead;
+    if (!page->entries.empty() &&
+        (page->entries.size() == limit ||
+         page->size + entry_size > kMaxResultSize)) {
+      page->truncated = true;
+      page->next_key = std::move(entry.key);
+      return false;
+    }
+    page->size += entry_size;
+    page->entries.push_back(std::move(entry));
+    return true;
+  };
+  auto on_done = ftl::MakeCopyable([
+    page = std::move(page), callback = std::move(callback)
+  ](storage::Status status) {
+    callback(status, std::move(page->entries), page->truncated,
+             std::move(page->next_key));
+  });
+  contents.ForEachEntry(start, end, reverse, std::move(on_next),
+                        std::move(on_done));
+}
+
+// Reads the values of the given entries, |kMaxConcurrentValueReads| at a
+// time, and calls |callback| with the leading entries whose keys and values
+// fit in a response, and with the key of the first entry left out, or
+// |next_key| if all entries fit. Values larger than |kMaxInlineDataSize| are
+// returned in VMOs. Values are no longer read once the response is full.
+class EntriesPageFetcher
+    : public ftl::RefCountedThreadSafe<EntriesPageFetcher> {
+ public:
+  static ftl::RefPtr<EntriesPageFetcher> Create(
+      storage::PageStorage* page_storage,
+      std::vector<storage::Entry> entries,
+      std::string next_key,
+      std::function<void(Status, fidl::Array<EntryPtr>, std::string)>
+          callback) {
+    return ftl::AdoptRef(new EntriesPageFetcher(
+        page_storage, std::move(entries), std::move(next_key),
+        std::move(callback)));
+  }
+
+  void Start() { FetchNextBatch(); }
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(EntriesPageFetcher);
+
+  EntriesPageFetcher(
+      storage::PageStorage* page_storage,
+      std::vector<storage::Entry> entries,
+      std::string next_key,
+      std::function<void(Status, fidl::Array<EntryPtr>, std::string)>
+          callback)
+      : page_storage_(page_storage),
+        entries_(std::move(entries)),
+        next_key_(std::move(next_key)),
+        results_(fidl::Array<EntryPtr>::New(0)),
+        callback_(std::move(callback)) {}
+
+  ~EntriesPageFetcher() {}
+
+  void FetchNextBatch() {
+    size_t begin = results_.size();
+    if (begin == entries_.size()) {
+      callback_(Status::OK, std::move(results_), std::move(next_key_));
+      return;
+    }
+    size_t end = std::min(entries_.size(), begin + kMaxConcurrentValueReads);
+    auto waiter =
+        callback::Waiter<storage::Status, const storage::Object>::Create(
+            storage::Status::OK);
+    for (size_t i = begin; i < end; ++i) {
+      page_storage_->GetObject(entries_[i].object_id, waiter->NewCallback());
+    }
+    ftl::RefPtr<EntriesPageFetcher> self(this);
+    waiter->Finalize([self](
+        storage::Status status,
+        std::vector<std::unique_ptr<const storage::Object>> objects) {
+      if (status != storage::Status::OK) {
+        FTL_LOG(ERROR) << "PageSnapshotImpl error while reading values.";
+        self->callback_(Status::IO_ERROR, nullptr, std::string());
+        return;
+      }
+      for (const auto& object : objects) {
+        if (!self->AddResult(*object)) {
+          return;
+        }
+      }
+      self->FetchNextBatch();
+    });
+  }
+
+  // Adds the entry with the given value to the results, and returns true if
+  // more entries should be added. Calls the callback otherwise.
+  bool AddResult(const storage::Object& object) {
+    const storage::Entry& entry = entries_[results_.size()];
+    ftl::StringView data;
+    ValuePtr value;
+    if (object.GetData(&data) != storage::Status::OK ||
+        PageUtils::DataToValuePtr(data, &value) != Status::OK) {
+      callback_(Status::IO_ERROR, nullptr, std::string());
+      return false;
+    }
+    size_t entry_size = entry.key.size() + kResultEntryOverhead;
+    size_t entry_handles = 0;
+    if (value->is_bytes()) {
+      entry_size += data.size();
+    } else {
+      entry_handles = 1;
+    }
+    if (!results_.empty() && (size_ + entry_size > kMaxResultSize ||
+                              handles_ + entry_handles > kMaxResultHandles)) {
+      callback_(Status::OK, std::move(results_), entry.key);
+      return false;
+    }
+    size_ += entry_size;
+    handles_ += entry_handles;
+    EntryPtr entry_ptr = Entry::New();
+    entry_ptr->key = convert::ToArray(entry.key);
+    entry_ptr->value = std::move(value);
+    results_.push_back(std::move(entry_ptr));
+    return true;
+  }
+
+  storage::PageStorage* const page_storage_;
+  const std::vector<storage::Entry> entries_;
+  std::string next_key_;
+  fidl::Array<EntryPtr> results_;
+  size_t size_ = 0;
+  size_t handles_ = 0;
+  std::function<void(Status, fidl::Array<EntryPtr>, std::string)> callback_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(EntriesPageFetcher);
+};
+
+// Returns the key from which to resume a scan of the keys starting with
+// |prefix|, given the |token| of the previous call, if any. Returns false if
+// |token| was not produced for this prefix.
+bool GetResumeKey(const std::string& prefix,
+                  const fidl::Array<uint8_t>& token,
+                  std::string* start) {
+  if (token.is_null()) {
+    *start = prefix;
+    return true;
+  }
+  *start = convert::ToString(token);
+  return start->compare(0, prefix.size(), prefix) == 0;
+}
+
+// Returns whether the range [|start|, |end|) is empty. Only a NULL |end| is
+// unbounded: the storage reads an empty |end| as the end of the page, so such
+// a range must not be passed down.
+bool IsEmptyRange(const fidl::Array<uint8_t>& start,
+                  const fidl::Array<uint8_t>& end) {
+  return !end.is_null() &&
+         convert::ToStringView(start) >= convert::ToStringView(end);
+}
+
+// Returns the bounds from which to resume a scan of the keys in [|start|,
+// |end|), in the given order, given the |token| of the previous call, if any:
+// the token is the key of the first entry left out. Returns false if |token|
+// is not in the range.
+bool GetResumeRange(const fidl::Array<uint8_t>& start,
+                    const fidl::Array<uint8_t>& end,
+                    bool reverse,
+                    const fidl::Array<uint8_t>& token,
+                    std::string* resume_start,
+                    std::string* resume_end) {
+  *resume_start = convert::ToString(start);
+  *resume_end = convert::ToString(end);
+  if (token.is_null()) {
+    return true;
+  }
+  std::string key = convert::ToString(token);
+  if (key < *resume_start || (!resume_end->empty() && key >= *resume_end)) {
+    return false;
+  }
+  if (reverse) {
+    // The smallest key after |key|, so that |key| is in the range.
+    *resume_end = key + '\0';
+  } else {
+    *resume_start = std::move(key);
+  }
+  return true;
+}
+
+// Converts the key of the first entry left out of a response into a token.
+fidl::Array<uint8_t> ToToken(const std::string& next_key) {
+  if (next_key.empty()) {
+    return nullptr;
+  }
+  return convert::ToArray(next_key);
+}
+
+fidl::Array<fidl::Array<uint8_t>> ToKeys(
+    const std::vector<storage::Entry>& entries) {
+  fidl::Array<fidl::Array<uint8_t>> keys =
+      fidl::Array<fidl::Array<uint8_t>>::New(0);
+  for (const storage::Entry& entry : entries) {
+    keys.push_back(convert::ToArray(entry.key));
+  }
+  return keys;
+}
+
+}  // namespace
+
 PageSnapshotImpl::PageSnapshotImpl(
     storage::PageStorage* page_storage,
     std::unique_ptr<storage::CommitContents> contents)
@@ -28,97 +392,227 @@ PageSnapshotImpl::~PageSnapshotImpl() {}
 void PageSnapshotImpl::GetEntries(fidl::Array<uint8_t> key_prefix,
                                   fidl::Array<uint8_t> token,
                                   const GetEntriesCallback& callback) {
-  std::unique_ptr<storage::Iterator<const storage::Entry>> it =
-      contents_->find(key_prefix);
-  auto waiter =
-      callback::Waiter<storage::Status, const storage::Object>::Create(
-          storage::Status::OK);
-  fidl::Array<EntryPtr> entries = fidl::Array<EntryPtr>::New(0);
-
-  while (it->Valid() &&
-         convert::ExtendedStringView((*it)->key).substr(0, key_prefix.size()) ==
-             convert::ExtendedStringView(key_prefix)) {
-    EntryPtr entry = Entry::New();
-    entry->key = convert::ToArray((*it)->key);
-    entries.push_back(std::move(entry));
-
-    page_storage_->GetObject((*it)->object_id, waiter->NewCallback());
-    it->Next();
-  }
-
-  std::function<void(storage::Status,
-                     std::vector<std::unique_ptr<const storage::Object>>)>
-      result_callback = ftl::MakeCopyable([
-        callback, entry_list = std::move(entries)
-      ](storage::Status status,
-        std::vector<std::unique_ptr<const storage::Object>> results) mutable {
-        if (status != storage::Status::OK) {
-          FTL_LOG(ERROR) << "PageSnapshotImpl::GetEntries error while reading.";
-          callback(Status::IO_ERROR, nullptr, nullptr);
-          return;
-        }
-
-        for (size_t i = 0; i < results.size(); i++) {
-          ftl::StringView object_contents;
-
-          storage::Status read_status = results[i]->GetData(&object_contents);
-          if (read_status != storage::Status::OK) {
-            callback(Status::IO_ERROR, nullptr, nullptr);
+  std::string prefix = convert::ToString(key_prefix);
+  std::string start;
+  if (!GetResumeKey(prefix, token, &start)) {
+    callback(Status::INVALID_TOKEN, nullptr, nullptr);
+    return;
+  }
+  std::string end = PageUtils::GetPrefixEnd(prefix);
+  CollectEntries(*contents_, start, end, false, 0, [
+    page_storage = page_storage_, callback
+  ](storage::Status status, std::vector<storage::Entry> entries,
+    bool truncated, std::string next_key) {
+    if (status != storage::Status::OK) {
+      callback(PageUtils::ConvertStatus(status), nullptr, nullptr);
+      return;
+    }
+    EntriesPageFetcher::Create(
+        page_storage, std::move(entries), std::move(next_key),
+        [callback](Status status, fidl::Array<EntryPtr> entries,
+                   std::string next_key) {
+          if (status != Status::OK) {
+            callback(status, nullptr, nullptr);
             return;
           }
-
-          entry_list[i]->value = Value::New();
-          entry_list[i]->value->set_bytes(convert::ToArray(object_contents));
-        }
-        callback(Status::OK, std::move(entry_list), nullptr);
-      });
-  waiter->Finalize(result_callback);
+          callback(next_key.empty() ? Status::OK : Status::PARTIAL_RESULT,
+                   std::move(entries), ToToken(next_key));
+        })
+        ->Start();
+  });
 }
 
 void PageSnapshotImpl::GetKeys(fidl::Array<uint8_t> key_prefix,
                                fidl::Array<uint8_t> token,
                                const GetKeysCallback& callback) {
-  std::unique_ptr<storage::Iterator<const storage::Entry>> it =
-      contents_->find(key_prefix);
-  fidl::Array<fidl::Array<uint8_t>> keys =
-      fidl::Array<fidl::Array<uint8_t>>::New(0);
+  std::string prefix = convert::ToString(key_prefix);
+  std::string start;
+  if (!GetResumeKey(prefix, token, &start)) {
+    callback(Status::INVALID_TOKEN, nullptr, nullptr);
+    return;
+  }
+  std::string end = PageUtils::GetPrefixEnd(prefix);
+  CollectEntries(*contents_, start, end, false, 0,
+                 [callback](storage::Status status,
+                            std::vector<storage::Entry> entries,
+                            bool truncated, std::string next_key) {
+                   if (status != storage::Status::OK) {
+                     callback(PageUtils::ConvertStatus(status), nullptr,
+                              nullptr);
+                     return;
+                   }
+                   callback(truncated ? Status::PARTIAL_RESULT : Status::OK,
+                            ToKeys(entries), ToToken(next_key));
+                 });
+}
 
-  while (it->Valid() &&
-         convert::ExtendedStringView((*it)->key).substr(0, key_prefix.size()) ==
-             convert::ExtendedStringView(key_prefix)) {
-    keys.push_back(convert::ToArray((*it)->key));
-    it->Next();
+void PageSnapshotImpl::GetEntriesInRange(
+    fidl::Array<uint8_t> start,
+    fidl::Array<uint8_t> end,
+    bool reverse,
+    uint32_t limit,
+    fidl::Array<uint8_t> token,
+    const GetEntriesInRangeCallback& callback) {
+  if (IsEmptyRange(start, end)) {
+    callback(Status::OK, fidl::Array<EntryPtr>::New(0), nullptr);
+    return;
   }
-  callback(Status::OK, std::move(keys), nullptr);
+  std::string resume_start;
+  std::string resume_end;
+  if (!GetResumeRange(start, end, reverse, token, &resume_start,
+                      &resume_end)) {
+    callback(Status::INVALID_TOKEN, nullptr, nullptr);
+    return;
+  }
+  CollectEntries(*contents_, resume_start, resume_end, reverse, limit, [
+    page_storage = page_storage_, callback
+  ](storage::Status status, std::vector<storage::Entry> entries,
+    bool truncated, std::string next_key) {
+    if (status != storage::Status::OK) {
+      callback(PageUtils::ConvertStatus(status), nullptr, nullptr);
+      return;
+    }
+    // The values may not all fit in the response either.
+    size_t entry_count = entries.size();
+    EntriesPageFetcher::Create(
+        page_storage, std::move(entries), std::move(next_key),
+        [callback, entry_count, truncated](Status status,
+                                           fidl::Array<EntryPtr> entries,
+                                           std::string next_key) {
+          if (status != Status::OK) {
+            callback(status, nullptr, nullptr);
+            return;
+          }
+          // The empty key is a valid token when reading in reverse order.
+          if (truncated || entries.size() < entry_count) {
+            callback(Status::PARTIAL_RESULT, std::move(entries),
+                     convert::ToArray(next_key));
+            return;
+          }
+          callback(Status::OK, std::move(entries), nullptr);
+        })
+        ->Start();
+  });
 }
 
-void PageSnapshotImpl::Get(fidl::Array<uint8_t> key,
-                           const GetCallback& callback) {
-  std::unique_ptr<storage::Iterator<const storage::Entry>> it =
-      contents_->find(key);
-  if (!it->Valid() ||
-      convert::ExtendedStringView((*it)->key) !=
-          convert::ExtendedStringView(key)) {
+void PageSnapshotImpl::GetKeysInRange(fidl::Array<uint8_t> start,
+                                      fidl::Array<uint8_t> end,
+                                      bool reverse,
+                                      uint32_t limit,
+                                      fidl::Array<uint8_t> token,
+                                      const GetKeysInRangeCallback& callback) {
+  if (IsEmptyRange(start, end)) {
+    callback(Status::OK, fidl::Array<fidl::Array<uint8_t>>::New(0), nullptr);
+    return;
+  }
+  std::string resume_start;
+  std::string resume_end;
+  if (!GetResumeRange(start, end, reverse, token, &resume_start,
+                      &resume_end)) {
+    callback(Status::INVALID_TOKEN, nullptr, nullptr);
+    return;
+  }
+  CollectEntries(*contents_, resume_start, resume_end, reverse, limit,
+                 [callback](storage::Status status,
+                            std::vector<storage::Entry> entries,
+                            bool truncated, std::string next_key) {
+                   if (status != storage::Status::OK) {
+                     callback(PageUtils::ConvertStatus(status), nullptr,
+                              nullptr);
+                     return;
+                   }
+                   if (truncated) {
+                     callback(Status::PARTIAL_RESULT, ToKeys(entries),
+                              convert::ToArray(next_key));
+                     return;
+                   }
+                   callback(Status::OK, ToKeys(entries), nullptr);
+                 });
+}
+
+void PageSnapshotImpl::GetCountInRange(
+    fidl::Array<uint8_t> start,
+    fidl::Array<uint8_t> end,
+    const GetCountInRangeCallback& callback) {
+  if (IsEmptyRange(start, end)) {
+    callback(Status::OK, 0);
+    return;
+  }
+  contents_->GetEntryCount(
+      start, end, [callback](storage::Status status, uint64_t count) {
+        callback(PageUtils::ConvertStatus(status), count);
+      });
+}
+
+void PageSnapshotImpl::GetKeyAtOffset(fidl::Array<uint8_t> start,
+                                      fidl::Array<uint8_t> end,
+                                      uint64_t offset,
+                                      const GetKeyAtOffsetCallback& callback) {
+  if (IsEmptyRange(start, end)) {
     callback(Status::KEY_NOT_FOUND, nullptr);
     return;
   }
-  PageUtils::GetReferenceAsValuePtr(page_storage_, (*it)->object_id, callback);
+  contents_->GetEntryAtOffset(
+      start, end, offset,
+      [callback](storage::Status status, storage::Entry entry) {
+        if (status != storage::Status::OK) {
+          callback(PageUtils::ConvertStatus(status, Status::KEY_NOT_FOUND),
+                   nullptr);
+          return;
+        }
+        callback(Status::OK, convert::ToArray(entry.key));
+      });
+}
+
+void PageSnapshotImpl::Get(fidl::Array<uint8_t> key,
+                           const GetCallback& callback) {
+  contents_->GetEntry(key, [ page_storage = page_storage_, callback ](
+                               storage::Status status, storage::Entry entry) {
+    if (status != storage::Status::OK) {
+      callback(PageUtils::ConvertStatus(status, Status::KEY_NOT_FOUND),
+               nullptr);
+      return;
+    }
+    PageUtils::GetReferenceAsValuePtr(page_storage, entry.object_id, callback);
+  });
+}
+
+void PageSnapshotImpl::GetMany(fidl::Array<fidl::Array<uint8_t>> keys,
+                               const GetManyCallback& callback) {
+  std::vector<std::string> key_strings;
+  key_strings.reserve(keys.size());
+  for (const auto& key : keys) {
+    key_strings.push_back(convert::ToString(key));
+  }
+  contents_->GetEntries(
+      std::move(key_strings),
+      [ page_storage = page_storage_, callback ](
+          storage::Status status,
+          std::vector<std::unique_ptr<storage::Entry>> entries) {
+        if (status != storage::Status::OK) {
+          callback(PageUtils::ConvertStatus(status), nullptr);
+          return;
+        }
+        ValuesFetcher::Create(page_storage, std::move(entries), callback)
+            ->Start();
+      });
 }
 
 void PageSnapshotImpl::GetPartial(fidl::Array<uint8_t> key,
                                   int64_t offset,
                                   int64_t max_size,
                                   const GetPartialCallback& callback) {
-  std::unique_ptr<storage::Iterator<const storage::Entry>> it =
-      contents_->find(key);
-  if (!it->Valid() ||
-      convert::ExtendedStringView((*it)->key) !=
-          convert::ExtendedStringView(key)) {
-    callback(Status::KEY_NOT_FOUND, mx::vmo());
-    return;
-  }
-  PageUtils::GetPartialReferenceAsBuffer(page_storage_, (*it)->object_id,
-                                         offset, max_size, callback);
+  contents_->GetEntry(key, [
+    page_storage = page_storage_, offset, max_size, callback
+  ](storage::Status status, storage::Entry entry) {
+    if (status != storage::Status::OK) {
+      callback(PageUtils::ConvertStatus(status, Status::KEY_NOT_FOUND),
+               mx::vmo());
+      return;
+    }
+    PageUtils::GetPartialReferenceAsBuffer(page_storage, entry.object_id,
+                                           offset, max_size, callback);
+  });
 }
 
 }  // namespace ledger
@@ -28,7 +28,28 @@ class PageSnapshotImpl : public PageSnapshot {
   void GetKeys(fidl::Array<uint8_t> key_prefix,
                fidl::Array<uint8_t> token,
                const GetKeysCallback& callback) override;
+  void GetEntriesInRange(fidl::Array<uint8_t> start,
+                         fidl::Array<uint8_t> end,
+                         bool reverse,
+                         uint32_t limit,
+                         fidl::Array<uint8_t> token,
+                         const GetEntriesInRangeCallback& callback) override;
+  void GetKeysInRange(fidl::Array<uint8_t> start,
+                      fidl::Array<uint8_t> end,
+                      bool reverse,
+                      uint32_t limit,
+                      fidl::Array<uint8_t> token,
+                      const GetKeysInRangeCallback& callback) override;
+  void GetCountInRange(fidl::Array<uint8_t> start,
+                       fidl::Array<uint8_t> end,
+                       const GetCountInRangeCallback& callback) override;
+  void GetKeyAtOffset(fidl::Array<uint8_t> start,
+                      fidl::Array<uint8_t> end,
+                      uint64_t offset,
+                      const GetKeyAtOffsetCallback& callback) override;
   void Get(fidl::Array<uint8_t> key, const GetCallback& callback) override;
+  void GetMany(fidl::Array<fidl::Array<uint8_t>> keys,
+               const GetManyCallback& callback) override;
   void GetPartial(fidl::Array<uint8_t> key,
                   int64_t offset,
                   int64_t max_size,
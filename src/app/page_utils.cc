@@ -5,28 +5,71 @@
 #include "apps/ledger/src/app/page_utils.h"
 
 #include <memory>
+#include <vector>
 
 #include "apps/ledger/src/app/constants.h"
 #include "apps/ledger/src/storage/public/object.h"
 #include "apps/ledger/src/storage/public/page_storage.h"
 #include "apps/ledger/src/storage/public/types.h"
-#include "lib/mtl/vmo/strings.h"
+#include "mx/vmo.h"
 
 namespace ledger {
 namespace {
+// Computes the range of a value of size |value_size| returned for the given
+// |offset| and |max_size|. Valid offsets are between -N and N-1.
+void ComputeRange(uint64_t value_size,
+                  int64_t offset,
+                  int64_t max_size,
+                  uint64_t* start,
+                  uint64_t* length) {
+  *start = value_size;
+  if (offset >= -static_cast<int64_t>(value_size) &&
+      offset < static_cast<int64_t>(value_size)) {
+    *start = offset < 0 ? value_size + offset : offset;
+  }
+  *length = max_size < 0 ? value_size : max_size;
+}
+
+// Creates a VMO holding the concatenation of |parts|. The bytes are written to
+// the VMO from where they are, without going through an intermediate string.
+bool VmoFromViews(const std::vector<ftl::StringView>& parts, mx::vmo* buffer) {
+  uint64_t size = 0;
+  for (ftl::StringView part : parts) {
+    size += part.size();
+  }
+  mx::vmo result;
+  if (mx::vmo::create(size, 0u, &result) != NO_ERROR) {
+    return false;
+  }
+  uint64_t offset = 0;
+  for (ftl::StringView part : parts) {
+    size_t written;
+    if (result.write(part.data(), offset, part.size(), &written) != NO_ERROR ||
+        written != part.size()) {
+      return false;
+    }
+    offset += part.size();
+  }
+  *buffer = std::move(result);
+  return true;
+}
+
+// Creates a VMO holding |data|, as |VmoFromViews()|.
+bool VmoFromView(ftl::StringView data, mx::vmo* buffer) {
+  return VmoFromViews(std::vector<ftl::StringView>{data}, buffer);
+}
+
 Status ToBuffer(convert::ExtendedStringView value,
                 int64_t offset,
                 int64_t max_size,
                 mx::vmo* buffer) {
-  size_t start = value.size();
-  // Valid indices are between -N and N-1.
-  if (offset >= -static_cast<int64_t>(value.size()) &&
-      offset < static_cast<int64_t>(value.size())) {
-    start = offset < 0 ? value.size() + offset : offset;
-  }
-  size_t length = max_size < 0 ? value.size() : max_size;
+  uint64_t start;
+  uint64_t length;
+  ComputeRange(value.size(), offset, max_size, &start, &length);
 
-  bool result = mtl::VmoFromString(value.substr(start, length), buffer);
+  // |value| is a view on the storage object, usually backed by the memory
+  // mapping of its pack file: this is the only copy of the data.
+  bool result = VmoFromView(value.substr(start, length), buffer);
   return result ? Status::OK : Status::UNKNOWN_ERROR;
 }
 
@@ -72,6 +115,34 @@ Status PageUtils::ConvertStatus(storage::Status status,
   }
 }
 
+std::string PageUtils::GetPrefixEnd(convert::ExtendedStringView prefix) {
+  std::string end = prefix.ToString();
+  while (!end.empty() && static_cast<uint8_t>(end.back()) == 0xff) {
+    end.pop_back();
+  }
+  if (!end.empty()) {
+    ++end.back();
+  }
+  return end;
+}
+
+Status PageUtils::DataToValuePtr(ftl::StringView data, ValuePtr* value) {
+  if (data.size() <= kMaxInlineDataSize) {
+    *value = Value::New();
+    (*value)->set_bytes(convert::ToArray(data));
+    return Status::OK;
+  }
+
+  mx::vmo buffer;
+  Status buffer_status = ToBuffer(data, 0, -1, &buffer);
+  if (buffer_status != Status::OK) {
+    return buffer_status;
+  }
+  *value = Value::New();
+  (*value)->set_buffer(std::move(buffer));
+  return Status::OK;
+}
+
 void PageUtils::GetReferenceAsValuePtr(
     storage::PageStorage* storage,
     convert::ExtendedStringView reference_id,
@@ -82,21 +153,12 @@ void PageUtils::GetReferenceAsValuePtr(
           callback(status, nullptr);
           return;
         }
-        if (data.size() <= kMaxInlineDataSize) {
-          ValuePtr value = Value::New();
-          value->set_bytes(convert::ToArray(data));
-          callback(Status::OK, std::move(value));
-          return;
-        }
-
-        mx::vmo buffer;
-        Status buffer_status = ToBuffer(data, 0, -1, &buffer);
-        if (buffer_status != Status::OK) {
-          callback(buffer_status, nullptr);
+        ValuePtr value;
+        status = DataToValuePtr(data, &value);
+        if (status != Status::OK) {
+          callback(status, nullptr);
           return;
         }
-        ValuePtr value = Value::New();
-        value->set_buffer(std::move(buffer));
         callback(Status::OK, std::move(value));
       });
 }
@@ -107,17 +169,39 @@ void PageUtils::GetPartialReferenceAsBuffer(
     int64_t offset,
     int64_t max_size,
     std::function<void(Status, mx::vmo)> callback) {
-  GetReferenceAsStringView(
-      storage, reference_id,
-      [offset, max_size, callback](Status status, ftl::StringView data) {
-        if (status != Status::OK) {
-          callback(status, mx::vmo());
+  // Only the requested range is read, so that large chunked values are not
+  // assembled in memory.
+  storage->GetObject(
+      reference_id,
+      [offset, max_size, callback](
+          storage::Status status,
+          std::unique_ptr<const storage::Object> object) {
+        if (status != storage::Status::OK) {
+          callback(
+              PageUtils::ConvertStatus(status, Status::REFERENCE_NOT_FOUND),
+              mx::vmo());
+          return;
+        }
+        uint64_t size;
+        status = object->GetSize(&size);
+        if (status != storage::Status::OK) {
+          callback(PageUtils::ConvertStatus(status), mx::vmo());
+          return;
+        }
+        uint64_t start;
+        uint64_t length;
+        ComputeRange(size, offset, max_size, &start, &length);
+        // The views are backed by the object, usually by the memory mappings
+        // of its pack files, and are written to the VMO without another copy.
+        std::vector<ftl::StringView> parts;
+        status = object->GetPartialDataViews(start, length, &parts);
+        if (status != storage::Status::OK) {
+          callback(PageUtils::ConvertStatus(status), mx::vmo());
           return;
         }
         mx::vmo buffer;
-        Status buffer_status = ToBuffer(data, offset, max_size, &buffer);
-        if (buffer_status != Status::OK) {
-          callback(buffer_status, mx::vmo());
+        if (!VmoFromViews(parts, &buffer)) {
+          callback(Status::UNKNOWN_ERROR, mx::vmo());
           return;
         }
         callback(Status::OK, std::move(buffer));
@@ -6,6 +6,7 @@
 #define APPS_LEDGER_SRC_APP_PAGE_UTILS_H_
 
 #include <functional>
+#include <string>
 
 #include "apps/ledger/services/public/ledger.fidl.h"
 #include "apps/ledger/src/convert/convert.h"
@@ -23,6 +24,15 @@ class PageUtils {
   static Status ConvertStatus(storage::Status status,
                               Status not_found_status = Status::INTERNAL_ERROR);
 
+  // Returns the smallest key greater than all the keys starting with |prefix|,
+  // or an empty string if there is no such key, i.e. if |prefix| only contains
+  // 0xff bytes.
+  static std::string GetPrefixEnd(convert::ExtendedStringView prefix);
+
+  // Converts |data| into a Value: inline bytes if it is at most
+  // |kMaxInlineDataSize| bytes long, a VMO otherwise.
+  static Status DataToValuePtr(ftl::StringView data, ValuePtr* value);
+
   // Returns a Reference contents as a ValuePtr.
   static void GetReferenceAsValuePtr(
       storage::PageStorage* storage,
@@ -43,7 +43,7 @@ TEST_F(LedgerSyncImplTest, RemoteContainsRequestUrl) {
       "page_id",
       test::Capture([this] { message_loop_.PostQuitTask(); }, &response));
   RunLoopWithTimeout();
-  EXPECT_EQ("https://.firebaseio.com/V/1/test_idV/page_idV.json?shallow=true",
+  EXPECT_EQ("https://.firebaseio.com/V/3/test_idV/page_idV.json?shallow=true",
             network_service_.GetRequest()->url);
 }
 
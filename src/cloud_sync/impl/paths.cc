@@ -27,7 +27,7 @@ std::string GetGcsPrefixForPage(ftl::StringView app_path,
 std::string GetFirebasePathForApp(ftl::StringView user_prefix,
                                   ftl::StringView app_id) {
   return ftl::Concatenate({firebase::EncodeKey(user_prefix), "/",
-                           storage::kSerializationVersion, "/",
+                           storage::kSyncSerializationVersion, "/",
                            firebase::EncodeKey(app_id)});
 }
 
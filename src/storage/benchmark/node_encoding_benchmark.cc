@@ -0,0 +1,178 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares the cost of encoding and decoding tree nodes in the binary format
+// with the cost of decoding them in the legacy JSON format.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/base64.h"
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/public/constants.h"
+#include "lib/ftl/command_line.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/concatenate.h"
+#include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/time/time_point.h"
+
+namespace storage {
+namespace {
+
+const char kHelpArg[] = "help";
+const char kEntryCountArg[] = "entry_count";
+const char kKeySizeArg[] = "key_size";
+const char kIterationsArg[] = "iterations";
+
+void PrintHelp() {
+  printf("Compares the binary and the legacy JSON encodings of tree nodes.\n");
+  printf("\n");
+  printf("  --entry_count=<N>: number of entries per node (default: 64).\n");
+  printf("  --key_size=<N>: size of each key in bytes (default: 32).\n");
+  printf("  --iterations=<N>: number of times each operation is run\n");
+  printf("    (default: 10000).\n");
+  printf("  --help: prints this help.\n");
+}
+
+void PrintResult(const char* name, size_t iterations, ftl::TimeDelta duration) {
+  printf("%-16s %8.1f ms %10.2f us/node\n", name, duration.ToMillisecondsF(),
+         duration.ToMillisecondsF() * 1000 / iterations);
+}
+
+std::string RandomString(size_t size) {
+  std::string result(size, '\0');
+  glue::RandBytes(&result[0], size);
+  return result;
+}
+
+// Encodes a node in the JSON format used before the binary one.
+std::string EncodeJsonNode(const std::vector<Entry>& entries,
+                           const std::vector<ObjectId>& children) {
+  std::string result = "{\"entries\":[";
+  for (size_t i = 0; i < entries.size(); ++i) {
+    std::string key;
+    std::string object_id;
+    glue::Base64Encode(entries[i].key, &key);
+    glue::Base64Encode(entries[i].object_id, &object_id);
+    result.append(ftl::Concatenate(
+        {i == 0 ? "" : ",", "{\"key\":\"", key, "\",\"object_id\":\"",
+         object_id, "\",\"priority\":",
+         entries[i].priority == KeyPriority::EAGER ? "0" : "1", "}"}));
+  }
+  result.append("],\"children\":[");
+  for (size_t i = 0; i < children.size(); ++i) {
+    std::string child;
+    glue::Base64Encode(children[i], &child);
+    result.append(ftl::Concatenate({i == 0 ? "" : ",", "\"", child, "\""}));
+  }
+  result.append("]}");
+  return result;
+}
+
+bool GetSizeArg(const ftl::CommandLine& command_line,
+                ftl::StringView name,
+                size_t* value) {
+  std::string string_value;
+  if (command_line.GetOptionValue(name, &string_value) &&
+      !ftl::StringToNumberWithError(string_value, value)) {
+    FTL_LOG(ERROR) << "Invalid " << name << ": " << string_value;
+    return false;
+  }
+  return true;
+}
+
+int Run(const ftl::CommandLine& command_line) {
+  size_t entry_count = 64;
+  size_t key_size = 32;
+  size_t iterations = 10000;
+  if (!GetSizeArg(command_line, kEntryCountArg, &entry_count) ||
+      !GetSizeArg(command_line, kKeySizeArg, &key_size) ||
+      !GetSizeArg(command_line, kIterationsArg, &iterations)) {
+    return 1;
+  }
+
+  // An internal node: all children are present.
+  std::vector<Entry> entries(entry_count);
+  for (Entry& entry : entries) {
+    entry.key = RandomString(key_size);
+    entry.object_id = RandomString(kObjectIdSize);
+    entry.priority = KeyPriority::EAGER;
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.key < b.key; });
+  std::vector<ObjectId> children(entry_count + 1);
+  for (ObjectId& child : children) {
+    child = RandomString(kObjectIdSize);
+  }
+  std::vector<uint64_t> child_entry_counts(children.size(), entry_count);
+
+  std::string binary = EncodeNode(entries, children, child_entry_counts);
+  std::string json = EncodeJsonNode(entries, children);
+  printf("%zu entries with %zu-byte keys: %zu bytes in binary, %zu in JSON\n",
+         entry_count, key_size, binary.size(), json.size());
+
+  ftl::TimePoint start = ftl::TimePoint::Now();
+  size_t total_size = 0;
+  for (size_t i = 0; i < iterations; ++i) {
+    total_size += EncodeNode(entries, children, child_entry_counts).size();
+  }
+  PrintResult("binary encode", iterations, ftl::TimePoint::Now() - start);
+  FTL_CHECK(total_size == iterations * binary.size());
+
+  std::vector<Entry> res_entries;
+  std::vector<ObjectId> res_children;
+  std::vector<uint64_t> res_child_entry_counts;
+  start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (!DecodeNode(binary, &res_entries, &res_children,
+                    &res_child_entry_counts)) {
+      FTL_LOG(ERROR) << "Unable to decode the binary node";
+      return 1;
+    }
+  }
+  PrintResult("binary decode", iterations, ftl::TimePoint::Now() - start);
+
+  start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < iterations; ++i) {
+    NodeView view;
+    if (!view.Init(binary)) {
+      FTL_LOG(ERROR) << "Unable to read the binary node";
+      return 1;
+    }
+    for (size_t j = 0; j < view.entry_count(); ++j) {
+      total_size += view.GetKey(j).size() + view.GetObjectId(j).size();
+    }
+    for (size_t j = 0; j < view.child_count(); ++j) {
+      total_size += view.GetChildId(j).size();
+    }
+  }
+  PrintResult("binary view", iterations, ftl::TimePoint::Now() - start);
+
+  start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < iterations; ++i) {
+    if (!DecodeNode(json, &res_entries, &res_children,
+                    &res_child_entry_counts)) {
+      FTL_LOG(ERROR) << "Unable to decode the JSON node";
+      return 1;
+    }
+  }
+  PrintResult("JSON decode", iterations, ftl::TimePoint::Now() - start);
+  return 0;
+}
+
+}  // namespace
+}  // namespace storage
+
+int main(int argc, const char** argv) {
+  ftl::CommandLine command_line = ftl::CommandLineFromArgcArgv(argc, argv);
+  if (command_line.HasOption(storage::kHelpArg)) {
+    storage::PrintHelp();
+    return 0;
+  }
+  return storage::Run(command_line);
+}
@@ -0,0 +1,257 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+// Compares the write and read throughput of the pack store with the legacy
+// layout, where each object is a separate file written to a staging directory,
+// synced and renamed to objects/<2 hex digits>/<rest of the id>.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/hash.h"
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "apps/ledger/src/storage/impl/compression.h"
+#include "apps/ledger/src/storage/impl/pack_store.h"
+#include "apps/ledger/src/storage/impl/segment_file.h"
+#include "lib/ftl/command_line.h"
+#include "lib/ftl/files/directory.h"
+#include "lib/ftl/files/file.h"
+#include "lib/ftl/files/path.h"
+#include "lib/ftl/files/scoped_temp_dir.h"
+#include "lib/ftl/files/unique_fd.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/concatenate.h"
+#include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/time/time_point.h"
+
+namespace storage {
+namespace {
+
+const char kHelpArg[] = "help";
+const char kObjectCountArg[] = "object_count";
+const char kObjectSizeArg[] = "object_size";
+const char kDirArg[] = "dir";
+
+void PrintHelp() {
+  printf("Compares the object throughput of the pack store and of the\n");
+  printf("legacy one-file-per-object layout.\n");
+  printf("\n");
+  printf("  --object_count=<N>: number of objects (default: 10000).\n");
+  printf("  --object_size=<N>: size of each object in bytes (default: 100).\n");
+  printf("  --dir=<path>: directory in which to write (default: a temporary\n");
+  printf("    directory under /tmp).\n");
+  printf("  --help: prints this help.\n");
+}
+
+void PrintResult(const char* name,
+                 size_t object_count,
+                 size_t object_size,
+                 ftl::TimeDelta duration) {
+  double seconds = duration.ToSecondsF();
+  printf("%-28s %8.1f ms %10.0f objects/s %8.1f MB/s\n", name,
+         duration.ToMillisecondsF(), object_count / seconds,
+         object_count * object_size / seconds / (1 << 20));
+}
+
+std::string ToHex(ftl::StringView bytes) {
+  const char kHexDigits[] = "0123456789ABCDEF";
+  std::string result;
+  for (unsigned char c : bytes) {
+    result.push_back(kHexDigits[c >> 4]);
+    result.push_back(kHexDigits[c & 0xf]);
+  }
+  return result;
+}
+
+// Reads all the bytes of |data|, so that reads from a memory mapping are not
+// cheaper than they really are.
+uint64_t Checksum(ftl::StringView data) {
+  uint64_t checksum = 0;
+  for (char c : data) {
+    checksum = checksum * 31 + static_cast<uint8_t>(c);
+  }
+  return checksum;
+}
+
+// Writes an object as the legacy layout did: one staging file, synced and
+// renamed to its final path.
+bool WriteLegacyObject(const std::string& staging_dir,
+                       const std::string& objects_dir,
+                       const ObjectId& object_id,
+                       const std::string& data) {
+  std::string staging_path = staging_dir + "/XXXXXX";
+  ftl::UniqueFD fd(mkstemp(&staging_path[0]));
+  if (!fd.is_valid() ||
+      write(fd.get(), data.data(), data.size()) !=
+          static_cast<ssize_t>(data.size()) ||
+      fsync(fd.get()) != 0) {
+    return false;
+  }
+  std::string hex = ToHex(object_id);
+  std::string dir = ftl::Concatenate({objects_dir, "/", hex.substr(0, 2)});
+  if (!files::IsDirectory(dir) && !files::CreateDirectory(dir)) {
+    return false;
+  }
+  return rename(staging_path.c_str(),
+                ftl::Concatenate({dir, "/", hex.substr(2)}).c_str()) == 0;
+}
+
+bool ReadLegacyObject(const std::string& objects_dir,
+                      const ObjectId& object_id,
+                      std::string* data) {
+  std::string hex = ToHex(object_id);
+  std::string path = ftl::Concatenate(
+      {objects_dir, "/", hex.substr(0, 2), "/", hex.substr(2)});
+  return files::IsFile(path) && files::ReadFileToString(path, data);
+}
+
+bool ReadPackObject(PackStore* pack_store,
+                    const ObjectId& object_id,
+                    std::string* buffer,
+                    ftl::StringView* data) {
+  PackStore::Location location;
+  std::shared_ptr<SegmentFile> file;
+  if (pack_store->Find(object_id, &location) != Status::OK ||
+      pack_store->GetSegmentFile(location.segment, &file) != Status::OK ||
+      file->GetData(location.offset, location.size, data) != Status::OK) {
+    return false;
+  }
+  if (location.compressed) {
+    if (!Decompress(*data, buffer)) {
+      return false;
+    }
+    *data = *buffer;
+  }
+  return true;
+}
+
+int Run(const ftl::CommandLine& command_line) {
+  size_t object_count = 10000;
+  size_t object_size = 100;
+  std::string value;
+  if (command_line.GetOptionValue(kObjectCountArg, &value) &&
+      !ftl::StringToNumberWithError(value, &object_count)) {
+    FTL_LOG(ERROR) << "Invalid " << kObjectCountArg << ": " << value;
+    return 1;
+  }
+  if (command_line.GetOptionValue(kObjectSizeArg, &value) &&
+      !ftl::StringToNumberWithError(value, &object_size)) {
+    FTL_LOG(ERROR) << "Invalid " << kObjectSizeArg << ": " << value;
+    return 1;
+  }
+  files::ScopedTempDir temp_dir;
+  std::string dir = temp_dir.path();
+  command_line.GetOptionValue(kDirArg, &dir);
+
+  std::vector<std::string> objects(object_count);
+  std::vector<ObjectId> object_ids(object_count);
+  for (size_t i = 0; i < object_count; ++i) {
+    objects[i].resize(object_size);
+    glue::RandBytes(&objects[i][0], object_size);
+    object_ids[i] = glue::SHA256Hash(objects[i].data(), objects[i].size());
+  }
+  printf("%zu objects of %zu bytes in %s\n", object_count, object_size,
+         dir.c_str());
+
+  // Legacy layout.
+  std::string staging_dir = dir + "/legacy/staging";
+  std::string objects_dir = dir + "/legacy/objects";
+  if (!files::CreateDirectory(staging_dir) ||
+      !files::CreateDirectory(objects_dir)) {
+    FTL_LOG(ERROR) << "Unable to create " << dir << "/legacy";
+    return 1;
+  }
+  ftl::TimePoint start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < object_count; ++i) {
+    if (!WriteLegacyObject(staging_dir, objects_dir, object_ids[i],
+                           objects[i])) {
+      FTL_LOG(ERROR) << "Unable to write legacy object";
+      return 1;
+    }
+  }
+  PrintResult("legacy write", object_count, object_size,
+              ftl::TimePoint::Now() - start);
+
+  uint64_t checksum = 0;
+  start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < object_count; ++i) {
+    std::string data;
+    if (!ReadLegacyObject(objects_dir, object_ids[i], &data) ||
+        data.size() != object_size) {
+      FTL_LOG(ERROR) << "Unable to read legacy object";
+      return 1;
+    }
+    checksum += Checksum(data);
+  }
+  PrintResult("legacy read", object_count, object_size,
+              ftl::TimePoint::Now() - start);
+
+  // Pack store, with each object made durable before the next one is written,
+  // as the legacy layout does, then with a single sync for all of them.
+  for (bool grouped : {false, true}) {
+    PackStore pack_store(
+        ftl::Concatenate({dir, grouped ? "/pack_grouped" : "/pack"}));
+    if (pack_store.Init() != Status::OK) {
+      FTL_LOG(ERROR) << "Unable to initialize the pack store";
+      return 1;
+    }
+    start = ftl::TimePoint::Now();
+    for (size_t i = 0; i < object_count; ++i) {
+      Status status = grouped ? pack_store.Append(object_ids[i], objects[i])
+                              : pack_store.Add(object_ids[i], objects[i]);
+      if (status != Status::OK) {
+        FTL_LOG(ERROR) << "Unable to write pack object";
+        return 1;
+      }
+    }
+    if (pack_store.Sync() != Status::OK) {
+      FTL_LOG(ERROR) << "Unable to sync the pack store";
+      return 1;
+    }
+    PrintResult(grouped ? "pack write, one sync" : "pack write, sync each",
+                object_count, object_size, ftl::TimePoint::Now() - start);
+  }
+
+  PackStore pack_store(dir + "/pack");
+  if (pack_store.Init() != Status::OK) {
+    FTL_LOG(ERROR) << "Unable to initialize the pack store";
+    return 1;
+  }
+  start = ftl::TimePoint::Now();
+  for (size_t i = 0; i < object_count; ++i) {
+    std::string buffer;
+    ftl::StringView data;
+    if (!ReadPackObject(&pack_store, object_ids[i], &buffer, &data) ||
+        data.size() != object_size) {
+      FTL_LOG(ERROR) << "Unable to read pack object";
+      return 1;
+    }
+    checksum -= Checksum(data);
+  }
+  PrintResult("pack read", object_count, object_size,
+              ftl::TimePoint::Now() - start);
+  if (checksum != 0) {
+    FTL_LOG(ERROR) << "The objects read differ between the two layouts";
+    return 1;
+  }
+  return 0;
+}
+
+}  // namespace
+}  // namespace storage
+
+int main(int argc, const char** argv) {
+  ftl::CommandLine command_line = ftl::CommandLineFromArgcArgv(argc, argv);
+  if (command_line.HasOption(storage::kHelpArg)) {
+    storage::PrintHelp();
+    return 0;
+  }
+  return storage::Run(command_line);
+}
@@ -4,8 +4,10 @@
 
 #include "apps/ledger/src/storage/fake/fake_commit.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "apps/ledger/src/storage/test/commit_contents_empty_impl.h"
 #include "apps/ledger/src/storage/fake/fake_journal_delegate.h"
@@ -58,6 +60,32 @@ class EntryMapIterator : public Iterator<const storage::Entry> {
   std::map<std::string, fake::FakeJournalDelegate::Entry>::const_iterator end_;
 };
 
+// Iterator over entries stored in a vector.
+class EntryVectorIterator : public Iterator<const storage::Entry> {
+ public:
+  explicit EntryVectorIterator(std::vector<storage::Entry> entries)
+      : entries_(std::move(entries)), it_(entries_.begin()) {}
+
+  ~EntryVectorIterator() {}
+
+  Iterator<const storage::Entry>& Next() override {
+    FTL_DCHECK(Valid()) << "Iterator::Next iterator not valid";
+    ++it_;
+    return *this;
+  }
+
+  bool Valid() const override { return it_ != entries_.end(); }
+
+  Status GetStatus() const override { return Status::OK; }
+
+  const storage::Entry& operator*() const override { return *it_; }
+  const storage::Entry* operator->() const override { return &*it_; }
+
+ private:
+  std::vector<storage::Entry> entries_;
+  std::vector<storage::Entry>::const_iterator it_;
+};
+
 class FakeCommitContents : public test::CommitContentsEmptyImpl {
  public:
   FakeCommitContents(FakeJournalDelegate* journal) : journal_(journal) {}
@@ -79,6 +107,98 @@ class FakeCommitContents : public test::CommitContentsEmptyImpl {
     return it;
   }
 
+  std::unique_ptr<Iterator<const Entry>> range(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      bool reverse) const override {
+    const std::map<std::string, fake::FakeJournalDelegate::Entry,
+                   convert::StringViewComparator>& data = journal_->GetData();
+    std::vector<Entry> entries;
+    for (auto it = data.lower_bound(start);
+         it != data.end() && (end.empty() || it->first < end); ++it) {
+      if (!it->second.deleted) {
+        entries.push_back(
+            Entry{it->first, it->second.value, it->second.priority});
+      }
+    }
+    if (reverse) {
+      std::reverse(entries.begin(), entries.end());
+    }
+    return std::make_unique<EntryVectorIterator>(std::move(entries));
+  }
+
+  void ForEachEntry(convert::ExtendedStringView start,
+                    convert::ExtendedStringView end,
+                    bool reverse,
+                    std::function<bool(Entry)> on_next,
+                    std::function<void(Status)> on_done) const override {
+    for (auto it = range(start, end, reverse); it->Valid(); it->Next()) {
+      if (!on_next(**it)) {
+        break;
+      }
+    }
+    on_done(Status::OK);
+  }
+
+  void GetEntryCount(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::function<void(Status, uint64_t)> callback) const override {
+    uint64_t count = 0;
+    for (auto it = range(start, end, false); it->Valid(); it->Next()) {
+      ++count;
+    }
+    callback(Status::OK, count);
+  }
+
+  void GetEntryAtOffset(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      uint64_t offset,
+      std::function<void(Status, Entry)> callback) const override {
+    auto it = range(start, end, false);
+    for (uint64_t i = 0; i < offset && it->Valid(); ++i) {
+      it->Next();
+    }
+    if (!it->Valid()) {
+      callback(Status::NOT_FOUND, Entry());
+      return;
+    }
+    callback(Status::OK, **it);
+  }
+
+  void GetEntry(convert::ExtendedStringView key,
+                std::function<void(Status, Entry)> callback) const override {
+    const std::map<std::string, fake::FakeJournalDelegate::Entry,
+                   convert::StringViewComparator>& data = journal_->GetData();
+    auto it = data.find(key);
+    if (it == data.end() || it->second.deleted) {
+      callback(Status::NOT_FOUND, Entry());
+      return;
+    }
+    callback(Status::OK,
+             Entry{it->first, it->second.value, it->second.priority});
+  }
+
+  void GetEntries(
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback) const override {
+    const std::map<std::string, fake::FakeJournalDelegate::Entry,
+                   convert::StringViewComparator>& data = journal_->GetData();
+    std::vector<std::unique_ptr<Entry>> result;
+    for (const std::string& key : keys) {
+      auto it = data.find(key);
+      if (it == data.end() || it->second.deleted) {
+        result.push_back(nullptr);
+        continue;
+      }
+      result.push_back(std::make_unique<Entry>(
+          Entry{it->first, it->second.value, it->second.priority}));
+    }
+    callback(Status::OK, std::move(result));
+  }
+
  private:
   FakeJournalDelegate* journal_;
 };
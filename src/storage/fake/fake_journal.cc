@@ -9,7 +9,9 @@
 namespace storage {
 namespace fake {
 
-FakeJournal::FakeJournal(FakeJournalDelegate* delegate) : delegate_(delegate) {}
+FakeJournal::FakeJournal(FakeJournalDelegate* delegate,
+                         PageStorage* page_storage)
+    : delegate_(delegate), page_storage_(page_storage) {}
 
 FakeJournal::~FakeJournal() {}
 
@@ -19,10 +21,26 @@ Status FakeJournal::Put(convert::ExtendedStringView key,
   return delegate_->SetValue(key, object_id, priority);
 }
 
+Status FakeJournal::PutValue(convert::ExtendedStringView key,
+                             convert::ExtendedStringView value,
+                             KeyPriority priority) {
+  std::unique_ptr<const Object> object;
+  Status status = page_storage_->AddObjectSynchronous(value, &object);
+  if (status != Status::OK) {
+    return status;
+  }
+  return delegate_->SetValue(key, object->GetId(), priority);
+}
+
 Status FakeJournal::Delete(convert::ExtendedStringView key) {
   return delegate_->Delete(key);
 }
 
+Status FakeJournal::DeleteRange(convert::ExtendedStringView start,
+                                convert::ExtendedStringView end) {
+  return delegate_->DeleteRange(start, end);
+}
+
 void FakeJournal::Commit(
     std::function<void(Status, const CommitId&)> callback) {
   delegate_->Commit(callback);
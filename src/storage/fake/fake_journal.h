@@ -10,6 +10,7 @@
 
 #include "apps/ledger/src/storage/fake/fake_journal_delegate.h"
 #include "apps/ledger/src/storage/public/journal.h"
+#include "apps/ledger/src/storage/public/page_storage.h"
 #include "apps/ledger/src/storage/public/types.h"
 #include "lib/ftl/macros.h"
 
@@ -19,19 +20,25 @@ namespace fake {
 // A |FakeJournal| is an in-memory journal.
 class FakeJournal : public Journal {
  public:
-  explicit FakeJournal(FakeJournalDelegate* delegate);
+  FakeJournal(FakeJournalDelegate* delegate, PageStorage* page_storage);
   ~FakeJournal() override;
 
   // Journal:
   Status Put(convert::ExtendedStringView key,
              ObjectIdView object_id,
              KeyPriority priority) override;
+  Status PutValue(convert::ExtendedStringView key,
+                  convert::ExtendedStringView value,
+                  KeyPriority priority) override;
   Status Delete(convert::ExtendedStringView key) override;
+  Status DeleteRange(convert::ExtendedStringView start,
+                     convert::ExtendedStringView end) override;
   void Commit(std::function<void(Status, const CommitId&)> callback) override;
   Status Rollback() override;
 
  private:
   FakeJournalDelegate* delegate_;
+  PageStorage* page_storage_;
   FTL_DISALLOW_COPY_AND_ASSIGN(FakeJournal);
 };
 
@@ -43,6 +43,19 @@ Status FakeJournalDelegate::Delete(convert::ExtendedStringView key) {
   return Status::OK;
 }
 
+Status FakeJournalDelegate::DeleteRange(convert::ExtendedStringView start,
+                                        convert::ExtendedStringView end) {
+  if (is_committed_ || is_rolled_back_) {
+    return Status::ILLEGAL_STATE;
+  }
+  for (auto it = data_.lower_bound(start);
+       it != data_.end() && (end.empty() || ftl::StringView(it->first) < end);
+       ++it) {
+    it->second.deleted = true;
+  }
+  return Status::OK;
+}
+
 void FakeJournalDelegate::Commit(
     std::function<void(Status, const CommitId&)> callback) {
   if (is_committed_ || is_rolled_back_) {
@@ -34,6 +34,8 @@ class FakeJournalDelegate {
                   ObjectIdView value,
                   KeyPriority priority);
   Status Delete(convert::ExtendedStringView key);
+  Status DeleteRange(convert::ExtendedStringView start,
+                     convert::ExtendedStringView end);
 
   void Commit(std::function<void(Status, const CommitId&)> callback);
   bool IsCommitted() const;
@@ -12,6 +12,7 @@
 #include "apps/ledger/src/storage/fake/fake_journal.h"
 #include "apps/ledger/src/storage/public/constants.h"
 #include "lib/mtl/socket/strings.h"
+#include "lib/mtl/tasks/message_loop.h"
 
 namespace storage {
 namespace fake {
@@ -79,7 +80,7 @@ Status FakePageStorage::StartCommit(const CommitId& commit_id,
                                     JournalType journal_type,
                                     std::unique_ptr<Journal>* journal) {
   auto delegate = std::make_unique<FakeJournalDelegate>();
-  *journal = std::make_unique<FakeJournal>(delegate.get());
+  *journal = std::make_unique<FakeJournal>(delegate.get(), this);
   journals_[delegate->GetId()] = std::move(delegate);
   return Status::OK;
 }
@@ -104,6 +105,13 @@ void FakePageStorage::AddObjectFromLocal(
   }
   std::string object_id = RandomId();
   objects_[object_id] = value;
+  if (async_object_writes_) {
+    mtl::MessageLoop::GetCurrent()->task_runner()->PostTask(
+        [ callback, object_id = std::move(object_id) ]() mutable {
+          callback(Status::OK, std::move(object_id));
+        });
+    return;
+  }
   callback(Status::OK, std::move(object_id));
 }
 
@@ -140,6 +148,16 @@ Status FakePageStorage::AddObjectSynchronous(
   return GetObjectSynchronous(object_id, object);
 }
 
+Status FakePageStorage::SetTreeType(TreeType tree_type) {
+  for (const auto& journal : journals_) {
+    if (journal.second->IsCommitted()) {
+      return Status::ILLEGAL_STATE;
+    }
+  }
+  tree_type_ = tree_type;
+  return Status::OK;
+}
+
 const std::map<std::string, std::unique_ptr<FakeJournalDelegate>>&
 FakePageStorage::GetJournals() const {
   return journals_;
@@ -150,5 +168,9 @@ FakePageStorage::GetObjects() const {
   return objects_;
 }
 
+TreeType FakePageStorage::GetTreeType() const {
+  return tree_type_;
+}
+
 }  // namespace fake
 }  // namespace storage
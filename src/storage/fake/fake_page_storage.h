@@ -45,17 +45,26 @@ class FakePageStorage : public test::PageStorageEmptyImpl {
                               std::unique_ptr<const Object>* object) override;
   Status AddObjectSynchronous(convert::ExtendedStringView data,
                               std::unique_ptr<const Object>* object) override;
+  Status SetTreeType(TreeType tree_type) override;
 
   // For testing:
+  // Sets whether |AddObjectFromLocal| returns its result from the message loop
+  // instead of synchronously.
+  void set_async_object_writes(bool async_object_writes) {
+    async_object_writes_ = async_object_writes;
+  }
   const std::map<std::string, std::unique_ptr<FakeJournalDelegate>>&
   GetJournals() const;
   const std::map<ObjectId, std::string, convert::StringViewComparator>&
   GetObjects() const;
+  TreeType GetTreeType() const;
 
  private:
   std::map<std::string, std::unique_ptr<FakeJournalDelegate>> journals_;
   std::map<ObjectId, std::string, convert::StringViewComparator> objects_;
   PageId page_id_;
+  TreeType tree_type_ = TreeType::BTREE;
+  bool async_object_writes_ = false;
 
   FTL_DISALLOW_COPY_AND_ASSIGN(FakePageStorage);
 };
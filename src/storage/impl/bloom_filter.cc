@@ -0,0 +1,128 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/bloom_filter.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "lib/ftl/build_config.h"
+#include "lib/ftl/logging.h"
+
+#if !defined(ARCH_CPU_LITTLE_ENDIAN)
+#error "Big endian is not supported"
+#endif
+
+namespace storage {
+
+namespace {
+
+// 10 bits per key and 7 probes give a false positive rate of about 1%.
+constexpr size_t kBitsPerKey = 10;
+constexpr size_t kProbeCount = 7;
+
+// "LBF1" in little endian.
+constexpr uint32_t kMagic = 0x3146424c;
+
+// Serialized form: u32 magic, u32 padding, u64 capacity, u64 size, followed by
+// the bits.
+constexpr size_t kHeaderSize = 3 * sizeof(uint64_t);
+
+size_t GetWordCount(size_t capacity) {
+  size_t bit_count = std::max<size_t>(capacity * kBitsPerKey, 64);
+  return (bit_count + 63) / 64;
+}
+
+// 64-bit FNV-1a, with a final mix so that all bits depend on all bytes.
+uint64_t Hash(ftl::StringView key, uint64_t seed) {
+  uint64_t hash = 0xcbf29ce484222325ull ^ seed;
+  for (unsigned char c : key) {
+    hash ^= c;
+    hash *= 0x100000001b3ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+}  // namespace
+
+BloomFilter::BloomFilter(size_t capacity)
+    : BloomFilter(capacity, 0, std::vector<uint64_t>(GetWordCount(capacity))) {}
+
+BloomFilter::BloomFilter(size_t capacity,
+                         size_t size,
+                         std::vector<uint64_t> bits)
+    : capacity_(capacity), size_(size), bits_(std::move(bits)) {
+  FTL_DCHECK(bits_.size() == GetWordCount(capacity_));
+}
+
+BloomFilter::~BloomFilter() {}
+
+std::unique_ptr<BloomFilter> BloomFilter::FromBytes(ftl::StringView bytes) {
+  if (bytes.size() < kHeaderSize) {
+    return nullptr;
+  }
+  uint32_t magic;
+  uint64_t capacity;
+  uint64_t size;
+  memcpy(&magic, bytes.data(), sizeof(magic));
+  memcpy(&capacity, bytes.data() + sizeof(uint64_t), sizeof(capacity));
+  memcpy(&size, bytes.data() + 2 * sizeof(uint64_t), sizeof(size));
+  if (magic != kMagic || capacity > bytes.size() * 8) {
+    return nullptr;
+  }
+  size_t word_count = GetWordCount(capacity);
+  if (bytes.size() != kHeaderSize + word_count * sizeof(uint64_t)) {
+    return nullptr;
+  }
+  std::vector<uint64_t> bits(word_count);
+  memcpy(bits.data(), bytes.data() + kHeaderSize,
+         word_count * sizeof(uint64_t));
+  return std::unique_ptr<BloomFilter>(
+      new BloomFilter(capacity, size, std::move(bits)));
+}
+
+std::string BloomFilter::ToBytes() const {
+  std::string bytes(kHeaderSize + bits_.size() * sizeof(uint64_t), '\0');
+  uint64_t capacity = capacity_;
+  uint64_t size = size_;
+  memcpy(&bytes[0], &kMagic, sizeof(kMagic));
+  memcpy(&bytes[sizeof(uint64_t)], &capacity, sizeof(capacity));
+  memcpy(&bytes[2 * sizeof(uint64_t)], &size, sizeof(size));
+  memcpy(&bytes[kHeaderSize], bits_.data(), bits_.size() * sizeof(uint64_t));
+  return bytes;
+}
+
+void BloomFilter::Add(ftl::StringView key) {
+  ForEachBit(key, [this](size_t bit) {
+    bits_[bit / 64] |= 1ull << (bit % 64);
+    return true;
+  });
+  ++size_;
+}
+
+bool BloomFilter::MayContain(ftl::StringView key) const {
+  return ForEachBit(key, [this](size_t bit) {
+    return (bits_[bit / 64] & (1ull << (bit % 64))) != 0;
+  });
+}
+
+template <typename F>
+bool BloomFilter::ForEachBit(ftl::StringView key, F callback) const {
+  // Double hashing: the i-th probe is h1 + i * h2.
+  uint64_t h1 = Hash(key, 0);
+  uint64_t h2 = Hash(key, h1) | 1;
+  uint64_t bit_count = bits_.size() * 64;
+  for (size_t i = 0; i < kProbeCount; ++i) {
+    if (!callback((h1 + i * h2) % bit_count)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace storage
@@ -0,0 +1,60 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BLOOM_FILTER_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_BLOOM_FILTER_H_
+
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+
+namespace storage {
+
+// A Bloom filter over a set of keys: |MayContain()| never returns false for a
+// key that was added, and returns true for a key that was not added with a
+// probability of about 1% as long as no more than |capacity()| keys were
+// added. Keys cannot be removed: the filter must be rebuilt instead.
+class BloomFilter {
+ public:
+  // Creates an empty filter sized for |capacity| keys.
+  explicit BloomFilter(size_t capacity);
+  ~BloomFilter();
+
+  // Restores a filter from the output of |ToBytes()|. Returns nullptr if
+  // |bytes| is malformed.
+  static std::unique_ptr<BloomFilter> FromBytes(ftl::StringView bytes);
+
+  // Returns the serialized form of this filter.
+  std::string ToBytes() const;
+
+  void Add(ftl::StringView key);
+  bool MayContain(ftl::StringView key) const;
+
+  // Number of keys this filter is sized for, and number of keys added.
+  size_t capacity() const { return capacity_; }
+  size_t size() const { return size_; }
+
+ private:
+  BloomFilter(size_t capacity, size_t size, std::vector<uint64_t> bits);
+
+  // Calls |callback| with the index of each bit of |key|, until it returns
+  // false. Returns whether |callback| always returned true.
+  template <typename F>
+  bool ForEachBit(ftl::StringView key, F callback) const;
+
+  size_t capacity_;
+  size_t size_;
+  std::vector<uint64_t> bits_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(BloomFilter);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_BLOOM_FILTER_H_
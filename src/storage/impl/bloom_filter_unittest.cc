@@ -0,0 +1,65 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/bloom_filter.h"
+
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+std::string Key(size_t i) {
+  return "key" + std::to_string(i);
+}
+
+TEST(BloomFilterTest, NoFalseNegatives) {
+  BloomFilter filter(1000);
+  EXPECT_FALSE(filter.MayContain(Key(0)));
+  for (size_t i = 0; i < 1000; ++i) {
+    filter.Add(Key(i));
+  }
+  EXPECT_EQ(1000u, filter.size());
+  for (size_t i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(filter.MayContain(Key(i)));
+  }
+}
+
+TEST(BloomFilterTest, FalsePositiveRate) {
+  BloomFilter filter(1000);
+  for (size_t i = 0; i < 1000; ++i) {
+    filter.Add(Key(i));
+  }
+  size_t false_positives = 0;
+  for (size_t i = 1000; i < 11000; ++i) {
+    if (filter.MayContain(Key(i))) {
+      ++false_positives;
+    }
+  }
+  // About 1% is expected.
+  EXPECT_LT(false_positives, 300u);
+}
+
+TEST(BloomFilterTest, Serialization) {
+  BloomFilter filter(100);
+  for (size_t i = 0; i < 100; ++i) {
+    filter.Add(Key(i));
+  }
+  std::string bytes = filter.ToBytes();
+  std::unique_ptr<BloomFilter> restored = BloomFilter::FromBytes(bytes);
+  ASSERT_TRUE(restored);
+  EXPECT_EQ(100u, restored->capacity());
+  EXPECT_EQ(100u, restored->size());
+  for (size_t i = 0; i < 100; ++i) {
+    EXPECT_TRUE(restored->MayContain(Key(i)));
+  }
+  EXPECT_EQ(bytes, restored->ToBytes());
+
+  EXPECT_FALSE(BloomFilter::FromBytes(""));
+  EXPECT_FALSE(BloomFilter::FromBytes(bytes.substr(0, bytes.size() - 1)));
+  bytes[0] ^= 1;
+  EXPECT_FALSE(BloomFilter::FromBytes(bytes));
+}
+
+}  // namespace
+}  // namespace storage
@@ -10,30 +10,29 @@
 namespace storage {
 
 BTreeIterator::BTreeIterator(std::unique_ptr<const TreeNode> root) {
-  // Initialize the iterator.
-  std::unique_ptr<const TreeNode> current_node = std::move(root);
-  while (current_node) {
-    std::unique_ptr<const TreeNode> next_node;
-    Status status = current_node->GetChild(0, &next_node);
-    // We position the current reading pointer just "before" the beginning of
-    // the node.
-    stack_.emplace(std::move(current_node), -1, 0);
-    if (status == Status::OK) {
-      current_node = std::move(next_node);
-    } else if (status == Status::NO_SUCH_CHILD) {
-      break;
-    } else {
-      current_status_ = status;
-    }
+  SeekForward(std::move(root), "");
+}
+
+BTreeIterator::BTreeIterator(std::unique_ptr<const TreeNode> root,
+                             std::string start,
+                             std::string end,
+                             bool reverse)
+    : start_(std::move(start)), end_(std::move(end)), reverse_(reverse) {
+  if (!end_.empty() && end_ <= start_) {
+    return;
   }
-  if (Valid()) {
-    this->Next();
+  if (reverse_) {
+    SeekBackward(std::move(root), end_);
+  } else {
+    SeekForward(std::move(root), start_);
   }
+  CheckBounds();
 }
 
 BTreeIterator::~BTreeIterator() {}
 
 BTreeIterator& BTreeIterator::Seek(convert::ExtendedStringView key) {
+  FTL_DCHECK(!reverse_);
   if (!Valid()) {
     return *this;
   }
@@ -42,108 +41,121 @@ BTreeIterator& BTreeIterator::Seek(convert::ExtendedStringView key) {
     return *this;
   }
 
-  std::unique_ptr<const TreeNode> current_node;
+  std::unique_ptr<const TreeNode> root;
   // Clear the stack.
   while (!stack_.empty()) {
-    current_node.swap(stack_.top().node);
+    root.swap(stack_.top().node);
     stack_.pop();
   }
-  while (current_node) {
+  SeekForward(std::move(root), key);
+  CheckBounds();
+  return *this;
+}
+
+void BTreeIterator::SeekForward(std::unique_ptr<const TreeNode> node,
+                                convert::ExtendedStringView key) {
+  while (node) {
     int index;
-    Status status = current_node->FindKeyOrChild(key, &index);
-    if (status == Status::OK) {
-      stack_.emplace(std::move(current_node), index, index);
-      stack_.top().node->GetEntry(stack_.top().entry_index, &current_entry_);
-    } else if (status == Status::NOT_FOUND) {
-      std::unique_ptr<const TreeNode> next_node;
-      Status child_status = current_node->GetChild(index, &next_node);
-      stack_.emplace(std::move(current_node), index - 1, index);
-      if (child_status == Status::OK) {
-        current_node = std::move(next_node);
-        // If child_status != Status::OK, then current_node would remain unset
-        // after the move above, then we will exit the loop.
-      } else if (child_status == Status::NO_SUCH_CHILD) {
-        Next();
-      } else {
-        current_status_ = child_status;
-      }
-    } else {
+    if (node->FindKeyOrChild(key, &index) == Status::OK) {
+      current_status_ = node->GetEntry(index, &current_entry_);
+      stack_.emplace(std::move(node), index, index);
+      return;
+    }
+    // All keys lower than |key| are before the child at |index|: the next
+    // entry is in that child or, if it is empty, right after it.
+    std::unique_ptr<const TreeNode> child;
+    Status status = node->GetChild(index, &child);
+    stack_.emplace(std::move(node), index - 1, index);
+    if (status == Status::NO_SUCH_CHILD) {
+      Ascend();
+      return;
+    }
+    if (status != Status::OK) {
       current_status_ = status;
-      break;
+      return;
     }
+    node = std::move(child);
   }
-  return *this;
 }
 
-BTreeIterator& BTreeIterator::Next() {
-  FTL_DCHECK(Valid());
-  // direction_up tells the algorithm whether we are exploring the tree down
-  // (from root to leaves) or up (from leaves to root). In the down direction,
-  // we are exploring the children of each node: when exploring a node, we look
-  // for its next unexplored child and explore it, recursively, until we reach
-  // the bottom of the tree. In the up direction, we are exploring the entries
-  // of each node: starting at the bottom, we look at the next entry of the
-  // explored node; if there is no such entry (we are at the end), we go to the
-  // next node up the stack and look at its next entry, and again, until we
-  // either find a valid entry or we unrolled the whole tree.
-  // The normal mode of operation when nodes are not empty is to explore "down"
-  // [3] until no child is found [4], then go "up" and return the next entry of
-  // the bottom node [1]. If we are also at the end of the entry list, we go up
-  // further [2].
-  bool direction_up = false;
-  while (!stack_.empty()) {
-    Position* current_position = &stack_.top();
-    if (direction_up) {
-      // We are moving up in the tree, as we finished exploring the previous
-      // branch. We now point to the next entry (key/value pair).
-      current_position->entry_index++;
-      if (current_position->entry_index <
-          current_position->node->GetKeyCount()) {
-        // [1] There is a next entry in this node, point to it and exit.
-        current_position->node->GetEntry(current_position->entry_index,
-                                         &current_entry_);
-        break;
-      }
-      // [2] We are at the end of this node, so let's continue to move up the
-      // tree.
-      stack_.pop();
-      continue;
+void BTreeIterator::SeekBackward(std::unique_ptr<const TreeNode> node,
+                                 convert::ExtendedStringView key) {
+  while (node) {
+    // Whether |key| is found or not, all keys lower than |key| are before the
+    // entry at |index|: the previous entry is in the child at |index| or, if
+    // it is empty, right before it.
+    int index = node->GetKeyCount();
+    if (!key.empty()) {
+      node->FindKeyOrChild(key, &index);
+    }
+    std::unique_ptr<const TreeNode> child;
+    Status status = node->GetChild(index, &child);
+    stack_.emplace(std::move(node), index, index);
+    if (status == Status::NO_SUCH_CHILD) {
+      Ascend();
+      return;
+    }
+    if (status != Status::OK) {
+      current_status_ = status;
+      return;
     }
+    node = std::move(child);
+  }
+}
 
-    // We are either at the beginning of a node, or already explored its entry
-    // at entry_index, so we explore the next child of the node.
-    current_position->child_index++;
-
-    if (current_position->child_index <
-        current_position->node->GetKeyCount() + 1) {
-      // We are not at the end of the child list, given the number of
-      // entries stored in this node. However, this doesn't mean that this
-      // child won't be empty.
-      std::unique_ptr<const TreeNode> next_child;
-      Status status = current_position->node->GetChild(
-          current_position->child_index, &next_child);
-
-      if (status == Status::OK) {
-        // [3] The child is not empty, so we add it to the stack to explore it.
-        stack_.emplace(std::move(next_child), -1, -1);
-      } else if (status == Status::NO_SUCH_CHILD) {
-        // [4] The child is empty, so we reverse direction. This will lead us to
-        // try to read the next entry, if available.
-        direction_up = true;
-      } else {
-        current_status_ = status;
-        return *this;
-      }
-      continue;
+void BTreeIterator::Ascend() {
+  while (!stack_.empty()) {
+    Position& position = stack_.top();
+    int entry_index =
+        reverse_ ? position.child_index - 1 : position.child_index;
+    if (entry_index >= 0 && entry_index < position.node->GetKeyCount()) {
+      position.entry_index = entry_index;
+      current_status_ = position.node->GetEntry(entry_index, &current_entry_);
+      return;
     }
-    // [5] We are at the end of the child list, so this node is completely
-    // explored now. Remove it from the stack and go up.
-    direction_up = true;
     stack_.pop();
   }
+}
+
+BTreeIterator& BTreeIterator::Next() {
+  FTL_DCHECK(Valid());
+  // The entry at |entry_index| of the top node has been iterated over: the
+  // next one is the first, or last if iterating in reverse, of the child
+  // following it.
+  Position& position = stack_.top();
+  position.child_index =
+      reverse_ ? position.entry_index : position.entry_index + 1;
+  std::unique_ptr<const TreeNode> child;
+  Status status = position.node->GetChild(position.child_index, &child);
+  if (status == Status::OK) {
+    if (reverse_) {
+      SeekBackward(std::move(child), "");
+    } else {
+      SeekForward(std::move(child), "");
+    }
+  } else if (status == Status::NO_SUCH_CHILD) {
+    Ascend();
+  } else {
+    current_status_ = status;
+    return *this;
+  }
+  CheckBounds();
   return *this;
 }
 
+void BTreeIterator::CheckBounds() {
+  if (!Valid()) {
+    return;
+  }
+  if (reverse_ ? current_entry_.key < start_
+               : !end_.empty() && current_entry_.key >= end_) {
+    // Drop the remaining nodes: there is no entry left in the range.
+    while (!stack_.empty()) {
+      stack_.pop();
+    }
+  }
+}
+
 bool BTreeIterator::Valid() const {
   return !stack_.empty() && current_status_ == Status::OK;
 }
@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <stack>
+#include <string>
 
 #include "apps/ledger/src/convert/convert.h"
 #include "apps/ledger/src/storage/impl/btree/position.h"
@@ -20,7 +21,18 @@ namespace storage {
 // An iterator over a BTree, represented by its root.
 class BTreeIterator : public Iterator<const Entry> {
  public:
+  // Creates an iterator over all the entries of the tree, in increasing key
+  // order.
   explicit BTreeIterator(std::unique_ptr<const TreeNode> root);
+
+  // Creates an iterator over the entries of the tree with keys in [|start|,
+  // |end|), in increasing key order, or in decreasing key order if |reverse|
+  // is true. An empty |end| means that the range has no upper bound. Only the
+  // nodes holding entries of the range, and their ancestors, are loaded.
+  BTreeIterator(std::unique_ptr<const TreeNode> root,
+                std::string start,
+                std::string end,
+                bool reverse);
   ~BTreeIterator() override;
 
   // Iterator:
@@ -28,13 +40,38 @@ class BTreeIterator : public Iterator<const Entry> {
   bool Valid() const override;
   Status GetStatus() const override;
 
-  // Advances the iterator to the entry equal or after the provided key.
+  // Advances the iterator to the entry equal or after the provided key. Only
+  // valid for iterators in increasing key order.
   BTreeIterator& Seek(convert::ExtendedStringView key);
 
   const Entry& operator*() const override;
   const Entry* operator->() const override;
 
  private:
+  // Pushes the nodes from |node| to the first entry equal or after |key| in
+  // its subtree, and moves to that entry.
+  void SeekForward(std::unique_ptr<const TreeNode> node,
+                   convert::ExtendedStringView key);
+  // Pushes the nodes from |node| to the last entry strictly before |key| in
+  // its subtree, or to its last entry if |key| is empty, and moves to that
+  // entry.
+  void SeekBackward(std::unique_ptr<const TreeNode> node,
+                    convert::ExtendedStringView key);
+
+  // Moves to the entry following, or preceding if |reverse_| is true, the
+  // child at |child_index| of the top of the stack, which has been completely
+  // iterated over, popping the nodes which have no such entry.
+  void Ascend();
+
+  // Makes the iterator invalid if the current entry is out of the range.
+  void CheckBounds();
+
+  const std::string start_;
+  const std::string end_;
+  const bool reverse_ = false;
+
+  // The nodes from the root to the node holding the current entry. The child
+  // at |child_index| of each node is the one being iterated over.
   std::stack<Position> stack_;
   Entry current_entry_;
   Status current_status_ = Status::OK;
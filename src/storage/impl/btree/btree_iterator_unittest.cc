@@ -4,9 +4,13 @@
 
 #include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
 
+#include <algorithm>
+
 #include "apps/ledger/src/glue/crypto/rand.h"
 #include "apps/ledger/src/storage/fake/fake_page_storage.h"
 #include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_builder.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
 #include "apps/ledger/src/storage/public/commit_contents.h"
 #include "apps/ledger/src/storage/public/constants.h"
@@ -14,6 +18,7 @@
 #include "apps/ledger/src/storage/public/types.h"
 #include "gtest/gtest.h"
 #include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_printf.h"
 
 namespace storage {
 namespace {
@@ -194,5 +199,111 @@ TEST_F(BTreeIteratorTest, Seek) {
   EXPECT_EQ(Status::OK, it->GetStatus());
 }
 
+TEST_F(BTreeIteratorTest, Range) {
+  std::vector<Entry> entries;
+  for (int i = 0; i < 7; ++i) {
+    entries.push_back(Entry{"key" + std::to_string(i), RandomId(),
+                            storage::KeyPriority::EAGER});
+  }
+
+  // We create a tree with one root and two leaves, and an empty child between
+  // them, as follows:
+  //              C:[2, 3]
+  //           /      |    \
+  //  A:[0, 1]       nil    B:[4, 5, 6]
+
+  ObjectId node_A, node_B, node_C;
+  EXPECT_EQ(Status::OK,
+            TreeNode::FromEntries(&fake_storage_,
+                                  std::vector<Entry>{entries[0], entries[1]},
+                                  std::vector<ObjectId>(3), &node_A));
+  EXPECT_EQ(Status::OK,
+            TreeNode::FromEntries(
+                &fake_storage_,
+                std::vector<Entry>{entries[4], entries[5], entries[6]},
+                std::vector<ObjectId>(4), &node_B));
+  EXPECT_EQ(Status::OK,
+            TreeNode::FromEntries(
+                &fake_storage_, std::vector<Entry>{entries[2], entries[3]},
+                std::vector<ObjectId>{node_A, "", node_B}, &node_C));
+
+  CommitContentsImpl reader(node_C, &fake_storage_);
+
+  // Expected entries, by their index in |entries|, for the given range.
+  struct {
+    std::string start;
+    std::string end;
+    bool reverse;
+    std::vector<int> expected;
+  } test_cases[] = {
+      {"", "", false, {0, 1, 2, 3, 4, 5, 6}},
+      {"", "", true, {6, 5, 4, 3, 2, 1, 0}},
+      {"key1", "key5", false, {1, 2, 3, 4}},
+      {"key1", "key5", true, {4, 3, 2, 1}},
+      {"key11", "key45", false, {2, 3, 4}},
+      {"key11", "key45", true, {4, 3, 2}},
+      {"key3", "", false, {3, 4, 5, 6}},
+      {"", "key3", true, {2, 1, 0}},
+      {"key2", "key3", true, {2}},
+      {"key21", "key3", false, {}},
+      {"key21", "key3", true, {}},
+      {"key5", "key2", false, {}},
+      {"key9", "", true, {}},
+  };
+  for (const auto& test_case : test_cases) {
+    std::unique_ptr<Iterator<const Entry>> it =
+        reader.range(test_case.start, test_case.end, test_case.reverse);
+    for (int index : test_case.expected) {
+      ASSERT_TRUE(it->Valid());
+      EXPECT_EQ(entries[index], **it);
+      it->Next();
+    }
+    EXPECT_FALSE(it->Valid());
+    EXPECT_EQ(Status::OK, it->GetStatus());
+  }
+}
+
+TEST_F(BTreeIteratorTest, RangeMultipleLevels) {
+  std::vector<Entry> entries;
+  TreeBuilder builder(
+      &fake_storage_,
+      3 * GetEncodedEntrySize(Entry{"key000", RandomId(), KeyPriority::EAGER}));
+  for (int i = 0; i < 200; ++i) {
+    entries.push_back(Entry{ftl::StringPrintf("key%03d", 2 * i), RandomId(),
+                            KeyPriority::EAGER});
+    EXPECT_EQ(Status::OK, builder.Add(entries.back()));
+  }
+  ObjectId root_id;
+  ASSERT_EQ(Status::OK, builder.Finish(&root_id));
+  CommitContentsImpl reader(root_id, &fake_storage_);
+
+  for (int start : {0, 1, 37, 38, 123, 398, 399, 400}) {
+    for (int end : {-1, 0, 38, 39, 250, 399, 400}) {
+      std::string start_key = ftl::StringPrintf("key%03d", start);
+      std::string end_key = end < 0 ? "" : ftl::StringPrintf("key%03d", end);
+      std::vector<Entry> expected;
+      for (const Entry& entry : entries) {
+        if (entry.key >= start_key && (end < 0 || entry.key < end_key)) {
+          expected.push_back(entry);
+        }
+      }
+      for (bool reverse : {false, true}) {
+        if (reverse) {
+          std::reverse(expected.begin(), expected.end());
+        }
+        std::unique_ptr<Iterator<const Entry>> it =
+            reader.range(start_key, end_key, reverse);
+        for (const Entry& entry : expected) {
+          ASSERT_TRUE(it->Valid());
+          EXPECT_EQ(entry, **it);
+          it->Next();
+        }
+        EXPECT_FALSE(it->Valid());
+        EXPECT_EQ(Status::OK, it->GetStatus());
+      }
+    }
+  }
+}
+
 }  // namespace
 }  // namespace storage
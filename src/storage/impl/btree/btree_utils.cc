@@ -4,9 +4,15 @@
 
 #include "apps/ledger/src/storage/impl/btree/btree_utils.h"
 
+#include <algorithm>
+
 #include "apps/ledger/src/callback/waiter.h"
+#include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_builder.h"
 #include "lib/ftl/functional/closure.h"
 #include "lib/ftl/functional/make_copyable.h"
+#include "lib/ftl/memory/ref_counted.h"
 
 namespace storage {
 namespace btree {
@@ -21,7 +27,7 @@ void ForEachEntryIn(PageStorage* page_storage,
                     std::string min_key,
                     std::function<bool(EntryAndNodeId)> on_next,
                     std::function<void(Status)> on_done) {
-  auto waiter = callback::Waiter<Status, const Object>::Create(Status::OK);
+  auto waiter = callback::Waiter<Status, const TreeNode>::Create(Status::OK);
 
   int start_index;
   Status key_found = node->FindKeyOrChild(min_key, &start_index);
@@ -49,7 +55,8 @@ void ForEachEntryIn(PageStorage* page_storage,
 
   for (int i = start_index; i <= node->GetKeyCount(); ++i) {
     if (!node->GetChildId(i).empty()) {
-      page_storage->GetObject(node->GetChildId(i), waiter->NewCallback());
+      TreeNode::FromId(page_storage, node->GetChildId(i),
+                       waiter->NewCallback());
     } else {
       waiter->NewCallback()(Status::OK, nullptr);
     }
@@ -57,24 +64,18 @@ void ForEachEntryIn(PageStorage* page_storage,
   waiter->Finalize(ftl::MakeCopyable([
     parent = std::move(node), start_index, min_key = std::move(min_key),
     page_storage, on_next = std::move(on_next), on_done = std::move(on_done)
-  ](Status s, std::vector<std::unique_ptr<const Object>> objects) {
+  ](Status s, std::vector<std::unique_ptr<const TreeNode>> children) {
     if (s != Status::OK) {
       on_done(s);
       return;
     }
     callback::StatusWaiter<Status> children_waiter(Status::OK);
-    for (size_t i = 0; i < objects.size(); ++i) {
-      if (objects[i] != nullptr) {
-        std::unique_ptr<const TreeNode> node;
-        s = TreeNode::FromObject(page_storage, std::move(objects[i]), &node);
-        if (s != Status::OK) {
-          on_done(s);
-          return;
-        }
-        ForEachEntryIn(page_storage, std::move(node), min_key, on_next,
+    for (size_t i = 0; i < children.size(); ++i) {
+      if (children[i] != nullptr) {
+        ForEachEntryIn(page_storage, std::move(children[i]), min_key, on_next,
                        children_waiter.NewCallback());
       }
-      if (i == objects.size() - 1) {
+      if (i == children.size() - 1) {
         break;
       }
       Entry entry;
@@ -93,264 +94,382 @@ void ForEachEntryIn(PageStorage* page_storage,
   }));
 }
 
-void RemoveNodeId(const ObjectId& id, std::unordered_set<ObjectId>* nodes) {
-  auto it = nodes->find(id);
-  if (it != nodes->end()) {
-    nodes->erase(it);
+// Helper class for btree::ForEachEntryInRange.
+
+// Walks through the entries of a range of a tree, loading nodes
+// asynchronously. The walker holds the nodes from the root to the current
+// entry, as |BTreeIterator|, and keeps a reference to itself in the callbacks
+// of pending loads.
+class RangeWalker : public ftl::RefCountedThreadSafe<RangeWalker> {
+ public:
+  static ftl::RefPtr<RangeWalker> Create(
+      PageStorage* page_storage,
+      std::string start,
+      std::string end,
+      bool reverse,
+      size_t prefetch_count,
+      std::function<bool(Entry)> on_next,
+      std::function<void(Status)> on_done) {
+    return ftl::AdoptRef(new RangeWalker(
+        page_storage, std::move(start), std::move(end), reverse,
+        prefetch_count, std::move(on_next), std::move(on_done)));
   }
-}
 
-// Helper functions for btree::ApplyChanges.
+  void Start(ObjectIdView root_id) {
+    if (!end_.empty() && end_ <= start_) {
+      Finish(Status::OK);
+      return;
+    }
+    next_node_id_ = root_id.ToString();
+    seek_key_ = reverse_ ? end_ : start_;
+    Run();
+  }
 
-void ApplyChangesIn(
-    PageStorage* page_storage,
-    Iterator<const EntryChange>* changes,
-    std::unique_ptr<const TreeNode> node,
-    bool is_root,
-    const std::string& max_key,
-    size_t node_size,
-    std::unordered_set<ObjectId>* new_nodes,
-    std::function<void(Status,
-                       ObjectId,
-                       std::unique_ptr<TreeNode::Mutation::Updater>)> on_done);
-
-// Recursively merge |left| and |right| nodes. |new_id| will contain the ID of
-// the new, merged node. Returns OK on success or the error code otherwise.
-void Merge(PageStorage* page_storage,
-           std::unique_ptr<const TreeNode> left,
-           std::unique_ptr<const TreeNode> right,
-           std::unordered_set<ObjectId>* new_nodes,
-           std::function<void(Status, ObjectId)> on_done) {
-  if (left == nullptr) {
-    if (right == nullptr) {
-      on_done(Status::OK, "");
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(RangeWalker);
+
+  // A node on the path to the current entry. The child at |child_index| is
+  // the one being iterated over, and the children up to |prefetch_index|,
+  // excluded, in the iteration order, have been requested.
+  struct Frame {
+    std::unique_ptr<const TreeNode> node;
+    int entry_index;
+    int child_index;
+    int prefetch_index;
+  };
+
+  RangeWalker(PageStorage* page_storage,
+              std::string start,
+              std::string end,
+              bool reverse,
+              size_t prefetch_count,
+              std::function<bool(Entry)> on_next,
+              std::function<void(Status)> on_done)
+      : page_storage_(page_storage),
+        start_(std::move(start)),
+        end_(std::move(end)),
+        reverse_(reverse),
+        prefetch_count_(prefetch_count),
+        on_next_(std::move(on_next)),
+        on_done_(std::move(on_done)) {}
+
+  ~RangeWalker() {}
+
+  // Iterates until a node has to be loaded asynchronously, or the iteration
+  // is done. Loads completing synchronously, e.g. from the node cache, are
+  // handled in the loop rather than recursively.
+  void Run() {
+    running_ = true;
+    while (!done_) {
+      if (loaded_node_) {
+        Descend(std::move(loaded_node_));
+      } else if (!next_node_id_.empty()) {
+        load_pending_ = true;
+        ObjectId node_id;
+        node_id.swap(next_node_id_);
+        ftl::RefPtr<RangeWalker> self(this);
+        TreeNode::FromId(page_storage_, node_id, [self](
+            Status status, std::unique_ptr<const TreeNode> node) {
+          self->OnNodeLoaded(status, std::move(node));
+        });
+        if (!stack_.empty()) {
+          Prefetch(&stack_.back());
+        }
+        if (load_pending_) {
+          running_ = false;
+          return;
+        }
+      } else if (status_ != Status::OK) {
+        Finish(status_);
+      } else if (stack_.empty() || !InRange(current_entry_)) {
+        Finish(Status::OK);
+      } else if (!on_next_(current_entry_)) {
+        Finish(Status::OK);
+      } else {
+        Advance();
+      }
+    }
+    running_ = false;
+  }
+
+  void OnNodeLoaded(Status status, std::unique_ptr<const TreeNode> node) {
+    load_pending_ = false;
+    if (status != Status::OK) {
+      status_ = status;
+    } else {
+      loaded_node_ = std::move(node);
+    }
+    if (!running_) {
+      Run();
+    }
+  }
+
+  // Pushes |node| and moves to the first entry of its subtree equal or after
+  // |seek_key_|, or to the last one strictly before it if |reverse_| is true,
+  // or requests the child holding that entry.
+  void Descend(std::unique_ptr<const TreeNode> node) {
+    int index;
+    if (reverse_) {
+      index = node->GetKeyCount();
+      if (!seek_key_.empty()) {
+        node->FindKeyOrChild(seek_key_, &index);
+      }
+      Push(std::move(node), index, index);
+    } else if (node->FindKeyOrChild(seek_key_, &index) == Status::OK) {
+      Push(std::move(node), index, index);
+      status_ = stack_.back().node->GetEntry(index, &current_entry_);
       return;
+    } else {
+      Push(std::move(node), index - 1, index);
     }
-    on_done(Status::OK, right->GetId());
-    return;
+    VisitChild();
   }
-  if (right == nullptr) {
-    on_done(Status::OK, left->GetId());
-    return;
+
+  // Moves past the current entry, to the child following it, or preceding it
+  // if |reverse_| is true.
+  void Advance() {
+    Frame& frame = stack_.back();
+    frame.child_index =
+        reverse_ ? frame.entry_index : frame.entry_index + 1;
+    seek_key_.clear();
+    VisitChild();
   }
 
-  // Merge the children before merging left and right.
-  std::unique_ptr<const TreeNode> left_rightmost_child;
-  std::unique_ptr<const TreeNode> right_leftmost_child;
-  Status s = left->GetChild(left->GetKeyCount(), &left_rightmost_child);
-  if (s != Status::OK && s != Status::NO_SUCH_CHILD) {
-    on_done(s, "");
-    return;
+  // Requests the child at |child_index| of the top node, or moves to the next
+  // entry if it is empty.
+  void VisitChild() {
+    Frame& frame = stack_.back();
+    next_node_id_ = frame.node->GetChildId(frame.child_index);
+    if (next_node_id_.empty()) {
+      Ascend();
+    }
   }
-  s = right->GetChild(0, &left_rightmost_child);
-  if (s != Status::OK && s != Status::NO_SUCH_CHILD) {
-    on_done(s, "");
-    return;
+
+  // Moves to the entry following, or preceding if |reverse_| is true, the
+  // child at |child_index| of the top node, which has been completely iterated
+  // over, popping the nodes which have no such entry.
+  void Ascend() {
+    while (!stack_.empty()) {
+      Frame& frame = stack_.back();
+      int entry_index = reverse_ ? frame.child_index - 1 : frame.child_index;
+      if (entry_index >= 0 && entry_index < frame.node->GetKeyCount()) {
+        frame.entry_index = entry_index;
+        status_ = frame.node->GetEntry(entry_index, &current_entry_);
+        return;
+      }
+      stack_.pop_back();
+    }
   }
-  Merge(page_storage, std::move(left_rightmost_child),
-        std::move(right_leftmost_child), new_nodes, ftl::MakeCopyable([
-          page_storage, left = std::move(left), right = std::move(right),
-          new_nodes, on_done = std::move(on_done)
-        ](Status s, ObjectId child_id) mutable {
-          if (s != Status::OK) {
-            on_done(s, "");
-            return;
-          }
-          RemoveNodeId(left->GetId(), new_nodes);
-          RemoveNodeId(right->GetId(), new_nodes);
-
-          TreeNode::Merge(page_storage, std::move(left), std::move(right),
-                          child_id, [ new_nodes, on_done = std::move(on_done) ](
-                                        Status s, ObjectId merged_id) {
-                            if (s == Status::OK) {
-                              new_nodes->insert(merged_id);
-                            }
-                            on_done(s, merged_id);
-                          });
-        }));
-}
 
-// Applies the change to the given node. If the change is a deletion, it also
-// triggers the merging of the corresponding children. |new_nodes| will be
-// updated by adding all newly created nodes and removing the previous ones. The
-// pointed object of |new_nodes| should outlive the call to the |on_done|
-// callback.
-void ApplyChangeOnNode(
-    PageStorage* page_storage,
-    const EntryChange* change,
-    const TreeNode* node,
-    int change_index,
-    std::unordered_set<ObjectId>* new_nodes,
-    std::function<void(Status, std::unique_ptr<TreeNode::Mutation::Updater>)>
-        on_done) {
-  if (!change->deleted) {
-    // Update the entry's value.
-    on_done(
-        Status::OK,
-        std::make_unique<TreeNode::Mutation::Updater>([entry = change->entry](
-            TreeNode::Mutation * mutation) { mutation->UpdateEntry(entry); }));
-    return;
+  void Push(std::unique_ptr<const TreeNode> node,
+            int entry_index,
+            int child_index) {
+    stack_.push_back(Frame{std::move(node), entry_index, child_index,
+                           child_index + (reverse_ ? -1 : 1)});
   }
-  // Remove the entry after merging the children.
-  ObjectId child_id;
-  std::unique_ptr<const TreeNode> left;
-  std::unique_ptr<const TreeNode> right;
-  Status s = node->GetChild(change_index, &left);
-  if (s != Status::OK && s != Status::NO_SUCH_CHILD) {
-    on_done(s, nullptr);
-    return;
+
+  // Requests the children of |frame| that come after its current child, up to
+  // |prefetch_count_| of them, and as long as they may hold entries of the
+  // range. The loaded nodes are dropped: requesting them downloads them from
+  // sync, so that loading them again when they are reached does not wait.
+  // Nodes stored locally are skipped, as they are read synchronously: reading
+  // them ahead of time would not save any wait.
+  void Prefetch(Frame* frame) {
+    int step = reverse_ ? -1 : 1;
+    if ((frame->prefetch_index - frame->child_index) * step <= 0) {
+      frame->prefetch_index = frame->child_index + step;
+    }
+    int last = frame->child_index + step * static_cast<int>(prefetch_count_);
+    for (; frame->prefetch_index != last + step;
+         frame->prefetch_index += step) {
+      int index = frame->prefetch_index;
+      if (index < 0 || index > frame->node->GetKeyCount()) {
+        return;
+      }
+      // The child at |index| is after the entry at |index - 1|, and before
+      // the entry at |index|.
+      int bound_index = reverse_ ? index : index - 1;
+      if (bound_index >= 0 && bound_index < frame->node->GetKeyCount()) {
+        Entry bound;
+        if (frame->node->GetEntry(bound_index, &bound) != Status::OK ||
+            !InRange(bound)) {
+          return;
+        }
+      }
+      ObjectId child_id = frame->node->GetChildId(index);
+      if (!child_id.empty() &&
+          page_storage_->ContainsObject(child_id) != Status::OK) {
+        TreeNode::FromId(
+            page_storage_, child_id,
+            [](Status status, std::unique_ptr<const TreeNode> node) {});
+      }
+    }
   }
-  s = node->GetChild(change_index + 1, &right);
-  if (s != Status::OK && s != Status::NO_SUCH_CHILD) {
-    on_done(s, nullptr);
-    return;
+
+  bool InRange(const Entry& entry) const {
+    return reverse_ ? entry.key >= start_
+                    : end_.empty() || entry.key < end_;
   }
 
-  Merge(page_storage, std::move(left), std::move(right), new_nodes, [
-    key = change->entry.key, on_done = std::move(on_done)
-  ](Status s, ObjectId child_id) {
-    if (s != Status::OK) {
-      on_done(s, nullptr);
+  void Finish(Status status) {
+    done_ = true;
+    stack_.clear();
+    auto on_done = std::move(on_done_);
+    on_done(status);
+  }
+
+  PageStorage* const page_storage_;
+  const std::string start_;
+  const std::string end_;
+  const bool reverse_;
+  const size_t prefetch_count_;
+  std::function<bool(Entry)> on_next_;
+  std::function<void(Status)> on_done_;
+
+  std::vector<Frame> stack_;
+  Entry current_entry_;
+  Status status_ = Status::OK;
+  // Key to look for when descending in the next node, or empty to go to its
+  // first, or last, entry.
+  std::string seek_key_;
+  // Id of the node to load next, if any.
+  ObjectId next_node_id_;
+  // The last loaded node, not yet pushed.
+  std::unique_ptr<const TreeNode> loaded_node_;
+  bool load_pending_ = false;
+  bool running_ = false;
+  bool done_ = false;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RangeWalker);
+};
+
+// Helper class for btree::GetEntries.
+
+// Looks up sorted keys in a tree. The keys are dispatched among the children
+// of each node, so that each node on the paths to the keys is loaded once.
+// The children of a node are loaded concurrently. The lookup keeps a reference
+// to itself in the callbacks of pending loads.
+class MultiKeyLookUp : public ftl::RefCountedThreadSafe<MultiKeyLookUp> {
+ public:
+  static ftl::RefPtr<MultiKeyLookUp> Create(
+      PageStorage* page_storage,
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback) {
+    return ftl::AdoptRef(new MultiKeyLookUp(page_storage, std::move(keys),
+                                            std::move(callback)));
+  }
+
+  void Start(ObjectIdView root_id) {
+    if (keys_.empty()) {
+      Finish(Status::OK);
       return;
     }
-    on_done(Status::OK, std::make_unique<TreeNode::Mutation::Updater>(
-                            [key, child_id](TreeNode::Mutation* mutation) {
-                              mutation->RemoveEntry(key, child_id);
-                            }));
-  });
-}
+    // The lookup is pending until all the keys have been dispatched.
+    pending_loads_ = 1;
+    LookUp(root_id, 0, keys_.size());
+    OnLoadDone();
+  }
 
-// Retrieves the child node in the given |child_index| and, if present,
-// recursively calls ApplyChangesIn to apply all necessary changes to the
-// subtree with that child as root. When |on_done| is called, the |changes|
-// iterator will already be advanced to the first change that has not been
-// applied, or to the end of the iterator if there is no such element.
-void ApplyChangeOnKeyNotFound(
-    PageStorage* page_storage,
-    Iterator<const EntryChange>* changes,
-    const TreeNode* node,
-    int child_index,
-    int node_size,
-    std::unordered_set<ObjectId>* new_nodes,
-    std::function<void(Status, std::unique_ptr<TreeNode::Mutation::Updater>)>
-        on_done) {
-  std::unique_ptr<const TreeNode> child;
-  Status s = node->GetChild(child_index, &child);
-  if (s != Status::OK && s != Status::NO_SUCH_CHILD) {
-    changes->Next();
-    on_done(s, nullptr);
-    return;
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(MultiKeyLookUp);
+
+  MultiKeyLookUp(
+      PageStorage* page_storage,
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback)
+      : page_storage_(page_storage),
+        keys_(std::move(keys)),
+        results_(keys_.size()),
+        callback_(std::move(callback)) {}
+
+  ~MultiKeyLookUp() {}
+
+  // Looks up the keys at positions [|begin|, |end|) in the subtree with root
+  // |node_id|.
+  void LookUp(ObjectIdView node_id, size_t begin, size_t end) {
+    ++pending_loads_;
+    ftl::RefPtr<MultiKeyLookUp> self(this);
+    TreeNode::FromId(page_storage_, node_id, [self, begin, end](
+        Status status, std::unique_ptr<const TreeNode> node) {
+      if (self->done_) {
+        return;
+      }
+      if (status != Status::OK) {
+        self->Finish(status);
+        return;
+      }
+      self->LookUpInNode(*node, begin, end);
+      self->OnLoadDone();
+    });
   }
-  if (s == Status::NO_SUCH_CHILD) {
-    if ((*changes)->deleted) {
-      // We try to remove an entry that is not in the tree. This is
-      // expected, as journals collate all operations on a key in a single
-      // change: if one does a put then a delete on a key, then we will only
-      // see here the delete operation.
-      FTL_VLOG(1) << "Failed to delete key " << (*changes)->entry.key
-                  << ": No such entry.";
-      changes->Next();
-      on_done(Status::OK, nullptr);
-      return;
+
+  void LookUpInNode(const TreeNode& node, size_t begin, size_t end) {
+    size_t i = begin;
+    while (i < end && !done_) {
+      int index;
+      Status status = node.FindKeyOrChild(keys_[i], &index);
+      if (status == Status::OK) {
+        results_[i] = std::make_unique<Entry>();
+        status = node.GetEntry(index, results_[i].get());
+        if (status != Status::OK) {
+          Finish(status);
+          return;
+        }
+        ++i;
+        continue;
+      }
+      if (status != Status::NOT_FOUND) {
+        Finish(status);
+        return;
+      }
+      // The keys before the entry at |index| are in the same child.
+      size_t child_end = end;
+      if (index < node.GetKeyCount()) {
+        Entry entry;
+        status = node.GetEntry(index, &entry);
+        if (status != Status::OK) {
+          Finish(status);
+          return;
+        }
+        child_end = std::lower_bound(keys_.begin() + i, keys_.begin() + end,
+                                     entry.key) -
+                    keys_.begin();
+      }
+      ObjectId child_id = node.GetChildId(index);
+      if (!child_id.empty()) {
+        LookUp(child_id, i, child_end);
+      }
+      i = child_end;
     }
-    // Add the entry here. Since there is no child, both the new left and
-    // right children are empty.
-    Entry entry = std::move((*changes)->entry);
-    changes->Next();
-    on_done(Status::OK,
-            std::make_unique<TreeNode::Mutation::Updater>([entry = std::move(
-                                                               entry)](
-                TreeNode::Mutation * mutation) {
-              mutation->AddEntry(entry, "", "");
-            }));
-    return;
   }
-  // Recursively search for the key in the child and then update the child
-  // id in this node in the corresponding index.
-  std::string next_key;
-  if (child_index == node->GetKeyCount()) {
-    next_key = "";
-  } else {
-    Entry entry;
-    node->GetEntry(child_index, &entry);
-    next_key = entry.key;
-  }
-  ApplyChangesIn(
-      page_storage, changes, std::move(child), false, std::move(next_key),
-      node_size, new_nodes,
-      [on_done = std::move(on_done)](
-          Status s, ObjectId new_child_id,
-          std::unique_ptr<TreeNode::Mutation::Updater> parent_updater) {
-        // No need to call Next on the iterator here, it has already
-        // advanced in the ApplyChangesIn loop.
-        on_done(s, std::move(parent_updater));
-      });
-}
 
-// Applies all given changes in the subtree having |node| as a root.
-// |changes| should be sorted by the changes' entry key.
-// |max_key| is the maximal value (exclusive) this code could have as a key.
-// E.g. a child node placed between keys "A" and "B", has "B" as it's |max_key|.
-// It should be an empty string for the root node.
-// |node_size| is the maximal size of a tree node as defined in this B-Tree.
-// |new_nodes| is the set of all nodes added during the recursion.
-// |on_done| is called once, with the returned status and, when successfull, the
-// id of the new root and the TreeNode::Mutation::Updater for the parent node's
-// mutation.
-void ApplyChangesIn(
-    PageStorage* page_storage,
-    Iterator<const EntryChange>* changes,
-    std::unique_ptr<const TreeNode> node,
-    bool is_root,
-    const std::string& max_key,
-    size_t node_size,
-    std::unordered_set<ObjectId>* new_nodes,
-    std::function<void(Status,
-                       ObjectId,
-                       std::unique_ptr<TreeNode::Mutation::Updater>)> on_done) {
-  auto waiter =
-      callback::Waiter<Status, TreeNode::Mutation::Updater>::Create(Status::OK);
-  // Apply all changes in the correct range: until the max_key. Wait for all
-  // changes to be detected for this node before applying them in this node's
-  // mutation, so as to guarantee they are applied in the right order.
-  while (changes->Valid() &&
-         (max_key.empty() || (*changes)->entry.key < max_key)) {
-    int index;
-    Status s = node->FindKeyOrChild((*changes)->entry.key, &index);
-    const EntryChange& change = **changes;
-    if (s == Status::OK) {
-      // The key was found. Apply the change to this node.
-      ApplyChangeOnNode(page_storage, &change, node.get(), index, new_nodes,
-                        waiter->NewCallback());
-      changes->Next();
-    } else if (s == Status::NOT_FOUND) {
-      // The key was not found here. Search in the corresponding child.
-      ApplyChangeOnKeyNotFound(page_storage, changes, node.get(), index,
-                               node_size, new_nodes, waiter->NewCallback());
-    } else {
-      // Error in FindKeyOrChild.
-      on_done(s, "", nullptr);
-      return;
+  void OnLoadDone() {
+    if (!done_ && --pending_loads_ == 0) {
+      Finish(Status::OK);
     }
   }
-  waiter->Finalize(ftl::MakeCopyable([
-    node = std::move(node), is_root, max_key, node_size, new_nodes,
-    on_done = std::move(on_done)
-  ](Status s, std::vector<std::unique_ptr<TreeNode::Mutation::Updater>>
-                  apply_updates) mutable {
-    if (s != Status::OK) {
-      on_done(s, "", nullptr);
+
+  void Finish(Status status) {
+    FTL_DCHECK(!done_);
+    done_ = true;
+    if (status != Status::OK) {
+      callback_(status, std::vector<std::unique_ptr<Entry>>());
       return;
     }
-    TreeNode::Mutation mutation = node->StartMutation();
-    for (const auto& apply_update : apply_updates) {
-      if (apply_update) {
-        (*apply_update)(&mutation);
-      }
-    }
-    mutation.Finish(node_size, is_root, max_key, new_nodes, std::move(on_done));
-  }));
-}
+    callback_(Status::OK, std::move(results_));
+  }
+
+  PageStorage* const page_storage_;
+  const std::vector<std::string> keys_;
+  std::vector<std::unique_ptr<Entry>> results_;
+  std::function<void(Status, std::vector<std::unique_ptr<Entry>>)> callback_;
+  size_t pending_loads_ = 0;
+  bool done_ = false;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(MultiKeyLookUp);
+};
 
 // Returns a vector with all the tree's entries, sorted by key.
 void GetEntriesVector(
@@ -374,55 +493,1140 @@ void GetEntriesVector(
       }));
 }
 
+Status CountEntries(const TreeNode& node, uint64_t* count);
+
+// Stores in |count| the number of entries of the subtree of the child at
+// |index| of |node|. Subtrees whose count is not recorded in |node| are read
+// entirely.
+Status GetChildEntryCount(const TreeNode& node, int index, uint64_t* count) {
+  *count = node.GetChildEntryCount(index);
+  if (*count != kUnknownEntryCount) {
+    return Status::OK;
+  }
+  std::unique_ptr<const TreeNode> child;
+  Status status = node.GetChild(index, &child);
+  if (status != Status::OK) {
+    return status;
+  }
+  return CountEntries(*child, count);
+}
+
+// Stores in |count| the number of entries of the subtree of |node|.
+Status CountEntries(const TreeNode& node, uint64_t* count) {
+  *count = node.GetKeyCount();
+  for (int i = 0; i <= node.GetKeyCount(); ++i) {
+    uint64_t child_count;
+    Status status = GetChildEntryCount(node, i, &child_count);
+    if (status != Status::OK) {
+      return status;
+    }
+    *count += child_count;
+  }
+  return Status::OK;
+}
+
+// Stores in |rank| the number of entries of the BTree starting at |root_id|
+// with keys lower than |key|.
+Status GetRank(PageStorage* page_storage,
+               ObjectIdView root_id,
+               convert::ExtendedStringView key,
+               uint64_t* rank) {
+  std::unique_ptr<const TreeNode> node;
+  Status status = TreeNode::FromIdSynchronous(page_storage, root_id, &node);
+  if (status != Status::OK) {
+    return status;
+  }
+  *rank = 0;
+  while (true) {
+    int index;
+    bool found = node->FindKeyOrChild(key, &index) == Status::OK;
+    // The entries before |index| and the children on their left are lower
+    // than |key|, and so is the child at |index| if |key| is found.
+    *rank += index;
+    int child_end = found ? index + 1 : index;
+    for (int i = 0; i < child_end; ++i) {
+      uint64_t child_count;
+      status = GetChildEntryCount(*node, i, &child_count);
+      if (status != Status::OK) {
+        return status;
+      }
+      *rank += child_count;
+    }
+    if (found) {
+      return Status::OK;
+    }
+    std::unique_ptr<const TreeNode> child;
+    status = node->GetChild(index, &child);
+    if (status == Status::NO_SUCH_CHILD) {
+      return Status::OK;
+    }
+    if (status != Status::OK) {
+      return status;
+    }
+    node = std::move(child);
+  }
+}
+
+// Helper functions for btree::ApplyChanges.
+
+// The contents of a tree node being written.
+struct NodeContents {
+  std::vector<Entry> entries;
+  std::vector<ObjectId> children;
+  std::vector<uint64_t> child_entry_counts;
+};
+
+void AddChild(ObjectId child_id, uint64_t entry_count, NodeContents* contents) {
+  contents->child_entry_counts.push_back(child_id.empty() ? 0 : entry_count);
+  contents->children.push_back(std::move(child_id));
+}
+
+// Appends to |contents| the entries of |node| in [begin, end), each preceded
+// by the child on its left.
+void AddChildrenAndEntries(const TreeNode& node,
+                           int begin,
+                           int end,
+                           NodeContents* contents) {
+  for (int i = begin; i < end; ++i) {
+    AddChild(node.GetChildId(i), node.GetChildEntryCount(i), contents);
+    contents->entries.emplace_back();
+    node.GetEntry(i, &contents->entries.back());
+  }
+}
+
+// Appends to |contents| the entries of |node| in [begin, end), each followed
+// by the child on its right.
+void AddEntriesAndChildren(const TreeNode& node,
+                           int begin,
+                           int end,
+                           NodeContents* contents) {
+  for (int i = begin; i < end; ++i) {
+    contents->entries.emplace_back();
+    node.GetEntry(i, &contents->entries.back());
+    AddChild(node.GetChildId(i + 1), node.GetChildEntryCount(i + 1), contents);
+  }
+}
+
+// A sequence of sibling subtrees, separated by pivot entries: the nodes
+// written for the contents of a node, which are split if they are too large.
+struct Forest {
+  std::vector<ObjectId> roots;
+  std::vector<uint64_t> entry_counts;
+  std::vector<Entry> pivots;
+};
+
+std::unique_ptr<Forest> SingleTree(ObjectId id, uint64_t entry_count) {
+  auto forest = std::make_unique<Forest>();
+  forest->roots.push_back(std::move(id));
+  forest->entry_counts.push_back(entry_count);
+  return forest;
+}
+
+// Appends to |contents| the roots of |forest|, separated by its pivots.
+void AddForest(Forest forest, NodeContents* contents) {
+  for (size_t i = 0; i < forest.roots.size(); ++i) {
+    if (i > 0) {
+      contents->entries.push_back(std::move(forest.pivots[i - 1]));
+    }
+    AddChild(std::move(forest.roots[i]), forest.entry_counts[i], contents);
+  }
+}
+
+// Replaces the child of |contents| at |index| by the roots of |forest|,
+// separated by its pivots.
+void ReplaceChild(size_t index, Forest forest, NodeContents* contents) {
+  contents->entries.insert(contents->entries.begin() + index,
+                           std::make_move_iterator(forest.pivots.begin()),
+                           std::make_move_iterator(forest.pivots.end()));
+  contents->children.erase(contents->children.begin() + index);
+  contents->children.insert(contents->children.begin() + index,
+                            std::make_move_iterator(forest.roots.begin()),
+                            std::make_move_iterator(forest.roots.end()));
+  contents->child_entry_counts.erase(contents->child_entry_counts.begin() +
+                                     index);
+  contents->child_entry_counts.insert(
+      contents->child_entry_counts.begin() + index,
+      forest.entry_counts.begin(), forest.entry_counts.end());
+}
+
+// Removes from |contents| the entry at |index| and the child on its right,
+// leaving the child on its left as a placeholder for the merge of both.
+void RemoveEntryAndRightChild(size_t index, NodeContents* contents) {
+  contents->entries.erase(contents->entries.begin() + index);
+  contents->children.erase(contents->children.begin() + index + 1);
+  contents->child_entry_counts.erase(contents->child_entry_counts.begin() +
+                                     index + 1);
+}
+
+// Returns the indexes of the pivots splitting entries of the given encoded
+// sizes into the smallest number of nodes of similar sizes fitting in
+// |max_size|, or no index if they fit in a single node. Splitting a node
+// takes at least three entries: one for each new node, and the pivot between
+// them.
+std::vector<size_t> GetSplitIndexes(const std::vector<size_t>& entry_sizes,
+                                    size_t max_size) {
+  std::vector<size_t> pivots;
+  size_t total_size = 0;
+  for (size_t entry_size : entry_sizes) {
+    total_size += entry_size;
+  }
+  if (total_size <= max_size || entry_sizes.size() < 3) {
+    return pivots;
+  }
+
+  // If we want N nodes of size S, separated by pivots of average size P, then
+  // the total size T is T = N*S+(N-1)*P, leading to N=(T+P)/(S+P), rounded up.
+  size_t average_size = total_size / entry_sizes.size();
+  size_t node_count =
+      (total_size + max_size + 2 * average_size - 1) / (max_size + average_size);
+
+  // Nodes are filled up to an equal share of the remaining size, so that they
+  // are all at least about half full. Nodes hold at least one entry, and are
+  // followed by at least two, the pivot and the first entry of the next node.
+  size_t remaining_size = total_size;
+  size_t begin = 0;
+  for (size_t i = 0; begin < entry_sizes.size(); ++i) {
+    size_t remaining_nodes = i + 1 < node_count ? node_count - i : 1;
+    size_t target_size = std::min(max_size, remaining_size / remaining_nodes);
+    size_t end = begin + 1;
+    size_t node_size = entry_sizes[begin];
+    while (end < entry_sizes.size() &&
+           (node_size + entry_sizes[end] <= target_size ||
+            end + 1 == entry_sizes.size())) {
+      node_size += entry_sizes[end];
+      ++end;
+    }
+    remaining_size -= node_size;
+    if (end < entry_sizes.size()) {
+      remaining_size -= entry_sizes[end];
+      pivots.push_back(end);
+      ++end;
+    }
+    begin = end;
+  }
+  return pivots;
+}
+
+// Removes ranges of keys from a tree, then applies sorted changes to it,
+// rewriting the nodes on the paths to the changed keys and to the bounds of the
+// ranges. Nodes are written by |WriteNodes()|, which splits the ones
+// over the maximal node size, and nodes under the minimal size, see
+// |GetMinNodeSize()|, are merged with a sibling by |Normalize()| before their
+// parent is written. All the nodes but the root are then within bounds, as
+// long as the nodes of the original tree are. Nodes are loaded with
+// |TreeNode::FromId()|, and so downloaded from sync if they are not available
+// locally. The updater keeps a reference to itself in the callbacks of pending
+// loads.
+class TreeUpdater : public ftl::RefCountedThreadSafe<TreeUpdater> {
+ public:
+  using ForestCallback = std::function<void(Status, std::unique_ptr<Forest>)>;
+  using ContentsCallback = std::function<void(Status, NodeContents)>;
+
+  static ftl::RefPtr<TreeUpdater> Create(
+      PageStorage* page_storage,
+      size_t node_size,
+      std::vector<KeyRange> deleted_ranges,
+      std::vector<EntryChange> changes,
+      std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+          callback) {
+    return ftl::AdoptRef(new TreeUpdater(
+        page_storage, node_size, std::move(deleted_ranges), std::move(changes),
+        std::move(callback)));
+  }
+
+  // Removes the ranges and applies the changes to the tree with root
+  // |root_id|, or to an empty tree if |root_id| is empty.
+  void Start(ObjectIdView root_id) {
+    ObjectId id = root_id.ToString();
+    if (id.empty()) {
+      NodeContents contents;
+      AddChild(ObjectId(), 0, &contents);
+      Forest forest;
+      Status status = WriteNodes(std::move(contents), &forest);
+      if (status != Status::OK) {
+        Finish(status, "");
+        return;
+      }
+      id = std::move(forest.roots.front());
+    }
+    RemoveRanges(std::move(id), 0);
+  }
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(TreeUpdater);
+
+  TreeUpdater(
+      PageStorage* page_storage,
+      size_t node_size,
+      std::vector<KeyRange> deleted_ranges,
+      std::vector<EntryChange> changes,
+      std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+          callback)
+      : page_storage_(page_storage),
+        max_size_(node_size),
+        min_size_(GetMinNodeSize(node_size)),
+        deleted_ranges_(std::move(deleted_ranges)),
+        changes_(std::move(changes)),
+        callback_(std::move(callback)) {}
+
+  ~TreeUpdater() {}
+
+  // Removes the ranges from the one at position |next_range| on from the tree
+  // with root |root_id|, then applies the changes.
+  void RemoveRanges(ObjectId root_id, size_t next_range) {
+    while (next_range < deleted_ranges_.size() &&
+           !deleted_ranges_[next_range].end.empty() &&
+           deleted_ranges_[next_range].end <=
+               deleted_ranges_[next_range].start) {
+      ++next_range;
+    }
+    ftl::RefPtr<TreeUpdater> self(this);
+    if (next_range == deleted_ranges_.size()) {
+      ApplyChangesIn(std::move(root_id), kUnknownEntryCount, 0,
+                     changes_.size(),
+                     [self](Status status, std::unique_ptr<Forest> forest) {
+                       if (status != Status::OK) {
+                         self->Finish(status, "");
+                         return;
+                       }
+                       self->BuildRoot(std::move(*forest));
+                     });
+      return;
+    }
+    RemoveRange(std::move(root_id), kUnknownEntryCount,
+                deleted_ranges_[next_range], [self, next_range](
+                    Status status, std::unique_ptr<Forest> forest) {
+                  ObjectId root_id;
+                  if (status == Status::OK) {
+                    status = self->WriteRoot(std::move(*forest), &root_id);
+                  }
+                  if (status != Status::OK) {
+                    self->Finish(status, "");
+                    return;
+                  }
+                  self->RemoveRanges(std::move(root_id), next_range + 1);
+                });
+  }
+
+  // Removes the entries with keys in |range| from the subtree with root |id|,
+  // and calls |callback| with the nodes written for the subtree. The children
+  // entirely within |range| are dropped without being read: only the nodes on
+  // the paths to the bounds of |range| are rewritten. A node left without
+  // entries is kept, with its only child, until it is merged with a sibling.
+  void RemoveRange(ObjectId id,
+                   uint64_t entry_count,
+                   const KeyRange& range,
+                   ForestCallback callback) {
+    if (id.empty()) {
+      callback(Status::OK, SingleTree(ObjectId(), 0));
+      return;
+    }
+    ftl::RefPtr<TreeUpdater> self(this);
+    TreeNode::FromId(page_storage_, id, [self, id, entry_count, &range,
+                                         callback](
+        Status status, std::unique_ptr<const TreeNode> node) {
+      if (status != Status::OK) {
+        callback(status, nullptr);
+        return;
+      }
+      self->RemoveRangeInNode(std::move(id), entry_count, std::move(node),
+                              range, callback);
+    });
+  }
+
+  void RemoveRangeInNode(ObjectId id,
+                         uint64_t entry_count,
+                         std::unique_ptr<const TreeNode> node,
+                         const KeyRange& range,
+                         ForestCallback callback) {
+    // The entries of |node| in the range are the ones in [begin, end).
+    int key_count = node->GetKeyCount();
+    int begin;
+    node->FindKeyOrChild(range.start, &begin);
+    int end = key_count;
+    if (!range.end.empty()) {
+      node->FindKeyOrChild(range.end, &end);
+    }
+    ftl::RefPtr<TreeUpdater> self(this);
+
+    if (begin == end) {
+      // The range is within the child at |begin|.
+      ObjectId child_id = node->GetChildId(begin);
+      uint64_t child_count = node->GetChildEntryCount(begin);
+      RemoveRange(child_id, child_count, range,
+                  ftl::MakeCopyable([
+                    self, id = std::move(id), entry_count,
+                    node = std::move(node), begin, child_id, callback
+                  ](Status status, std::unique_ptr<Forest> child) {
+                    if (status != Status::OK) {
+                      callback(status, nullptr);
+                      return;
+                    }
+                    if (child->roots.size() == 1 &&
+                        child->roots.front() == child_id) {
+                      callback(Status::OK, SingleTree(id, entry_count));
+                      return;
+                    }
+                    NodeContents contents;
+                    AddChildrenAndEntries(*node, 0, node->GetKeyCount(),
+                                          &contents);
+                    AddChild(node->GetChildId(node->GetKeyCount()),
+                             node->GetChildEntryCount(node->GetKeyCount()),
+                             &contents);
+                    ReplaceChild(begin, std::move(*child), &contents);
+                    self->NormalizeAndWrite(std::move(contents), callback);
+                  }));
+      return;
+    }
+
+    // The children between the removed entries are dropped. The ones at both
+    // ends hold keys both in and out of the range: they are trimmed and merged
+    // together.
+    auto waiter = callback::Waiter<Status, Forest>::Create(Status::OK);
+    RemoveRange(node->GetChildId(begin), node->GetChildEntryCount(begin), range,
+                waiter->NewCallback());
+    RemoveRange(node->GetChildId(end), node->GetChildEntryCount(end), range,
+                waiter->NewCallback());
+    waiter->Finalize(ftl::MakeCopyable([
+      self, node = std::move(node), begin, end, callback
+    ](Status status, std::vector<std::unique_ptr<Forest>> children) mutable {
+      if (status != Status::OK) {
+        callback(status, nullptr);
+        return;
+      }
+      // The last root of the trimmed left child and the first one of the
+      // trimmed right child are merged in place of the first one.
+      Forest& left = *children[0];
+      Forest& right = *children[1];
+      ObjectId left_id = left.roots.back();
+      uint64_t left_count = left.entry_counts.back();
+      ObjectId right_id = right.roots.front();
+      uint64_t right_count = right.entry_counts.front();
+      NodeContents contents;
+      AddChildrenAndEntries(*node, 0, begin, &contents);
+      AddForest(std::move(left), &contents);
+      size_t index = contents.children.size() - 1;
+      for (size_t i = 1; i < right.roots.size(); ++i) {
+        contents.entries.push_back(std::move(right.pivots[i - 1]));
+        AddChild(std::move(right.roots[i]), right.entry_counts[i], &contents);
+      }
+      AddEntriesAndChildren(*node, end, node->GetKeyCount(), &contents);
+      self->MergeSubtrees(
+          std::move(left_id), left_count, std::move(right_id), right_count,
+          ftl::MakeCopyable([self, contents = std::move(contents), index,
+                             callback](Status status,
+                                       std::unique_ptr<Forest> merged) mutable {
+            if (status != Status::OK) {
+              callback(status, nullptr);
+              return;
+            }
+            ReplaceChild(index, std::move(*merged), &contents);
+            self->NormalizeAndWrite(std::move(contents), callback);
+          }));
+    }));
+  }
+
+  // Applies the changes at positions [|begin|, |end|), which all have keys in
+  // the range of the subtree with root |id|, and calls |callback| with the
+  // nodes written for the subtree.
+  void ApplyChangesIn(ObjectId id,
+                      uint64_t entry_count,
+                      size_t begin,
+                      size_t end,
+                      ForestCallback callback) {
+    if (begin == end) {
+      callback(Status::OK, SingleTree(std::move(id), entry_count));
+      return;
+    }
+    ftl::RefPtr<TreeUpdater> self(this);
+    TreeNode::FromId(page_storage_, id, [self, begin, end, callback](
+        Status status, std::unique_ptr<const TreeNode> node) {
+      if (status != Status::OK) {
+        callback(status, nullptr);
+        return;
+      }
+      self->ApplyChangesInNode(std::move(node), begin, end, callback);
+    });
+  }
+
+  // Dispatches the changes at positions [|begin|, |end|) among the entries of
+  // |node| and its children, then writes the node with the updated children.
+  void ApplyChangesInNode(std::unique_ptr<const TreeNode> node,
+                          size_t begin,
+                          size_t end,
+                          ForestCallback callback) {
+    int key_count = node->GetKeyCount();
+    // The changes in the subtree of the child at index i are the ones at
+    // positions [child_changes[i], child_changes[i + 1]), excluding the change
+    // of the entry at index i, if any, which is the last one.
+    std::vector<size_t> child_changes;
+    std::vector<const EntryChange*> entry_changes(key_count, nullptr);
+    auto waiter = callback::Waiter<Status, Forest>::Create(Status::OK);
+    size_t i = begin;
+    for (int index = 0; index <= key_count; ++index) {
+      Entry entry;
+      if (index < key_count) {
+        node->GetEntry(index, &entry);
+      }
+      child_changes.push_back(i);
+      while (i < end &&
+             (index == key_count || changes_[i].entry.key < entry.key)) {
+        ++i;
+      }
+      ObjectId child_id = node->GetChildId(index);
+      if (i > child_changes.back() && !child_id.empty()) {
+        ApplyChangesIn(std::move(child_id), node->GetChildEntryCount(index),
+                       child_changes.back(), i, waiter->NewCallback());
+      }
+      if (index < key_count && i < end && changes_[i].entry.key == entry.key) {
+        entry_changes[index] = &changes_[i];
+        ++i;
+      }
+    }
+    child_changes.push_back(end);
+
+    ftl::RefPtr<TreeUpdater> self(this);
+    waiter->Finalize(ftl::MakeCopyable([
+      self, node = std::move(node), child_changes = std::move(child_changes),
+      entry_changes = std::move(entry_changes), callback
+    ](Status status, std::vector<std::unique_ptr<Forest>> children) mutable {
+      if (status != Status::OK) {
+        callback(status, nullptr);
+        return;
+      }
+      NodeContents contents;
+      std::vector<std::string> deleted_keys;
+      auto next_child = children.begin();
+      for (int index = 0; index <= node->GetKeyCount(); ++index) {
+        size_t change_end = child_changes[index + 1];
+        if (index < node->GetKeyCount() && entry_changes[index]) {
+          --change_end;
+        }
+        ObjectId child_id = node->GetChildId(index);
+        if (child_changes[index] == change_end) {
+          AddChild(std::move(child_id), node->GetChildEntryCount(index),
+                   &contents);
+        } else if (!child_id.empty()) {
+          AddForest(std::move(**next_child), &contents);
+          ++next_child;
+        } else {
+          // New keys are added to the leaf. Deletions of keys that are not in
+          // the tree are ignored, as journals collate all operations on a key
+          // in a single change.
+          AddChild(ObjectId(), 0, &contents);
+          for (size_t i = child_changes[index]; i < change_end; ++i) {
+            if (!self->changes_[i].deleted) {
+              contents.entries.push_back(self->changes_[i].entry);
+              AddChild(ObjectId(), 0, &contents);
+            }
+          }
+        }
+        if (index == node->GetKeyCount()) {
+          break;
+        }
+        const EntryChange* change = entry_changes[index];
+        if (change && change->deleted) {
+          deleted_keys.push_back(change->entry.key);
+        }
+        if (change && !change->deleted) {
+          contents.entries.push_back(change->entry);
+        } else {
+          contents.entries.emplace_back();
+          node->GetEntry(index, &contents.entries.back());
+        }
+      }
+      self->RemoveEntries(std::move(contents), std::move(deleted_keys), 0,
+                          [self, callback](Status status,
+                                           NodeContents contents) {
+                            if (status != Status::OK) {
+                              callback(status, nullptr);
+                              return;
+                            }
+                            self->NormalizeAndWrite(std::move(contents),
+                                                    callback);
+                          });
+    }));
+  }
+
+  // Removes from |contents| the entries with keys in |keys|, sorted, from the
+  // one at position |next_key| on, merging the children on both sides of each
+  // of them.
+  void RemoveEntries(NodeContents contents,
+                     std::vector<std::string> keys,
+                     size_t next_key,
+                     ContentsCallback callback) {
+    size_t index = 0;
+    for (; next_key < keys.size(); ++next_key) {
+      while (contents.entries[index].key != keys[next_key]) {
+        ++index;
+      }
+      if (!contents.children[index].empty()) {
+        break;
+      }
+      // Both children of an entry of a leaf are empty.
+      RemoveEntryAndRightChild(index, &contents);
+    }
+    if (next_key == keys.size()) {
+      callback(Status::OK, std::move(contents));
+      return;
+    }
+    ObjectId left_id = contents.children[index];
+    uint64_t left_count = contents.child_entry_counts[index];
+    ObjectId right_id = contents.children[index + 1];
+    uint64_t right_count = contents.child_entry_counts[index + 1];
+    RemoveEntryAndRightChild(index, &contents);
+    ftl::RefPtr<TreeUpdater> self(this);
+    MergeSubtrees(
+        std::move(left_id), left_count, std::move(right_id), right_count,
+        ftl::MakeCopyable([
+          self, contents = std::move(contents), keys = std::move(keys),
+          next_key, index, callback
+        ](Status status, std::unique_ptr<Forest> merged) mutable {
+          if (status != Status::OK) {
+            callback(status, NodeContents());
+            return;
+          }
+          ReplaceChild(index, std::move(*merged), &contents);
+          self->RemoveEntries(std::move(contents), std::move(keys),
+                              next_key + 1, callback);
+        }));
+  }
+
+  // Merges the subtrees with roots |left_id| and |right_id|, of the same
+  // height, where all the keys of the left one are lower than the keys of the
+  // right one. The nodes on the right edge of the left subtree and on the left
+  // edge of the right one are concatenated pairwise.
+  void MergeSubtrees(ObjectId left_id,
+                     uint64_t left_count,
+                     ObjectId right_id,
+                     uint64_t right_count,
+                     ForestCallback callback) {
+    if (left_id.empty()) {
+      FTL_DCHECK(right_id.empty());
+      callback(Status::OK, SingleTree(ObjectId(), 0));
+      return;
+    }
+    auto waiter = callback::Waiter<Status, const TreeNode>::Create(Status::OK);
+    TreeNode::FromId(page_storage_, left_id, waiter->NewCallback());
+    TreeNode::FromId(page_storage_, right_id, waiter->NewCallback());
+    ftl::RefPtr<TreeUpdater> self(this);
+    waiter->Finalize([self, callback](
+        Status status, std::vector<std::unique_ptr<const TreeNode>> nodes) {
+      if (status != Status::OK) {
+        callback(status, nullptr);
+        return;
+      }
+      const TreeNode& left = *nodes[0];
+      const TreeNode& right = *nodes[1];
+      // The last child of |left| and the first one of |right| are merged in
+      // place of the first one.
+      NodeContents contents;
+      AddChildrenAndEntries(left, 0, left.GetKeyCount(), &contents);
+      size_t index = contents.children.size();
+      AddChild(right.GetChildId(0), right.GetChildEntryCount(0), &contents);
+      AddEntriesAndChildren(right, 0, right.GetKeyCount(), &contents);
+      self->MergeSubtrees(
+          left.GetChildId(left.GetKeyCount()),
+          left.GetChildEntryCount(left.GetKeyCount()), right.GetChildId(0),
+          right.GetChildEntryCount(0), ftl::MakeCopyable([
+            self, contents = std::move(contents), index, callback
+          ](Status status, std::unique_ptr<Forest> merged) mutable {
+            if (status != Status::OK) {
+              callback(status, nullptr);
+              return;
+            }
+            ReplaceChild(index, std::move(*merged), &contents);
+            self->NormalizeAndWrite(std::move(contents), callback);
+          }));
+    });
+  }
+
+  // Merges the children of |contents| which are under the minimal size with a
+  // sibling, and splits the merged nodes over the maximal size. A single child
+  // is left as is: it is merged, if needed, when its parent is merged with a
+  // sibling.
+  void Normalize(NodeContents contents, ContentsCallback callback) {
+    size_t index = 0;
+    while (index < contents.children.size() &&
+           underfull_nodes_.count(contents.children[index]) == 0) {
+      ++index;
+    }
+    if (contents.children.size() < 2 || index == contents.children.size()) {
+      callback(Status::OK, std::move(contents));
+      return;
+    }
+    // The child is merged with the next one, or the previous one if it is the
+    // last.
+    size_t left = index + 1 < contents.children.size() ? index : index - 1;
+    auto waiter = callback::Waiter<Status, const TreeNode>::Create(Status::OK);
+    TreeNode::FromId(page_storage_, contents.children[left],
+                     waiter->NewCallback());
+    TreeNode::FromId(page_storage_, contents.children[left + 1],
+                     waiter->NewCallback());
+    ftl::RefPtr<TreeUpdater> self(this);
+    waiter->Finalize(ftl::MakeCopyable([
+      self, contents = std::move(contents), left, callback
+    ](Status status,
+      std::vector<std::unique_ptr<const TreeNode>> nodes) mutable {
+      if (status != Status::OK) {
+        callback(status, NodeContents());
+        return;
+      }
+      const TreeNode& left_node = *nodes[0];
+      const TreeNode& right_node = *nodes[1];
+      NodeContents merged;
+      AddChildrenAndEntries(left_node, 0, left_node.GetKeyCount(), &merged);
+      AddChild(left_node.GetChildId(left_node.GetKeyCount()),
+               left_node.GetChildEntryCount(left_node.GetKeyCount()),
+               &merged);
+      merged.entries.push_back(std::move(contents.entries[left]));
+      AddChild(right_node.GetChildId(0), right_node.GetChildEntryCount(0),
+               &merged);
+      AddEntriesAndChildren(right_node, 0, right_node.GetKeyCount(), &merged);
+      RemoveEntryAndRightChild(left, &contents);
+      // The children of the merged node may be under the minimal size too, if
+      // one of the nodes only had a single child.
+      self->NormalizeAndWrite(
+          std::move(merged), ftl::MakeCopyable([
+            self, contents = std::move(contents), left, callback
+          ](Status status, std::unique_ptr<Forest> merged) mutable {
+            if (status != Status::OK) {
+              callback(status, NodeContents());
+              return;
+            }
+            ReplaceChild(left, std::move(*merged), &contents);
+            self->Normalize(std::move(contents), callback);
+          }));
+    }));
+  }
+
+  void NormalizeAndWrite(NodeContents contents, ForestCallback callback) {
+    ftl::RefPtr<TreeUpdater> self(this);
+    Normalize(std::move(contents),
+              [self, callback](Status status, NodeContents contents) {
+                if (status != Status::OK) {
+                  callback(status, nullptr);
+                  return;
+                }
+                auto forest = std::make_unique<Forest>();
+                status = self->WriteNodes(std::move(contents), forest.get());
+                if (status != Status::OK) {
+                  callback(status, nullptr);
+                  return;
+                }
+                callback(Status::OK, std::move(forest));
+              });
+  }
+
+  // Writes the nodes holding |contents|, splitting them into several nodes if
+  // they are over the maximal size, and stores them in |forest|. A single node
+  // under the minimal size is recorded, to be merged with a sibling.
+  Status WriteNodes(NodeContents contents, Forest* forest) {
+    std::vector<size_t> entry_sizes;
+    size_t total_size = 0;
+    for (const Entry& entry : contents.entries) {
+      entry_sizes.push_back(GetEncodedEntrySize(entry));
+      total_size += entry_sizes.back();
+    }
+    std::vector<size_t> pivots = GetSplitIndexes(entry_sizes, max_size_);
+    pivots.push_back(contents.entries.size());
+    size_t begin = 0;
+    for (size_t end : pivots) {
+      // There is one more child than the number of entries.
+      std::vector<Entry> entries(
+          std::make_move_iterator(contents.entries.begin() + begin),
+          std::make_move_iterator(contents.entries.begin() + end));
+      std::vector<ObjectId> children(contents.children.begin() + begin,
+                                     contents.children.begin() + end + 1);
+      std::vector<uint64_t> child_entry_counts(
+          contents.child_entry_counts.begin() + begin,
+          contents.child_entry_counts.begin() + end + 1);
+      uint64_t entry_count = entries.size();
+      for (uint64_t child_entry_count : child_entry_counts) {
+        entry_count = AddEntryCounts(entry_count, child_entry_count);
+      }
+      ObjectId id;
+      Status status = TreeNode::FromEntries(page_storage_, entries, children,
+                                            child_entry_counts, &id);
+      if (status != Status::OK) {
+        return status;
+      }
+      new_nodes_.insert(id);
+      if (pivots.size() == 1 && total_size < min_size_) {
+        underfull_nodes_.insert(id);
+      } else {
+        underfull_nodes_.erase(id);
+      }
+      forest->roots.push_back(std::move(id));
+      forest->entry_counts.push_back(entry_count);
+      if (end < contents.entries.size()) {
+        forest->pivots.push_back(std::move(contents.entries[end]));
+      }
+      begin = end + 1;
+    }
+    return Status::OK;
+  }
+
+  // Writes the levels above the roots of |forest| until there is only one,
+  // and stores it in |root_id|.
+  Status WriteRoot(Forest forest, ObjectId* root_id) {
+    while (forest.roots.size() > 1) {
+      NodeContents contents;
+      AddForest(std::move(forest), &contents);
+      forest = Forest();
+      Status status = WriteNodes(std::move(contents), &forest);
+      if (status != Status::OK) {
+        return status;
+      }
+    }
+    root_id->swap(forest.roots.front());
+    return Status::OK;
+  }
+
+  void BuildRoot(Forest forest) {
+    ObjectId root_id;
+    Status status = WriteRoot(std::move(forest), &root_id);
+    if (status != Status::OK) {
+      Finish(status, "");
+      return;
+    }
+    CollapseRoot(std::move(root_id));
+  }
+
+  // Replaces the root |root_id| by its only child while it has no entries.
+  void CollapseRoot(ObjectId root_id) {
+    ftl::RefPtr<TreeUpdater> self(this);
+    TreeNode::FromId(page_storage_, root_id, [self, root_id](
+        Status status, std::unique_ptr<const TreeNode> root) {
+      if (status != Status::OK) {
+        self->Finish(status, "");
+        return;
+      }
+      if (root->GetKeyCount() == 0 && !root->GetChildId(0).empty()) {
+        self->CollapseRoot(root->GetChildId(0));
+        return;
+      }
+      self->Finish(Status::OK, root_id);
+    });
+  }
+
+  // Adds to |reachable_nodes_| the new nodes in the subtree with root |id|.
+  // Only new nodes are read: they cannot be referred to by older nodes.
+  void AddReachableNodes(ObjectId id, std::function<void(Status)> callback) {
+    if (new_nodes_.count(id) == 0 || !reachable_nodes_.insert(id).second) {
+      callback(Status::OK);
+      return;
+    }
+    ftl::RefPtr<TreeUpdater> self(this);
+    TreeNode::FromId(page_storage_, id, [self, callback](
+        Status status, std::unique_ptr<const TreeNode> node) {
+      if (status != Status::OK) {
+        callback(status);
+        return;
+      }
+      callback::StatusWaiter<Status> waiter(Status::OK);
+      for (int i = 0; i <= node->GetKeyCount(); ++i) {
+        self->AddReachableNodes(node->GetChildId(i), waiter.NewCallback());
+      }
+      waiter.Finalize(callback);
+    });
+  }
+
+  void Finish(Status status, ObjectId root_id) {
+    if (status != Status::OK) {
+      callback_(status, "", {});
+      return;
+    }
+    // Nodes written and then merged, split or rewritten by a later change are
+    // not part of the new tree.
+    ftl::RefPtr<TreeUpdater> self(this);
+    AddReachableNodes(root_id, [self, root_id](Status status) {
+      if (status != Status::OK) {
+        self->callback_(status, "", {});
+        return;
+      }
+      self->callback_(Status::OK, std::move(root_id),
+                      std::move(self->reachable_nodes_));
+    });
+  }
+
+  PageStorage* const page_storage_;
+  const size_t max_size_;
+  const size_t min_size_;
+  const std::vector<KeyRange> deleted_ranges_;
+  const std::vector<EntryChange> changes_;
+  std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+      callback_;
+
+  std::unordered_set<ObjectId> new_nodes_;
+  // The new nodes under the minimal size, which are not roots of a split.
+  std::unordered_set<ObjectId> underfull_nodes_;
+  // The new nodes which are part of the new tree.
+  std::unordered_set<ObjectId> reachable_nodes_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TreeUpdater);
+};
+
+// Tells whether keys, given in increasing order, are in any of the given
+// ranges, sorted by their start.
+class RangeFilter {
+ public:
+  explicit RangeFilter(const std::vector<KeyRange>& ranges)
+      : ranges_(ranges) {}
+
+  bool Contains(const std::string& key) {
+    // Ranges ending before |key| end before all the following keys too.
+    while (next_range_ < ranges_.size() && !ranges_[next_range_].end.empty() &&
+           ranges_[next_range_].end <= key) {
+      ++next_range_;
+    }
+    return next_range_ < ranges_.size() && ranges_[next_range_].start <= key;
+  }
+
+ private:
+  const std::vector<KeyRange>& ranges_;
+  size_t next_range_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(RangeFilter);
+};
+
 }  // namespace
 
+size_t GetMinNodeSize(size_t node_size) {
+  return node_size / 4;
+}
+
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback) {
+  ApplyChanges(page_storage, root_id, node_size, {}, std::move(changes),
+               std::move(callback));
+}
+
 void ApplyChanges(
     PageStorage* page_storage,
     ObjectIdView root_id,
     size_t node_size,
+    std::vector<KeyRange> deleted_ranges,
     std::unique_ptr<Iterator<const EntryChange>> changes,
     std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
         callback) {
-  // Get or create the root.
-  ObjectId tmp_node_id;
-  if (root_id.empty()) {
-    Status status =
-        TreeNode::FromEntries(page_storage, std::vector<Entry>(),
-                              std::vector<ObjectId>{ObjectId()}, &tmp_node_id);
+  // The changes are dispatched among the children of each node before the
+  // children are loaded.
+  std::vector<EntryChange> change_list;
+  for (; changes->Valid(); changes->Next()) {
+    change_list.push_back(**changes);
+  }
+  Status status = changes->GetStatus();
+  if (status != Status::OK) {
+    callback(status, "", {});
+    return;
+  }
+  TreeUpdater::Create(page_storage, node_size, std::move(deleted_ranges),
+                      std::move(change_list), std::move(callback))
+      ->Start(root_id);
+}
+
+void ApplyChangesByRebuilding(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback) {
+  ApplyChangesByRebuilding(page_storage, root_id, node_size, {},
+                           std::move(changes), std::move(callback));
+}
+
+void ApplyChangesByRebuilding(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::vector<KeyRange> deleted_ranges,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback) {
+  std::unique_ptr<BTreeIterator> entries;
+  if (!root_id.empty()) {
+    std::unique_ptr<const TreeNode> root;
+    Status status = TreeNode::FromIdSynchronous(page_storage, root_id, &root);
     if (status != Status::OK) {
-      callback(status, ObjectId(), {});
+      callback(status, "", {});
       return;
     }
-    root_id = tmp_node_id;
+    entries = std::make_unique<BTreeIterator>(std::move(root));
+  }
+
+  TreeBuilder builder(page_storage, node_size);
+  RangeFilter deleted(deleted_ranges);
+  Status status = Status::OK;
+  while (status == Status::OK && entries && entries->Valid()) {
+    if (!changes->Valid() || (*entries)->key < (*changes)->entry.key) {
+      // The entry is unchanged, unless it is in a deleted range.
+      if (!deleted.Contains((*entries)->key)) {
+        status = builder.Add(**entries);
+      }
+      entries->Next();
+      continue;
+    }
+    if ((*entries)->key == (*changes)->entry.key) {
+      entries->Next();
+    }
+    if (!(*changes)->deleted) {
+      status = builder.Add((*changes)->entry);
+    }
+    changes->Next();
+  }
+  if (status == Status::OK && entries) {
+    status = entries->GetStatus();
+  }
+  // Deletions of keys that are not in the tree are ignored, as journals collate
+  // all operations on a key in a single change.
+  for (; status == Status::OK && changes->Valid(); changes->Next()) {
+    if (!(*changes)->deleted) {
+      status = builder.Add((*changes)->entry);
+    }
+  }
+  if (status == Status::OK) {
+    status = changes->GetStatus();
+  }
+
+  ObjectId new_root_id;
+  if (status == Status::OK) {
+    status = builder.Finish(&new_root_id);
+  }
+  if (status != Status::OK) {
+    callback(status, "", {});
+    return;
+  }
+  callback(Status::OK, std::move(new_root_id), builder.new_nodes());
+}
+
+Status EstimateEntryCount(PageStorage* page_storage,
+                          ObjectIdView root_id,
+                          size_t* count) {
+  std::unique_ptr<const TreeNode> node;
+  Status status = TreeNode::FromIdSynchronous(page_storage, root_id, &node);
+  if (status != Status::OK) {
+    return status;
+  }
+  uint64_t entry_count = node->GetSubtreeEntryCount();
+  if (entry_count != kUnknownEntryCount) {
+    *count = entry_count;
+    return Status::OK;
+  }
+  // Without the entry counts of the children of the root, each node on the
+  // path stands for as many subtrees as it has children, and holds one entry
+  // less.
+  size_t subtree_count = 1;
+  *count = 0;
+  while (true) {
+    *count += subtree_count * node->GetKeyCount();
+    subtree_count *= node->GetKeyCount() + 1;
+    std::unique_ptr<const TreeNode> child;
+    status = node->GetChild(0, &child);
+    if (status == Status::NO_SUCH_CHILD) {
+      return Status::OK;
+    }
+    if (status != Status::OK) {
+      return status;
+    }
+    node = std::move(child);
   }
-  TreeNode::FromId(
-      page_storage, root_id, ftl::MakeCopyable([
-        page_storage, node_size, changes = std::move(changes),
-        callback = std::move(callback)
-      ](Status s, std::unique_ptr<const TreeNode> root) mutable {
-        if (s != Status::OK) {
-          callback(s, "", {});
-          return;
-        }
-        // |new_nodes| will be populated with all nodes created after this set
-        // of changes.
-        auto new_nodes = std::make_unique<std::unordered_set<ObjectId>>();
-        std::unordered_set<ObjectId>* new_nodes_ptr = new_nodes.get();
-        ApplyChangesIn(
-            page_storage, changes.get(), std::move(root), true, "", node_size,
-            new_nodes_ptr, ftl::MakeCopyable([
-              new_nodes = std::move(new_nodes), callback = std::move(callback)
-            ](Status s, ObjectId new_id,
-                           std::unique_ptr<TreeNode::Mutation::Updater>
-                               parent_updater) mutable {
-              FTL_DCHECK(parent_updater == nullptr);
-              if (s != Status::OK) {
-                callback(s, "", {});
-                return;
-              }
-              callback(Status::OK, std::move(new_id), std::move(*new_nodes));
-            }));
-      }));
+}
+
+Status GetEntryCount(PageStorage* page_storage,
+                     ObjectIdView root_id,
+                     convert::ExtendedStringView start,
+                     convert::ExtendedStringView end,
+                     uint64_t* count) {
+  uint64_t start_rank;
+  Status status = GetRank(page_storage, root_id, start, &start_rank);
+  if (status != Status::OK) {
+    return status;
+  }
+  uint64_t end_rank;
+  if (end.empty()) {
+    std::unique_ptr<const TreeNode> root;
+    status = TreeNode::FromIdSynchronous(page_storage, root_id, &root);
+    if (status != Status::OK) {
+      return status;
+    }
+    status = CountEntries(*root, &end_rank);
+  } else {
+    status = GetRank(page_storage, root_id, end, &end_rank);
+  }
+  if (status != Status::OK) {
+    return status;
+  }
+  *count = end_rank > start_rank ? end_rank - start_rank : 0;
+  return Status::OK;
+}
+
+Status GetEntryAtOffset(PageStorage* page_storage,
+                        ObjectIdView root_id,
+                        convert::ExtendedStringView start,
+                        uint64_t offset,
+                        Entry* entry) {
+  uint64_t position;
+  Status status = GetRank(page_storage, root_id, start, &position);
+  if (status != Status::OK) {
+    return status;
+  }
+  if (offset > UINT64_MAX - position) {
+    return Status::NOT_FOUND;
+  }
+  position += offset;
+
+  std::unique_ptr<const TreeNode> node;
+  status = TreeNode::FromIdSynchronous(page_storage, root_id, &node);
+  if (status != Status::OK) {
+    return status;
+  }
+  while (true) {
+    // Skip the children and entries of |node| before |position|, and descend
+    // in the child holding it, if it is not an entry of |node|.
+    int index = 0;
+    for (;; ++index) {
+      uint64_t child_count;
+      status = GetChildEntryCount(*node, index, &child_count);
+      if (status != Status::OK) {
+        return status;
+      }
+      if (position < child_count) {
+        break;
+      }
+      position -= child_count;
+      if (index == node->GetKeyCount()) {
+        return Status::NOT_FOUND;
+      }
+      if (position == 0) {
+        return node->GetEntry(index, entry);
+      }
+      --position;
+    }
+    std::unique_ptr<const TreeNode> child;
+    status = node->GetChild(index, &child);
+    if (status != Status::OK) {
+      return status;
+    }
+    node = std::move(child);
+  }
+}
+
+void GetEntries(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::vector<std::string> keys,
+    std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+        callback) {
+  FTL_DCHECK(std::is_sorted(keys.begin(), keys.end()));
+  MultiKeyLookUp::Create(page_storage, std::move(keys), std::move(callback))
+      ->Start(root_id);
 }
 
 void GetObjectIds(PageStorage* page_storage,
@@ -482,17 +1686,11 @@ void ForEachEntry(PageStorage* page_storage,
                   std::function<bool(EntryAndNodeId)> on_next,
                   std::function<void(Status)> on_done) {
   FTL_DCHECK(!root_id.empty());
-  page_storage->GetObject(
-      root_id, ftl::MakeCopyable([
+  TreeNode::FromId(
+      page_storage, root_id, ftl::MakeCopyable([
         min_key = std::move(min_key), page_storage,
         on_next = std::move(on_next), on_done = std::move(on_done)
-      ](Status status, std::unique_ptr<const Object> object) mutable {
-        if (status != Status::OK) {
-          on_done(status);
-          return;
-        }
-        std::unique_ptr<const TreeNode> root;
-        status = TreeNode::FromObject(page_storage, std::move(object), &root);
+      ](Status status, std::unique_ptr<const TreeNode> root) mutable {
         if (status != Status::OK) {
           on_done(status);
           return;
@@ -504,6 +1702,20 @@ void ForEachEntry(PageStorage* page_storage,
       }));
 }
 
+void ForEachEntryInRange(PageStorage* page_storage,
+                         ObjectIdView root_id,
+                         std::string start,
+                         std::string end,
+                         bool reverse,
+                         size_t prefetch_count,
+                         std::function<bool(Entry)> on_next,
+                         std::function<void(Status)> on_done) {
+  FTL_DCHECK(!root_id.empty());
+  RangeWalker::Create(page_storage, std::move(start), std::move(end), reverse,
+                      prefetch_count, std::move(on_next), std::move(on_done))
+      ->Start(root_id);
+}
+
 void ForEachDiff(PageStorage* page_storage,
                  ObjectIdView base_root_id,
                  ObjectIdView other_root_id,
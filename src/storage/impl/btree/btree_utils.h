@@ -7,7 +7,9 @@
 
 #include <memory>
 #include <unordered_set>
+#include <vector>
 
+#include "apps/ledger/src/convert/convert.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
 #include "apps/ledger/src/storage/public/types.h"
 
@@ -20,11 +22,46 @@ struct EntryAndNodeId {
   const ObjectId& node_id;
 };
 
+// Returns the minimal size in bytes of the encoded entries of a node other
+// than the root, for nodes of at most |node_size| bytes. Split nodes are about
+// half full, so that they can both gain and lose entries before being split or
+// merged again.
+size_t GetMinNodeSize(size_t node_size);
+
 // Applies changes provided by |changes| to the BTree starting at |root_id|.
-// |changes| must provide |EntryChange| objects sorted by their key. The
-// callback will provide the status of the operation, the id of the new root
-// and the list of ids of all new nodes created after the changes.
+// |changes| must provide |EntryChange| objects sorted by their key. Nodes are
+// split so that their encoded entries fit in |node_size| bytes, as computed by
+// |GetEncodedEntrySize()|, and the nodes left under |GetMinNodeSize()| are
+// merged with a sibling. The callback will provide the status of the
+// operation, the id of the new root and the list of ids of all new nodes
+// created after the changes.
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback);
+
+// Same as above, but first removes the entries with keys in any of
+// |deleted_ranges|, sorted by their start. Subtrees entirely within a range are
+// dropped without being read: only the nodes on the paths to the bounds of
+// each range are rewritten, and are split or merged as above.
 void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::vector<KeyRange> deleted_ranges,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback);
+
+// Applies changes provided by |changes| to the BTree starting at |root_id|, by
+// building a new tree bottom-up from the entries of the tree merged with the
+// changes. This reads the whole tree, but is faster than |ApplyChanges()| when
+// the changes are numerous relative to the size of the tree. Arguments are the
+// same as for |ApplyChanges()|.
+void ApplyChangesByRebuilding(
     PageStorage* page_storage,
     ObjectIdView root_id,
     size_t node_size,
@@ -32,6 +69,55 @@ void ApplyChanges(
     std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
         callback);
 
+// Same as above, but the entries of the tree with keys in any of
+// |deleted_ranges|, sorted by their start, are dropped.
+void ApplyChangesByRebuilding(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    size_t node_size,
+    std::vector<KeyRange> deleted_ranges,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback);
+
+// Estimates the number of entries of the BTree starting at |root_id|. The count
+// is exact if it is recorded in the root, and otherwise estimated from the
+// nodes on the path to its first leaf.
+Status EstimateEntryCount(PageStorage* page_storage,
+                          ObjectIdView root_id,
+                          size_t* count);
+
+// Stores in |count| the number of entries of the BTree starting at |root_id|
+// with keys in [|start|, |end|). An empty |end| means that the range has no
+// upper bound. Only the nodes on the paths to |start| and |end| are read,
+// except for subtrees whose entry count is not recorded in their parent.
+Status GetEntryCount(PageStorage* page_storage,
+                     ObjectIdView root_id,
+                     convert::ExtendedStringView start,
+                     convert::ExtendedStringView end,
+                     uint64_t* count);
+
+// Stores in |entry| the entry at position |offset|, counting from 0, among the
+// entries of the BTree starting at |root_id| with keys equal or after |start|.
+// Returns |NOT_FOUND| if there are |offset| such entries or less. Only the
+// nodes on the paths to |start| and to the entry are read, except for subtrees
+// whose entry count is not recorded in their parent.
+Status GetEntryAtOffset(PageStorage* page_storage,
+                        ObjectIdView root_id,
+                        convert::ExtendedStringView start,
+                        uint64_t offset,
+                        Entry* entry);
+
+// Looks up the entries of the BTree starting at |root_id| with the given
+// |keys|, in increasing order, and calls |callback| with, for each key, its
+// entry, or null if the key is not present. The keys are looked up together:
+// each node on the paths to the keys is read once.
+void GetEntries(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::vector<std::string> keys,
+    std::function<void(Status, std::vector<std::unique_ptr<Entry>>)> callback);
+
 // Retrieves the ids of all objects in the BTree, i.e tree nodes and values of
 // entries in the tree. After a successfull call, |callback| will be called
 // with the set of results.
@@ -59,6 +145,31 @@ void ForEachEntry(PageStorage* page_storage,
                   std::function<bool(EntryAndNodeId)> on_next,
                   std::function<void(Status)> on_done);
 
+// Number of tree nodes requested ahead of the current position by
+// |ForEachEntryInRange()|.
+constexpr size_t kPrefetchNodeCount = 8;
+
+// Iterates asynchronously through the entries of the tree with the given root
+// with keys in [|start|, |end|), in increasing key order, or in decreasing key
+// order if |reverse| is true, and calls |on_next| on each of them. An empty
+// |end| means that the range has no upper bound. Returning false from
+// |on_next| stops the iteration. |on_done| is called once, when there are no
+// more entries, the iteration was stopped, or an error occurs.
+//
+// Nodes are loaded with |PageStorage::GetObject()|, and so downloaded from
+// sync if they are not available locally. Up to |prefetch_count| of the
+// siblings following the current child of each node on the current path are
+// requested ahead of time, so that they are loaded while the entries before
+// them are being processed.
+void ForEachEntryInRange(PageStorage* page_storage,
+                         ObjectIdView root_id,
+                         std::string start,
+                         std::string end,
+                         bool reverse,
+                         size_t prefetch_count,
+                         std::function<bool(Entry)> on_next,
+                         std::function<void(Status)> on_done);
+
 // Iterates through the differences between two trees given their root ids
 // |base_root_id| and |other_root_id| and calls |on_next| on found differences.
 // Returning false from |on_next| will immediately stop the iteration. |on_done|
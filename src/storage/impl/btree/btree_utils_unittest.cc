@@ -6,14 +6,22 @@
 
 #include <stdio.h>
 
+#include <algorithm>
+#include <set>
+#include <utility>
+#include <vector>
+
 #include "apps/ledger/src/storage/fake/fake_page_storage.h"
 #include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
 #include "apps/ledger/src/storage/impl/btree/entry_change_iterator.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "apps/ledger/src/storage/public/constants.h"
 #include "apps/ledger/src/storage/public/types.h"
 #include "apps/ledger/src/test/capture.h"
 #include "apps/ledger/src/test/test_with_message_loop.h"
 #include "gtest/gtest.h"
+#include "lib/ftl/functional/make_copyable.h"
 #include "lib/ftl/logging.h"
 #include "lib/ftl/strings/string_printf.h"
 #include "lib/mtl/socket/strings.h"
@@ -22,7 +30,13 @@
 namespace storage {
 namespace {
 
-const int kTestNodeSize = 4;
+// Number of test entries, with keys "keyXX", fitting in a node.
+const int kTestEntriesPerNode = 4;
+
+const size_t kTestNodeSize =
+    kTestEntriesPerNode *
+    GetEncodedEntrySize(
+        Entry{"key00", ObjectId(kObjectIdSize, 'a'), KeyPriority::EAGER});
 
 class TrackGetObjectFakePageStorage : public fake::FakePageStorage {
  public:
@@ -34,10 +48,29 @@ class TrackGetObjectFakePageStorage : public fake::FakePageStorage {
       const std::function<void(Status, std::unique_ptr<const Object>)>&
           callback) override {
     object_requests.insert(object_id.ToString());
-    fake::FakePageStorage::GetObject(object_id, callback);
+    ++object_request_count;
+    if (!delay_get_object) {
+      fake::FakePageStorage::GetObject(object_id, callback);
+      return;
+    }
+    // Returns the object from the message loop, as when it is read from disk
+    // or downloaded.
+    fake::FakePageStorage::GetObject(object_id, [callback](
+        Status status, std::unique_ptr<const Object> object) {
+      mtl::MessageLoop::GetCurrent()->task_runner()->PostTask(
+          ftl::MakeCopyable([ callback, status, object = std::move(object) ](
+              ) mutable { callback(status, std::move(object)); }));
+    });
+  }
+
+  Status ContainsObject(ObjectIdView object_id) override {
+    return objects_stored_locally ? Status::OK : Status::NOT_FOUND;
   }
 
   std::set<ObjectId> object_requests;
+  size_t object_request_count = 0;
+  bool delay_get_object = false;
+  bool objects_stored_locally = false;
 };
 
 class BTreeUtilsTest : public ::test::TestWithMessageLoop {
@@ -90,6 +123,104 @@ class BTreeUtilsTest : public ::test::TestWithMessageLoop {
     return new_root_id;
   }
 
+  // Returns the keys found by |btree::ForEachEntryInRange()| in the given
+  // range, stopping after |max_count| of them if it is not 0.
+  std::vector<std::string> ScanRange(ObjectIdView root_id,
+                                     std::string start,
+                                     std::string end,
+                                     bool reverse,
+                                     size_t prefetch_count,
+                                     size_t max_count = 0) {
+    std::vector<std::string> keys;
+    Status status;
+    btree::ForEachEntryInRange(
+        &fake_storage_, root_id, std::move(start), std::move(end), reverse,
+        prefetch_count,
+        [&keys, max_count](Entry entry) {
+          keys.push_back(entry.key);
+          return max_count == 0 || keys.size() < max_count;
+        },
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::OK, status);
+    return keys;
+  }
+
+  // Checks that the entry counts recorded in the subtree with the given root
+  // match its contents, and returns its number of entries.
+  uint64_t CheckEntryCounts(ObjectIdView node_id) {
+    std::unique_ptr<const TreeNode> node;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+    uint64_t count = node->GetKeyCount();
+    for (int i = 0; i <= node->GetKeyCount(); ++i) {
+      ObjectId child_id = node->GetChildId(i);
+      uint64_t child_count = child_id.empty() ? 0 : CheckEntryCounts(child_id);
+      EXPECT_EQ(child_count, node->GetChildEntryCount(i));
+      count += child_count;
+    }
+    EXPECT_EQ(count, node->GetSubtreeEntryCount());
+    return count;
+  }
+
+  // Returns the depths at which the tree with root |root_id| has empty
+  // children: the tree is balanced if they are all the same.
+  std::set<int> GetLeafDepths(ObjectIdView root_id) {
+    std::set<int> depths;
+    std::vector<std::pair<ObjectId, int>> pending;
+    pending.emplace_back(root_id.ToString(), 1);
+    while (!pending.empty()) {
+      std::pair<ObjectId, int> node_and_depth = std::move(pending.back());
+      pending.pop_back();
+      std::unique_ptr<const TreeNode> node;
+      EXPECT_EQ(Status::OK,
+                TreeNode::FromIdSynchronous(
+                    &fake_storage_, node_and_depth.first, &node));
+      for (int i = 0; i <= node->GetKeyCount(); ++i) {
+        ObjectId child_id = node->GetChildId(i);
+        if (child_id.empty()) {
+          depths.insert(node_and_depth.second);
+        } else {
+          pending.emplace_back(std::move(child_id),
+                               node_and_depth.second + 1);
+        }
+      }
+    }
+    return depths;
+  }
+
+  // Checks that the nodes of the tree with root |root_id| fit in |node_size|
+  // bytes, unless they have less than 3 entries and cannot be split, and that
+  // all of them but the root are at least |btree::GetMinNodeSize()| large.
+  void CheckNodeSizes(ObjectIdView root_id, size_t node_size) {
+    std::vector<ObjectId> pending;
+    pending.push_back(root_id.ToString());
+    while (!pending.empty()) {
+      ObjectId node_id = std::move(pending.back());
+      pending.pop_back();
+      std::unique_ptr<const TreeNode> node;
+      ASSERT_EQ(Status::OK,
+                TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+      size_t size = 0;
+      for (int i = 0; i < node->GetKeyCount(); ++i) {
+        Entry entry;
+        ASSERT_EQ(Status::OK, node->GetEntry(i, &entry));
+        size += GetEncodedEntrySize(entry);
+      }
+      if (node->GetKeyCount() >= 3) {
+        EXPECT_LE(size, node_size);
+      }
+      if (node_id != root_id) {
+        EXPECT_GE(size, btree::GetMinNodeSize(node_size));
+      }
+      for (int i = 0; i <= node->GetKeyCount(); ++i) {
+        if (!node->GetChildId(i).empty()) {
+          pending.push_back(node->GetChildId(i));
+        }
+      }
+    }
+  }
+
  protected:
   TrackGetObjectFakePageStorage fake_storage_;
 
@@ -107,7 +238,7 @@ TEST_F(BTreeUtilsTest, ApplyChangesFromEmpty) {
   // Expected layout (X is key "keyX"):
   // [1, 2, 3, 4]
   btree::ApplyChanges(
-      &fake_storage_, root_id, 4,
+      &fake_storage_, root_id, kTestNodeSize,
       std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
       ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
                       &new_root_id, &new_nodes));
@@ -137,7 +268,7 @@ TEST_F(BTreeUtilsTest, ApplyChangesManyEntries) {
   //                 [03, 07]
   //            /       |            \
   // [00, 01, 02]  [04, 05, 06] [08, 09, 10]
-  btree::ApplyChanges(&fake_storage_, root_id, 4,
+  btree::ApplyChanges(&fake_storage_, root_id, kTestNodeSize,
                       std::make_unique<EntryChangeIterator>(
                           golden_entries.begin(), golden_entries.end()),
                       ::test::Capture([this] { message_loop_.PostQuitTask(); },
@@ -169,7 +300,7 @@ TEST_F(BTreeUtilsTest, ApplyChangesManyEntries) {
   //                 [03, 07]
   //            /       |            \
   // [00, 01, 02]  [04, 05, 06] [071, 08, 09, 10]
-  btree::ApplyChanges(&fake_storage_, new_root_id, 4,
+  btree::ApplyChanges(&fake_storage_, new_root_id, kTestNodeSize,
                       std::make_unique<EntryChangeIterator>(new_change.begin(),
                                                             new_change.end()),
                       ::test::Capture([this] { message_loop_.PostQuitTask(); },
@@ -216,7 +347,7 @@ TEST_F(BTreeUtilsTest, DeleteChanges) {
   Status status;
   ObjectId new_root_id;
   std::unordered_set<ObjectId> new_nodes;
-  btree::ApplyChanges(&fake_storage_, root_id, 4,
+  btree::ApplyChanges(&fake_storage_, root_id, kTestNodeSize,
                       std::make_unique<EntryChangeIterator>(
                           delete_changes.begin(), delete_changes.end()),
                       ::test::Capture([this] { message_loop_.PostQuitTask(); },
@@ -246,6 +377,484 @@ TEST_F(BTreeUtilsTest, DeleteChanges) {
   EXPECT_FALSE(entries->Valid());
 }
 
+TEST_F(BTreeUtilsTest, DeleteAllChanges) {
+  std::vector<EntryChange> changes = CreateEntryChanges(11);
+  ObjectId root_id = CreateTree(changes);
+  for (EntryChange& change : changes) {
+    change.deleted = true;
+  }
+
+  // The root left without entries is replaced by its child.
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  btree::ApplyChanges(
+      &fake_storage_, root_id, kTestNodeSize,
+      std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+
+  std::unique_ptr<const TreeNode> root;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromIdSynchronous(&fake_storage_, new_root_id, &root));
+  EXPECT_EQ(0, root->GetKeyCount());
+  EXPECT_TRUE(root->GetChildId(0).empty());
+}
+
+TEST_F(BTreeUtilsTest, DeleteEntriesAndUpdateTheirChildren) {
+  // Expected layout (XX is key "keyXX"):
+  //                 [03, 07]
+  //            /       |            \
+  // [00, 01, 02]  [04, 05, 06] [08, 09, 10]
+  std::vector<EntryChange> entries = CreateEntryChanges(11);
+  ObjectId root_id = CreateTree(entries);
+
+  // Both entries of the root are deleted, and all the children are updated:
+  // the merged children are the updated ones.
+  std::vector<EntryChange> changes;
+  changes.push_back(EntryChange{entries[2].entry, true});
+  changes.push_back(EntryChange{entries[3].entry, true});
+  changes.push_back(EntryChange{
+      Entry{"key05", entries[0].entry.object_id, KeyPriority::LAZY}, false});
+  changes.push_back(EntryChange{entries[7].entry, true});
+  changes.push_back(EntryChange{
+      Entry{"key075", entries[0].entry.object_id, KeyPriority::EAGER}, false});
+  changes.push_back(EntryChange{entries[8].entry, true});
+
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  btree::ApplyChanges(
+      &fake_storage_, root_id, kTestNodeSize,
+      std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+
+  std::vector<std::string> expected_keys = {
+      "key00", "key01", "key04", "key05", "key06", "key075", "key09", "key10"};
+  EXPECT_EQ(expected_keys, ScanRange(new_root_id, "", "", false, 0));
+  Entry entry;
+  TreeNode::FindEntry(&fake_storage_, new_root_id, "key05",
+                      ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                      &status, &entry));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  EXPECT_EQ(KeyPriority::LAZY, entry.priority);
+  EXPECT_EQ(expected_keys.size(), CheckEntryCounts(new_root_id));
+  EXPECT_EQ(1u, GetLeafDepths(new_root_id).size());
+  CheckNodeSizes(new_root_id, kTestNodeSize);
+}
+
+TEST_F(BTreeUtilsTest, DeleteAndInsertKeepNodeSizes) {
+  // Nodes hold up to 8 entries, and at least 2 but the root.
+  const size_t node_size = 2 * kTestNodeSize;
+  // Nodes are loaded asynchronously, as when they are downloaded.
+  fake_storage_.delay_get_object = true;
+  std::vector<EntryChange> entries = CreateEntryChanges(100);
+  ObjectId root_id = CreateEmptyContents();
+  std::set<std::string> keys;
+
+  // Applies the changes for the entries at positions in [begin, end) with the
+  // given |step|, and checks the resulting tree.
+  auto apply = [&](int begin, int end, int step, bool deleted) {
+    std::vector<EntryChange> changes;
+    for (int i = begin; i < end; i += step) {
+      changes.push_back(EntryChange{entries[i].entry, deleted});
+      if (deleted) {
+        keys.erase(entries[i].entry.key);
+      } else {
+        keys.insert(entries[i].entry.key);
+      }
+    }
+    Status status;
+    std::unordered_set<ObjectId> new_nodes;
+    btree::ApplyChanges(
+        &fake_storage_, root_id, node_size,
+        std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &root_id, &new_nodes));
+    ASSERT_FALSE(RunLoopWithTimeout());
+    ASSERT_EQ(Status::OK, status);
+    EXPECT_EQ(std::vector<std::string>(keys.begin(), keys.end()),
+              ScanRange(root_id, "", "", false, 0));
+    EXPECT_EQ(keys.size(), CheckEntryCounts(root_id));
+    EXPECT_EQ(1u, GetLeafDepths(root_id).size());
+    CheckNodeSizes(root_id, node_size);
+  };
+
+  apply(0, 100, 1, false);
+  // Deletes most of the entries, leaving nodes with a few entries each.
+  apply(0, 100, 3, true);
+  apply(1, 100, 3, true);
+  // Inserts them again, and deletes all but one entry out of 10, which would
+  // leave leaves without entries.
+  apply(0, 100, 1, false);
+  for (int i = 1; i < 10; ++i) {
+    apply(i, 100, 10, true);
+  }
+  // Inserts them again, then deletes a contiguous run of entries, which
+  // empties whole subtrees.
+  apply(0, 100, 1, false);
+  apply(20, 80, 1, true);
+  apply(30, 70, 2, false);
+  // Deletes all but a few entries.
+  apply(0, 95, 1, true);
+  apply(0, 100, 7, false);
+}
+
+TEST_F(BTreeUtilsTest, ApplyChangesNodeSizeInBytes) {
+  const size_t node_size = 4096;
+  // Stores in |height| the height of the subtree with the given root, after
+  // checking that its nodes fit in |node_size| and its leaves are all at the
+  // same depth.
+  std::function<void(ObjectIdView, int*)> check_node =
+      [this, node_size, &check_node](ObjectIdView node_id, int* height) {
+        std::unique_ptr<const TreeNode> node;
+        ASSERT_EQ(Status::OK,
+                  TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+        size_t size = 0;
+        for (int i = 0; i < node->GetKeyCount(); ++i) {
+          Entry entry;
+          ASSERT_EQ(Status::OK, node->GetEntry(i, &entry));
+          size += GetEncodedEntrySize(entry);
+        }
+        EXPECT_LE(size, node_size);
+        *height = -1;
+        for (int i = 0; i <= node->GetKeyCount(); ++i) {
+          int child_height = -1;
+          if (!node->GetChildId(i).empty()) {
+            check_node(node->GetChildId(i), &child_height);
+          }
+          if (i > 0) {
+            EXPECT_EQ(*height, child_height + 1);
+          }
+          *height = child_height + 1;
+        }
+      };
+
+  // Nodes hold about 45 entries with small keys, but 3 with large ones.
+  for (size_t key_size : {8u, 1000u}) {
+    std::vector<EntryChange> changes;
+    for (int i = 0; i < 100; ++i) {
+      std::string key = ftl::StringPrintf("key%03d", i);
+      key.resize(key_size, '_');
+      changes.push_back(EntryChange{
+          Entry{key, ObjectId(kObjectIdSize, 'a'), KeyPriority::EAGER},
+          false});
+    }
+    // Insert the entries in several steps, so that nodes are split.
+    ObjectId root_id = CreateEmptyContents();
+    for (int step = 0; step < 4; ++step) {
+      std::vector<EntryChange> step_changes;
+      for (size_t i = step; i < changes.size(); i += 4) {
+        step_changes.push_back(changes[i]);
+      }
+      Status status;
+      std::unordered_set<ObjectId> new_nodes;
+      btree::ApplyChanges(
+          &fake_storage_, root_id, node_size,
+          std::make_unique<EntryChangeIterator>(step_changes.begin(),
+                                                step_changes.end()),
+          ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                          &root_id, &new_nodes));
+      ASSERT_FALSE(RunLoopWithTimeout());
+      ASSERT_EQ(Status::OK, status);
+    }
+
+    int height;
+    check_node(root_id, &height);
+    EXPECT_EQ(key_size == 8u ? 1 : 3, height);
+
+    CommitContentsImpl reader(root_id, &fake_storage_);
+    std::unique_ptr<Iterator<const Entry>> it = reader.begin();
+    for (const EntryChange& change : changes) {
+      ASSERT_TRUE(it->Valid());
+      EXPECT_EQ(change.entry, **it);
+      it->Next();
+    }
+    EXPECT_FALSE(it->Valid());
+  }
+}
+
+TEST_F(BTreeUtilsTest, ApplyChangesByRebuilding) {
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK, fake_storage_.AddObjectSynchronous("change1", &object));
+  ObjectId object_id = object->GetId();
+
+  std::vector<EntryChange> entries = CreateEntryChanges(50);
+  ObjectId base_root_id = CreateTree(entries);
+
+  std::vector<EntryChange> changes;
+  // Update value for key01.
+  changes.push_back(
+      EntryChange{Entry{"key01", object_id, KeyPriority::LAZY}, false});
+  // Add entry key255.
+  changes.push_back(
+      EntryChange{Entry{"key255", object_id, KeyPriority::LAZY}, false});
+  // Remove entry key40.
+  changes.push_back(EntryChange{Entry{"key40", "", KeyPriority::LAZY}, true});
+  // Remove entry key99, which is not in the tree.
+  changes.push_back(EntryChange{Entry{"key99", "", KeyPriority::LAZY}, true});
+
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  btree::ApplyChangesByRebuilding(
+      &fake_storage_, base_root_id, kTestNodeSize,
+      std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  EXPECT_TRUE(new_nodes.find(new_root_id) != new_nodes.end());
+
+  std::vector<Entry> expected_entries;
+  for (const EntryChange& change : entries) {
+    if (change.entry.key == "key01") {
+      expected_entries.push_back(changes[0].entry);
+    } else if (change.entry.key == "key25") {
+      expected_entries.push_back(change.entry);
+      expected_entries.push_back(changes[1].entry);
+    } else if (change.entry.key != "key40") {
+      expected_entries.push_back(change.entry);
+    }
+  }
+  CommitContentsImpl reader(new_root_id, &fake_storage_);
+  std::unique_ptr<Iterator<const Entry>> it = reader.begin();
+  for (const Entry& entry : expected_entries) {
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(entry, **it);
+    it->Next();
+  }
+  EXPECT_FALSE(it->Valid());
+
+  // Building from an empty tree.
+  std::vector<EntryChange> golden_entries = CreateEntryChanges(24);
+  btree::ApplyChangesByRebuilding(
+      &fake_storage_, CreateEmptyContents(), kTestNodeSize,
+      std::make_unique<EntryChangeIterator>(golden_entries.begin(),
+                                            golden_entries.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  // Expected layout (XX is key "keyXX"):
+  //                      [04, 09, 14, 19]
+  //            /       /        |         \          \
+  // [00, ..., 03] [05, ..., 08] ... [15, ..., 18] [20, ..., 23]
+  EXPECT_EQ(6u, new_nodes.size());
+  size_t count;
+  EXPECT_EQ(Status::OK,
+            btree::EstimateEntryCount(&fake_storage_, new_root_id, &count));
+  EXPECT_EQ(24u, count);
+}
+
+TEST_F(BTreeUtilsTest, ApplyChangesWithDeletedRanges) {
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK, fake_storage_.AddObjectSynchronous("change1", &object));
+  ObjectId object_id = object->GetId();
+
+  std::vector<EntryChange> entries = CreateEntryChanges(100);
+  ObjectId base_root_id = CreateTree(entries);
+  Status status;
+  std::set<ObjectId> base_object_ids;
+  btree::GetObjectIds(&fake_storage_, base_root_id,
+                      ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                      &status, &base_object_ids));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+
+  std::vector<KeyRange> deleted_ranges = {{"key10", "key60"}, {"key80", ""}};
+  std::vector<EntryChange> changes;
+  // Remove entry key05.
+  changes.push_back(EntryChange{Entry{"key05", "", KeyPriority::LAZY}, true});
+  // Add entry key30 again, after the deletion of its range.
+  changes.push_back(
+      EntryChange{Entry{"key30", object_id, KeyPriority::LAZY}, false});
+
+  std::vector<std::string> expected_keys;
+  for (int i = 0; i < 80; ++i) {
+    if (i < 10 && i != 5) {
+      expected_keys.push_back(ftl::StringPrintf("key%02d", i));
+    } else if (i == 30 || i >= 60) {
+      expected_keys.push_back(ftl::StringPrintf("key%02d", i));
+    }
+  }
+
+  for (bool rebuild : {false, true}) {
+    ObjectId new_root_id;
+    std::unordered_set<ObjectId> new_nodes;
+    auto changes_it =
+        std::make_unique<EntryChangeIterator>(changes.begin(), changes.end());
+    auto callback = ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                    &status, &new_root_id, &new_nodes);
+    if (rebuild) {
+      btree::ApplyChangesByRebuilding(&fake_storage_, base_root_id,
+                                      kTestNodeSize, deleted_ranges,
+                                      std::move(changes_it), callback);
+    } else {
+      btree::ApplyChanges(&fake_storage_, base_root_id, kTestNodeSize,
+                          deleted_ranges, std::move(changes_it), callback);
+    }
+    ASSERT_FALSE(RunLoopWithTimeout());
+    ASSERT_EQ(Status::OK, status);
+    EXPECT_EQ(expected_keys, ScanRange(new_root_id, "", "", false, 0));
+    EXPECT_EQ(expected_keys.size(), CheckEntryCounts(new_root_id));
+
+    // All the new nodes are in the new tree.
+    std::set<ObjectId> object_ids;
+    btree::GetObjectIds(
+        &fake_storage_, new_root_id,
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &object_ids));
+    ASSERT_FALSE(RunLoopWithTimeout());
+    ASSERT_EQ(Status::OK, status);
+    for (const ObjectId& node_id : new_nodes) {
+      EXPECT_EQ(1u, object_ids.count(node_id));
+    }
+    if (!rebuild) {
+      // Only the nodes on the paths to the bounds of the ranges and to the
+      // changed keys are rewritten.
+      EXPECT_GE(10u, new_nodes.size());
+      EXPECT_LT(3 * new_nodes.size(), base_object_ids.size());
+    }
+  }
+}
+
+TEST_F(BTreeUtilsTest, ApplyChangesDeletedRangesKeepBalance) {
+  std::vector<EntryChange> entries = CreateEntryChanges(100);
+  ObjectId base_root_id = CreateTree(entries);
+  ASSERT_EQ(1u, GetLeafDepths(base_root_id).size());
+
+  // Ranges with bounds in subtrees of different heights once trimmed, e.g.
+  // ones spanning several levels of the tree.
+  for (int begin = 0; begin < 100; begin += 7) {
+    for (int end = begin + 1; end <= 100; end += 5) {
+      std::string start_key = ftl::StringPrintf("key%02d", begin);
+      std::string end_key = end == 100 ? "" : ftl::StringPrintf("key%02d", end);
+      std::vector<std::string> expected_keys;
+      for (int i = 0; i < 100; ++i) {
+        if (i < begin || i >= end) {
+          expected_keys.push_back(ftl::StringPrintf("key%02d", i));
+        }
+      }
+
+      Status status;
+      ObjectId new_root_id;
+      std::unordered_set<ObjectId> new_nodes;
+      std::vector<EntryChange> changes;
+      btree::ApplyChanges(
+          &fake_storage_, base_root_id, kTestNodeSize,
+          {KeyRange{start_key, end_key}},
+          std::make_unique<EntryChangeIterator>(changes.begin(),
+                                                changes.end()),
+          ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                          &new_root_id, &new_nodes));
+      ASSERT_FALSE(RunLoopWithTimeout());
+      ASSERT_EQ(Status::OK, status);
+      EXPECT_EQ(expected_keys, ScanRange(new_root_id, "", "", false, 0));
+      EXPECT_EQ(expected_keys.size(), CheckEntryCounts(new_root_id));
+      EXPECT_EQ(1u, GetLeafDepths(new_root_id).size())
+          << "Deleting [" << start_key << ", " << end_key << ")";
+      CheckNodeSizes(new_root_id, kTestNodeSize);
+    }
+  }
+}
+
+TEST_F(BTreeUtilsTest, DeletedRangesKeepNodeSizes) {
+  // Nodes hold up to 8 entries, and at least 2 but the root.
+  const size_t node_size = 2 * kTestNodeSize;
+  // Nodes are loaded asynchronously, as when they are downloaded.
+  fake_storage_.delay_get_object = true;
+  std::vector<EntryChange> entries = CreateEntryChanges(100);
+  ObjectId root_id = CreateEmptyContents();
+  std::set<std::string> keys;
+
+  // Deletes the ranges of entries at positions [begin, begin + length), with
+  // the given |step| between their beginnings, and inserts the entries at
+  // positions in |inserted|, then checks the resulting tree.
+  auto apply = [&](int begin, int length, int step,
+                   std::vector<int> inserted) {
+    std::vector<KeyRange> ranges;
+    for (int i = begin; length > 0 && i < 100; i += step) {
+      int end = std::min(i + length, 100);
+      ranges.push_back(KeyRange{entries[i].entry.key,
+                                end == 100 ? "" : entries[end].entry.key});
+      for (int j = i; j < end; ++j) {
+        keys.erase(entries[j].entry.key);
+      }
+    }
+    std::vector<EntryChange> changes;
+    for (int i : inserted) {
+      changes.push_back(entries[i]);
+      keys.insert(entries[i].entry.key);
+    }
+    Status status;
+    std::unordered_set<ObjectId> new_nodes;
+    btree::ApplyChanges(
+        &fake_storage_, root_id, node_size, std::move(ranges),
+        std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &root_id, &new_nodes));
+    ASSERT_FALSE(RunLoopWithTimeout());
+    ASSERT_EQ(Status::OK, status);
+    EXPECT_EQ(std::vector<std::string>(keys.begin(), keys.end()),
+              ScanRange(root_id, "", "", false, 0));
+    EXPECT_EQ(keys.size(), CheckEntryCounts(root_id));
+    EXPECT_EQ(1u, GetLeafDepths(root_id).size());
+    CheckNodeSizes(root_id, node_size);
+  };
+
+  std::vector<int> all(100);
+  for (int i = 0; i < 100; ++i) {
+    all[i] = i;
+  }
+  apply(0, 0, 100, all);
+  // Repeatedly deletes short ranges spread over the tree, which leave nodes
+  // with few entries at the bounds of each range.
+  for (int i = 0; i < 10; ++i) {
+    apply(i, 1, 10, {});
+  }
+  apply(0, 0, 100, all);
+  for (int i = 0; i < 5; ++i) {
+    apply(2 * i, 2, 10, {});
+  }
+  // Deletes long ranges, which drop whole subtrees, while inserting entries
+  // on their sides.
+  apply(0, 0, 100, all);
+  apply(10, 30, 50, {5, 45, 55, 95});
+  apply(0, 0, 100, all);
+  apply(5, 90, 100, {0, 1, 2, 3, 4, 95, 96, 97, 98, 99});
+  apply(3, 2, 100, {});
+}
+
+TEST_F(BTreeUtilsTest, ApplyChangesDeleteAll) {
+  std::vector<EntryChange> entries = CreateEntryChanges(50);
+  ObjectId base_root_id = CreateTree(entries);
+
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  std::vector<EntryChange> changes;
+  btree::ApplyChanges(
+      &fake_storage_, base_root_id, kTestNodeSize, {KeyRange{"", ""}},
+      std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  EXPECT_EQ(std::unordered_set<ObjectId>({new_root_id}), new_nodes);
+  std::unique_ptr<const TreeNode> root;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromIdSynchronous(&fake_storage_, new_root_id, &root));
+  EXPECT_EQ(0, root->GetKeyCount());
+  EXPECT_TRUE(root->GetChildId(0).empty());
+}
+
 TEST_F(BTreeUtilsTest, GetObjectIdsFromEmpty) {
   ObjectId root_id = CreateEmptyContents();
   Status status;
@@ -260,7 +869,7 @@ TEST_F(BTreeUtilsTest, GetObjectIdsFromEmpty) {
 }
 
 TEST_F(BTreeUtilsTest, GetObjectOneNodeTree) {
-  std::vector<EntryChange> entries = CreateEntryChanges(kTestNodeSize);
+  std::vector<EntryChange> entries = CreateEntryChanges(kTestEntriesPerNode);
   ObjectId root_id = CreateTree(entries);
 
   Status status;
@@ -420,5 +1029,279 @@ TEST_F(BTreeUtilsTest, ForEachDiff) {
   EXPECT_EQ(changes.size(), current_change);
 }
 
+TEST_F(BTreeUtilsTest, EntryCounts) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+  EXPECT_EQ(100u, CheckEntryCounts(root_id));
+
+  // Counts are kept up to date when entries are deleted, and nodes merged.
+  for (size_t i = 0; i < changes.size(); i += 3) {
+    std::vector<EntryChange> deletion = {EntryChange{changes[i].entry, true}};
+    Status status;
+    ObjectId new_root_id;
+    std::unordered_set<ObjectId> new_nodes;
+    btree::ApplyChanges(
+        &fake_storage_, root_id, kTestNodeSize,
+        std::make_unique<EntryChangeIterator>(deletion.begin(),
+                                              deletion.end()),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &new_root_id, &new_nodes));
+    ASSERT_FALSE(RunLoopWithTimeout());
+    ASSERT_EQ(Status::OK, status);
+    root_id = new_root_id;
+  }
+  EXPECT_EQ(66u, CheckEntryCounts(root_id));
+}
+
+TEST_F(BTreeUtilsTest, GetEntryCount) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+
+  uint64_t count;
+  EXPECT_EQ(Status::OK,
+            btree::GetEntryCount(&fake_storage_, root_id, "", "", &count));
+  EXPECT_EQ(100u, count);
+  EXPECT_EQ(Status::OK, btree::GetEntryCount(&fake_storage_, root_id, "key10",
+                                             "key20", &count));
+  EXPECT_EQ(10u, count);
+  EXPECT_EQ(Status::OK, btree::GetEntryCount(&fake_storage_, root_id, "key105",
+                                             "key2", &count));
+  EXPECT_EQ(9u, count);
+  EXPECT_EQ(Status::OK,
+            btree::GetEntryCount(&fake_storage_, root_id, "key95", "", &count));
+  EXPECT_EQ(5u, count);
+  EXPECT_EQ(Status::OK,
+            btree::GetEntryCount(&fake_storage_, root_id, "z", "", &count));
+  EXPECT_EQ(0u, count);
+  EXPECT_EQ(Status::OK, btree::GetEntryCount(&fake_storage_, root_id, "key50",
+                                             "key50", &count));
+  EXPECT_EQ(0u, count);
+}
+
+TEST_F(BTreeUtilsTest, GetEntryAtOffset) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+
+  Entry entry;
+  for (size_t i = 0; i < changes.size(); ++i) {
+    ASSERT_EQ(Status::OK,
+              btree::GetEntryAtOffset(&fake_storage_, root_id, "", i, &entry));
+    EXPECT_EQ(changes[i].entry, entry);
+  }
+  EXPECT_EQ(Status::NOT_FOUND, btree::GetEntryAtOffset(
+                                   &fake_storage_, root_id, "", 100, &entry));
+
+  EXPECT_EQ(Status::OK, btree::GetEntryAtOffset(&fake_storage_, root_id,
+                                                "key50", 10, &entry));
+  EXPECT_EQ(changes[60].entry, entry);
+  EXPECT_EQ(Status::OK, btree::GetEntryAtOffset(&fake_storage_, root_id,
+                                                "key505", 0, &entry));
+  EXPECT_EQ(changes[51].entry, entry);
+  EXPECT_EQ(Status::NOT_FOUND, btree::GetEntryAtOffset(
+                                   &fake_storage_, root_id, "key50", 50,
+                                   &entry));
+}
+
+TEST_F(BTreeUtilsTest, GetEntries) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+  fake_storage_.delay_get_object = true;
+
+  Status status;
+  std::vector<std::unique_ptr<Entry>> entries;
+  btree::GetEntries(
+      &fake_storage_, root_id,
+      {"", "key00", "key005", "key13", "key14", "key50", "key99", "key999"},
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &entries));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  ASSERT_EQ(8u, entries.size());
+  EXPECT_FALSE(entries[0]);
+  ASSERT_TRUE(entries[1]);
+  EXPECT_EQ(changes[0].entry, *entries[1]);
+  EXPECT_FALSE(entries[2]);
+  ASSERT_TRUE(entries[3]);
+  EXPECT_EQ(changes[13].entry, *entries[3]);
+  ASSERT_TRUE(entries[4]);
+  EXPECT_EQ(changes[14].entry, *entries[4]);
+  ASSERT_TRUE(entries[5]);
+  EXPECT_EQ(changes[50].entry, *entries[5]);
+  ASSERT_TRUE(entries[6]);
+  EXPECT_EQ(changes[99].entry, *entries[6]);
+  EXPECT_FALSE(entries[7]);
+}
+
+TEST_F(BTreeUtilsTest, GetEntriesSharesNodes) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+
+  std::vector<std::string> keys;
+  for (const EntryChange& change : changes) {
+    keys.push_back(change.entry.key);
+  }
+
+  // Looking up all the keys reads each node once. The objects of the tree are
+  // its nodes and one value per entry.
+  std::set<ObjectId> objects;
+  Status status;
+  btree::GetObjectIds(
+      &fake_storage_, root_id,
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &objects));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+
+  fake_storage_.object_request_count = 0;
+  std::vector<std::unique_ptr<Entry>> entries;
+  btree::GetEntries(&fake_storage_, root_id, keys,
+                    ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                    &status, &entries));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  ASSERT_EQ(changes.size(), entries.size());
+  for (size_t i = 0; i < changes.size(); ++i) {
+    ASSERT_TRUE(entries[i]);
+    EXPECT_EQ(changes[i].entry, *entries[i]);
+  }
+  EXPECT_EQ(objects.size() - changes.size(),
+            fake_storage_.object_request_count);
+
+  // No keys: no node is read.
+  fake_storage_.object_request_count = 0;
+  btree::GetEntries(&fake_storage_, root_id, {},
+                    ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                    &status, &entries));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_TRUE(entries.empty());
+  EXPECT_EQ(0u, fake_storage_.object_request_count);
+}
+
+TEST_F(BTreeUtilsTest, CommitContentsGetEntries) {
+  // Keys are accepted in any order, and may be repeated.
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+  CommitContentsImpl contents(root_id, &fake_storage_);
+
+  Status status;
+  std::vector<std::unique_ptr<Entry>> entries;
+  contents.GetEntries({"key42", "key07", "unknown", "key42"},
+                      ::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                      &status, &entries));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  ASSERT_EQ(4u, entries.size());
+  ASSERT_TRUE(entries[0]);
+  EXPECT_EQ(changes[42].entry, *entries[0]);
+  ASSERT_TRUE(entries[1]);
+  EXPECT_EQ(changes[7].entry, *entries[1]);
+  EXPECT_FALSE(entries[2]);
+  ASSERT_TRUE(entries[3]);
+  EXPECT_EQ(changes[42].entry, *entries[3]);
+}
+
+TEST_F(BTreeUtilsTest, GetEntryCountUnknownCounts) {
+  // Nodes written without entry counts are read to count their entries.
+  std::vector<EntryChange> changes = CreateEntryChanges(4);
+  std::unique_ptr<const Object> left;
+  ASSERT_EQ(Status::OK,
+            fake_storage_.AddObjectSynchronous(
+                EncodeNode({changes[0].entry, changes[1].entry}, {"", "", ""},
+                           {0, 0, 0}),
+                &left));
+  std::unique_ptr<const Object> right;
+  ASSERT_EQ(Status::OK, fake_storage_.AddObjectSynchronous(
+                            EncodeNode({changes[3].entry}, {"", ""}, {0, 0}),
+                            &right));
+  std::unique_ptr<const Object> root;
+  ASSERT_EQ(Status::OK,
+            fake_storage_.AddObjectSynchronous(
+                EncodeNode({changes[2].entry}, {left->GetId(), right->GetId()},
+                           {kUnknownEntryCount, kUnknownEntryCount}),
+                &root));
+
+  uint64_t count;
+  EXPECT_EQ(Status::OK, btree::GetEntryCount(&fake_storage_, root->GetId(),
+                                             "", "", &count));
+  EXPECT_EQ(4u, count);
+  EXPECT_EQ(Status::OK, btree::GetEntryCount(&fake_storage_, root->GetId(),
+                                             "key01", "key03", &count));
+  EXPECT_EQ(2u, count);
+  Entry entry;
+  EXPECT_EQ(Status::OK, btree::GetEntryAtOffset(&fake_storage_, root->GetId(),
+                                                "", 3, &entry));
+  EXPECT_EQ(changes[3].entry, entry);
+}
+
+TEST_F(BTreeUtilsTest, ForEachEntryInRange) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+  std::vector<std::string> keys;
+  for (const EntryChange& change : changes) {
+    keys.push_back(change.entry.key);
+  }
+  std::vector<std::string> reversed_keys(keys.rbegin(), keys.rend());
+
+  for (size_t prefetch_count : {0u, 1u, 8u}) {
+    EXPECT_EQ(keys, ScanRange(root_id, "", "", false, prefetch_count));
+    EXPECT_EQ(reversed_keys, ScanRange(root_id, "", "", true, prefetch_count));
+    EXPECT_EQ(std::vector<std::string>(keys.begin() + 10, keys.begin() + 20),
+              ScanRange(root_id, "key10", "key20", false, prefetch_count));
+    EXPECT_EQ(std::vector<std::string>(keys.begin() + 11, keys.begin() + 21),
+              ScanRange(root_id, "key105", "key205", false, prefetch_count));
+    EXPECT_EQ(std::vector<std::string>(reversed_keys.begin() + 80,
+                                       reversed_keys.begin() + 90),
+              ScanRange(root_id, "key10", "key20", true, prefetch_count));
+    EXPECT_EQ(std::vector<std::string>(keys.begin(), keys.begin() + 3),
+              ScanRange(root_id, "", "", false, prefetch_count, 3));
+    EXPECT_TRUE(ScanRange(root_id, "key20", "key10", false, prefetch_count)
+                    .empty());
+    EXPECT_TRUE(ScanRange(root_id, "z", "", false, prefetch_count).empty());
+  }
+}
+
+TEST_F(BTreeUtilsTest, ForEachEntryInRangeAsynchronous) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+  std::vector<std::string> keys;
+  for (const EntryChange& change : changes) {
+    keys.push_back(change.entry.key);
+  }
+
+  fake_storage_.delay_get_object = true;
+  EXPECT_EQ(keys, ScanRange(root_id, "", "", false, btree::kPrefetchNodeCount));
+  EXPECT_EQ(std::vector<std::string>(keys.rbegin() + 50, keys.rend()),
+            ScanRange(root_id, "", "key50", true, btree::kPrefetchNodeCount));
+}
+
+TEST_F(BTreeUtilsTest, ForEachEntryInRangePrefetch) {
+  std::vector<EntryChange> changes = CreateEntryChanges(100);
+  ObjectId root_id = CreateTree(changes);
+
+  // Without prefetching, only the nodes on the path to the first entry are
+  // requested.
+  fake_storage_.object_requests.clear();
+  ScanRange(root_id, "", "", false, 0, 1);
+  size_t path_length = fake_storage_.object_requests.size();
+
+  // With prefetching, the following siblings of the nodes on that path are
+  // requested as well.
+  fake_storage_.object_requests.clear();
+  ScanRange(root_id, "", "", false, 2, 1);
+  EXPECT_LT(path_length, fake_storage_.object_requests.size());
+
+  // Nodes after the end of the range are not requested.
+  fake_storage_.object_requests.clear();
+  ScanRange(root_id, "", "key01", false, 2);
+  EXPECT_EQ(path_length, fake_storage_.object_requests.size());
+
+  // Nodes stored locally are not prefetched.
+  fake_storage_.objects_stored_locally = true;
+  fake_storage_.object_requests.clear();
+  ScanRange(root_id, "", "", false, 2, 1);
+  EXPECT_EQ(path_length, fake_storage_.object_requests.size());
+}
+
 }  // namespace
 }  // namespace storage
@@ -4,32 +4,139 @@
 
 #include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 
 #include "apps/ledger/src/convert/convert.h"
 #include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/btree_utils.h"
 #include "apps/ledger/src/storage/impl/btree/diff_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "apps/ledger/src/storage/impl/live_roots.h"
 #include "apps/ledger/src/storage/public/commit_contents.h"
+#include "lib/ftl/functional/make_copyable.h"
 #include "lib/ftl/logging.h"
 
 namespace storage {
 
 CommitContentsImpl::CommitContentsImpl(ObjectIdView root_id,
                                        PageStorage* page_storage)
-    : root_id_(root_id.ToString()), page_storage_(page_storage) {}
+    : root_id_(root_id.ToString()),
+      page_storage_(page_storage),
+      live_roots_(page_storage_->GetLiveRoots()) {
+  if (live_roots_) {
+    live_roots_->AddRoot(root_id_);
+  }
+}
 
-CommitContentsImpl::~CommitContentsImpl() {}
+CommitContentsImpl::~CommitContentsImpl() {
+  if (live_roots_) {
+    live_roots_->RemoveRoot(root_id_);
+  }
+}
 
 std::unique_ptr<Iterator<const Entry>> CommitContentsImpl::begin() const {
-  return std::unique_ptr<BTreeIterator>(NewIterator());
+  return std::make_unique<BTreeIterator>(GetRoot());
 }
 
 std::unique_ptr<Iterator<const Entry>> CommitContentsImpl::find(
     convert::ExtendedStringView key) const {
-  std::unique_ptr<BTreeIterator> it(NewIterator());
-  it->Seek(key);
-  return std::unique_ptr<Iterator<const Entry>>(std::move(it));
+  return range(key, "", false);
+}
+
+std::unique_ptr<Iterator<const Entry>> CommitContentsImpl::range(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    bool reverse) const {
+  return std::make_unique<BTreeIterator>(GetRoot(), start.ToString(),
+                                         end.ToString(), reverse);
+}
+
+void CommitContentsImpl::ForEachEntry(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    bool reverse,
+    std::function<bool(Entry)> on_next,
+    std::function<void(Status)> on_done) const {
+  btree::ForEachEntryInRange(page_storage_, root_id_, start.ToString(),
+                             end.ToString(), reverse, btree::kPrefetchNodeCount,
+                             std::move(on_next), std::move(on_done));
+}
+
+void CommitContentsImpl::GetEntryCount(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    std::function<void(Status, uint64_t)> callback) const {
+  uint64_t count;
+  Status status =
+      btree::GetEntryCount(page_storage_, root_id_, start, end, &count);
+  if (status != Status::OK) {
+    callback(status, 0);
+    return;
+  }
+  callback(Status::OK, count);
+}
+
+void CommitContentsImpl::GetEntryAtOffset(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    uint64_t offset,
+    std::function<void(Status, Entry)> callback) const {
+  Entry entry;
+  Status status =
+      btree::GetEntryAtOffset(page_storage_, root_id_, start, offset, &entry);
+  if (status == Status::OK && !end.empty() && entry.key >= end) {
+    status = Status::NOT_FOUND;
+  }
+  if (status != Status::OK) {
+    callback(status, Entry());
+    return;
+  }
+  callback(Status::OK, std::move(entry));
+}
+
+void CommitContentsImpl::GetEntry(
+    convert::ExtendedStringView key,
+    std::function<void(Status, Entry)> callback) const {
+  TreeNode::FindEntry(page_storage_, root_id_, key.ToString(),
+                      std::move(callback));
+}
+
+void CommitContentsImpl::GetEntries(
+    std::vector<std::string> keys,
+    std::function<void(Status, std::vector<std::unique_ptr<Entry>>)> callback)
+    const {
+  // The tree is looked up with the distinct keys, sorted. |positions| maps
+  // each requested key to its position among them.
+  std::vector<std::string> sorted_keys = keys;
+  std::sort(sorted_keys.begin(), sorted_keys.end());
+  sorted_keys.erase(std::unique(sorted_keys.begin(), sorted_keys.end()),
+                    sorted_keys.end());
+  std::vector<size_t> positions;
+  positions.reserve(keys.size());
+  for (const std::string& key : keys) {
+    positions.push_back(
+        std::lower_bound(sorted_keys.begin(), sorted_keys.end(), key) -
+        sorted_keys.begin());
+  }
+  btree::GetEntries(
+      page_storage_, root_id_, std::move(sorted_keys),
+      ftl::MakeCopyable([
+        positions = std::move(positions), callback = std::move(callback)
+      ](Status status, std::vector<std::unique_ptr<Entry>> entries) {
+        if (status != Status::OK) {
+          callback(status, std::vector<std::unique_ptr<Entry>>());
+          return;
+        }
+        std::vector<std::unique_ptr<Entry>> result;
+        result.reserve(positions.size());
+        for (size_t position : positions) {
+          const std::unique_ptr<Entry>& entry = entries[position];
+          result.push_back(entry ? std::make_unique<Entry>(*entry) : nullptr);
+        }
+        callback(Status::OK, std::move(result));
+      }));
 }
 
 void CommitContentsImpl::diff(
@@ -58,11 +165,11 @@ ObjectId CommitContentsImpl::GetBaseObjectId() const {
   return root_id_;
 }
 
-std::unique_ptr<BTreeIterator> CommitContentsImpl::NewIterator() const {
+std::unique_ptr<const TreeNode> CommitContentsImpl::GetRoot() const {
   std::unique_ptr<const TreeNode> root;
   // TODO(nellyv): Update API to return error Status. LE-39
   FTL_CHECK(TreeNode::FromIdSynchronous(page_storage_, root_id_, &root) == Status::OK);
-  return std::make_unique<BTreeIterator>(std::move(root));
+  return root;
 }
 
 }  // namespace storage
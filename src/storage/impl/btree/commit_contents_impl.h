@@ -7,6 +7,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "apps/ledger/src/convert/convert.h"
 #include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
@@ -16,7 +17,11 @@
 
 namespace storage {
 
-// B-Tree implementation of |CommitContents|.
+class LiveRoots;
+
+// B-Tree implementation of |CommitContents|. The tree is registered as a live
+// root, so that it is not collected while the contents are in use, e.g. by a
+// snapshot, even after the commit they were read from is deleted.
 class CommitContentsImpl : public CommitContents {
  public:
   CommitContentsImpl(ObjectIdView root_id, PageStorage* page_storage);
@@ -28,6 +33,36 @@ class CommitContentsImpl : public CommitContents {
   std::unique_ptr<Iterator<const Entry>> find(
       convert::ExtendedStringView key) const override;
 
+  std::unique_ptr<Iterator<const Entry>> range(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      bool reverse) const override;
+
+  void ForEachEntry(convert::ExtendedStringView start,
+                    convert::ExtendedStringView end,
+                    bool reverse,
+                    std::function<bool(Entry)> on_next,
+                    std::function<void(Status)> on_done) const override;
+
+  void GetEntryCount(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::function<void(Status, uint64_t)> callback) const override;
+
+  void GetEntryAtOffset(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      uint64_t offset,
+      std::function<void(Status, Entry)> callback) const override;
+
+  void GetEntry(convert::ExtendedStringView key,
+                std::function<void(Status, Entry)> callback) const override;
+
+  void GetEntries(
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback) const override;
+
   void diff(
       std::unique_ptr<CommitContents> other,
       std::function<void(Status, std::unique_ptr<Iterator<const EntryChange>>)>
@@ -36,10 +71,11 @@ class CommitContentsImpl : public CommitContents {
   ObjectId GetBaseObjectId() const override;
 
  private:
-  std::unique_ptr<BTreeIterator> NewIterator() const;
+  std::unique_ptr<const TreeNode> GetRoot() const;
 
   const ObjectId root_id_;
   PageStorage* page_storage_;
+  std::shared_ptr<LiveRoots> live_roots_;
 };
 
 }  // namespace storage
@@ -4,25 +4,142 @@
 
 #include "apps/ledger/src/storage/impl/btree/diff_iterator.h"
 
-#include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
+#include <stack>
+
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
 #include "lib/ftl/logging.h"
 
 namespace storage {
 
+// A position in a B-Tree that can step over the entries and the children of
+// the nodes. Within a node, the children and entries are visited alternately:
+// child 0, entry 0, child 1, ..., entry N - 1, child N. Unlike |BTreeIterator|,
+// children are only loaded when descended into, so that they can be skipped.
+class DiffIterator::Cursor {
+ public:
+  // A cursor with a null |root| is done from the start.
+  explicit Cursor(std::unique_ptr<const TreeNode> root) {
+    if (root) {
+      stack_.emplace(std::move(root), -1, -1);
+    }
+  }
+
+  // Computes the height of the tree, used to compare subtrees on both sides.
+  Status Init() {
+    root_height_ = 0;
+    std::unique_ptr<const TreeNode> node;
+    const TreeNode* current = stack_.top().node.get();
+    while (true) {
+      std::unique_ptr<const TreeNode> child;
+      Status status = Status::NO_SUCH_CHILD;
+      for (int i = 0; i <= current->GetKeyCount(); ++i) {
+        status = current->GetChild(i, &child);
+        if (status != Status::NO_SUCH_CHILD) {
+          break;
+        }
+      }
+      if (status == Status::NO_SUCH_CHILD) {
+        return Status::OK;
+      }
+      if (status != Status::OK) {
+        return status;
+      }
+      ++root_height_;
+      node = std::move(child);
+      current = node.get();
+    }
+  }
+
+  // Skips the empty children and the nodes that are entirely visited. Once
+  // this returns, the cursor is either done, on an entry or on a non-empty
+  // child.
+  Status Normalize() {
+    while (!stack_.empty()) {
+      Position& position = stack_.top();
+      if (position.child_index == position.entry_index) {
+        if (position.node->GetChildId(position.child_index + 1).empty()) {
+          ++position.child_index;
+          continue;
+        }
+        return Status::OK;
+      }
+      if (position.entry_index + 1 < position.node->GetKeyCount()) {
+        return position.node->GetEntry(position.entry_index + 1, &entry_);
+      }
+      stack_.pop();
+    }
+    return Status::OK;
+  }
+
+  bool Done() const { return stack_.empty(); }
+
+  bool OnEntry() const {
+    FTL_DCHECK(!Done());
+    return stack_.top().child_index != stack_.top().entry_index;
+  }
+
+  const Entry& entry() const {
+    FTL_DCHECK(OnEntry());
+    return entry_;
+  }
+
+  ObjectId child_id() const {
+    FTL_DCHECK(!OnEntry());
+    return stack_.top().node->GetChildId(stack_.top().child_index + 1);
+  }
+
+  // Height of the current child, leaves being at height 0.
+  int child_height() const {
+    return root_height_ - static_cast<int>(stack_.size());
+  }
+
+  // Loads the current child and moves to its first child.
+  Status Descend() {
+    FTL_DCHECK(!OnEntry());
+    Position& position = stack_.top();
+    std::unique_ptr<const TreeNode> child;
+    Status status = position.node->GetChild(++position.child_index, &child);
+    if (status != Status::OK) {
+      return status;
+    }
+    stack_.emplace(std::move(child), -1, -1);
+    return Status::OK;
+  }
+
+  // Moves past the current entry or child.
+  void Skip() {
+    FTL_DCHECK(!Done());
+    Position& position = stack_.top();
+    if (OnEntry()) {
+      ++position.entry_index;
+    } else {
+      ++position.child_index;
+    }
+  }
+
+ private:
+  std::stack<Position> stack_;
+  int root_height_ = 0;
+  Entry entry_;
+};
+
 DiffIterator::DiffIterator(std::unique_ptr<const TreeNode> left,
-                           std::unique_ptr<const TreeNode> right)
-    : left_(std::make_unique<BTreeIterator>(std::move(left))),
-      right_(std::make_unique<BTreeIterator>(std::move(right))) {
-  if (!Valid()) {
+                           std::unique_ptr<const TreeNode> right) {
+  if (left->GetId() == right->GetId()) {
+    left_ = std::make_unique<Cursor>(nullptr);
+    right_ = std::make_unique<Cursor>(nullptr);
     return;
   }
-
-  if (left_->Valid() && right_->Valid() && **left_ == **right_) {
-    Next();
-  } else {
-    BuildEntryChange();
+  left_ = std::make_unique<Cursor>(std::move(left));
+  right_ = std::make_unique<Cursor>(std::move(right));
+  status_ = left_->Init();
+  if (status_ == Status::OK) {
+    status_ = right_->Init();
+  }
+  if (status_ != Status::OK) {
+    return;
   }
+  FindNextChange();
 }
 
 DiffIterator::~DiffIterator() {}
@@ -30,53 +147,97 @@ DiffIterator::~DiffIterator() {}
 DiffIterator& DiffIterator::Next() {
   FTL_DCHECK(Valid());
 
-  // Unconditionnaly advance by one step.
-  if (left_->Valid() && !right_->Valid()) {
-    left_->Next();
-  } else if (right_->Valid() && !left_->Valid()) {
-    right_->Next();
-  } else if ((*left_)->key < (*right_)->key) {
-    left_->Next();
-  } else if ((*left_)->key > (*right_)->key) {
-    right_->Next();
+  // Unconditionnaly advance by one step. Both cursors are on entries, or done.
+  if (right_->Done() ||
+      (!left_->Done() && left_->entry().key < right_->entry().key)) {
+    left_->Skip();
+  } else if (left_->Done() || right_->entry().key < left_->entry().key) {
+    right_->Skip();
   } else {
-    left_->Next();
-    right_->Next();
+    left_->Skip();
+    right_->Skip();
   }
+  FindNextChange();
+  return *this;
+}
 
-  // While the two iterators point to the same data, advance until finding a
-  // difference.
-  while (left_->Valid() && right_->Valid() && **left_ == **right_) {
-    left_->Next();
-    right_->Next();
-  }
-  if (Valid()) {
-    BuildEntryChange();
+void DiffIterator::FindNextChange() {
+  while (true) {
+    status_ = left_->Normalize();
+    if (status_ != Status::OK) {
+      return;
+    }
+    status_ = right_->Normalize();
+    if (status_ != Status::OK) {
+      return;
+    }
+    if (left_->Done() && right_->Done()) {
+      return;
+    }
+    bool left_on_child = !left_->Done() && !left_->OnEntry();
+    bool right_on_child = !right_->Done() && !right_->OnEntry();
+
+    if (!left_on_child && !right_on_child) {
+      // Both sides are on entries, or one of them is done.
+      if (left_->Done() || right_->Done() ||
+          !(left_->entry() == right_->entry())) {
+        BuildEntryChange();
+        return;
+      }
+      left_->Skip();
+      right_->Skip();
+      continue;
+    }
+
+    if (left_on_child && right_on_child) {
+      if (left_->child_id() == right_->child_id()) {
+        // Identical subtrees hold the same entries on both sides.
+        left_->Skip();
+        right_->Skip();
+        continue;
+      }
+      // Only descend into the higher subtree, so that subtrees of the same
+      // height can be compared afterwards.
+      int left_height = left_->child_height();
+      int right_height = right_->child_height();
+      if (left_height >= right_height) {
+        status_ = left_->Descend();
+        if (status_ != Status::OK) {
+          return;
+        }
+      }
+      if (right_height >= left_height) {
+        status_ = right_->Descend();
+      }
+    } else if (left_on_child) {
+      status_ = left_->Descend();
+    } else {
+      status_ = right_->Descend();
+    }
+    if (status_ != Status::OK) {
+      return;
+    }
   }
-  return *this;
 }
 
 bool DiffIterator::Valid() const {
-  return (left_->Valid() || right_->Valid()) &&
-         left_->GetStatus() == Status::OK && right_->GetStatus() == Status::OK;
+  return (!left_->Done() || !right_->Done()) && status_ == Status::OK;
 }
 
 Status DiffIterator::GetStatus() const {
-  if (left_->GetStatus() != Status::OK) {
-    return left_->GetStatus();
-  }
-  return right_->GetStatus();
+  return status_;
 }
 
 void DiffIterator::BuildEntryChange() {
   FTL_DCHECK(Valid());
-  if ((left_->Valid() && !right_->Valid()) ||
-      (left_->Valid() && right_->Valid() && (*left_)->key < (*right_)->key)) {
-    change_.reset(new EntryChange{**left_, true});
+  if (right_->Done() ||
+      (!left_->Done() && left_->entry().key < right_->entry().key)) {
+    change_.reset(new EntryChange{left_->entry(), true});
   } else {
-    change_.reset(new EntryChange{**right_, false});
+    change_.reset(new EntryChange{right_->entry(), false});
   }
 }
+
 const EntryChange& DiffIterator::operator*() const {
   return *change_;
 }
@@ -6,7 +6,6 @@
 #define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_DIFF_ITERATOR_H_
 
 #include <memory>
-#include <queue>
 
 #include "apps/ledger/src/storage/impl/btree/position.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
@@ -19,6 +18,10 @@ namespace storage {
 // An iterator over the differences between an ordered pair of BTrees,
 // represented by thier roots. Differences are computed in the |left| to |right|
 // direction (|left| is the base for the diff, |right| the target).
+//
+// Subtrees with the same id on both sides are skipped without being loaded, so
+// that the cost of the diff is proportional to the size of the differences
+// times the height of the trees, and not to the size of the trees.
 class DiffIterator : public Iterator<const EntryChange> {
  public:
   DiffIterator(std::unique_ptr<const TreeNode> left,
@@ -34,18 +37,20 @@ class DiffIterator : public Iterator<const EntryChange> {
   const EntryChange* operator->() const override;
 
  private:
+  class Cursor;
+
+  // Advances both cursors until they point to different entries, or to the end
+  // of both trees.
+  void FindNextChange();
   void BuildEntryChange();
 
   // Stores the change of the B-Trees at the current position of the iterator.
   // This is used as a staging area for operator* and operator-> calls.
   std::unique_ptr<EntryChange> change_;
 
-  // TODO(etiennej): We are going for the simplest, most naive implementation as
-  // to unblock further work. Better implementations may want to inspect the
-  // individual nodes inside B-Trees to skip identical nodes and branches
-  // altogether instead of iterating through them.
-  std::unique_ptr<Iterator<const Entry>> left_;
-  std::unique_ptr<Iterator<const Entry>> right_;
+  std::unique_ptr<Cursor> left_;
+  std::unique_ptr<Cursor> right_;
+  Status status_ = Status::OK;
 };
 
 }  // namespace storage
@@ -6,12 +6,18 @@
 
 #include "apps/ledger/src/glue/crypto/rand.h"
 #include "apps/ledger/src/storage/fake/fake_page_storage.h"
+#include "apps/ledger/src/storage/impl/btree/btree_utils.h"
 #include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/entry_change_iterator.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
 #include "apps/ledger/src/storage/public/constants.h"
 #include "apps/ledger/src/storage/public/types.h"
+#include "apps/ledger/src/test/capture.h"
+#include "apps/ledger/src/test/test_with_message_loop.h"
 #include "gtest/gtest.h"
 #include "lib/ftl/logging.h"
+#include "lib/ftl/strings/string_printf.h"
 
 namespace storage {
 
@@ -24,7 +30,26 @@ ObjectId RandomId() {
   return result;
 }
 
-class DiffIteratorTest : public ::testing::Test {
+// Size of the nodes holding up to 4 test entries, with keys "keyXXXX".
+const size_t kTestNodeSize =
+    4 * GetEncodedEntrySize(
+            Entry{"key0000", ObjectId(kObjectIdSize, 'a'), KeyPriority::EAGER});
+
+class CountGetObjectFakePageStorage : public fake::FakePageStorage {
+ public:
+  CountGetObjectFakePageStorage(PageId id) : fake::FakePageStorage(id) {}
+  ~CountGetObjectFakePageStorage() {}
+
+  Status GetObjectSynchronous(ObjectIdView object_id,
+                              std::unique_ptr<const Object>* object) override {
+    ++object_requests;
+    return fake::FakePageStorage::GetObjectSynchronous(object_id, object);
+  }
+
+  size_t object_requests = 0;
+};
+
+class DiffIteratorTest : public ::test::TestWithMessageLoop {
  public:
   DiffIteratorTest() : fake_storage_("page_id") {}
 
@@ -37,7 +62,51 @@ class DiffIteratorTest : public ::testing::Test {
   }
 
  protected:
-  fake::FakePageStorage fake_storage_;
+  std::vector<EntryChange> CreateEntryChanges(int size) {
+    std::vector<EntryChange> result;
+    for (int i = 0; i < size; ++i) {
+      result.push_back(EntryChange{Entry{ftl::StringPrintf("key%04d", i),
+                                         RandomId(), KeyPriority::EAGER},
+                                   false});
+    }
+    return result;
+  }
+
+  ObjectId ApplyChanges(ObjectIdView root_id,
+                        const std::vector<EntryChange>& changes) {
+    Status status;
+    ObjectId new_root_id;
+    std::unordered_set<ObjectId> new_nodes;
+    btree::ApplyChanges(
+        &fake_storage_, root_id, kTestNodeSize,
+        std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &new_root_id, &new_nodes));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::OK, status);
+    return new_root_id;
+  }
+
+  ObjectId CreateTree(const std::vector<EntryChange>& entries) {
+    ObjectId root_id;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromEntries(&fake_storage_, std::vector<Entry>(),
+                                    std::vector<ObjectId>(1), &root_id));
+    return ApplyChanges(root_id, entries);
+  }
+
+  std::unique_ptr<DiffIterator> Diff(ObjectIdView left_id,
+                                     ObjectIdView right_id) {
+    std::unique_ptr<const TreeNode> left;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, left_id, &left));
+    std::unique_ptr<const TreeNode> right;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, right_id, &right));
+    return std::make_unique<DiffIterator>(std::move(left), std::move(right));
+  }
+
+  CountGetObjectFakePageStorage fake_storage_;
 
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(DiffIteratorTest);
@@ -141,5 +210,69 @@ TEST_F(DiffIteratorTest, IterateOneNode) {
   EXPECT_EQ(Status::OK, it.GetStatus());
 }
 
+TEST_F(DiffIteratorTest, IterateManyLevels) {
+  std::vector<EntryChange> entries = CreateEntryChanges(100);
+  ObjectId base_root_id = CreateTree(entries);
+
+  std::vector<EntryChange> changes;
+  // Update the value of key0010.
+  changes.push_back(EntryChange{
+      Entry{entries[10].entry.key, RandomId(), KeyPriority::EAGER}, false});
+  // Add key0042b.
+  changes.push_back(
+      EntryChange{Entry{"key0042b", RandomId(), KeyPriority::LAZY}, false});
+  // Remove key0077.
+  changes.push_back(EntryChange{entries[77].entry, true});
+  ObjectId other_root_id = ApplyChanges(base_root_id, changes);
+
+  std::unique_ptr<DiffIterator> it = Diff(base_root_id, other_root_id);
+  for (const EntryChange& change : changes) {
+    ASSERT_TRUE(it->Valid());
+    EXPECT_EQ(change.entry, (*it)->entry);
+    EXPECT_EQ(change.deleted, (*it)->deleted);
+    it->Next();
+  }
+  EXPECT_FALSE(it->Valid());
+  EXPECT_EQ(Status::OK, it->GetStatus());
+
+  // The reverse diff has the opposite changes.
+  it = Diff(other_root_id, base_root_id);
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(entries[10].entry, (*it)->entry);
+  EXPECT_FALSE((*it)->deleted);
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(changes[1].entry, (*it)->entry);
+  EXPECT_TRUE((*it)->deleted);
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(entries[77].entry, (*it)->entry);
+  EXPECT_FALSE((*it)->deleted);
+  it->Next();
+  EXPECT_FALSE(it->Valid());
+  EXPECT_EQ(Status::OK, it->GetStatus());
+}
+
+TEST_F(DiffIteratorTest, SkipIdenticalSubtrees) {
+  std::vector<EntryChange> entries = CreateEntryChanges(1000);
+  ObjectId base_root_id = CreateTree(entries);
+  EntryChange change{
+      Entry{entries[500].entry.key, RandomId(), KeyPriority::EAGER}, false};
+  ObjectId other_root_id = ApplyChanges(base_root_id, {change});
+
+  fake_storage_.object_requests = 0;
+  std::unique_ptr<DiffIterator> it = Diff(base_root_id, other_root_id);
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ(change.entry, (*it)->entry);
+  it->Next();
+  EXPECT_FALSE(it->Valid());
+  EXPECT_EQ(Status::OK, it->GetStatus());
+
+  // Only the nodes on the path to the changed entry, and on the leftmost path
+  // to compute the heights of the trees, are loaded on each side. Iterating
+  // over both trees loads hundreds of nodes.
+  EXPECT_LT(fake_storage_.object_requests, 30u);
+}
+
 }  // namespace
 }  // namespace storage
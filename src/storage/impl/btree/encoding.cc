@@ -5,94 +5,103 @@
 #include "apps/ledger/src/storage/impl/btree/encoding.h"
 
 #include "apps/ledger/src/glue/crypto/base64.h"
+#include "apps/ledger/src/storage/public/constants.h"
 #include "lib/ftl/logging.h"
 
 #include <rapidjson/document.h>
-#include <rapidjson/stringbuffer.h>
-#include <rapidjson/writer.h>
 
 namespace storage {
 
 namespace {
 
-const int kPriorityEager = 0;
-const int kPriorityLazy = 1;
+const uint8_t kPriorityEager = 0;
+const uint8_t kPriorityLazy = 1;
 
+// The binary format before the entry counts of the children were added.
+const uint8_t kBinaryNodeVersionWithoutCounts = 1;
+
+// Size of the version, entry_count and child_count fields.
+const size_t kHeaderSize = 1 + 2 * sizeof(uint32_t);
+
+// Keys of the legacy JSON format.
 const char kEntries[] = "entries";
 const char kKey[] = "key";
 const char kObjectId[] = "object_id";
 const char kPriority[] = "priority";
 const char kChildren[] = "children";
 
-void WriteAsBase64(rapidjson::Writer<rapidjson::StringBuffer>& writer,
-                   ftl::StringView bytes) {
-  std::string encoded;
-  glue::Base64Encode(bytes, &encoded);
-  writer.String(encoded.c_str(), encoded.size());
+void AppendUint8(uint8_t value, std::string* output) {
+  output->push_back(static_cast<char>(value));
 }
 
-bool ReadFromBase64(const rapidjson::Value& value, std::string* decoded) {
-  if (!value.IsString()) {
-    return false;
+void AppendUint32(uint32_t value, std::string* output) {
+  for (int i = 0; i < 4; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
   }
+}
 
-  std::string result;
-  return glue::Base64Decode(
-      ftl::StringView(value.GetString(), value.GetStringLength()), decoded);
+void AppendUint64(uint64_t value, std::string* output) {
+  for (int i = 0; i < 8; ++i) {
+    output->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
 }
 
-}  // namespace
+void WriteUint32At(uint32_t value, size_t offset, std::string* output) {
+  for (int i = 0; i < 4; ++i) {
+    (*output)[offset + i] = static_cast<char>((value >> (8 * i)) & 0xff);
+  }
+}
 
-std::string EncodeNode(const std::vector<Entry>& entries,
-                       const std::vector<ObjectId>& children) {
-  rapidjson::StringBuffer string_buffer;
-  rapidjson::Writer<rapidjson::StringBuffer> writer(string_buffer);
-
-  writer.StartObject();
-  {
-    writer.Key(kEntries);
-    writer.StartArray();
-    {
-      for (const Entry& entry : entries) {
-        writer.StartObject();
-        {
-          writer.Key(kKey);
-          WriteAsBase64(writer, entry.key);
-
-          writer.Key(kObjectId);
-          WriteAsBase64(writer, entry.object_id);
-
-          writer.Key(kPriority);
-          if (entry.priority == KeyPriority::EAGER) {
-            writer.Int(kPriorityEager);
-          } else if (entry.priority == KeyPriority::LAZY) {
-            writer.Int(kPriorityLazy);
-          } else {
-            FTL_NOTREACHED();
-          }
-        }
-        writer.EndObject();
-      }
-    }
-    writer.EndArray();
+uint8_t ReadUint8(ftl::StringView data, size_t offset) {
+  return static_cast<uint8_t>(data[offset]);
+}
 
-    writer.Key(kChildren);
-    writer.StartArray();
-    {
-      for (const ObjectId& child : children) {
-        WriteAsBase64(writer, child);
-      }
-    }
-    writer.EndArray();
+uint32_t ReadUint32(ftl::StringView data, size_t offset) {
+  uint32_t value = 0;
+  for (int i = 0; i < 4; ++i) {
+    value |= static_cast<uint32_t>(static_cast<uint8_t>(data[offset + i]))
+             << (8 * i);
+  }
+  return value;
+}
+
+uint64_t ReadUint64(ftl::StringView data, size_t offset) {
+  uint64_t value = 0;
+  for (int i = 0; i < 8; ++i) {
+    value |= static_cast<uint64_t>(static_cast<uint8_t>(data[offset + i]))
+             << (8 * i);
   }
-  writer.EndObject();
+  return value;
+}
 
-  return string_buffer.GetString();
+void AppendId(ftl::StringView id, std::string* output) {
+  FTL_DCHECK(id.size() <= UINT8_MAX);
+  AppendUint8(id.size(), output);
+  output->append(id.data(), id.size());
 }
 
-bool DecodeNode(ftl::StringView json,
-                std::vector<Entry>* res_entries,
-                std::vector<ObjectId>* res_children) {
+// Checks that an id, prefixed by its size, starts at |*offset| and fits in
+// |data|. On success, |*offset| is updated to point after the id.
+bool SkipId(ftl::StringView data, uint64_t* offset) {
+  if (*offset + 1 > data.size()) {
+    return false;
+  }
+  *offset += 1 + ReadUint8(data, *offset);
+  return *offset <= data.size();
+}
+
+bool ReadFromBase64(const rapidjson::Value& value, std::string* decoded) {
+  if (!value.IsString()) {
+    return false;
+  }
+
+  return glue::Base64Decode(
+      ftl::StringView(value.GetString(), value.GetStringLength()), decoded);
+}
+
+bool DecodeJsonNode(ftl::StringView json,
+                    std::vector<Entry>* res_entries,
+                    std::vector<ObjectId>* res_children) {
   rapidjson::Document document;
   document.Parse(json.data(), json.size());
 
@@ -157,4 +166,218 @@ bool DecodeNode(ftl::StringView json,
   res_children->swap(children);
   return true;
 }
+
+}  // namespace
+
+std::string EncodeNode(const std::vector<Entry>& entries,
+                       const std::vector<ObjectId>& children,
+                       const std::vector<uint64_t>& child_entry_counts) {
+  FTL_DCHECK(children.size() == child_entry_counts.size());
+  std::string output;
+  AppendUint8(kBinaryNodeVersion, &output);
+  AppendUint32(entries.size(), &output);
+  AppendUint32(children.size(), &output);
+
+  // Reserve the offset tables and fill them while writing the records.
+  size_t entry_table = output.size();
+  size_t child_table = entry_table + entries.size() * sizeof(uint32_t);
+  output.resize(child_table + children.size() * sizeof(uint32_t));
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const Entry& entry = entries[i];
+    WriteUint32At(output.size(), entry_table + i * sizeof(uint32_t), &output);
+    AppendUint32(entry.key.size(), &output);
+    output.append(entry.key);
+    if (entry.priority == KeyPriority::EAGER) {
+      AppendUint8(kPriorityEager, &output);
+    } else if (entry.priority == KeyPriority::LAZY) {
+      AppendUint8(kPriorityLazy, &output);
+    } else {
+      FTL_NOTREACHED();
+    }
+    AppendId(entry.object_id, &output);
+  }
+
+  for (size_t i = 0; i < children.size(); ++i) {
+    WriteUint32At(output.size(), child_table + i * sizeof(uint32_t), &output);
+    AppendId(children[i], &output);
+    AppendUint64(children[i].empty() ? 0 : child_entry_counts[i], &output);
+  }
+
+  return output;
+}
+
+size_t GetEncodedEntrySize(const Entry& entry) {
+  // Offset, key size, key, priority, id size and object id of the entry.
+  size_t entry_size =
+      2 * sizeof(uint32_t) + entry.key.size() + 2 + entry.object_id.size();
+  // Offset, id size, id and entry count of the child.
+  size_t child_size = sizeof(uint32_t) + 1 + kObjectIdSize + sizeof(uint64_t);
+  return entry_size + child_size;
+}
+
+bool DecodeNode(ftl::StringView data,
+                std::vector<Entry>* res_entries,
+                std::vector<ObjectId>* res_children,
+                std::vector<uint64_t>* res_child_entry_counts) {
+  if (data.empty() || (ReadUint8(data, 0) != kBinaryNodeVersion &&
+                       ReadUint8(data, 0) != kBinaryNodeVersionWithoutCounts)) {
+    if (!DecodeJsonNode(data, res_entries, res_children)) {
+      return false;
+    }
+    res_child_entry_counts->assign(res_children->size(), kUnknownEntryCount);
+    return true;
+  }
+
+  NodeView view;
+  if (!view.Init(data)) {
+    return false;
+  }
+
+  std::vector<Entry> entries;
+  entries.reserve(view.entry_count());
+  for (size_t i = 0; i < view.entry_count(); ++i) {
+    entries.push_back(Entry{view.GetKey(i).ToString(),
+                            view.GetObjectId(i).ToString(),
+                            view.GetPriority(i)});
+  }
+
+  std::vector<ObjectId> children;
+  std::vector<uint64_t> child_entry_counts;
+  children.reserve(view.child_count());
+  child_entry_counts.reserve(view.child_count());
+  for (size_t i = 0; i < view.child_count(); ++i) {
+    children.push_back(view.GetChildId(i).ToString());
+    child_entry_counts.push_back(view.GetChildEntryCount(i));
+  }
+
+  res_entries->swap(entries);
+  res_children->swap(children);
+  res_child_entry_counts->swap(child_entry_counts);
+  return true;
+}
+
+NodeView::NodeView() {}
+
+NodeView::~NodeView() {}
+
+bool NodeView::Init(ftl::StringView data) {
+  if (data.size() < kHeaderSize) {
+    return false;
+  }
+  uint8_t version = ReadUint8(data, 0);
+  if (version != kBinaryNodeVersion &&
+      version != kBinaryNodeVersionWithoutCounts) {
+    return false;
+  }
+  uint32_t entry_count = ReadUint32(data, 1);
+  uint32_t child_count = ReadUint32(data, 1 + sizeof(uint32_t));
+
+  // Offsets are computed on 64 bits so that corrupted counts and sizes cannot
+  // overflow.
+  uint64_t offset = kHeaderSize + (static_cast<uint64_t>(entry_count) +
+                                   child_count) * sizeof(uint32_t);
+  if (offset > data.size()) {
+    return false;
+  }
+
+  // Records must be stored contiguously, in order, right after the offset
+  // tables. This guarantees that a node has a single valid encoding.
+  for (uint32_t i = 0; i < entry_count; ++i) {
+    if (ReadUint32(data, kHeaderSize + i * sizeof(uint32_t)) != offset) {
+      return false;
+    }
+    if (offset + sizeof(uint32_t) > data.size()) {
+      return false;
+    }
+    offset += sizeof(uint32_t) + ReadUint32(data, offset);
+    if (offset + 1 > data.size()) {
+      return false;
+    }
+    uint8_t priority = ReadUint8(data, offset);
+    if (priority != kPriorityEager && priority != kPriorityLazy) {
+      return false;
+    }
+    offset += 1;
+    if (!SkipId(data, &offset)) {
+      return false;
+    }
+  }
+
+  size_t child_table = kHeaderSize + entry_count * sizeof(uint32_t);
+  for (uint32_t i = 0; i < child_count; ++i) {
+    if (ReadUint32(data, child_table + i * sizeof(uint32_t)) != offset) {
+      return false;
+    }
+    uint64_t id_offset = offset;
+    if (!SkipId(data, &offset)) {
+      return false;
+    }
+    bool empty_child = ReadUint8(data, id_offset) == 0;
+    if (version == kBinaryNodeVersion) {
+      if (offset + sizeof(uint64_t) > data.size()) {
+        return false;
+      }
+      if (empty_child && ReadUint64(data, offset) != 0) {
+        return false;
+      }
+      offset += sizeof(uint64_t);
+    }
+  }
+
+  if (offset != data.size()) {
+    return false;
+  }
+
+  data_ = data;
+  version_ = version;
+  entry_count_ = entry_count;
+  child_count_ = child_count;
+  return true;
+}
+
+ftl::StringView NodeView::GetKey(size_t index) const {
+  uint32_t offset = EntryOffset(index);
+  return data_.substr(offset + sizeof(uint32_t), ReadUint32(data_, offset));
+}
+
+ftl::StringView NodeView::GetObjectId(size_t index) const {
+  uint32_t offset = EntryOffset(index);
+  // Skip the key and the priority.
+  offset += sizeof(uint32_t) + ReadUint32(data_, offset) + 1;
+  return data_.substr(offset + 1, ReadUint8(data_, offset));
+}
+
+KeyPriority NodeView::GetPriority(size_t index) const {
+  uint32_t offset = EntryOffset(index);
+  offset += sizeof(uint32_t) + ReadUint32(data_, offset);
+  return ReadUint8(data_, offset) == kPriorityEager ? KeyPriority::EAGER
+                                                    : KeyPriority::LAZY;
+}
+
+ftl::StringView NodeView::GetChildId(size_t index) const {
+  uint32_t offset = ChildOffset(index);
+  return data_.substr(offset + 1, ReadUint8(data_, offset));
+}
+
+uint64_t NodeView::GetChildEntryCount(size_t index) const {
+  if (version_ != kBinaryNodeVersion) {
+    return kUnknownEntryCount;
+  }
+  uint32_t offset = ChildOffset(index);
+  offset += 1 + ReadUint8(data_, offset);
+  return ReadUint64(data_, offset);
+}
+
+uint32_t NodeView::EntryOffset(size_t index) const {
+  FTL_DCHECK(index < entry_count_);
+  return ReadUint32(data_, kHeaderSize + index * sizeof(uint32_t));
+}
+
+uint32_t NodeView::ChildOffset(size_t index) const {
+  FTL_DCHECK(index < child_count_);
+  return ReadUint32(data_,
+                    kHeaderSize + (entry_count_ + index) * sizeof(uint32_t));
+}
+
 }  // namespace storage
@@ -5,19 +5,104 @@
 #ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_ENCODING_H_
 #define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_ENCODING_H_
 
+#include <stdint.h>
+
 #include <string>
+#include <vector>
 
 #include "apps/ledger/src/storage/public/types.h"
 #include "lib/ftl/strings/string_view.h"
 
 namespace storage {
 
+// Tree nodes are stored in a compact binary format. The first byte of an
+// encoded node is the format version, which can never be the first byte of a
+// node in the legacy JSON format ('{'), so that both can be decoded.
+//
+// Version 2 layout, all integers being little endian:
+//   u8  version
+//   u32 entry_count
+//   u32 child_count
+//   u32 entry_offsets[entry_count]
+//   u32 child_offsets[child_count]
+//   entries:  u32 key_size, key, u8 priority, u8 id_size, object_id
+//   children: u8 id_size, child_id, u64 subtree_entry_count
+// Offsets are relative to the start of the encoded node. |child_id| is empty,
+// and |subtree_entry_count| 0, for an empty child.
+//
+// Version 1 nodes have the same layout without |subtree_entry_count|. The
+// entry counts of their children, as those of nodes in the JSON format, are
+// unknown.
+constexpr uint8_t kBinaryNodeVersion = 2;
+
+// Entry count of a subtree whose number of entries is not known.
+constexpr uint64_t kUnknownEntryCount = UINT64_MAX;
+
+// Returns the sum of the entry counts |a| and |b|, which is unknown if either
+// of them is.
+inline uint64_t AddEntryCounts(uint64_t a, uint64_t b) {
+  if (a == kUnknownEntryCount || b == kUnknownEntryCount) {
+    return kUnknownEntryCount;
+  }
+  return a + b;
+}
+
+// Encodes the node with the given |entries| and |children| in the binary
+// format. |child_entry_counts| holds the number of entries of the subtree of
+// each child, or |kUnknownEntryCount|.
 std::string EncodeNode(const std::vector<Entry>& entries,
-                       const std::vector<ObjectId>& children);
+                       const std::vector<ObjectId>& children,
+                       const std::vector<uint64_t>& child_entry_counts);
 
-bool DecodeNode(ftl::StringView json,
+// Returns the number of bytes taken by |entry| and by the child on its left in
+// the binary encoding of a node, including their offsets. The child is counted
+// as present, so that the size does not depend on the position of the node in
+// the tree.
+size_t GetEncodedEntrySize(const Entry& entry);
+
+// Decodes a node encoded either in the binary or in the legacy JSON format.
+bool DecodeNode(ftl::StringView data,
                 std::vector<Entry>* entries,
-                std::vector<ObjectId>* children);
+                std::vector<ObjectId>* children,
+                std::vector<uint64_t>* child_entry_counts);
+
+// A read-only view over a node in the binary format, giving access to its
+// entries and children without copying them. The view points into the encoded
+// data, which must outlive it.
+class NodeView {
+ public:
+  NodeView();
+  ~NodeView();
+
+  // Validates |data| and initializes this view over it. Returns false if
+  // |data| is not a well-formed node in the binary format.
+  bool Init(ftl::StringView data);
+
+  size_t entry_count() const { return entry_count_; }
+  size_t child_count() const { return child_count_; }
+
+  // Accessors for the entry at |index|, which must be in [0, entry_count()).
+  ftl::StringView GetKey(size_t index) const;
+  ftl::StringView GetObjectId(size_t index) const;
+  KeyPriority GetPriority(size_t index) const;
+
+  // Returns the id of the child at |index|, which must be in
+  // [0, child_count()). The id is empty if there is no child at that position.
+  ftl::StringView GetChildId(size_t index) const;
+
+  // Returns the number of entries of the subtree of the child at |index|, or
+  // |kUnknownEntryCount|.
+  uint64_t GetChildEntryCount(size_t index) const;
+
+ private:
+  uint32_t EntryOffset(size_t index) const;
+  uint32_t ChildOffset(size_t index) const;
+
+  ftl::StringView data_;
+  uint8_t version_ = 0;
+  uint32_t entry_count_ = 0;
+  uint32_t child_count_ = 0;
+};
 
 }  // namespace storage
 
@@ -26,13 +26,18 @@ TEST(EncodingTest, EmptyData) {
   std::vector<Entry> entries;
   std::vector<ObjectId> children;
 
-  std::string bytes = EncodeNode(entries, children);
+  std::vector<uint64_t> child_entry_counts = {};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
 
   std::vector<Entry> res_entries;
   std::vector<ObjectId> res_children;
-  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children));
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
   EXPECT_EQ(entries, res_entries);
   EXPECT_EQ(children, res_children);
+  EXPECT_EQ(child_entry_counts, res_child_entry_counts);
 }
 
 TEST(EncodingTest, SingleEntry) {
@@ -41,13 +46,18 @@ TEST(EncodingTest, SingleEntry) {
   std::vector<ObjectId> children = {MakeObjectId("child_1"),
                                     MakeObjectId("child_2")};
 
-  std::string bytes = EncodeNode(entries, children);
+  std::vector<uint64_t> child_entry_counts = {3, kUnknownEntryCount};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
 
   std::vector<Entry> res_entries;
   std::vector<ObjectId> res_children;
-  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children));
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
   EXPECT_EQ(entries, res_entries);
   EXPECT_EQ(children, res_children);
+  EXPECT_EQ(child_entry_counts, res_child_entry_counts);
 }
 
 TEST(EncodingTest, MoreEntries) {
@@ -60,13 +70,18 @@ TEST(EncodingTest, MoreEntries) {
       MakeObjectId("child_1"), MakeObjectId("child_2"), MakeObjectId("child_3"),
       MakeObjectId("child_4"), MakeObjectId("child_5")};
 
-  std::string bytes = EncodeNode(entries, children);
+  std::vector<uint64_t> child_entry_counts = {1, 2, 3, 4, 5};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
 
   std::vector<Entry> res_entries;
   std::vector<ObjectId> res_children;
-  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children));
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
   EXPECT_EQ(entries, res_entries);
   EXPECT_EQ(children, res_children);
+  EXPECT_EQ(child_entry_counts, res_child_entry_counts);
 }
 
 TEST(EncodingTest, ZeroByte) {
@@ -75,24 +90,148 @@ TEST(EncodingTest, ZeroByte) {
   std::vector<ObjectId> children = {MakeObjectId("ch\0ld_1"_s),
                                     MakeObjectId("child_\0"_s)};
 
-  std::string bytes = EncodeNode(entries, children);
+  std::vector<uint64_t> child_entry_counts = {0x100, 0};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
 
   std::vector<Entry> res_entries;
   std::vector<ObjectId> res_children;
-  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children));
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
   EXPECT_EQ(entries, res_entries);
   EXPECT_EQ(children, res_children);
+  EXPECT_EQ(child_entry_counts, res_child_entry_counts);
 }
 
 TEST(EncodingTest, Errors) {
   std::vector<Entry> res_entries;
   std::vector<ObjectId> res_children;
-  EXPECT_FALSE(DecodeNode("[]", &res_entries, &res_children));
-  EXPECT_FALSE(DecodeNode("{}", &res_entries, &res_children));
-  EXPECT_FALSE(DecodeNode("{\"entries\":[]}", &res_entries, &res_children));
-  EXPECT_FALSE(DecodeNode("{\"children\":[]}", &res_entries, &res_children));
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_FALSE(DecodeNode("[]", &res_entries, &res_children,
+                          &res_child_entry_counts));
+  EXPECT_FALSE(DecodeNode("{}", &res_entries, &res_children,
+                          &res_child_entry_counts));
+  EXPECT_FALSE(DecodeNode("{\"entries\":[]}", &res_entries, &res_children,
+                          &res_child_entry_counts));
+  EXPECT_FALSE(DecodeNode("{\"children\":[]}", &res_entries, &res_children,
+                          &res_child_entry_counts));
   EXPECT_TRUE(DecodeNode("{\"entries\":[],\"children\":[]}", &res_entries,
-                         &res_children));
+                         &res_children,
+                         &res_child_entry_counts));
+}
+
+TEST(EncodingTest, BinaryErrors) {
+  std::vector<Entry> entries = {
+      {"key1", MakeObjectId("abc"), KeyPriority::EAGER},
+      {"key2", MakeObjectId("def"), KeyPriority::LAZY}};
+  std::vector<ObjectId> children = {MakeObjectId("child_1"), "",
+                                    MakeObjectId("child_3")};
+  std::vector<uint64_t> child_entry_counts = {1, 0, 3};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
+
+  std::vector<Entry> res_entries;
+  std::vector<ObjectId> res_children;
+  std::vector<uint64_t> res_child_entry_counts;
+  for (size_t size = 1; size < bytes.size(); ++size) {
+    EXPECT_FALSE(
+        DecodeNode(bytes.substr(0, size), &res_entries, &res_children,
+                   &res_child_entry_counts));
+  }
+  EXPECT_FALSE(DecodeNode(bytes + "\0"_s, &res_entries, &res_children,
+                          &res_child_entry_counts));
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
+}
+
+TEST(EncodingTest, BinaryVersion1) {
+  // {"key", "object_id", LAZY} with an empty child and "child" as children, in
+  // the format without entry counts.
+  std::string bytes =
+      "\x01\x01\0\0\0\x02\0\0\0\x15\0\0\0\x27\0\0\0\x28\0\0\0"
+      "\x03\0\0\0key\x01\x09object_id\0\x05"
+      "child"_s;
+
+  std::vector<Entry> res_entries;
+  std::vector<ObjectId> res_children;
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(bytes, &res_entries, &res_children,
+                         &res_child_entry_counts));
+  std::vector<Entry> expected_entries = {
+      {"key", "object_id", KeyPriority::LAZY}};
+  std::vector<ObjectId> expected_children = {"", "child"};
+  EXPECT_EQ(expected_entries, res_entries);
+  EXPECT_EQ(expected_children, res_children);
+  EXPECT_EQ(std::vector<uint64_t>(2, kUnknownEntryCount),
+            res_child_entry_counts);
+}
+
+TEST(EncodingTest, LegacyJson) {
+  // {"key", "object_id", LAZY} with an empty child and "child" as children.
+  std::string json =
+      "{\"entries\":[{\"key\":\"a2V5\",\"object_id\":\"b2JqZWN0X2lk\","
+      "\"priority\":1}],\"children\":[\"\",\"Y2hpbGQ=\"]}";
+
+  std::vector<Entry> res_entries;
+  std::vector<ObjectId> res_children;
+  std::vector<uint64_t> res_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(json, &res_entries, &res_children,
+                         &res_child_entry_counts));
+  std::vector<Entry> expected_entries = {
+      {"key", "object_id", KeyPriority::LAZY}};
+  std::vector<ObjectId> expected_children = {"", "child"};
+  EXPECT_EQ(expected_entries, res_entries);
+  EXPECT_EQ(expected_children, res_children);
+  EXPECT_EQ(std::vector<uint64_t>(2, kUnknownEntryCount),
+            res_child_entry_counts);
+}
+
+TEST(EncodingTest, NodeView) {
+  std::vector<Entry> entries = {
+      {"key1", MakeObjectId("abc"), KeyPriority::EAGER},
+      {"", MakeObjectId("def"), KeyPriority::LAZY},
+      {"k\0ey3"_s, MakeObjectId("geh"), KeyPriority::EAGER}};
+  std::vector<ObjectId> children = {"", MakeObjectId("child_2"), "",
+                                    MakeObjectId("child_4")};
+  std::vector<uint64_t> child_entry_counts = {0, 12, 0, kUnknownEntryCount};
+
+  std::string bytes = EncodeNode(entries, children, child_entry_counts);
+  EXPECT_EQ(kBinaryNodeVersion, static_cast<uint8_t>(bytes[0]));
+
+  NodeView view;
+  ASSERT_TRUE(view.Init(bytes));
+  ASSERT_EQ(entries.size(), view.entry_count());
+  ASSERT_EQ(children.size(), view.child_count());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    EXPECT_EQ(entries[i].key, view.GetKey(i).ToString());
+    EXPECT_EQ(entries[i].object_id, view.GetObjectId(i).ToString());
+    EXPECT_EQ(entries[i].priority, view.GetPriority(i));
+  }
+  for (size_t i = 0; i < children.size(); ++i) {
+    EXPECT_EQ(children[i], view.GetChildId(i).ToString());
+    EXPECT_EQ(child_entry_counts[i], view.GetChildEntryCount(i));
+  }
+
+  EXPECT_FALSE(view.Init(""));
+  EXPECT_FALSE(view.Init("{\"entries\":[],\"children\":[]}"));
+}
+
+TEST(EncodingTest, GetEncodedEntrySize) {
+  std::vector<Entry> entries = {
+      {"key1", MakeObjectId("abc"), KeyPriority::EAGER},
+      {"a longer key", MakeObjectId("def"), KeyPriority::LAZY}};
+  std::vector<ObjectId> children = {MakeObjectId("child_1"),
+                                    MakeObjectId("child_2"),
+                                    MakeObjectId("child_3")};
+
+  // The encoded node holds the entries and their children, the last child and
+  // the header.
+  size_t size = EncodeNode({}, {MakeObjectId("child_3")}, {1}).size();
+  for (const Entry& entry : entries) {
+    size += GetEncodedEntrySize(entry);
+  }
+  EXPECT_EQ(size, EncodeNode(entries, children, {1, 2, 3}).size());
 }
 
 }  // namespace
@@ -0,0 +1,434 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/hash_tree.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/hash.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+namespace hash_tree {
+namespace {
+
+// Number of bits of the hash of a key consumed by each level.
+constexpr int kBitsPerLevel = 5;
+static_assert(1u << kBitsPerLevel == kFanout,
+              "The fanout must be a power of two.");
+
+struct Node;
+
+// A subtree being updated. Subtrees that are not modified are only referred to
+// by their |id| and |entry_count|, and are never loaded nor written. |node| is
+// set once the subtree is loaded, and |id| is cleared once it is modified.
+struct Subtree {
+  ObjectId id;
+  uint64_t entry_count = 0;
+  std::unique_ptr<Node> node;
+
+  bool empty() const { return id.empty() && !node; }
+};
+
+// A node of a subtree, with at least one entry. All entries of a node have the
+// same level, and |children| has one more element than |entries|.
+struct Node {
+  int level;
+  std::vector<Entry> entries;
+  std::vector<Subtree> children;
+};
+
+// Applies changes to a tree held in memory, by splitting and joining subtrees.
+// Each change only loads and modifies the nodes on the path to its key.
+class TreeUpdater {
+ public:
+  explicit TreeUpdater(PageStorage* page_storage)
+      : page_storage_(page_storage) {}
+
+  Status Init(ObjectIdView root_id) {
+    if (root_id.empty()) {
+      return Status::OK;
+    }
+    root_.id = root_id.ToString();
+    Status status = Load(&root_);
+    if (status != Status::OK) {
+      return status;
+    }
+    if (!root_.node) {
+      // The root of the empty tree has no entry.
+      root_.id.clear();
+    }
+    return Status::OK;
+  }
+
+  // Adds or updates the entry of |change|, or removes it.
+  Status Apply(const EntryChange& change) {
+    Subtree left;
+    Subtree right;
+    Status status = Split(std::move(root_), change.entry.key, &left, &right);
+    if (status != Status::OK) {
+      return status;
+    }
+    return Join(std::move(left), change.deleted ? nullptr : &change.entry,
+                std::move(right), &root_);
+  }
+
+  // Removes the entries with keys in |range|. The subtree between the bounds
+  // of the range is dropped without being loaded.
+  Status DeleteRange(const KeyRange& range) {
+    if (!range.end.empty() && range.end <= range.start) {
+      return Status::OK;
+    }
+    Subtree left;
+    Subtree rest;
+    Status status = Split(std::move(root_), range.start, &left, &rest);
+    if (status != Status::OK) {
+      return status;
+    }
+    if (range.end.empty()) {
+      root_ = std::move(left);
+      return Status::OK;
+    }
+    Subtree middle;
+    Subtree right;
+    std::unique_ptr<Entry> end_entry;
+    status = Split(std::move(rest), range.end, &middle, &right, &end_entry);
+    if (status != Status::OK) {
+      return status;
+    }
+    return Join(std::move(left), end_entry.get(), std::move(right), &root_);
+  }
+
+  // Writes all modified nodes and stores the id of the root in |root_id|.
+  Status Finish(ObjectId* root_id) {
+    if (root_.empty()) {
+      return Write({}, {""}, {0}, root_id);
+    }
+    uint64_t entry_count;
+    return Write(&root_, root_id, &entry_count);
+  }
+
+  const std::unordered_set<ObjectId>& new_nodes() const { return new_nodes_; }
+
+ private:
+  // Loads the node of |subtree| if it is not loaded yet. The node of a stored
+  // subtree without entries is left null.
+  Status Load(Subtree* subtree) {
+    if (subtree->node || subtree->id.empty()) {
+      return Status::OK;
+    }
+    std::unique_ptr<const TreeNode> tree_node;
+    Status status =
+        TreeNode::FromIdSynchronous(page_storage_, subtree->id, &tree_node);
+    if (status != Status::OK) {
+      return status;
+    }
+    stored_nodes_.insert(subtree->id);
+    if (tree_node->GetKeyCount() == 0) {
+      return Status::OK;
+    }
+    auto node = std::make_unique<Node>();
+    node->entries.resize(tree_node->GetKeyCount());
+    for (int i = 0; i < tree_node->GetKeyCount(); ++i) {
+      status = tree_node->GetEntry(i, &node->entries[i]);
+      if (status != Status::OK) {
+        return status;
+      }
+    }
+    node->children.resize(tree_node->GetKeyCount() + 1);
+    for (int i = 0; i <= tree_node->GetKeyCount(); ++i) {
+      node->children[i].id = tree_node->GetChildId(i);
+      node->children[i].entry_count = tree_node->GetChildEntryCount(i);
+    }
+    // Trees built by another algorithm, such as the B-Tree, cannot be updated
+    // here: all entries of a node must have the level of the node.
+    node->level = GetKeyLevel(node->entries.front().key);
+    for (const Entry& entry : node->entries) {
+      if (GetKeyLevel(entry.key) != node->level) {
+        FTL_LOG(ERROR) << "Base tree is not a hash tree.";
+        return Status::FORMAT_ERROR;
+      }
+    }
+    subtree->node = std::move(node);
+    return Status::OK;
+  }
+
+  // Stores the level of the root of |subtree| in |level|, or -1 if the subtree
+  // is empty.
+  Status GetLevel(Subtree* subtree, int* level) {
+    Status status = Load(subtree);
+    if (status != Status::OK) {
+      return status;
+    }
+    *level = subtree->node ? subtree->node->level : -1;
+    return Status::OK;
+  }
+
+  // Returns a subtree holding |node|, or its only child if it has no entry.
+  static Subtree MakeSubtree(std::unique_ptr<Node> node) {
+    if (node->entries.empty()) {
+      FTL_DCHECK(node->children.size() == 1u);
+      return std::move(node->children.front());
+    }
+    Subtree subtree;
+    subtree.node = std::move(node);
+    return subtree;
+  }
+
+  // Splits |subtree| into the subtrees holding the keys lower than |key|, in
+  // |left|, and greater than |key|, in |right|. The entry with |key|, if any,
+  // is stored in |key_entry| if it is not null, and dropped otherwise.
+  Status Split(Subtree subtree,
+               const std::string& key,
+               Subtree* left,
+               Subtree* right,
+               std::unique_ptr<Entry>* key_entry = nullptr) {
+    Status status = Load(&subtree);
+    if (status != Status::OK) {
+      return status;
+    }
+    if (!subtree.node) {
+      *left = Subtree();
+      *right = Subtree();
+      return Status::OK;
+    }
+    Node& node = *subtree.node;
+    auto it = std::lower_bound(
+        node.entries.begin(), node.entries.end(), key,
+        [](const Entry& entry, const std::string& key) {
+          return entry.key < key;
+        });
+    size_t index = it - node.entries.begin();
+    bool found = it != node.entries.end() && it->key == key;
+
+    Subtree child_left;
+    Subtree child_right;
+    if (found) {
+      child_left = std::move(node.children[index]);
+      if (key_entry) {
+        *key_entry = std::make_unique<Entry>(std::move(*it));
+      }
+    } else {
+      status = Split(std::move(node.children[index]), key, &child_left,
+                     &child_right, key_entry);
+      if (status != Status::OK) {
+        return status;
+      }
+    }
+
+    auto left_node = std::make_unique<Node>();
+    left_node->level = node.level;
+    left_node->entries.assign(std::make_move_iterator(node.entries.begin()),
+                              std::make_move_iterator(it));
+    left_node->children.assign(
+        std::make_move_iterator(node.children.begin()),
+        std::make_move_iterator(node.children.begin() + index));
+    left_node->children.push_back(std::move(child_left));
+
+    auto right_node = std::make_unique<Node>();
+    right_node->level = node.level;
+    right_node->entries.assign(std::make_move_iterator(found ? it + 1 : it),
+                               std::make_move_iterator(node.entries.end()));
+    if (!found) {
+      right_node->children.push_back(std::move(child_right));
+    }
+    right_node->children.insert(
+        right_node->children.end(),
+        std::make_move_iterator(node.children.begin() + index + 1),
+        std::make_move_iterator(node.children.end()));
+
+    *left = MakeSubtree(std::move(left_node));
+    *right = MakeSubtree(std::move(right_node));
+    return Status::OK;
+  }
+
+  // Joins |left|, the optional |entry| and |right| in |result|. The keys of
+  // |left| must be lower than the key of |entry| and the keys of |right|, and
+  // the keys of |right| greater than the key of |entry|.
+  Status Join(Subtree left,
+              const Entry* entry,
+              Subtree right,
+              Subtree* result) {
+    int left_level;
+    Status status = GetLevel(&left, &left_level);
+    if (status != Status::OK) {
+      return status;
+    }
+    int right_level;
+    status = GetLevel(&right, &right_level);
+    if (status != Status::OK) {
+      return status;
+    }
+    int entry_level = entry ? GetKeyLevel(entry->key) : -1;
+    int level = std::max({left_level, entry_level, right_level});
+    if (level < 0) {
+      *result = Subtree();
+      return Status::OK;
+    }
+
+    // The new node holds the entries of |level| from all three parts. The
+    // remaining ones are joined recursively in the child between them.
+    auto node = std::make_unique<Node>();
+    node->level = level;
+    Subtree left_rest;
+    if (left_level == level) {
+      Node& left_node = *left.node;
+      node->entries = std::move(left_node.entries);
+      node->children.assign(std::make_move_iterator(left_node.children.begin()),
+                            std::make_move_iterator(left_node.children.end()));
+      left_rest = std::move(node->children.back());
+      node->children.pop_back();
+    } else {
+      left_rest = std::move(left);
+    }
+    Subtree right_rest;
+    std::unique_ptr<Node> right_node;
+    if (right_level == level) {
+      right_node = std::move(right.node);
+      right_rest = std::move(right_node->children.front());
+    } else {
+      right_rest = std::move(right);
+    }
+
+    if (entry_level == level) {
+      node->children.push_back(std::move(left_rest));
+      node->entries.push_back(*entry);
+      node->children.push_back(std::move(right_rest));
+    } else {
+      Subtree middle;
+      status = Join(std::move(left_rest), entry, std::move(right_rest), &middle);
+      if (status != Status::OK) {
+        return status;
+      }
+      node->children.push_back(std::move(middle));
+    }
+
+    if (right_node) {
+      node->entries.insert(node->entries.end(),
+                           std::make_move_iterator(right_node->entries.begin()),
+                           std::make_move_iterator(right_node->entries.end()));
+      node->children.insert(
+          node->children.end(),
+          std::make_move_iterator(right_node->children.begin() + 1),
+          std::make_move_iterator(right_node->children.end()));
+    }
+    *result = MakeSubtree(std::move(node));
+    return Status::OK;
+  }
+
+  // Writes the modified nodes of |subtree|, bottom-up, and stores the id of its
+  // root in |id| and its number of entries in |entry_count|.
+  Status Write(Subtree* subtree, ObjectId* id, uint64_t* entry_count) {
+    if (!subtree->id.empty() || !subtree->node) {
+      *id = subtree->id;
+      *entry_count = subtree->id.empty() ? 0 : subtree->entry_count;
+      return Status::OK;
+    }
+    std::vector<ObjectId> children;
+    std::vector<uint64_t> child_entry_counts;
+    *entry_count = subtree->node->entries.size();
+    for (Subtree& child : subtree->node->children) {
+      ObjectId child_id;
+      uint64_t child_entry_count;
+      Status status = Write(&child, &child_id, &child_entry_count);
+      if (status != Status::OK) {
+        return status;
+      }
+      children.push_back(std::move(child_id));
+      child_entry_counts.push_back(child_entry_count);
+      *entry_count = AddEntryCounts(*entry_count, child_entry_count);
+    }
+    return Write(subtree->node->entries, children, child_entry_counts, id);
+  }
+
+  Status Write(const std::vector<Entry>& entries,
+               const std::vector<ObjectId>& children,
+               const std::vector<uint64_t>& child_entry_counts,
+               ObjectId* id) {
+    Status status = TreeNode::FromEntries(page_storage_, entries, children,
+                                          child_entry_counts, id);
+    if (status != Status::OK) {
+      return status;
+    }
+    // Changes that cancel out rebuild nodes that were already stored.
+    if (stored_nodes_.find(*id) == stored_nodes_.end()) {
+      new_nodes_.insert(*id);
+    }
+    return Status::OK;
+  }
+
+  PageStorage* const page_storage_;
+  Subtree root_;
+  std::unordered_set<ObjectId> stored_nodes_;
+  std::unordered_set<ObjectId> new_nodes_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TreeUpdater);
+};
+
+}  // namespace
+
+uint8_t GetKeyLevel(convert::ExtendedStringView key) {
+  std::string hash = glue::SHA256Hash(key.data(), key.size());
+  uint8_t leading_zeros = 0;
+  for (char c : hash) {
+    uint8_t byte = static_cast<uint8_t>(c);
+    if (byte != 0) {
+      while (!(byte & 0x80)) {
+        ++leading_zeros;
+        byte <<= 1;
+      }
+      break;
+    }
+    leading_zeros += 8;
+  }
+  return leading_zeros / kBitsPerLevel;
+}
+
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback) {
+  ApplyChanges(page_storage, root_id, {}, std::move(changes),
+               std::move(callback));
+}
+
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::vector<KeyRange> deleted_ranges,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback) {
+  TreeUpdater updater(page_storage);
+  Status status = updater.Init(root_id);
+  for (size_t i = 0; status == Status::OK && i < deleted_ranges.size(); ++i) {
+    status = updater.DeleteRange(deleted_ranges[i]);
+  }
+  // Deletions of keys that are not in the tree are no-ops.
+  for (; status == Status::OK && changes->Valid(); changes->Next()) {
+    status = updater.Apply(**changes);
+  }
+  if (status == Status::OK) {
+    status = changes->GetStatus();
+  }
+
+  ObjectId new_root_id;
+  if (status == Status::OK) {
+    status = updater.Finish(&new_root_id);
+  }
+  if (status != Status::OK) {
+    callback(status, "", {});
+    return;
+  }
+  callback(Status::OK, std::move(new_root_id), updater.new_nodes());
+}
+
+}  // namespace hash_tree
+}  // namespace storage
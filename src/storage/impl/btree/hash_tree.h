@@ -0,0 +1,65 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_HASH_TREE_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_HASH_TREE_H_
+
+#include <functional>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/storage/public/iterator.h"
+#include "apps/ledger/src/storage/public/page_storage.h"
+#include "apps/ledger/src/storage/public/types.h"
+
+namespace storage {
+
+// A history-independent search tree, stored with the same node format as the
+// B-Tree of |btree_utils.h|, and read with the same iterators.
+//
+// Each key is assigned a level, computed from its hash: a key has level at
+// least L + 1 with probability 1 / kFanout^(L + 1). A tree holds the
+// entries of its highest level in its root node, and the entries between two
+// consecutive ones, or before the first and after the last, in the child
+// subtree at that position, built the same way. The shape of a tree thus only
+// depends on its contents, and identical contents always yield the same nodes,
+// whatever the order in which changes were applied and on which device.
+namespace hash_tree {
+
+// Average number of entries of a node. The key levels, and so the shape of the
+// trees, depend on it: it cannot be changed without rebuilding all trees.
+constexpr size_t kFanout = 32;
+
+// Returns the level of the given |key|, i.e. the height, counting from 0 for
+// leaves, of the node holding it.
+uint8_t GetKeyLevel(convert::ExtendedStringView key);
+
+// Applies changes provided by |changes| to the tree starting at |root_id|.
+// |changes| must provide |EntryChange| objects sorted by their key. The
+// callback will provide the status of the operation, the id of the new root
+// and the list of ids of all new nodes created after the changes.
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback);
+
+// Same as above, but first removes the entries with keys in any of
+// |deleted_ranges|. Only the nodes on the paths to the bounds of each range
+// are loaded and rewritten: the subtrees between them are dropped.
+void ApplyChanges(
+    PageStorage* page_storage,
+    ObjectIdView root_id,
+    std::vector<KeyRange> deleted_ranges,
+    std::unique_ptr<Iterator<const EntryChange>> changes,
+    std::function<void(Status, ObjectId, std::unordered_set<ObjectId>)>
+        callback);
+
+}  // namespace hash_tree
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_HASH_TREE_H_
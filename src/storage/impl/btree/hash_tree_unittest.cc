@@ -0,0 +1,320 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/hash_tree.h"
+
+#include <algorithm>
+#include <limits>
+#include <random>
+
+#include "apps/ledger/src/storage/fake/fake_page_storage.h"
+#include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/entry_change_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "apps/ledger/src/storage/public/constants.h"
+#include "apps/ledger/src/test/capture.h"
+#include "apps/ledger/src/test/test_with_message_loop.h"
+#include "gtest/gtest.h"
+#include "lib/ftl/strings/string_printf.h"
+
+namespace storage {
+namespace {
+
+std::vector<EntryChange> CreateEntryChanges(int size,
+                                            const std::string& value_prefix) {
+  std::vector<EntryChange> result;
+  for (int i = 0; i < size; ++i) {
+    ObjectId value_id = ftl::StringPrintf("%s%04d", value_prefix.c_str(), i);
+    value_id.resize(kObjectIdSize, '0');
+    result.push_back(EntryChange{Entry{ftl::StringPrintf("key%04d", i),
+                                       std::move(value_id), KeyPriority::EAGER},
+                                 false});
+  }
+  return result;
+}
+
+class HashTreeTest : public ::test::TestWithMessageLoop {
+ public:
+  HashTreeTest() : fake_storage_("page_id") {}
+
+  ~HashTreeTest() override {}
+
+ protected:
+  ObjectId CreateEmptyContents() {
+    ObjectId id;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromEntries(&fake_storage_, std::vector<Entry>(),
+                                    std::vector<ObjectId>(1), &id));
+    return id;
+  }
+
+  ObjectId ApplyChanges(ObjectIdView root_id,
+                        std::vector<EntryChange> changes,
+                        std::unordered_set<ObjectId>* new_nodes = nullptr) {
+    std::sort(changes.begin(), changes.end(),
+              [](const EntryChange& lhs, const EntryChange& rhs) {
+                return lhs.entry.key < rhs.entry.key;
+              });
+    Status status;
+    ObjectId new_root_id;
+    std::unordered_set<ObjectId> nodes;
+    hash_tree::ApplyChanges(
+        &fake_storage_, root_id,
+        std::make_unique<EntryChangeIterator>(changes.begin(), changes.end()),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &new_root_id, &nodes));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::OK, status);
+    if (new_nodes) {
+      *new_nodes = std::move(nodes);
+    }
+    return new_root_id;
+  }
+
+  // Checks that the tree with the given root holds exactly |entries|, sorted by
+  // key, and records their number.
+  void CheckContents(ObjectIdView root_id, const std::vector<Entry>& entries) {
+    std::unique_ptr<const TreeNode> root;
+    ASSERT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, root_id, &root));
+    EXPECT_EQ(entries.size(), root->GetSubtreeEntryCount());
+    BTreeIterator it(std::move(root));
+    for (const Entry& entry : entries) {
+      ASSERT_TRUE(it.Valid());
+      EXPECT_EQ(entry, *it);
+      it.Next();
+    }
+    EXPECT_FALSE(it.Valid());
+    EXPECT_EQ(Status::OK, it.GetStatus());
+  }
+
+  // Checks that all entries of the subtree with the given root are lower than
+  // the level of the parent node, |max_level|, and share the same level within
+  // a node.
+  void CheckLevels(ObjectIdView node_id, int max_level) {
+    std::unique_ptr<const TreeNode> node;
+    ASSERT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+    ASSERT_LT(0, node->GetKeyCount());
+    Entry entry;
+    ASSERT_EQ(Status::OK, node->GetEntry(0, &entry));
+    int level = hash_tree::GetKeyLevel(entry.key);
+    EXPECT_LT(level, max_level);
+    for (int i = 0; i <= node->GetKeyCount(); ++i) {
+      if (i < node->GetKeyCount()) {
+        ASSERT_EQ(Status::OK, node->GetEntry(i, &entry));
+        EXPECT_EQ(level, hash_tree::GetKeyLevel(entry.key));
+      }
+      ObjectId child_id = node->GetChildId(i);
+      if (!child_id.empty()) {
+        CheckLevels(child_id, level);
+      }
+    }
+  }
+
+  // Returns a description of the shape and contents of the tree with the given
+  // root. |FakePageStorage| assigns random ids to the nodes: identical trees
+  // are compared with their descriptions instead.
+  std::string Describe(ObjectIdView node_id) {
+    std::unique_ptr<const TreeNode> node;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+    std::string result = "[";
+    for (int i = 0; i <= node->GetKeyCount(); ++i) {
+      ObjectId child_id = node->GetChildId(i);
+      if (!child_id.empty()) {
+        result += Describe(child_id);
+      }
+      if (i < node->GetKeyCount()) {
+        Entry entry;
+        EXPECT_EQ(Status::OK, node->GetEntry(i, &entry));
+        result += " " + entry.key + ":" + entry.object_id + " ";
+      }
+    }
+    return result + "]";
+  }
+
+  fake::FakePageStorage fake_storage_;
+
+ private:
+  FTL_DISALLOW_COPY_AND_ASSIGN(HashTreeTest);
+};
+
+TEST_F(HashTreeTest, GetKeyLevel) {
+  // Levels are in [0, 256 / 5], and about 1 / 32 of the keys are above 0.
+  int above_zero = 0;
+  for (int i = 0; i < 3200; ++i) {
+    uint8_t level = hash_tree::GetKeyLevel(ftl::StringPrintf("key%d", i));
+    EXPECT_LE(level, 51);
+    if (level > 0) {
+      ++above_zero;
+    }
+  }
+  EXPECT_LT(50, above_zero);
+  EXPECT_GT(150, above_zero);
+}
+
+TEST_F(HashTreeTest, ApplyChangesFromEmpty) {
+  std::vector<EntryChange> changes = CreateEntryChanges(1000, "value");
+  std::unordered_set<ObjectId> new_nodes;
+  ObjectId root_id = ApplyChanges(CreateEmptyContents(), changes, &new_nodes);
+  EXPECT_TRUE(new_nodes.find(root_id) != new_nodes.end());
+  // With 1000 entries, nodes have 32 entries on average.
+  EXPECT_LT(1u, new_nodes.size());
+  EXPECT_GT(200u, new_nodes.size());
+
+  std::vector<Entry> entries;
+  for (const EntryChange& change : changes) {
+    entries.push_back(change.entry);
+  }
+  CheckContents(root_id, entries);
+  CheckLevels(root_id, std::numeric_limits<int>::max());
+}
+
+TEST_F(HashTreeTest, HistoryIndependence) {
+  std::vector<EntryChange> changes = CreateEntryChanges(500, "value");
+  std::string expected_tree =
+      Describe(ApplyChanges(CreateEmptyContents(), changes));
+
+  // Insert the same entries in batches of varying sizes, in random order.
+  std::mt19937 generator(0);
+  for (size_t batch_size : {1u, 7u, 100u}) {
+    std::vector<EntryChange> shuffled = changes;
+    std::shuffle(shuffled.begin(), shuffled.end(), generator);
+    ObjectId root_id = CreateEmptyContents();
+    for (size_t i = 0; i < shuffled.size(); i += batch_size) {
+      size_t end = std::min(i + batch_size, shuffled.size());
+      root_id = ApplyChanges(root_id, std::vector<EntryChange>(
+                                          shuffled.begin() + i,
+                                          shuffled.begin() + end));
+    }
+    EXPECT_EQ(expected_tree, Describe(root_id));
+  }
+}
+
+TEST_F(HashTreeTest, DeleteChanges) {
+  std::vector<EntryChange> changes = CreateEntryChanges(500, "value");
+  ObjectId root_id = ApplyChanges(CreateEmptyContents(), changes);
+
+  // Deleting every other key gives the tree of the remaining keys only.
+  std::vector<EntryChange> deletions;
+  std::vector<EntryChange> remaining;
+  std::vector<Entry> entries;
+  for (size_t i = 0; i < changes.size(); ++i) {
+    if (i % 2 == 0) {
+      deletions.push_back(EntryChange{changes[i].entry, true});
+    } else {
+      remaining.push_back(changes[i]);
+      entries.push_back(changes[i].entry);
+    }
+  }
+  ObjectId deleted_root_id = ApplyChanges(root_id, deletions);
+  EXPECT_EQ(Describe(ApplyChanges(CreateEmptyContents(), remaining)),
+            Describe(deleted_root_id));
+  CheckContents(deleted_root_id, entries);
+
+  // Deleting all keys gives the empty tree.
+  for (EntryChange& change : remaining) {
+    change.deleted = true;
+  }
+  EXPECT_EQ("[]", Describe(ApplyChanges(deleted_root_id, remaining)));
+}
+
+TEST_F(HashTreeTest, UpdateValues) {
+  std::vector<EntryChange> changes = CreateEntryChanges(500, "value");
+  ObjectId root_id = ApplyChanges(CreateEmptyContents(), changes);
+
+  std::vector<EntryChange> updates = CreateEntryChanges(500, "other");
+  std::unordered_set<ObjectId> new_nodes;
+  ObjectId updated_root_id =
+      ApplyChanges(root_id, {updates[42], updates[420]}, &new_nodes);
+  // Only the nodes on the paths to the updated keys are rewritten.
+  EXPECT_GE(new_nodes.size(), 1u);
+  EXPECT_LE(new_nodes.size(), 6u);
+
+  std::vector<Entry> entries;
+  for (const EntryChange& change : changes) {
+    entries.push_back(change.entry);
+  }
+  entries[42] = updates[42].entry;
+  entries[420] = updates[420].entry;
+  CheckContents(updated_root_id, entries);
+
+  // Restoring the values gives back the original tree.
+  EXPECT_EQ(Describe(root_id),
+            Describe(ApplyChanges(updated_root_id,
+                                  {changes[42], changes[420]})));
+}
+
+TEST_F(HashTreeTest, DeleteRanges) {
+  std::vector<EntryChange> changes = CreateEntryChanges(1000, "value");
+  ObjectId root_id = ApplyChanges(CreateEmptyContents(), changes);
+  std::vector<EntryChange> updates = CreateEntryChanges(1000, "other");
+
+  // Delete two ranges, and put an entry back in the first one.
+  std::vector<KeyRange> deleted_ranges = {{"key0100", "key0600"},
+                                          {"key0900", ""}};
+  std::vector<EntryChange> range_changes = {updates[300]};
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  hash_tree::ApplyChanges(
+      &fake_storage_, root_id, deleted_ranges,
+      std::make_unique<EntryChangeIterator>(range_changes.begin(),
+                                            range_changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  // Only the nodes on the paths to the bounds of the ranges and to the put
+  // key are rewritten.
+  EXPECT_LE(new_nodes.size(), 12u);
+
+  std::vector<EntryChange> remaining;
+  std::vector<Entry> entries;
+  for (size_t i = 0; i < changes.size(); ++i) {
+    const EntryChange& change = i == 300 ? updates[i] : changes[i];
+    if (i < 100 || i == 300 || (i >= 600 && i < 900)) {
+      remaining.push_back(change);
+      entries.push_back(change.entry);
+    }
+  }
+  EXPECT_EQ(Describe(ApplyChanges(CreateEmptyContents(), remaining)),
+            Describe(new_root_id));
+  CheckContents(new_root_id, entries);
+}
+
+TEST_F(HashTreeTest, RejectNonHashTreeBase) {
+  // A node holding keys of different levels is not part of a hash tree.
+  std::vector<EntryChange> changes = CreateEntryChanges(100, "v");
+  std::vector<Entry> entries = {changes[0].entry};
+  for (const EntryChange& change : changes) {
+    if (hash_tree::GetKeyLevel(change.entry.key) !=
+        hash_tree::GetKeyLevel(entries[0].key)) {
+      entries.push_back(change.entry);
+      break;
+    }
+  }
+  ASSERT_EQ(2u, entries.size());
+  ObjectId root_id;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromEntries(&fake_storage_, entries,
+                                  std::vector<ObjectId>(3), &root_id));
+
+  std::vector<EntryChange> new_changes = CreateEntryChanges(1, "w");
+  Status status;
+  ObjectId new_root_id;
+  std::unordered_set<ObjectId> new_nodes;
+  hash_tree::ApplyChanges(
+      &fake_storage_, root_id,
+      std::make_unique<EntryChangeIterator>(new_changes.begin(),
+                                            new_changes.end()),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &new_root_id, &new_nodes));
+  ASSERT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::FORMAT_ERROR, status);
+}
+
+}  // namespace
+}  // namespace storage
@@ -0,0 +1,75 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/key_index.h"
+
+#include <algorithm>
+
+namespace storage {
+namespace {
+
+// Returns the 8 bytes of |key| starting at |offset|, padded with zero bytes,
+// as a big endian integer.
+uint64_t GetFingerprint(ftl::StringView key, size_t offset) {
+  uint64_t fingerprint = 0;
+  for (size_t i = offset; i < offset + sizeof(uint64_t); ++i) {
+    fingerprint <<= 8;
+    if (i < key.size()) {
+      fingerprint |= static_cast<uint8_t>(key[i]);
+    }
+  }
+  return fingerprint;
+}
+
+}  // namespace
+
+KeyIndex::KeyIndex() {}
+
+KeyIndex::KeyIndex(const std::vector<Entry>& entries) {
+  if (entries.empty()) {
+    return;
+  }
+  // Keys are sorted: the prefix shared by all keys is the one shared by the
+  // first and the last.
+  const std::string& first = entries.front().key;
+  const std::string& last = entries.back().key;
+  size_t prefix_size = 0;
+  while (prefix_size < first.size() && prefix_size < last.size() &&
+         first[prefix_size] == last[prefix_size]) {
+    ++prefix_size;
+  }
+  common_prefix_ = first.substr(0, prefix_size);
+
+  fingerprints_.reserve(entries.size());
+  for (const Entry& entry : entries) {
+    fingerprints_.push_back(GetFingerprint(entry.key, prefix_size));
+  }
+}
+
+KeyIndex::~KeyIndex() {}
+
+void KeyIndex::Find(convert::ExtendedStringView key,
+                    size_t* begin,
+                    size_t* end) const {
+  int prefix_order =
+      key.substr(0, common_prefix_.size()).compare(common_prefix_);
+  if (prefix_order != 0) {
+    // |key| is lower, respectively greater, than all the keys.
+    *begin = prefix_order < 0 ? 0 : fingerprints_.size();
+    *end = *begin;
+    return;
+  }
+
+  auto range =
+      std::equal_range(fingerprints_.begin(), fingerprints_.end(),
+                       GetFingerprint(key, common_prefix_.size()));
+  *begin = range.first - fingerprints_.begin();
+  *end = range.second - fingerprints_.begin();
+}
+
+size_t KeyIndex::GetSize() const {
+  return common_prefix_.size() + fingerprints_.size() * sizeof(uint64_t);
+}
+
+}  // namespace storage
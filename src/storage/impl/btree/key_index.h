@@ -0,0 +1,52 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_KEY_INDEX_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_KEY_INDEX_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/storage/public/types.h"
+
+namespace storage {
+
+// A search structure over the sorted keys of a tree node, built when the node
+// is decoded.
+//
+// The prefix shared by all keys of the node is stored once. The next 8 bytes
+// of each key, padded with zero bytes, form its fingerprint, stored as a big
+// endian integer in a contiguous array. Fingerprints preserve the order of the
+// keys: if the fingerprints of two keys differ, they compare as the keys. A
+// key is thus located by comparing integers, without reading the keys of the
+// node, and only the keys with the same fingerprint remain to be compared.
+class KeyIndex {
+ public:
+  KeyIndex();
+  // |entries| must be sorted by key.
+  explicit KeyIndex(const std::vector<Entry>& entries);
+  ~KeyIndex();
+
+  // Stores in [|begin|, |end|) the positions of the keys that have the same
+  // fingerprint as |key|. Keys before |begin| are lower than |key|, and keys
+  // from |end| on are greater.
+  void Find(convert::ExtendedStringView key, size_t* begin, size_t* end) const;
+
+  // Number of keys in the index.
+  size_t key_count() const { return fingerprints_.size(); }
+
+  // Approximate memory allocated by the index, in bytes.
+  size_t GetSize() const;
+
+ private:
+  std::string common_prefix_;
+  std::vector<uint64_t> fingerprints_;
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_KEY_INDEX_H_
@@ -0,0 +1,124 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/key_index.h"
+
+#include <algorithm>
+
+#include "apps/ledger/src/storage/public/constants.h"
+#include "gtest/gtest.h"
+#include "lib/ftl/strings/string_printf.h"
+
+namespace storage {
+namespace {
+
+std::string operator"" _s(const char* str, size_t size) {
+  return std::string(str, size);
+}
+
+std::vector<Entry> MakeEntries(std::vector<std::string> keys) {
+  std::sort(keys.begin(), keys.end());
+  std::vector<Entry> entries;
+  for (std::string& key : keys) {
+    entries.push_back(Entry{std::move(key), ObjectId(kObjectIdSize, 'a'),
+                            KeyPriority::EAGER});
+  }
+  return entries;
+}
+
+// Checks that the range returned by |KeyIndex::Find()| for each of |queries|
+// separates the keys lower and greater than the query.
+void CheckFind(const std::vector<Entry>& entries,
+               const std::vector<std::string>& queries) {
+  KeyIndex index(entries);
+  EXPECT_EQ(entries.size(), index.key_count());
+  for (const std::string& query : queries) {
+    size_t begin;
+    size_t end;
+    index.Find(query, &begin, &end);
+    ASSERT_LE(begin, end);
+    ASSERT_LE(end, entries.size());
+    for (size_t i = 0; i < begin; ++i) {
+      EXPECT_LT(entries[i].key, query);
+    }
+    for (size_t i = end; i < entries.size(); ++i) {
+      EXPECT_GT(entries[i].key, query);
+    }
+  }
+}
+
+// Returns the keys of |entries|, and keys right before and after each of
+// them.
+std::vector<std::string> MakeQueries(const std::vector<Entry>& entries) {
+  std::vector<std::string> queries = {"", std::string(10, '\xff')};
+  for (const Entry& entry : entries) {
+    queries.push_back(entry.key);
+    queries.push_back(entry.key + "\0"_s);
+    queries.push_back(entry.key + "\xff");
+    if (!entry.key.empty()) {
+      queries.push_back(entry.key.substr(0, entry.key.size() - 1));
+    }
+  }
+  return queries;
+}
+
+TEST(KeyIndexTest, Empty) {
+  KeyIndex index(std::vector<Entry>{});
+  size_t begin;
+  size_t end;
+  index.Find("key", &begin, &end);
+  EXPECT_EQ(0u, begin);
+  EXPECT_EQ(0u, end);
+}
+
+TEST(KeyIndexTest, Find) {
+  // Keys shorter and longer than the fingerprints, and with zero bytes.
+  std::vector<Entry> entries =
+      MakeEntries({"", "a", "ab", "ab\0"_s, "ab\0\0"_s, "abc", "abcdefgh",
+                   "abcdefghi", "abcdefghj", "b", "\xff"});
+  CheckFind(entries, MakeQueries(entries));
+}
+
+TEST(KeyIndexTest, CommonPrefix) {
+  // Keys sharing a long prefix are told apart by the bytes that follow it.
+  for (size_t size : {10u, 500u}) {
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < size; ++i) {
+      keys.push_back(ftl::StringPrintf("com.example.app/contacts/%04zu", i));
+    }
+    std::vector<Entry> entries = MakeEntries(keys);
+    std::vector<std::string> queries = MakeQueries(entries);
+    queries.push_back("com.example.app/");
+    queries.push_back("com.example.app/contacts/");
+    queries.push_back("com.example.app0");
+    queries.push_back("com");
+    CheckFind(entries, queries);
+
+    // Each key has its own fingerprint.
+    KeyIndex index(entries);
+    for (size_t i = 0; i < entries.size(); ++i) {
+      size_t begin;
+      size_t end;
+      index.Find(entries[i].key, &begin, &end);
+      EXPECT_EQ(i, begin);
+      EXPECT_EQ(i + 1, end);
+    }
+  }
+}
+
+TEST(KeyIndexTest, SameFingerprint) {
+  // Keys differing after the fingerprint share the same range.
+  std::vector<Entry> entries = MakeEntries(
+      {"p/0123456789a", "p/0123456789b", "p/0123456789c", "p/1"});
+  KeyIndex index(entries);
+  size_t begin;
+  size_t end;
+  index.Find("p/0123456789bb", &begin, &end);
+  EXPECT_EQ(0u, begin);
+  EXPECT_EQ(3u, end);
+  CheckFind(entries, MakeQueries(entries));
+}
+
+}  // namespace
+}  // namespace storage
@@ -0,0 +1,95 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/tree_builder.h"
+
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "lib/ftl/logging.h"
+
+namespace storage {
+
+TreeBuilder::TreeBuilder(PageStorage* page_storage, size_t node_size)
+    : page_storage_(page_storage), node_size_(node_size), levels_(1) {
+  FTL_DCHECK(node_size_ > 0);
+}
+
+TreeBuilder::~TreeBuilder() {}
+
+Status TreeBuilder::Add(Entry entry) {
+  FTL_DCHECK(!finished_);
+  FTL_DCHECK(last_key_.empty() || last_key_ < entry.key);
+  last_key_ = entry.key;
+
+  // When a node is full, it is written and the entry becomes the separator
+  // between it and the next node, in the level above.
+  size_t entry_size = GetEncodedEntrySize(entry);
+  size_t level = 0;
+  while (!levels_[level].entries.empty() &&
+         levels_[level].size + entry_size > node_size_) {
+    Status status = FlushLevel(level);
+    if (status != Status::OK) {
+      return status;
+    }
+    ++level;
+  }
+  levels_[level].entries.push_back(std::move(entry));
+  levels_[level].size += entry_size;
+  return Status::OK;
+}
+
+Status TreeBuilder::Finish(ObjectId* root_id) {
+  FTL_DCHECK(!finished_);
+  finished_ = true;
+  for (size_t level = 0; level + 1 < levels_.size(); ++level) {
+    Status status = FlushLevel(level);
+    if (status != Status::OK) {
+      return status;
+    }
+  }
+  PendingNode& root = levels_.back();
+  root.children.resize(root.entries.size() + 1);
+  root.child_entry_counts.resize(root.entries.size() + 1);
+  Status status =
+      TreeNode::FromEntries(page_storage_, root.entries, root.children,
+                            root.child_entry_counts, root_id);
+  if (status != Status::OK) {
+    return status;
+  }
+  new_nodes_.insert(*root_id);
+  return Status::OK;
+}
+
+Status TreeBuilder::FlushLevel(size_t level) {
+  if (level + 1 == levels_.size()) {
+    levels_.emplace_back();
+  }
+  PendingNode& node = levels_[level];
+  // Leaves have no children.
+  node.children.resize(node.entries.size() + 1);
+  node.child_entry_counts.resize(node.entries.size() + 1);
+  ObjectId node_id;
+  uint64_t entry_count = node.entries.size();
+  if (!node.entries.empty() || !node.children[0].empty()) {
+    Status status =
+        TreeNode::FromEntries(page_storage_, node.entries, node.children,
+                              node.child_entry_counts, &node_id);
+    if (status != Status::OK) {
+      return status;
+    }
+    new_nodes_.insert(node_id);
+    for (uint64_t child_count : node.child_entry_counts) {
+      entry_count += child_count;
+    }
+  }
+  node.entries.clear();
+  node.children.clear();
+  node.child_entry_counts.clear();
+  node.size = 0;
+  levels_[level + 1].children.push_back(std::move(node_id));
+  levels_[level + 1].child_entry_counts.push_back(entry_count);
+  return Status::OK;
+}
+
+}  // namespace storage
@@ -0,0 +1,66 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_BUILDER_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_BUILDER_H_
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "apps/ledger/src/storage/public/page_storage.h"
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+
+// Builds a B-Tree bottom-up from entries given in strictly increasing key
+// order, in a single pass. Nodes are written as soon as they are full, so that
+// only one node per level of the tree is held in memory.
+//
+// Nodes are filled with entries up to |node_size| bytes, as computed by
+// |GetEncodedEntrySize()|, except the rightmost node of each level.
+class TreeBuilder {
+ public:
+  TreeBuilder(PageStorage* page_storage, size_t node_size);
+  ~TreeBuilder();
+
+  // Adds the next entry of the tree. Its key must be greater than the keys of
+  // all the entries previously added.
+  Status Add(Entry entry);
+
+  // Writes the remaining nodes and stores the id of the root in |root_id|. No
+  // entry can be added afterwards.
+  Status Finish(ObjectId* root_id);
+
+  // Ids of all the nodes written.
+  const std::unordered_set<ObjectId>& new_nodes() const { return new_nodes_; }
+
+ private:
+  // The node being filled at a given level of the tree. Leaves are at level 0.
+  // A node of level > 0 holds one more child than entries once complete.
+  struct PendingNode {
+    std::vector<Entry> entries;
+    std::vector<ObjectId> children;
+    std::vector<uint64_t> child_entry_counts;
+    size_t size = 0;
+  };
+
+  // Writes the node at |level| and adds it as the next child of the level
+  // above. An empty node is replaced by an empty child id.
+  Status FlushLevel(size_t level);
+
+  PageStorage* const page_storage_;
+  const size_t node_size_;
+  std::vector<PendingNode> levels_;
+  std::unordered_set<ObjectId> new_nodes_;
+  std::string last_key_;
+  bool finished_ = false;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TreeBuilder);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_BUILDER_H_
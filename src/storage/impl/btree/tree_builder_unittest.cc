@@ -0,0 +1,132 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/tree_builder.h"
+
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "apps/ledger/src/storage/fake/fake_page_storage.h"
+#include "apps/ledger/src/storage/impl/btree/btree_iterator.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node.h"
+#include "apps/ledger/src/storage/public/constants.h"
+#include "gtest/gtest.h"
+#include "lib/ftl/strings/string_printf.h"
+
+namespace storage {
+namespace {
+
+// Number of test entries, with keys "keyXXXX", fitting in a node.
+const size_t kTestEntriesPerNode = 4;
+
+const size_t kTestNodeSize =
+    kTestEntriesPerNode *
+    GetEncodedEntrySize(
+        Entry{"key0000", ObjectId(kObjectIdSize, 'a'), KeyPriority::EAGER});
+
+ObjectId RandomId() {
+  std::string result;
+  result.resize(kObjectIdSize);
+  glue::RandBytes(&result[0], kObjectIdSize);
+  return result;
+}
+
+std::vector<Entry> GetEntries(int size) {
+  std::vector<Entry> entries;
+  for (int i = 0; i < size; ++i) {
+    entries.push_back(Entry{ftl::StringPrintf("key%04d", i), RandomId(),
+                            KeyPriority::EAGER});
+  }
+  return entries;
+}
+
+class TreeBuilderTest : public ::testing::Test {
+ public:
+  TreeBuilderTest() : fake_storage_("page_id") {}
+
+  ~TreeBuilderTest() override {}
+
+ protected:
+  ObjectId Build(const std::vector<Entry>& entries,
+                 std::unordered_set<ObjectId>* new_nodes) {
+    TreeBuilder builder(&fake_storage_, kTestNodeSize);
+    for (const Entry& entry : entries) {
+      EXPECT_EQ(Status::OK, builder.Add(entry));
+    }
+    ObjectId root_id;
+    EXPECT_EQ(Status::OK, builder.Finish(&root_id));
+    *new_nodes = builder.new_nodes();
+    return root_id;
+  }
+
+  // Checks that the subtree with the given root has at most
+  // |kTestEntriesPerNode| entries per node and all its leaves at the given
+  // |height|, and returns the number of its nodes.
+  size_t CheckNodes(ObjectIdView node_id, int height) {
+    std::unique_ptr<const TreeNode> node;
+    EXPECT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, node_id, &node));
+    EXPECT_LE(static_cast<size_t>(node->GetKeyCount()), kTestEntriesPerNode);
+    size_t node_count = 1;
+    for (int i = 0; i <= node->GetKeyCount(); ++i) {
+      ObjectId child_id = node->GetChildId(i);
+      if (height == 0) {
+        EXPECT_TRUE(child_id.empty());
+      } else if (!child_id.empty()) {
+        node_count += CheckNodes(child_id, height - 1);
+      }
+    }
+    return node_count;
+  }
+
+  fake::FakePageStorage fake_storage_;
+
+ private:
+  FTL_DISALLOW_COPY_AND_ASSIGN(TreeBuilderTest);
+};
+
+TEST_F(TreeBuilderTest, Empty) {
+  std::unordered_set<ObjectId> new_nodes;
+  ObjectId root_id = Build(std::vector<Entry>(), &new_nodes);
+  EXPECT_EQ(1u, new_nodes.size());
+
+  std::unique_ptr<const TreeNode> root;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromIdSynchronous(&fake_storage_, root_id, &root));
+  EXPECT_EQ(0, root->GetKeyCount());
+  EXPECT_TRUE(root->GetChildId(0).empty());
+}
+
+TEST_F(TreeBuilderTest, Build) {
+  // Sizes filling the levels exactly, and leaving partial nodes.
+  for (int size : {1, 4, 5, 9, 24, 25, 100, 124, 125, 1000}) {
+    std::vector<Entry> entries = GetEntries(size);
+    std::unordered_set<ObjectId> new_nodes;
+    ObjectId root_id = Build(entries, &new_nodes);
+
+    std::unique_ptr<const TreeNode> root;
+    ASSERT_EQ(Status::OK,
+              TreeNode::FromIdSynchronous(&fake_storage_, root_id, &root));
+    EXPECT_EQ(entries.size(), root->GetSubtreeEntryCount());
+    BTreeIterator it(std::move(root));
+    for (const Entry& entry : entries) {
+      ASSERT_TRUE(it.Valid());
+      EXPECT_EQ(entry, *it);
+      it.Next();
+    }
+    EXPECT_FALSE(it.Valid());
+    EXPECT_EQ(Status::OK, it.GetStatus());
+
+    // Full nodes hold |kTestEntriesPerNode| entries, and have one more child.
+    int height = 0;
+    for (size_t capacity = kTestEntriesPerNode; capacity < entries.size();
+         capacity =
+             capacity * (kTestEntriesPerNode + 1) + kTestEntriesPerNode) {
+      ++height;
+    }
+    EXPECT_EQ(new_nodes.size(), CheckNodes(root_id, height));
+  }
+}
+
+}  // namespace
+}  // namespace storage
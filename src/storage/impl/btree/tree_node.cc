@@ -15,13 +15,16 @@ namespace storage {
 
 TreeNode::TreeNode(PageStorage* page_storage,
                    std::string id,
-                   std::vector<Entry> entries,
-                   std::vector<ObjectId> children)
+                   std::shared_ptr<const DecodedNode> contents)
     : page_storage_(page_storage),
       id_(std::move(id)),
-      entries_(entries),
-      children_(children) {
+      contents_(std::move(contents)),
+      entries_(contents_->entries),
+      children_(contents_->children),
+      child_entry_counts_(contents_->child_entry_counts) {
   FTL_DCHECK(entries_.size() + 1 == children_.size());
+  FTL_DCHECK(children_.size() == child_entry_counts_.size());
+  FTL_DCHECK(contents_->key_index.key_count() == entries_.size());
 }
 
 TreeNode::~TreeNode() {}
@@ -30,7 +33,15 @@ void TreeNode::FromId(
     PageStorage* page_storage,
     ObjectIdView id,
     std::function<void(Status, std::unique_ptr<const TreeNode>)> callback) {
-  std::unique_ptr<const Object> object;
+  TreeNodeCache* cache = page_storage->GetTreeNodeCache();
+  if (cache) {
+    std::shared_ptr<const DecodedNode> contents = cache->Get(id);
+    if (contents) {
+      callback(Status::OK, std::unique_ptr<const TreeNode>(new TreeNode(
+                               page_storage, id.ToString(), contents)));
+      return;
+    }
+  }
   page_storage->GetObject(
       id, [ page_storage, callback = std::move(callback) ](
               Status status, std::unique_ptr<const Object> object) {
@@ -47,6 +58,14 @@ void TreeNode::FromId(
 Status TreeNode::FromIdSynchronous(PageStorage* page_storage,
                                    ObjectIdView id,
                                    std::unique_ptr<const TreeNode>* node) {
+  TreeNodeCache* cache = page_storage->GetTreeNodeCache();
+  if (cache) {
+    std::shared_ptr<const DecodedNode> contents = cache->Get(id);
+    if (contents) {
+      node->reset(new TreeNode(page_storage, id.ToString(), contents));
+      return Status::OK;
+    }
+  }
   std::unique_ptr<const Object> object;
   Status status = page_storage->GetObjectSynchronous(id, &object);
   if (status != Status::OK) {
@@ -58,18 +77,23 @@ Status TreeNode::FromIdSynchronous(PageStorage* page_storage,
 Status TreeNode::FromObject(PageStorage* page_storage,
                             std::unique_ptr<const Object> object,
                             std::unique_ptr<const TreeNode>* node) {
-  ftl::StringView json;
-  Status status = object->GetData(&json);
+  ftl::StringView data;
+  Status status = object->GetData(&data);
   if (status != Status::OK) {
     return status;
   }
-  std::vector<Entry> entries;
-  std::vector<ObjectId> children;
-  if (!DecodeNode(json, &entries, &children)) {
+  auto contents = std::make_shared<DecodedNode>();
+  if (!DecodeNode(data, &contents->entries, &contents->children,
+                  &contents->child_entry_counts)) {
     return Status::FORMAT_ERROR;
   }
-  node->reset(new TreeNode(page_storage, object->GetId(), std::move(entries),
-                           std::move(children)));
+  contents->key_index = KeyIndex(contents->entries);
+  ObjectId id = object->GetId();
+  TreeNodeCache* cache = page_storage->GetTreeNodeCache();
+  if (cache) {
+    cache->Put(id, contents);
+  }
+  node->reset(new TreeNode(page_storage, std::move(id), std::move(contents)));
   return Status::OK;
 }
 
@@ -77,17 +101,79 @@ Status TreeNode::FromEntries(PageStorage* page_storage,
                              const std::vector<Entry>& entries,
                              const std::vector<ObjectId>& children,
                              ObjectId* node_id) {
+  std::vector<uint64_t> child_entry_counts(children.size());
+  for (size_t i = 0; i < children.size(); ++i) {
+    Status status = GetSubtreeEntryCount(page_storage, children[i],
+                                         &child_entry_counts[i]);
+    if (status != Status::OK) {
+      return status;
+    }
+  }
+  return FromEntries(page_storage, entries, children, child_entry_counts,
+                     node_id);
+}
+
+Status TreeNode::FromEntries(PageStorage* page_storage,
+                             const std::vector<Entry>& entries,
+                             const std::vector<ObjectId>& children,
+                             const std::vector<uint64_t>& child_entry_counts,
+                             ObjectId* node_id) {
   FTL_DCHECK(entries.size() + 1 == children.size());
-  std::string encoding = storage::EncodeNode(entries, children);
+  FTL_DCHECK(children.size() == child_entry_counts.size());
+  std::string encoding =
+      storage::EncodeNode(entries, children, child_entry_counts);
   std::unique_ptr<const Object> object;
   Status s = page_storage->AddObjectSynchronous(encoding, &object);
   if (s != Status::OK) {
     return s;
   }
   *node_id = object->GetId();
+  // New nodes are usually read right after being created, e.g. when iterating
+  // over the contents of the new commit.
+  TreeNodeCache* cache = page_storage->GetTreeNodeCache();
+  if (cache) {
+    auto contents = std::make_shared<DecodedNode>();
+    contents->entries = entries;
+    contents->children = children;
+    contents->child_entry_counts = child_entry_counts;
+    for (size_t i = 0; i < children.size(); ++i) {
+      if (children[i].empty()) {
+        contents->child_entry_counts[i] = 0;
+      }
+    }
+    contents->key_index = KeyIndex(contents->entries);
+    cache->Put(*node_id, std::move(contents));
+  }
   return Status::OK;
 }
 
+void TreeNode::FindEntry(PageStorage* page_storage,
+                         ObjectIdView root_id,
+                         std::string key,
+                         std::function<void(Status, Entry)> callback) {
+  FromId(page_storage, root_id, [
+    page_storage, key = std::move(key), callback = std::move(callback)
+  ](Status status, std::unique_ptr<const TreeNode> node) mutable {
+    if (status != Status::OK) {
+      callback(status, Entry());
+      return;
+    }
+    int index;
+    if (node->FindKeyOrChild(key, &index) == Status::OK) {
+      Entry entry;
+      status = node->GetEntry(index, &entry);
+      callback(status, std::move(entry));
+      return;
+    }
+    ObjectId child_id = node->GetChildId(index);
+    if (child_id.empty()) {
+      callback(Status::NOT_FOUND, Entry());
+      return;
+    }
+    FindEntry(page_storage, child_id, std::move(key), std::move(callback));
+  });
+}
+
 void TreeNode::Merge(PageStorage* page_storage,
                      std::unique_ptr<const TreeNode> left,
                      std::unique_ptr<const TreeNode> right,
@@ -98,16 +184,32 @@ void TreeNode::Merge(PageStorage* page_storage,
   entries.insert(entries.end(), right->entries_.begin(), right->entries_.end());
 
   std::vector<ObjectId> children;
+  std::vector<uint64_t> child_entry_counts;
   // Skip the last child of left, the first of the right and add merged_child_id
   // instead.
   children.insert(children.end(), left->children_.begin(),
                   left->children_.end() - 1);
+  child_entry_counts.insert(child_entry_counts.end(),
+                            left->child_entry_counts_.begin(),
+                            left->child_entry_counts_.end() - 1);
+  uint64_t merged_child_count;
+  Status s = GetSubtreeEntryCount(page_storage, merged_child_id,
+                                  &merged_child_count);
+  if (s != Status::OK) {
+    on_done(s, "");
+    return;
+  }
   children.push_back(merged_child_id.ToString());
+  child_entry_counts.push_back(merged_child_count);
   children.insert(children.end(), right->children_.begin() + 1,
                   right->children_.end());
+  child_entry_counts.insert(child_entry_counts.end(),
+                            right->child_entry_counts_.begin() + 1,
+                            right->child_entry_counts_.end());
 
   ObjectId merged_id;
-  Status s = FromEntries(page_storage, entries, children, &merged_id);
+  s = FromEntries(page_storage, entries, children, child_entry_counts,
+                  &merged_id);
   if (s != Status::OK) {
     on_done(s, "");
     return;
@@ -128,13 +230,23 @@ void TreeNode::Split(
   // Left node
   std::vector<Entry> entries;
   std::vector<ObjectId> children;
+  std::vector<uint64_t> child_entry_counts;
   for (int i = 0; i < index; ++i) {
     entries.push_back(entries_[i]);
     children.push_back(children_[i]);
+    child_entry_counts.push_back(child_entry_counts_[i]);
+  }
+  uint64_t count;
+  Status s = GetSubtreeEntryCount(page_storage_, left_rightmost_child, &count);
+  if (s != Status::OK) {
+    on_done(s, "", "");
+    return;
   }
   children.push_back(left_rightmost_child.ToString());
+  child_entry_counts.push_back(count);
   ObjectId left_id;
-  Status s = FromEntries(page_storage_, entries, children, &left_id);
+  s = FromEntries(page_storage_, entries, children, child_entry_counts,
+                  &left_id);
   if (s != Status::OK) {
     on_done(s, "", "");
     return;
@@ -142,14 +254,23 @@ void TreeNode::Split(
 
   entries.clear();
   children.clear();
+  child_entry_counts.clear();
   // Right node
+  s = GetSubtreeEntryCount(page_storage_, right_leftmost_child, &count);
+  if (s != Status::OK) {
+    on_done(s, "", "");
+    return;
+  }
   children.push_back(right_leftmost_child.ToString());
+  child_entry_counts.push_back(count);
   for (int i = index; i < GetKeyCount(); ++i) {
     entries.push_back(entries_[i]);
     children.push_back(children_[i + 1]);
+    child_entry_counts.push_back(child_entry_counts_[i + 1]);
   }
   ObjectId right_id;
-  s = FromEntries(page_storage_, entries, children, &right_id);
+  s = FromEntries(page_storage_, entries, children, child_entry_counts,
+                  &right_id);
   if (s != Status::OK) {
     // TODO(nellyv): If this fails, remove the left  object from the object
     // page_storage.
@@ -184,19 +305,32 @@ ObjectId TreeNode::GetChildId(int index) const {
   return children_[index];
 }
 
+uint64_t TreeNode::GetChildEntryCount(int index) const {
+  FTL_DCHECK(index >= 0 && index <= GetKeyCount());
+  return child_entry_counts_[index];
+}
+
+uint64_t TreeNode::GetSubtreeEntryCount() const {
+  uint64_t count = entries_.size();
+  for (uint64_t child_count : child_entry_counts_) {
+    count = AddEntryCounts(count, child_count);
+  }
+  return count;
+}
+
 Status TreeNode::FindKeyOrChild(convert::ExtendedStringView key,
                                 int* index) const {
+  // Only the keys with the same fingerprint as |key| need to be compared.
+  size_t begin;
+  size_t end;
+  contents_->key_index.Find(key, &begin, &end);
   auto it =
-      std::lower_bound(entries_.begin(), entries_.end(), key,
+      std::lower_bound(entries_.begin() + begin, entries_.begin() + end, key,
                        [](const Entry& entry, convert::ExtendedStringView key) {
                          return entry.key < key;
                        });
-  if (it == entries_.end()) {
-    *index = entries_.size();
-    return Status::NOT_FOUND;
-  }
   *index = it - entries_.begin();
-  if (it->key == key) {
+  if (it != entries_.begin() + end && it->key == key) {
     return Status::OK;
   }
   return Status::NOT_FOUND;
@@ -206,6 +340,22 @@ ObjectId TreeNode::GetId() const {
   return id_;
 }
 
+Status TreeNode::GetSubtreeEntryCount(PageStorage* page_storage,
+                                      ObjectIdView node_id,
+                                      uint64_t* count) {
+  if (node_id.empty()) {
+    *count = 0;
+    return Status::OK;
+  }
+  std::unique_ptr<const TreeNode> node;
+  Status status = FromIdSynchronous(page_storage, node_id, &node);
+  if (status != Status::OK) {
+    return status;
+  }
+  *count = node->GetSubtreeEntryCount();
+  return Status::OK;
+}
+
 // TreeNode::Mutation
 TreeNode::Mutation::Mutation(const TreeNode& node) : node_(node) {}
 
@@ -224,13 +374,13 @@ TreeNode::Mutation& TreeNode::Mutation::AddEntry(const Entry& entry,
 
   entries_.push_back(entry);
   if (children_.size() < entries_.size()) {
-    children_.push_back(left_id.ToString());
+    AddChild(left_id);
   } else {
     // On two consecutive |AddEntry| calls or |RemoveEntry| and AddEntry
     // calls the last defined child must match the given |left_id|.
     FTL_DCHECK(children_.back() == left_id);
   }
-  children_.push_back(right_id.ToString());
+  AddChild(right_id);
 
   return *this;
 }
@@ -242,7 +392,7 @@ TreeNode::Mutation& TreeNode::Mutation::UpdateEntry(const Entry& entry) {
 
   entries_.push_back(entry);
   if (children_.size() < entries_.size()) {
-    children_.push_back(node_.children_[node_index_]);
+    CopyChild(node_index_);
   }
   ++node_index_;
 
@@ -257,7 +407,7 @@ TreeNode::Mutation& TreeNode::Mutation::RemoveEntry(const std::string& key,
 
   FTL_DCHECK(node_.entries_[node_index_].key == key);
   if (children_.size() == entries_.size()) {
-    children_.push_back(child_id.ToString());
+    AddChild(child_id);
   } else {
     // On two consecutive |RemoveEntry| calls the last defined child must
     // match the given |child_id|.
@@ -276,7 +426,7 @@ TreeNode::Mutation& TreeNode::Mutation::UpdateChildId(
              entries_.back().key < key_after);
   CopyUntil(key_after);
 
-  children_.push_back(child_id.ToString());
+  AddChild(child_id);
   return *this;
 }
 
@@ -287,7 +437,7 @@ void TreeNode::Mutation::FinalizeEntriesChildren() {
   // is not yet added.
   if (children_.size() == entries_.size()) {
     FTL_DCHECK(node_index_ == node_.GetKeyCount());
-    children_.push_back(node_.children_[node_index_]);
+    CopyChild(node_index_);
   }
 
   finished = true;
@@ -298,7 +448,8 @@ void TreeNode::Mutation::Finish(
   FTL_DCHECK(!finished);
   FinalizeEntriesChildren();
   ObjectId new_id;
-  Status s = FromEntries(node_.page_storage_, entries_, children_, &new_id);
+  Status s = FromEntries(node_.page_storage_, entries_, children_,
+                         child_entry_counts_, &new_id);
   if (s != Status::OK) {
     on_done(s, "");
     return;
@@ -306,107 +457,21 @@ void TreeNode::Mutation::Finish(
   on_done(Status::OK, std::move(new_id));
 }
 
-void TreeNode::Mutation::Finish(
-    size_t max_size,
-    bool is_root,
-    const std::string& max_key,
-    std::unordered_set<ObjectId>* new_nodes,
-    std::function<void(Status,
-                       ObjectId /* new_root_id */,
-                       std::unique_ptr<Updater> /* parent_updater */)>
-        on_done) {
-  FinalizeEntriesChildren();
-  // If we want N nodes, each with S entries, separated by 1 entry, then the
-  // total number of entries E is E = N*S+(N-1), leading to N=(E+1)/(S+1). As
-  // integer division rounds down, we remove one to the dividand and add 1 to
-  // the result to get the rounded up number.
-  size_t new_node_count = 1 + entries_.size() / (max_size + 1);
-  if (new_node_count == 1) {
-    ObjectId result_id;
-    ObjectId new_id;
-    Status s = FromEntries(node_.page_storage_, entries_, children_, &new_id);
-    if (s != Status::OK) {
-      on_done(s, "", nullptr);
-      return;
-    }
-    new_nodes->insert(new_id);
-    if (is_root) {
-      on_done(Status::OK, new_id, nullptr);
-      return;
-    }
-    on_done(Status::OK, "",
-            std::make_unique<Updater>([ max_key, new_id = std::move(new_id) ](
-                Mutation * m) { m->UpdateChildId(max_key, new_id); }));
-    return;
-  }
-
-  std::vector<Entry> new_entries;
-  std::vector<ObjectId> new_children;
-
-  size_t elements_per_node =
-      1 + (entries_.size() - new_node_count) / new_node_count;
-  for (size_t i = 0; i < new_node_count; ++i) {
-    int element_count = std::min(elements_per_node, entries_.size());
-    std::vector<Entry> entries;
-    std::vector<ObjectId> children;
-
-    // Select entries for the split node.
-    entries.insert(entries.end(), &entries_[0], &entries_[element_count]);
-    entries_.erase(entries_.begin(), entries_.begin() + (element_count));
-
-    // Select children for the split node. There is one more than the number of
-    // entries.
-    children.insert(children.end(), &children_[0],
-                    &children_[element_count + 1]);
-    children_.erase(children_.begin(), children_.begin() + (element_count + 1));
-
-    ObjectId new_id;
-    FromEntries(node_.page_storage_, entries, children, &new_id);
-    new_children.push_back(new_id);
-    new_nodes->insert(new_id);
-
-    if (entries_.size() != 0) {
-      // Save the pivot that needs to be moved up one level in the tree.
-      new_entries.push_back(*entries_.begin());
-      entries_.erase(entries_.begin());
-    }
-  }
-
-  // All entries and children must have been allocated.
-  FTL_DCHECK(entries_.size() == 0) << "Entries left: " << entries_.size();
-  FTL_DCHECK(children_.size() == 0) << "Children left: " << children_.size();
-
-  if (!is_root) {
-    // Move the pivots to the parent node.
-    on_done(Status::OK, "", std::make_unique<Updater>([
-              new_entries = std::move(new_entries),
-              new_children = std::move(new_children)
-            ](Mutation * m) {
-              for (size_t i = 0; i < new_entries.size(); ++i) {
-                m->AddEntry(new_entries[i], new_children[i],
-                            new_children[i + 1]);
-              }
-            }));
-    return;
+void TreeNode::Mutation::AddChild(ObjectIdView child_id) {
+  // New children were usually just written, and are in the cache. If the
+  // count cannot be read, it is recorded as unknown.
+  uint64_t count;
+  if (GetSubtreeEntryCount(node_.page_storage_, child_id, &count) !=
+      Status::OK) {
+    count = kUnknownEntryCount;
   }
+  children_.push_back(child_id.ToString());
+  child_entry_counts_.push_back(count);
+}
 
-  // No parent node, create a new one.
-  std::unique_ptr<const TreeNode> new_node;
-  ObjectId tmp_node_id;
-  Status s =
-      TreeNode::FromEntries(node_.page_storage_, std::vector<Entry>(),
-                            std::vector<ObjectId>{ObjectId()}, &tmp_node_id);
-  FTL_DCHECK(s == Status::OK);
-  s = TreeNode::FromIdSynchronous(node_.page_storage_, tmp_node_id, &new_node);
-  FTL_DCHECK(s == Status::OK);
-
-  // new_entries could contain more than max_size elements, so we can't directly
-  // create the root using FromEntries. We use a mutation instead.
-  TreeNode::Mutation mutation = new_node->StartMutation();
-  for (size_t i = 0; i < new_entries.size(); ++i) {
-    mutation.AddEntry(new_entries[i], new_children[i], new_children[i + 1]);
-  }
-  mutation.Finish(max_size, true, max_key, new_nodes, std::move(on_done));
+void TreeNode::Mutation::CopyChild(int index) {
+  children_.push_back(node_.children_[index]);
+  child_entry_counts_.push_back(node_.child_entry_counts_[index]);
 }
 
 void TreeNode::Mutation::CopyUntil(std::string key) {
@@ -416,7 +481,7 @@ void TreeNode::Mutation::CopyUntil(std::string key) {
     // If a previous change (AddEntry or RemoveEntry) updated the previous
     // child, ignore node_.children_[i].
     if (children_.size() < entries_.size()) {
-      children_.push_back(node_.children_[node_index_]);
+      CopyChild(node_index_);
     }
     ++node_index_;
   }
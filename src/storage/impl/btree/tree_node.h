@@ -6,10 +6,10 @@
 #define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_NODE_H_
 
 #include <memory>
-#include <unordered_set>
 #include <vector>
 
 #include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node_cache.h"
 #include "apps/ledger/src/storage/public/commit_contents.h"
 #include "apps/ledger/src/storage/public/object.h"
 #include "apps/ledger/src/storage/public/page_storage.h"
@@ -66,23 +66,12 @@ class TreeNode {
     // any methods on it will fail.
     void Finish(std::function<void(Status, ObjectId)> on_done);
 
-    // Creates as many tree nodes as necessary given the |max_size| of entries a
-    // node can have. If this mutation corresponds to a root node, |on_done|
-    // will be called with the new root id and a null Updater. Otherwise,
-    // |on_done| will be called with an empty object id and if there some
-    // changes to be done on the parent node, the Updater will have a non-null
-    // value. After calling this method, this Mutation object is no longer valid
-    // and calling any methods on it will fail.
-    // TODO(nellyv): This method should not be necessary after updating the
-    // B-Tree node implementation.
-    void Finish(size_t max_size,
-                bool is_root,
-                const std::string& max_key,
-                std::unordered_set<ObjectId>* new_nodes,
-                std::function<void(Status, ObjectId, std::unique_ptr<Updater>)>
-                    on_done);
-
    private:
+    // Adds the child with the given |child_id|, reading its entry count.
+    void AddChild(ObjectIdView child_id);
+    // Adds the child of |node_| at |index|, with its entry count.
+    void CopyChild(int index);
+
     // Copies the entries from the |node_| starting at |node_index_| and until
     // that entry's key is equal to or greater than the given |key|. If |key| is
     // empty, all entries until the end of the vector are copied.
@@ -97,13 +86,15 @@ class TreeNode {
 
     std::vector<Entry> entries_;
     std::vector<ObjectId> children_;
+    std::vector<uint64_t> child_entry_counts_;
     bool finished = false;
 
     FTL_DISALLOW_COPY_AND_ASSIGN(Mutation);
   };
 
   // Creates a |TreeNode| object for an existing node and calls the given
-  // |callback| with the returned status and node.
+  // |callback| with the returned status and node. The decoded node is shared
+  // through the |TreeNodeCache| of |page_storage|, if it has one.
   static void FromId(
       PageStorage* page_storage,
       ObjectIdView id,
@@ -126,12 +117,29 @@ class TreeNode {
   // Creates a |TreeNode| object with the given entries. Contents of |children|
   // are optional and if a child is not present, an empty id should be given in
   // the corresponding index. The id of the new node is stored in |node_id|. It
-  // is expected that |children| = |entries| + 1.
+  // is expected that |children| = |entries| + 1. The children are read to
+  // record their entry counts in the new node.
   static Status FromEntries(PageStorage* page_storage,
                             const std::vector<Entry>& entries,
                             const std::vector<ObjectId>& children,
                             ObjectId* node_id);
 
+  // Same as above, with the number of entries of the subtree of each child, or
+  // |kUnknownEntryCount|, given in |child_entry_counts|.
+  static Status FromEntries(PageStorage* page_storage,
+                            const std::vector<Entry>& entries,
+                            const std::vector<ObjectId>& children,
+                            const std::vector<uint64_t>& child_entry_counts,
+                            ObjectId* node_id);
+
+  // Looks up the entry with the given |key| in the tree with root |root_id|,
+  // loading only the nodes on the path from the root to the entry, and calls
+  // |callback| with it. The status is |NOT_FOUND| if |key| is not in the tree.
+  static void FindEntry(PageStorage* page_storage,
+                        ObjectIdView root_id,
+                        std::string key,
+                        std::function<void(Status, Entry)> callback);
+
   // Creates a new tree node by merging |left| and |right|. |merged_child_id|
   // should contain the id of the new child node stored between the last entry
   // of |left| and the first entry of |right| in the merged node. |on_done| will
@@ -177,6 +185,15 @@ class TreeNode {
   // GetKeyCount()].
   ObjectId GetChildId(int index) const;
 
+  // Returns the number of entries of the subtree of the child at position
+  // |index|, or |kUnknownEntryCount| if it was not recorded when this node was
+  // written. |index| has to be in [0, GetKeyCount()].
+  uint64_t GetChildEntryCount(int index) const;
+
+  // Returns the number of entries of the subtree of which this node is the
+  // root, or |kUnknownEntryCount| if the count of a child is unknown.
+  uint64_t GetSubtreeEntryCount() const;
+
   // Searches for the given |key| in this node. If it is found, |OK| is
   // returned and index contains the index of the entry. If not, |NOT_FOUND|
   // is returned and index stores the index of the child node where the key
@@ -188,13 +205,20 @@ class TreeNode {
  private:
   TreeNode(PageStorage* page_storage,
            std::string id,
-           std::vector<Entry> entries,
-           std::vector<ObjectId> children);
+           std::shared_ptr<const DecodedNode> contents);
+
+  // Stores in |count| the number of entries of the subtree with root
+  // |node_id|, 0 if |node_id| is empty, or |kUnknownEntryCount|.
+  static Status GetSubtreeEntryCount(PageStorage* page_storage,
+                                     ObjectIdView node_id,
+                                     uint64_t* count);
 
   PageStorage* page_storage_;
   ObjectId id_;
-  const std::vector<Entry> entries_;
-  const std::vector<ObjectId> children_;
+  std::shared_ptr<const DecodedNode> contents_;
+  const std::vector<Entry>& entries_;
+  const std::vector<ObjectId>& children_;
+  const std::vector<uint64_t>& child_entry_counts_;
 };
 
 }  // namespace storage
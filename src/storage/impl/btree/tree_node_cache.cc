@@ -0,0 +1,95 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/tree_node_cache.h"
+
+#include "lib/ftl/logging.h"
+
+namespace storage {
+
+namespace {
+
+// Estimates the memory used by a cached node with the given |id|.
+size_t ComputeSize(ObjectIdView id, const DecodedNode& contents) {
+  size_t size = sizeof(DecodedNode) + id.size();
+  for (const Entry& entry : contents.entries) {
+    size += sizeof(Entry) + entry.key.size() + entry.object_id.size();
+  }
+  for (const ObjectId& child : contents.children) {
+    size += sizeof(ObjectId) + child.size();
+  }
+  size += contents.child_entry_counts.size() * sizeof(uint64_t);
+  size += contents.key_index.GetSize();
+  return size;
+}
+
+}  // namespace
+
+TreeNodeCache::TreeNodeCache(size_t max_size) : max_size_(max_size) {}
+
+TreeNodeCache::~TreeNodeCache() {}
+
+std::shared_ptr<const DecodedNode> TreeNodeCache::Get(ObjectIdView id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(id.ToString());
+  if (it == entries_.end()) {
+    ++miss_count_;
+    return nullptr;
+  }
+  ++hit_count_;
+  lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+  return it->second.contents;
+}
+
+void TreeNodeCache::Put(ObjectIdView id,
+                        std::shared_ptr<const DecodedNode> contents) {
+  FTL_DCHECK(contents);
+  std::lock_guard<std::mutex> lock(mutex_);
+  ObjectId key = id.ToString();
+  auto it = entries_.find(key);
+  if (it != entries_.end()) {
+    // Nodes are immutable: the cached contents are still valid.
+    lru_.splice(lru_.begin(), lru_, it->second.lru_position);
+    return;
+  }
+
+  size_t size = ComputeSize(id, *contents);
+  if (size > max_size_) {
+    return;
+  }
+  lru_.push_front(key);
+  entries_[std::move(key)] =
+      CacheEntry{std::move(contents), size, lru_.begin()};
+  size_ += size;
+  EvictLocked();
+}
+
+size_t TreeNodeCache::hit_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return hit_count_;
+}
+
+size_t TreeNodeCache::miss_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return miss_count_;
+}
+
+size_t TreeNodeCache::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+void TreeNodeCache::EvictLocked() {
+  while (size_ > max_size_) {
+    FTL_DCHECK(!lru_.empty());
+    auto it = entries_.find(lru_.back());
+    FTL_DCHECK(it != entries_.end());
+    size_ -= it->second.size;
+    // Nodes still referenced by a |TreeNode| stay alive until released.
+    entries_.erase(it);
+    lru_.pop_back();
+  }
+}
+
+}  // namespace storage
@@ -0,0 +1,83 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_NODE_CACHE_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_NODE_CACHE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/key_index.h"
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+
+// The decoded contents of a tree node. As nodes are immutable, the same
+// contents are shared by all |TreeNode| objects with the same id.
+struct DecodedNode {
+  std::vector<Entry> entries;
+  std::vector<ObjectId> children;
+  // Number of entries of the subtree of each child, or |kUnknownEntryCount|.
+  std::vector<uint64_t> child_entry_counts;
+  // Index over the keys of |entries|, used to search the node.
+  KeyIndex key_index;
+};
+
+// Default memory budget of a |TreeNodeCache|, in bytes.
+constexpr size_t kDefaultTreeNodeCacheSize = 4 * 1024 * 1024;
+
+// A bounded cache of decoded tree nodes, keyed by object id. When the memory
+// used by cached nodes exceeds the budget, the least recently used ones are
+// dropped from the cache. Nodes are reference counted, so that dropping one
+// from the cache never invalidates a node still in use.
+//
+// This class is thread safe.
+class TreeNodeCache {
+ public:
+  explicit TreeNodeCache(size_t max_size = kDefaultTreeNodeCacheSize);
+  ~TreeNodeCache();
+
+  // Returns the node with the given |id|, or nullptr if it is not cached.
+  std::shared_ptr<const DecodedNode> Get(ObjectIdView id);
+
+  // Adds the node with the given |id| and |contents| in the cache.
+  void Put(ObjectIdView id, std::shared_ptr<const DecodedNode> contents);
+
+  // Number of lookups that found, respectively did not find, the node.
+  size_t hit_count() const;
+  size_t miss_count() const;
+
+  // Approximate memory used by the cached nodes, in bytes.
+  size_t size() const;
+
+ private:
+  struct CacheEntry {
+    std::shared_ptr<const DecodedNode> contents;
+    size_t size;
+    std::list<ObjectId>::iterator lru_position;
+  };
+
+  void EvictLocked();
+
+  const size_t max_size_;
+
+  mutable std::mutex mutex_;
+  std::unordered_map<ObjectId, CacheEntry> entries_;
+  // Ids of the cached nodes, the most recently used first.
+  std::list<ObjectId> lru_;
+  size_t size_ = 0;
+  size_t hit_count_ = 0;
+  size_t miss_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(TreeNodeCache);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_BTREE_TREE_NODE_CACHE_H_
@@ -0,0 +1,101 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/btree/tree_node_cache.h"
+
+#include "apps/ledger/src/storage/public/constants.h"
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+ObjectId MakeObjectId(std::string str) {
+  str.resize(kObjectIdSize, '_');
+  return str;
+}
+
+std::shared_ptr<const DecodedNode> MakeNode(size_t entry_count) {
+  auto node = std::make_shared<DecodedNode>();
+  for (size_t i = 0; i < entry_count; ++i) {
+    node->entries.push_back(Entry{"key" + std::to_string(i),
+                                  MakeObjectId("value" + std::to_string(i)),
+                                  KeyPriority::EAGER});
+    node->children.push_back("");
+  }
+  node->children.push_back("");
+  return node;
+}
+
+TEST(TreeNodeCacheTest, GetAndPut) {
+  TreeNodeCache cache;
+  ObjectId id = MakeObjectId("node");
+  EXPECT_EQ(nullptr, cache.Get(id));
+  EXPECT_EQ(0u, cache.hit_count());
+  EXPECT_EQ(1u, cache.miss_count());
+
+  std::shared_ptr<const DecodedNode> node = MakeNode(3);
+  cache.Put(id, node);
+  EXPECT_GT(cache.size(), 0u);
+  EXPECT_EQ(node, cache.Get(id));
+  EXPECT_EQ(1u, cache.hit_count());
+  EXPECT_EQ(1u, cache.miss_count());
+
+  // Adding the same node again keeps the cached contents.
+  size_t size = cache.size();
+  cache.Put(id, MakeNode(3));
+  EXPECT_EQ(node, cache.Get(id));
+  EXPECT_EQ(size, cache.size());
+}
+
+TEST(TreeNodeCacheTest, EvictLeastRecentlyUsed) {
+  std::shared_ptr<const DecodedNode> node = MakeNode(3);
+  TreeNodeCache probe;
+  probe.Put(MakeObjectId("node"), node);
+  // Room for two nodes only.
+  TreeNodeCache cache(2 * probe.size() + probe.size() / 2);
+
+  ObjectId id1 = MakeObjectId("node1");
+  ObjectId id2 = MakeObjectId("node2");
+  ObjectId id3 = MakeObjectId("node3");
+  cache.Put(id1, MakeNode(3));
+  cache.Put(id2, MakeNode(3));
+  // Use the first node, so that the second is the least recently used one.
+  EXPECT_NE(nullptr, cache.Get(id1));
+  cache.Put(id3, MakeNode(3));
+
+  EXPECT_NE(nullptr, cache.Get(id1));
+  EXPECT_EQ(nullptr, cache.Get(id2));
+  EXPECT_NE(nullptr, cache.Get(id3));
+  EXPECT_LE(cache.size(), 2 * probe.size() + probe.size() / 2);
+}
+
+TEST(TreeNodeCacheTest, EvictionKeepsNodesInUse) {
+  TreeNodeCache probe;
+  probe.Put(MakeObjectId("node"), MakeNode(3));
+  // Room for a single node.
+  TreeNodeCache cache(probe.size());
+
+  ObjectId id1 = MakeObjectId("node1");
+  ObjectId id2 = MakeObjectId("node2");
+  cache.Put(id1, MakeNode(3));
+  std::shared_ptr<const DecodedNode> node = cache.Get(id1);
+  ASSERT_NE(nullptr, node);
+
+  cache.Put(id2, MakeNode(3));
+  EXPECT_EQ(nullptr, cache.Get(id1));
+  // The evicted node is still valid for the code holding it.
+  ASSERT_EQ(3u, node->entries.size());
+  EXPECT_EQ("key0", node->entries[0].key);
+}
+
+TEST(TreeNodeCacheTest, NodeLargerThanBudget) {
+  TreeNodeCache cache(1);
+  ObjectId id = MakeObjectId("node");
+  cache.Put(id, MakeNode(3));
+  EXPECT_EQ(nullptr, cache.Get(id));
+  EXPECT_EQ(0u, cache.size());
+}
+
+}  // namespace
+}  // namespace storage
@@ -217,6 +217,46 @@ TEST_F(TreeNodeTest, FindKeyOrChild) {
   EXPECT_EQ(10, index);
 }
 
+TEST_F(TreeNodeTest, FindEntry) {
+  // Build a tree with entries "d" and "h" in the root, and the others in three
+  // leaves.
+  std::vector<Entry> entries = GetEntries(10);
+  std::vector<ObjectId> children;
+  for (auto range : {std::make_pair(0, 3), std::make_pair(4, 7),
+                     std::make_pair(8, 10)}) {
+    std::vector<Entry> leaf_entries(entries.begin() + range.first,
+                                    entries.begin() + range.second);
+    children.push_back(
+        FromEntries(leaf_entries,
+                    std::vector<ObjectId>(leaf_entries.size() + 1))
+            ->GetId());
+  }
+  ObjectId root_id = FromEntries({entries[3], entries[7]}, children)->GetId();
+
+  for (const Entry& expected_entry : entries) {
+    Status status;
+    Entry entry;
+    TreeNode::FindEntry(
+        &fake_storage_, root_id, expected_entry.key,
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &entry));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::OK, status);
+    EXPECT_EQ(expected_entry, entry);
+  }
+
+  for (std::string missing_key : {"0", "a0", "dd", "z"}) {
+    Status status;
+    Entry entry;
+    TreeNode::FindEntry(
+        &fake_storage_, root_id, missing_key,
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                        &entry));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::NOT_FOUND, status);
+  }
+}
+
 TEST_F(TreeNodeTest, MutationAddEntry) {
   int size = 2;
   std::unique_ptr<const TreeNode> node =
@@ -407,9 +447,12 @@ TEST_F(TreeNodeTest, Serialization) {
   EXPECT_EQ(Status::OK, object->GetData(&data));
   std::vector<Entry> parsed_entries;
   std::vector<ObjectId> parsed_children;
-  EXPECT_TRUE(DecodeNode(data, &parsed_entries, &parsed_children));
+  std::vector<uint64_t> parsed_child_entry_counts;
+  EXPECT_TRUE(DecodeNode(data, &parsed_entries, &parsed_children,
+                         &parsed_child_entry_counts));
   EXPECT_EQ(entries, parsed_entries);
   EXPECT_EQ(children, parsed_children);
+  EXPECT_EQ(std::vector<uint64_t>(size + 1, 0), parsed_child_entry_counts);
 }
 
 }  // namespace
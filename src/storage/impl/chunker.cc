@@ -0,0 +1,78 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/chunker.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+
+namespace storage {
+
+namespace {
+
+// A boundary is found when the 14 high bits of the hash are all zero, which
+// happens every 2^14 = 16KiB on average. High bits are used as they depend on
+// the last 64 bytes, while low bits only depend on the last few ones.
+const uint64_t kBoundaryMask = ~static_cast<uint64_t>(0) << (64 - 14);
+
+// Table of the gear rolling hash: a fixed pseudo-random value for each byte.
+// The table must never change, as it determines where values are split.
+class GearTable {
+ public:
+  GearTable() {
+    // splitmix64 with a fixed seed.
+    uint64_t state = 0x4c65646765724344u;
+    for (uint64_t& value : values_) {
+      state += 0x9e3779b97f4a7c15u;
+      uint64_t z = state;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9u;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebu;
+      value = z ^ (z >> 31);
+    }
+  }
+
+  uint64_t operator[](uint8_t byte) const { return values_[byte]; }
+
+ private:
+  uint64_t values_[256];
+};
+
+size_t NextChunkSize(const GearTable& gear, ftl::StringView data) {
+  if (data.size() <= kMinChunkSize) {
+    return data.size();
+  }
+  size_t end = std::min(data.size(), kMaxChunkSize);
+  uint64_t hash = 0;
+  // The hash only depends on the last 64 bytes, as older ones are shifted out.
+  for (size_t i = kMinChunkSize - 64; i < kMinChunkSize; ++i) {
+    hash = (hash << 1) + gear[static_cast<uint8_t>(data[i])];
+  }
+  for (size_t i = kMinChunkSize; i < end; ++i) {
+    hash = (hash << 1) + gear[static_cast<uint8_t>(data[i])];
+    if ((hash & kBoundaryMask) == 0) {
+      return i + 1;
+    }
+  }
+  return end;
+}
+
+}  // namespace
+
+std::vector<size_t> SplitIntoChunks(ftl::StringView data) {
+  std::vector<size_t> chunk_sizes;
+  while (!data.empty()) {
+    size_t size = GetFirstChunkSize(data);
+    chunk_sizes.push_back(size);
+    data = data.substr(size);
+  }
+  return chunk_sizes;
+}
+
+size_t GetFirstChunkSize(ftl::StringView data) {
+  static const GearTable gear;
+  return NextChunkSize(gear, data);
+}
+
+}  // namespace storage
@@ -0,0 +1,39 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_CHUNKER_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_CHUNKER_H_
+
+#include <stddef.h>
+
+#include <vector>
+
+#include "lib/ftl/strings/string_view.h"
+
+namespace storage {
+
+// Objects larger than this are stored as a list of chunks.
+constexpr size_t kChunkingThreshold = 64 * 1024;
+
+// Bounds of the size of the chunks returned by |SplitIntoChunks()|. Chunks are
+// 16KiB on average.
+constexpr size_t kMinChunkSize = 4 * 1024;
+constexpr size_t kMaxChunkSize = 64 * 1024;
+
+// Splits |data| into content-defined chunks and returns their sizes, which add
+// up to |data.size()|. Chunk boundaries are chosen with a rolling hash over
+// the content, so that a local modification of |data| only changes the chunks
+// around it: the other chunks are found again, and can be shared with the
+// previous version of the data.
+std::vector<size_t> SplitIntoChunks(ftl::StringView data);
+
+// Returns the size of the first chunk of |data|, as split by
+// |SplitIntoChunks()|. Only the first |kMaxChunkSize| bytes of |data| are
+// read: data received as a stream can be split as soon as that many bytes are
+// buffered.
+size_t GetFirstChunkSize(ftl::StringView data);
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_CHUNKER_H_
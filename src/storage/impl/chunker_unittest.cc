@@ -0,0 +1,108 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/chunker.h"
+
+#include <numeric>
+#include <set>
+#include <string>
+
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+std::string RandomString(size_t size) {
+  std::string result;
+  result.resize(size);
+  glue::RandBytes(&result[0], size);
+  return result;
+}
+
+// Returns the chunks of |data|.
+std::vector<std::string> GetChunks(const std::string& data) {
+  std::vector<std::string> chunks;
+  size_t offset = 0;
+  for (size_t size : SplitIntoChunks(data)) {
+    chunks.push_back(data.substr(offset, size));
+    offset += size;
+  }
+  return chunks;
+}
+
+TEST(ChunkerTest, SmallData) {
+  EXPECT_TRUE(SplitIntoChunks("").empty());
+
+  std::string data = RandomString(kMinChunkSize);
+  std::vector<size_t> sizes = SplitIntoChunks(data);
+  ASSERT_EQ(1u, sizes.size());
+  EXPECT_EQ(data.size(), sizes[0]);
+}
+
+TEST(ChunkerTest, ChunkSizes) {
+  std::string data = RandomString(2 * 1024 * 1024);
+  std::vector<size_t> sizes = SplitIntoChunks(data);
+  EXPECT_EQ(data.size(), std::accumulate(sizes.begin(), sizes.end(), static_cast<size_t>(0)));
+  for (size_t i = 0; i < sizes.size(); ++i) {
+    EXPECT_LE(sizes[i], kMaxChunkSize);
+    if (i != sizes.size() - 1) {
+      EXPECT_GT(sizes[i], kMinChunkSize);
+    }
+  }
+  // Chunks are neither all minimal nor all maximal.
+  EXPECT_GT(sizes.size(), data.size() / kMaxChunkSize);
+  EXPECT_LT(sizes.size(), data.size() / kMinChunkSize);
+}
+
+TEST(ChunkerTest, Deterministic) {
+  std::string data = RandomString(512 * 1024);
+  EXPECT_EQ(SplitIntoChunks(data), SplitIntoChunks(data));
+}
+
+TEST(ChunkerTest, LocalChange) {
+  std::string data = RandomString(1024 * 1024);
+  std::vector<std::string> chunks = GetChunks(data);
+
+  // Insert a few bytes in the middle of the data.
+  std::string modified = data;
+  modified.insert(data.size() / 2, "some new bytes");
+  std::vector<std::string> modified_chunks = GetChunks(modified);
+
+  std::set<std::string> chunk_set(chunks.begin(), chunks.end());
+  size_t new_chunk_count = 0;
+  for (const std::string& chunk : modified_chunks) {
+    if (chunk_set.count(chunk) == 0) {
+      ++new_chunk_count;
+    }
+  }
+  // Only the chunks around the modification are different.
+  EXPECT_GE(new_chunk_count, 1u);
+  EXPECT_LE(new_chunk_count, 2u);
+}
+
+TEST(ChunkerTest, Streaming) {
+  // Splitting data as it is received, once |kMaxChunkSize| bytes are
+  // buffered, gives the same chunks as splitting it all at once.
+  std::string data = RandomString(1024 * 1024 + 123);
+  std::vector<size_t> sizes;
+  std::string buffer;
+  for (size_t offset = 0; offset < data.size(); offset += 1000) {
+    buffer.append(data, offset, 1000);
+    while (buffer.size() >= kMaxChunkSize) {
+      size_t size = GetFirstChunkSize(buffer);
+      sizes.push_back(size);
+      buffer.erase(0, size);
+    }
+  }
+  while (!buffer.empty()) {
+    size_t size = GetFirstChunkSize(buffer);
+    sizes.push_back(size);
+    buffer.erase(0, size);
+  }
+  EXPECT_EQ(SplitIntoChunks(data), sizes);
+}
+
+}  // namespace
+}  // namespace storage
@@ -10,6 +10,7 @@
 
 #include "apps/ledger/src/glue/crypto/hash.h"
 #include "apps/ledger/src/storage/impl/btree/commit_contents_impl.h"
+#include "apps/ledger/src/storage/impl/live_roots.h"
 #include "apps/ledger/src/storage/public/constants.h"
 #include "lib/ftl/build_config.h"
 #include "lib/ftl/logging.h"
@@ -30,6 +31,11 @@ const int kGenerationStartIndex = kTimestampStartIndex + kTimestampSize;
 const int kRootNodeStartIndex = kGenerationStartIndex + kGenerationSize;
 const int kParentsStartIndex = kRootNodeStartIndex + kObjectIdSize;
 
+// Commits of pages using a tree other than the B-Tree end with one byte holding
+// the type of the tree. Commits of B-Tree pages keep the original format, so
+// that their ids do not change.
+const int kTreeTypeSize = 1;
+
 std::string TimestampToBytes(int64_t timestamp) {
   static_assert(sizeof(timestamp) == kTimestampSize, "Illegal timestamp size");
   return std::string(reinterpret_cast<char*>(&timestamp), kTimestampSize);
@@ -64,23 +70,45 @@ CommitImpl::CommitImpl(PageStorage* page_storage,
       generation_(generation),
       root_node_id_(root_node_id.ToString()),
       parent_ids_(parent_ids),
-      storage_bytes_(std::move(storage_bytes)) {
+      storage_bytes_(std::move(storage_bytes)),
+      live_roots_(page_storage_->GetLiveRoots()) {
   FTL_DCHECK(page_storage_ != nullptr);
   FTL_DCHECK(id_ == kFirstPageCommitId ||
              (!parent_ids_.empty() && parent_ids_.size() <= 2));
+  // The contents of this commit must not be collected while it is in use.
+  if (live_roots_) {
+    live_roots_->AddRoot(root_node_id_);
+  }
 }
 
-CommitImpl::~CommitImpl() {}
+CommitImpl::~CommitImpl() {
+  if (live_roots_) {
+    live_roots_->RemoveRoot(root_node_id_);
+  }
+}
 
 std::unique_ptr<Commit> CommitImpl::FromStorageBytes(
     PageStorage* page_storage,
     const CommitId& id,
     std::string storage_bytes) {
-  int parent_count =
-      (storage_bytes.size() - kParentsStartIndex) / kCommitIdSize;
+  if (storage_bytes.size() < kParentsStartIndex) {
+    FTL_LOG(ERROR) << "Illegal format for commit storage bytes "
+                   << storage_bytes;
+    return nullptr;
+  }
+  size_t parents_size = storage_bytes.size() - kParentsStartIndex;
+  if (parents_size % kCommitIdSize == kTreeTypeSize) {
+    parents_size -= kTreeTypeSize;
+    if (storage_bytes.back() != static_cast<char>(TreeType::HASH_TREE)) {
+      FTL_LOG(ERROR) << "Illegal tree type in commit storage bytes "
+                     << storage_bytes;
+      return nullptr;
+    }
+  }
+  int parent_count = parents_size / kCommitIdSize;
 
-  if ((storage_bytes.size() - kParentsStartIndex) % kCommitIdSize != 0 ||
-      parent_count < 1 || parent_count > 2) {
+  if (parents_size % kCommitIdSize != 0 || parent_count < 1 ||
+      parent_count > 2) {
     FTL_LOG(ERROR) << "Illegal format for commit storage bytes "
                    << storage_bytes;
     return nullptr;
@@ -106,7 +134,8 @@ std::unique_ptr<Commit> CommitImpl::FromStorageBytes(
 std::unique_ptr<Commit> CommitImpl::FromContentAndParents(
     PageStorage* page_storage,
     ObjectIdView root_node_id,
-    std::vector<std::unique_ptr<const Commit>> parent_commits) {
+    std::vector<std::unique_ptr<const Commit>> parent_commits,
+    TreeType tree_type) {
   FTL_DCHECK(parent_commits.size() == 1 || parent_commits.size() == 2);
   uint64_t parent_generation = 0;
   std::vector<CommitId> parent_ids;
@@ -126,13 +155,16 @@ std::unique_ptr<Commit> CommitImpl::FromContentAndParents(
 
   std::string storage_bytes;
   storage_bytes.reserve(kTimestampSize + kGenerationSize + kObjectIdSize +
-                        parent_ids.size() * kCommitIdSize);
+                        parent_ids.size() * kCommitIdSize + kTreeTypeSize);
   storage_bytes.append(TimestampToBytes(timestamp))
       .append(GenerationToBytes(generation))
       .append(root_node_id.data(), root_node_id.size());
   for (const CommitId& commit_id : parent_ids) {
     storage_bytes.append(commit_id);
   }
+  if (tree_type != TreeType::BTREE) {
+    storage_bytes.push_back(static_cast<char>(tree_type));
+  }
   CommitId id = glue::SHA256Hash(storage_bytes.data(), storage_bytes.size());
 
   return std::unique_ptr<Commit>(
@@ -140,6 +172,17 @@ std::unique_ptr<Commit> CommitImpl::FromContentAndParents(
                      std::move(parent_ids), std::move(storage_bytes)));
 }
 
+TreeType CommitImpl::GetTreeType(const Commit& commit) {
+  // Commits without a tree type, including the first, empty one, use B-Trees.
+  std::string storage_bytes = commit.GetStorageBytes();
+  if (storage_bytes.size() <= kParentsStartIndex ||
+      (storage_bytes.size() - kParentsStartIndex) % kCommitIdSize !=
+          kTreeTypeSize) {
+    return TreeType::BTREE;
+  }
+  return static_cast<TreeType>(storage_bytes.back());
+}
+
 std::unique_ptr<Commit> CommitImpl::Empty(PageStorage* page_storage) {
   ObjectId root_node_id;
   TreeNode::FromEntries(page_storage, std::vector<Entry>(),
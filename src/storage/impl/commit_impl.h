@@ -5,6 +5,8 @@
 #ifndef APPS_LEDGER_SRC_STORAGE_IMPL_COMMIT_IMPL_H_
 #define APPS_LEDGER_SRC_STORAGE_IMPL_COMMIT_IMPL_H_
 
+#include <memory>
+
 #include "apps/ledger/src/storage/public/commit.h"
 #include "apps/ledger/src/storage/public/page_storage.h"
 
@@ -24,7 +26,11 @@ class CommitImpl : public Commit {
   static std::unique_ptr<Commit> FromContentAndParents(
       PageStorage* page_storage,
       ObjectIdView root_node_id,
-      std::vector<std::unique_ptr<const Commit>> parent_commits);
+      std::vector<std::unique_ptr<const Commit>> parent_commits,
+      TreeType tree_type = TreeType::BTREE);
+
+  // Returns the type of the tree holding the contents of |commit|.
+  static TreeType GetTreeType(const Commit& commit);
 
   // Factory method for creating an empty |CommitImpl| object, i.e. without
   // parents and with empty contents.
@@ -58,6 +64,7 @@ class CommitImpl : public Commit {
   ObjectId root_node_id_;
   std::vector<CommitId> parent_ids_;
   std::string storage_bytes_;
+  std::shared_ptr<LiveRoots> live_roots_;
 };
 
 }  // namespace storage
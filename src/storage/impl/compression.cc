@@ -0,0 +1,241 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/compression.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace storage {
+
+// The compressed format is the decompressed size (u32), followed by a list of
+// sequences. Each sequence is a token byte, whose high and low 4 bits are the
+// number of literals and the match length minus 4, then the literals, then the
+// offset of the match (u16) in the data already decompressed. A 4 bits value
+// of 15 is followed by bytes added to it, up to and including the first one
+// that is not 255. The last sequence only has literals.
+
+namespace {
+
+const size_t kHashBits = 14;
+const size_t kMinMatch = 4;
+const size_t kMaxOffset = UINT16_MAX;
+const uint8_t kMaxNibble = 15;
+
+uint32_t Load32(const char* data) {
+  uint32_t result;
+  memcpy(&result, data, sizeof(result));
+  return result;
+}
+
+uint32_t Hash(uint32_t sequence) {
+  return (sequence * 2654435761u) >> (32 - kHashBits);
+}
+
+void WriteLength(size_t length, std::string* output) {
+  while (length >= 255) {
+    output->push_back(static_cast<char>(255));
+    length -= 255;
+  }
+  output->push_back(static_cast<char>(length));
+}
+
+bool ReadLength(ftl::StringView input, size_t* position, size_t* length) {
+  while (true) {
+    if (*position >= input.size()) {
+      return false;
+    }
+    uint8_t byte = input[(*position)++];
+    *length += byte;
+    if (byte != 255) {
+      return true;
+    }
+  }
+}
+
+// Writes a sequence of |literals| followed, if |match_length| is not 0, by a
+// match of |match_length| bytes at |offset|.
+void WriteSequence(ftl::StringView literals,
+                   size_t offset,
+                   size_t match_length,
+                   std::string* output) {
+  size_t match_code = match_length == 0 ? 0 : match_length - kMinMatch;
+  uint8_t token =
+      (std::min<size_t>(literals.size(), kMaxNibble) << 4) |
+      std::min<size_t>(match_code, kMaxNibble);
+  output->push_back(static_cast<char>(token));
+  if (literals.size() >= kMaxNibble) {
+    WriteLength(literals.size() - kMaxNibble, output);
+  }
+  output->append(literals.data(), literals.size());
+  if (match_length == 0) {
+    return;
+  }
+  uint16_t offset16 = offset;
+  output->append(reinterpret_cast<const char*>(&offset16), sizeof(offset16));
+  if (match_code >= kMaxNibble) {
+    WriteLength(match_code - kMaxNibble, output);
+  }
+}
+
+}  // namespace
+
+bool Compress(ftl::StringView data, std::string* compressed) {
+  if (data.size() < kMinCompressedSize || data.size() > UINT32_MAX) {
+    return false;
+  }
+  // Compression is only worth it if it saves at least 1/8 of the space.
+  const size_t max_size = data.size() - data.size() / 8;
+
+  std::string output;
+  output.reserve(max_size);
+  uint32_t size = data.size();
+  output.append(reinterpret_cast<const char*>(&size), sizeof(size));
+
+  // Last position, plus one, of each hashed 4 bytes sequence.
+  std::vector<uint32_t> table(1 << kHashBits, 0);
+  const char* input = data.data();
+  size_t anchor = 0;
+  size_t position = 0;
+  while (position + kMinMatch <= data.size()) {
+    uint32_t sequence = Load32(input + position);
+    uint32_t& entry = table[Hash(sequence)];
+    size_t candidate = entry;
+    entry = position + 1;
+    if (candidate == 0 || position - (candidate - 1) > kMaxOffset ||
+        Load32(input + candidate - 1) != sequence) {
+      ++position;
+      continue;
+    }
+    size_t match = candidate - 1;
+    size_t length = kMinMatch;
+    while (position + length < data.size() &&
+           input[match + length] == input[position + length]) {
+      ++length;
+    }
+    WriteSequence(data.substr(anchor, position - anchor), position - match,
+                  length, &output);
+    if (output.size() > max_size) {
+      return false;
+    }
+    position += length;
+    anchor = position;
+  }
+  WriteSequence(data.substr(anchor), 0, 0, &output);
+  if (output.size() > max_size) {
+    return false;
+  }
+  compressed->swap(output);
+  return true;
+}
+
+bool Decompress(ftl::StringView compressed, std::string* data) {
+  uint64_t size;
+  if (!GetDecompressedSize(compressed, &size)) {
+    return false;
+  }
+  // Each byte of input produces at most 255 bytes of output: reject sizes
+  // that cannot be valid before allocating the output.
+  if (size / 255 > compressed.size()) {
+    return false;
+  }
+
+  std::string output(size, '\0');
+  size_t written = 0;
+  size_t position = kCompressedHeaderSize;
+  while (position < compressed.size()) {
+    uint8_t token = compressed[position++];
+    size_t literal_count = token >> 4;
+    if (literal_count == kMaxNibble &&
+        !ReadLength(compressed, &position, &literal_count)) {
+      return false;
+    }
+    if (literal_count > compressed.size() - position ||
+        literal_count > size - written) {
+      return false;
+    }
+    memcpy(&output[written], compressed.data() + position, literal_count);
+    position += literal_count;
+    written += literal_count;
+    if (position == compressed.size()) {
+      break;
+    }
+
+    uint16_t offset;
+    if (compressed.size() - position < sizeof(offset)) {
+      return false;
+    }
+    memcpy(&offset, compressed.data() + position, sizeof(offset));
+    position += sizeof(offset);
+    size_t length = token & kMaxNibble;
+    if (length == kMaxNibble && !ReadLength(compressed, &position, &length)) {
+      return false;
+    }
+    length += kMinMatch;
+    if (offset == 0 || offset > written || length > size - written) {
+      return false;
+    }
+    // The match can overlap with the bytes it produces.
+    for (size_t i = 0; i < length; ++i) {
+      output[written + i] = output[written - offset + i];
+    }
+    written += length;
+  }
+  if (written != size) {
+    return false;
+  }
+  data->swap(output);
+  return true;
+}
+
+bool GetDecompressedSize(ftl::StringView compressed, uint64_t* size) {
+  if (compressed.size() < kCompressedHeaderSize) {
+    return false;
+  }
+  uint32_t size32;
+  memcpy(&size32, compressed.data(), sizeof(size32));
+  *size = size32;
+  return true;
+}
+
+double CompressionStats::Snapshot::ratio() const {
+  if (stored_bytes == 0) {
+    return 1.0;
+  }
+  return static_cast<double>(input_bytes) / stored_bytes;
+}
+
+CompressionStats::CompressionStats() {}
+
+CompressionStats::~CompressionStats() {}
+
+void CompressionStats::RecordCompression(uint64_t input_size,
+                                         uint64_t stored_size,
+                                         bool compressed,
+                                         ftl::TimeDelta time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (compressed) {
+    ++stats_.compressed_count;
+  } else {
+    ++stats_.uncompressed_count;
+  }
+  stats_.input_bytes += input_size;
+  stats_.stored_bytes += stored_size;
+  stats_.compression_time += time;
+}
+
+void CompressionStats::RecordDecompression(ftl::TimeDelta time) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++stats_.decompressed_count;
+  stats_.decompression_time += time;
+}
+
+CompressionStats::Snapshot CompressionStats::GetSnapshot() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+}  // namespace storage
@@ -0,0 +1,81 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_COMPRESSION_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_COMPRESSION_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+#include "lib/ftl/time/time_delta.h"
+
+namespace storage {
+
+// Objects smaller than this are never compressed.
+constexpr size_t kMinCompressedSize = 128;
+
+// Compresses |data| into |compressed|, using a byte-oriented LZ77 format that
+// is fast to decode. Returns false if |data| does not compress well enough
+// for the compressed form to be worth storing, in which case |compressed| is
+// left unspecified.
+bool Compress(ftl::StringView data, std::string* compressed);
+
+// Decompresses the output of |Compress()|. Returns false if |compressed| is
+// malformed.
+bool Decompress(ftl::StringView compressed, std::string* data);
+
+// Returns the size of the data once decompressed, without decompressing it.
+// Only the first bytes of the compressed data are needed.
+bool GetDecompressedSize(ftl::StringView compressed, uint64_t* size);
+
+// Number of bytes of the compressed data needed by |GetDecompressedSize()|.
+constexpr size_t kCompressedHeaderSize = 4;
+
+// Statistics about the compression of the objects of a page, used to evaluate
+// the disk space saved and the CPU time spent.
+//
+// This class is thread safe.
+class CompressionStats {
+ public:
+  struct Snapshot {
+    // Number of objects that were, respectively were not, compressed.
+    uint64_t compressed_count = 0;
+    uint64_t uncompressed_count = 0;
+    // Total size of the objects considered for compression, and of what was
+    // stored for them.
+    uint64_t input_bytes = 0;
+    uint64_t stored_bytes = 0;
+    ftl::TimeDelta compression_time = ftl::TimeDelta::Zero();
+    uint64_t decompressed_count = 0;
+    ftl::TimeDelta decompression_time = ftl::TimeDelta::Zero();
+
+    // Ratio between the size of the objects and the size stored for them.
+    double ratio() const;
+  };
+
+  CompressionStats();
+  ~CompressionStats();
+
+  void RecordCompression(uint64_t input_size,
+                         uint64_t stored_size,
+                         bool compressed,
+                         ftl::TimeDelta time);
+  void RecordDecompression(ftl::TimeDelta time);
+
+  Snapshot GetSnapshot() const;
+
+ private:
+  mutable std::mutex mutex_;
+  Snapshot stats_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(CompressionStats);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_COMPRESSION_H_
@@ -0,0 +1,104 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/compression.h"
+
+#include <string>
+
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+std::string RandomString(size_t size) {
+  std::string result;
+  result.resize(size);
+  glue::RandBytes(&result[0], size);
+  return result;
+}
+
+// Returns a JSON-like document, which compresses well.
+std::string MakeDocument(size_t entry_count) {
+  std::string result = "[";
+  for (size_t i = 0; i < entry_count; ++i) {
+    result += "{\"name\": \"entry " + std::to_string(i) +
+              "\", \"value\": " + std::to_string(i * 7) +
+              ", \"enabled\": true},";
+  }
+  result += "]";
+  return result;
+}
+
+TEST(CompressionTest, CompressAndDecompress) {
+  for (size_t entry_count : {10u, 100u, 10000u}) {
+    std::string data = MakeDocument(entry_count);
+    std::string compressed;
+    ASSERT_TRUE(Compress(data, &compressed));
+    EXPECT_LT(compressed.size(), data.size() / 2);
+
+    uint64_t size;
+    EXPECT_TRUE(GetDecompressedSize(compressed, &size));
+    EXPECT_EQ(data.size(), size);
+    std::string decompressed;
+    ASSERT_TRUE(Decompress(compressed, &decompressed));
+    EXPECT_EQ(data, decompressed);
+  }
+}
+
+TEST(CompressionTest, LongRuns) {
+  // Matches overlapping the bytes they produce, with extended lengths.
+  std::string data = std::string(100000, 'a') + RandomString(1000) +
+                     std::string(300, 'b');
+  std::string compressed;
+  ASSERT_TRUE(Compress(data, &compressed));
+  std::string decompressed;
+  ASSERT_TRUE(Decompress(compressed, &decompressed));
+  EXPECT_EQ(data, decompressed);
+}
+
+TEST(CompressionTest, IncompressibleData) {
+  std::string compressed;
+  EXPECT_FALSE(Compress(RandomString(10000), &compressed));
+  // Small objects are not compressed.
+  EXPECT_FALSE(Compress(std::string(kMinCompressedSize - 1, 'a'), &compressed));
+}
+
+TEST(CompressionTest, MalformedData) {
+  std::string data = MakeDocument(100);
+  std::string compressed;
+  ASSERT_TRUE(Compress(data, &compressed));
+
+  std::string decompressed;
+  EXPECT_FALSE(Decompress("", &decompressed));
+  for (size_t size = 0; size < compressed.size(); ++size) {
+    EXPECT_FALSE(Decompress(compressed.substr(0, size), &decompressed));
+  }
+  // Offset pointing before the start of the data.
+  std::string invalid_offset = compressed.substr(0, kCompressedHeaderSize);
+  invalid_offset += std::string("\x10" "a" "\x05\x00", 4);
+  EXPECT_FALSE(Decompress(invalid_offset, &decompressed));
+}
+
+TEST(CompressionTest, Stats) {
+  CompressionStats stats;
+  EXPECT_EQ(1.0, stats.GetSnapshot().ratio());
+  stats.RecordCompression(1000, 250, true, ftl::TimeDelta::FromMicroseconds(3));
+  stats.RecordCompression(1000, 1000, false,
+                          ftl::TimeDelta::FromMicroseconds(2));
+  stats.RecordDecompression(ftl::TimeDelta::FromMicroseconds(1));
+
+  CompressionStats::Snapshot snapshot = stats.GetSnapshot();
+  EXPECT_EQ(1u, snapshot.compressed_count);
+  EXPECT_EQ(1u, snapshot.uncompressed_count);
+  EXPECT_EQ(2000u, snapshot.input_bytes);
+  EXPECT_EQ(1250u, snapshot.stored_bytes);
+  EXPECT_EQ(1.6, snapshot.ratio());
+  EXPECT_EQ(5, snapshot.compression_time.ToMicroseconds());
+  EXPECT_EQ(1u, snapshot.decompressed_count);
+  EXPECT_EQ(1, snapshot.decompression_time.ToMicroseconds());
+}
+
+}  // namespace
+}  // namespace storage
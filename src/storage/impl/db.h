@@ -75,6 +75,10 @@ class DB {
   // Removes the commit with the given |commit_id| from the commits.
   virtual Status RemoveCommit(const CommitId& commit_id) = 0;
 
+  // Finds the ids of all the commits in the database and replaces the
+  // contents of |commit_ids| with them.
+  virtual Status GetCommitIds(std::vector<CommitId>* commit_ids) = 0;
+
   // Journals.
   // Creates a new |Journal| with the given |base| commit id and stores it on
   // the |journal| parameter.
@@ -120,6 +124,23 @@ class DB {
   virtual Status RemoveJournalEntry(const JournalId& journal_id,
                                     convert::ExtendedStringView key) = 0;
 
+  // Adds the deletion of the keys in [|start|, |end|) to the journal with the
+  // given |journal_id|, and removes the entries of the journal in that range,
+  // which the deletion supersedes. The ids of the objects referenced by the
+  // removed entries are stored in |removed_object_ids|. An empty |end| means
+  // that the range has no upper bound.
+  virtual Status AddJournalRangeDeletion(
+      const JournalId& journal_id,
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::vector<ObjectId>* removed_object_ids) = 0;
+
+  // Finds the ranges of keys deleted in the journal with the given
+  // |journal_id| and replaces the contents of |ranges| with them, sorted by
+  // their start.
+  virtual Status GetJournalRangeDeletions(const JournalId& journal_id,
+                                          std::vector<KeyRange>* ranges) = 0;
+
   // Journal value counters can be used to keep track of how many times a given
   // value is referenced in a journal.
   // Returns the number of times the given value is refererenced.
@@ -143,6 +164,29 @@ class DB {
       const JournalId& journal_id,
       std::unique_ptr<Iterator<const EntryChange>>* entries) = 0;
 
+  // Finds the ids of the objects referenced by the entries of all journals and
+  // replaces the contents of |object_ids| with them.
+  virtual Status GetJournalObjectIds(std::vector<ObjectId>* object_ids) = 0;
+
+  // Inline objects.
+  // Adds the object with the given |object_id| and |content| in the database.
+  // Used for small objects, which are cheaper to store next to the journal
+  // entries referencing them than in the pack store.
+  virtual Status AddInlineObject(ObjectIdView object_id,
+                                 ftl::StringView content) = 0;
+
+  // Finds the object with the given |object_id| and stores its content in
+  // |content|. Returns |NOT_FOUND| if the object is not stored in the database.
+  virtual Status GetInlineObject(ObjectIdView object_id,
+                                 std::string* content) = 0;
+
+  // Finds the ids of all the objects stored in the database and replaces the
+  // contents of |object_ids| with them.
+  virtual Status GetInlineObjectIds(std::vector<ObjectId>* object_ids) = 0;
+
+  // Removes the object with the given |object_id| from the database.
+  virtual Status RemoveInlineObject(ObjectIdView object_id) = 0;
+
   // Commit sync metadata.
   // Finds the set of unsynced commits and replaces the contents of |commit_ids|
   // with their ids. The result is ordered by the timestamps given when calling
@@ -174,19 +218,51 @@ class DB {
   virtual Status IsObjectSynced(ObjectIdView object_id, bool* is_synced) = 0;
 
   // Tree node size.
-  // Sets the node size of this page.
+  // Sets the node size of this page, i.e. the maximal size in bytes of the
+  // encoded entries of a tree node.
   virtual Status SetNodeSize(size_t node_size) = 0;
 
   // Finds the defined node size for this page and returns |OK| on success or
   // |NOT_FOUND| if the node_size is not defined, yet.
   virtual Status GetNodeSize(size_t* node_size) = 0;
 
+  // Tree type.
+  // Sets the type of the tree holding the contents of the commits of this page.
+  virtual Status SetTreeType(TreeType tree_type) = 0;
+
+  // Finds the tree type of this page and returns |OK| on success or
+  // |NOT_FOUND| if it is not defined, yet.
+  virtual Status GetTreeType(TreeType* tree_type) = 0;
+
   // Sets the opaque sync metadata associated with this page.
   virtual Status SetSyncMetadata(ftl::StringView sync_state) = 0;
 
   // Retrieves the opaque sync metadata associated with this page.
   virtual Status GetSyncMetadata(std::string* sync_state) = 0;
 
+  // Removes the sync metadata associated with this page.
+  virtual Status RemoveSyncMetadata() = 0;
+
+  // Sets the serialization version under which the commits of this page are
+  // synced.
+  virtual Status SetSyncVersion(ftl::StringView version) = 0;
+
+  // Retrieves the version set by |SetSyncVersion()|, or returns |NOT_FOUND|
+  // if there is none.
+  virtual Status GetSyncVersion(std::string* version) = 0;
+
+  // Sets the serialized filter over the ids of the objects stored in the
+  // database. The filter is only valid until the next inline object is added,
+  // so it is saved on shutdown, and removed once loaded.
+  virtual Status SetInlineObjectFilter(ftl::StringView filter) = 0;
+
+  // Retrieves the filter set by |SetInlineObjectFilter()|, or returns
+  // |NOT_FOUND| if there is none.
+  virtual Status GetInlineObjectFilter(std::string* filter) = 0;
+
+  // Removes the filter set by |SetInlineObjectFilter()|.
+  virtual Status RemoveInlineObjectFilter() = 0;
+
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(DB);
 };
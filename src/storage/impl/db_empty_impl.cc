@@ -46,6 +46,9 @@ Status DbEmptyImpl::AddCommitStorageBytes(const CommitId& commit_id,
 Status DbEmptyImpl::RemoveCommit(const CommitId& commit_id) {
   return Status::NOT_IMPLEMENTED;
 }
+Status DbEmptyImpl::GetCommitIds(std::vector<CommitId>* commit_ids) {
+  return Status::NOT_IMPLEMENTED;
+}
 Status DbEmptyImpl::GetImplicitJournalIds(std::vector<JournalId>* journal_ids) {
   return Status::NOT_IMPLEMENTED;
 }
@@ -74,6 +77,17 @@ Status DbEmptyImpl::RemoveJournalEntry(const JournalId& journal_id,
                                        convert::ExtendedStringView key) {
   return Status::NOT_IMPLEMENTED;
 }
+Status DbEmptyImpl::AddJournalRangeDeletion(
+    const JournalId& journal_id,
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    std::vector<ObjectId>* removed_object_ids) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetJournalRangeDeletions(const JournalId& journal_id,
+                                             std::vector<KeyRange>* ranges) {
+  return Status::NOT_IMPLEMENTED;
+}
 Status DbEmptyImpl::GetJournalEntries(
     const JournalId& journal_id,
     std::unique_ptr<Iterator<const EntryChange>>* entries) {
@@ -93,6 +107,23 @@ Status DbEmptyImpl::GetJournalValues(const JournalId& journal_id,
                                      std::vector<std::string>* values) {
   return Status::NOT_IMPLEMENTED;
 }
+Status DbEmptyImpl::GetJournalObjectIds(std::vector<ObjectId>* object_ids) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::AddInlineObject(ObjectIdView object_id,
+                                    ftl::StringView content) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetInlineObject(ObjectIdView object_id,
+                                    std::string* content) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetInlineObjectIds(std::vector<ObjectId>* object_ids) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::RemoveInlineObject(ObjectIdView object_id) {
+  return Status::NOT_IMPLEMENTED;
+}
 Status DbEmptyImpl::GetUnsyncedCommitIds(std::vector<CommitId>* commit_ids) {
   return Status::NOT_IMPLEMENTED;
 }
@@ -124,10 +155,34 @@ Status DbEmptyImpl::SetNodeSize(size_t node_size) {
 Status DbEmptyImpl::GetNodeSize(size_t* node_size) {
   return Status::NOT_IMPLEMENTED;
 }
+Status DbEmptyImpl::SetTreeType(TreeType tree_type) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetTreeType(TreeType* tree_type) {
+  return Status::NOT_IMPLEMENTED;
+}
 Status DbEmptyImpl::SetSyncMetadata(ftl::StringView sync_state) {
   return Status::NOT_IMPLEMENTED;
 }
 Status DbEmptyImpl::GetSyncMetadata(std::string* sync_state) {
   return Status::NOT_IMPLEMENTED;
 }
+Status DbEmptyImpl::RemoveSyncMetadata() {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::SetSyncVersion(ftl::StringView version) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetSyncVersion(std::string* version) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::SetInlineObjectFilter(ftl::StringView filter) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::GetInlineObjectFilter(std::string* filter) {
+  return Status::NOT_IMPLEMENTED;
+}
+Status DbEmptyImpl::RemoveInlineObjectFilter() {
+  return Status::NOT_IMPLEMENTED;
+}
 }  // namespace storage
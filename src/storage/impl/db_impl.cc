@@ -4,6 +4,8 @@
 
 #include "apps/ledger/src/storage/impl/db_impl.h"
 
+#include <string.h>
+
 #include <algorithm>
 #include <string>
 
@@ -28,6 +30,7 @@ constexpr ftl::StringView kJournalPrefix = "journals/";
 constexpr ftl::StringView kImplicitJournalMetaPrefix = "journals/implicit/";
 constexpr ftl::StringView kJournalEntry = "entry/";
 constexpr ftl::StringView kJournalCounter = "counter/";
+constexpr ftl::StringView kJournalRange = "range/";
 const char kImplicitJournalIdPrefix = 'I';
 const char kExplicitJournalIdPrefix = 'E';
 const size_t kJournalEntryPrefixSize =
@@ -39,13 +42,21 @@ const char kJournalLazyEntry = 'L';
 const char kJournalEagerEntry = 'E';
 const size_t kJournalEntryAddPrefixSize = 2;
 
+constexpr ftl::StringView kInlineObjectPrefix = "objects/";
+
 constexpr ftl::StringView kUnsyncedCommitPrefix = "unsynced/commits/";
 constexpr ftl::StringView kUnsyncedObjectPrefix = "unsynced/objects/";
 
 constexpr ftl::StringView kNodeSizeKey = "node-size";
 
+constexpr ftl::StringView kTreeTypeKey = "tree-type";
+
 constexpr ftl::StringView kSyncMetadata = "sync-metadata";
 
+constexpr ftl::StringView kSyncVersionKey = "sync-version";
+
+constexpr ftl::StringView kInlineObjectFilterKey = "inline-object-filter";
+
 std::string GetHeadKeyFor(CommitIdView head) {
   return ftl::Concatenate({kHeadPrefix, head});
 }
@@ -54,6 +65,10 @@ std::string GetCommitKeyFor(const CommitId& commit_id) {
   return ftl::Concatenate({kCommitPrefix, commit_id});
 }
 
+std::string GetInlineObjectKeyFor(ObjectIdView object_id) {
+  return ftl::Concatenate({kInlineObjectPrefix, object_id});
+}
+
 std::string GetUnsyncedCommitKeyFor(const CommitId& commit_id) {
   return ftl::Concatenate({kUnsyncedCommitPrefix, commit_id});
 }
@@ -89,6 +104,14 @@ Status ExtractObjectId(ftl::StringView db_value, ObjectId* id) {
   return Status::OK;
 }
 
+std::string GetJournalRangePrefixFor(const JournalId& id) {
+  return ftl::Concatenate({kJournalPrefix, id, "/", kJournalRange});
+}
+
+std::string GetJournalRangeKeyFor(const JournalId& id, ftl::StringView start) {
+  return ftl::Concatenate({GetJournalRangePrefixFor(id), start});
+}
+
 std::string GetJournalCounterPrefixFor(const JournalId& id) {
   return ftl::Concatenate({kJournalPrefix, id, "/", kJournalCounter});
 }
@@ -275,6 +298,10 @@ Status DbImpl::RemoveCommit(const CommitId& commit_id) {
   return Delete(GetCommitKeyFor(commit_id));
 }
 
+Status DbImpl::GetCommitIds(std::vector<CommitId>* commit_ids) {
+  return GetByPrefix(convert::ToSlice(kCommitPrefix), commit_ids);
+}
+
 Status DbImpl::CreateJournal(JournalType journal_type,
                              const CommitId& base,
                              std::unique_ptr<Journal>* journal) {
@@ -324,6 +351,10 @@ Status DbImpl::RemoveJournal(const JournalId& journal_id) {
       return s;
     }
   }
+  Status s = DeleteByPrefix(GetJournalRangePrefixFor(journal_id));
+  if (s != Status::OK) {
+    return s;
+  }
   return DeleteByPrefix(GetJournalEntryPrefixFor(journal_id));
 }
 
@@ -340,6 +371,72 @@ Status DbImpl::RemoveJournalEntry(const JournalId& journal_id,
   return Put(GetJournalEntryKeyFor(journal_id, key), kJournalEntryDelete);
 }
 
+Status DbImpl::AddJournalRangeDeletion(
+    const JournalId& journal_id,
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    std::vector<ObjectId>* removed_object_ids) {
+  std::vector<ObjectId> result;
+  std::string prefix = GetJournalEntryPrefixFor(journal_id);
+  std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(read_options_));
+  for (it->Seek(GetJournalEntryKeyFor(journal_id, start));
+       it->Valid() && it->key().starts_with(prefix); it->Next()) {
+    leveldb::Slice key = it->key();
+    key.remove_prefix(prefix.size());
+    if (!end.empty() && convert::ExtendedStringView(key) >= end) {
+      break;
+    }
+    ObjectId object_id;
+    if (ExtractObjectId(convert::ExtendedStringView(it->value()),
+                        &object_id) == Status::OK) {
+      result.push_back(std::move(object_id));
+    }
+    Status s = Delete(it->key());
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  if (!it->status().ok()) {
+    return ConvertStatus(it->status());
+  }
+
+  // Ranges are keyed by their start: a deletion with the same start as a
+  // previous one is merged with it.
+  std::string range_key = GetJournalRangeKeyFor(journal_id, start);
+  std::string previous_end;
+  Status s = Get(range_key, &previous_end);
+  if (s != Status::OK && s != Status::NOT_FOUND) {
+    return s;
+  }
+  bool covered =
+      s == Status::OK &&
+      (previous_end.empty() ||
+       (!end.empty() && convert::ExtendedStringView(previous_end) >= end));
+  if (!covered) {
+    s = Put(range_key, end);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  removed_object_ids->swap(result);
+  return Status::OK;
+}
+
+Status DbImpl::GetJournalRangeDeletions(const JournalId& journal_id,
+                                        std::vector<KeyRange>* ranges) {
+  std::vector<std::pair<std::string, std::string>> entries;
+  Status s = GetEntriesByPrefix(GetJournalRangePrefixFor(journal_id), &entries);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::vector<KeyRange> result;
+  for (auto& entry : entries) {
+    result.push_back(KeyRange{std::move(entry.first), std::move(entry.second)});
+  }
+  ranges->swap(result);
+  return Status::OK;
+}
+
 Status DbImpl::GetJournalValue(const JournalId& journal_id,
                                ftl::StringView key,
                                std::string* value) {
@@ -393,6 +490,50 @@ Status DbImpl::GetJournalValues(const JournalId& journal_id,
   return GetByPrefix(GetJournalCounterPrefixFor(journal_id), values);
 }
 
+Status DbImpl::GetJournalObjectIds(std::vector<ObjectId>* object_ids) {
+  std::vector<ObjectId> result;
+  std::unique_ptr<leveldb::Iterator> it(db_->NewIterator(read_options_));
+  leveldb::Slice prefix = convert::ToSlice(kJournalPrefix);
+  for (it->Seek(prefix); it->Valid() && it->key().starts_with(prefix);
+       it->Next()) {
+    // Only keep the entries, i.e. "journals/<journal_id>/entry/<key>", that
+    // add a value.
+    ftl::StringView key = convert::ExtendedStringView(it->key());
+    if (key.size() < kJournalEntryPrefixSize ||
+        key.substr(kJournalPrefix.size() + kJournalIdSize + 1,
+                   kJournalEntry.size()) != kJournalEntry) {
+      continue;
+    }
+    ObjectId object_id;
+    if (ExtractObjectId(convert::ExtendedStringView(it->value()),
+                        &object_id) == Status::OK) {
+      result.push_back(std::move(object_id));
+    }
+  }
+  if (!it->status().ok()) {
+    return ConvertStatus(it->status());
+  }
+  object_ids->swap(result);
+  return Status::OK;
+}
+
+Status DbImpl::AddInlineObject(ObjectIdView object_id,
+                               ftl::StringView content) {
+  return Put(GetInlineObjectKeyFor(object_id), content);
+}
+
+Status DbImpl::GetInlineObject(ObjectIdView object_id, std::string* content) {
+  return Get(GetInlineObjectKeyFor(object_id), content);
+}
+
+Status DbImpl::GetInlineObjectIds(std::vector<ObjectId>* object_ids) {
+  return GetByPrefix(convert::ToSlice(kInlineObjectPrefix), object_ids);
+}
+
+Status DbImpl::RemoveInlineObject(ObjectIdView object_id) {
+  return Delete(GetInlineObjectKeyFor(object_id));
+}
+
 Status DbImpl::GetUnsyncedCommitIds(std::vector<CommitId>* commit_ids) {
   std::vector<std::pair<std::string, std::string>> entries;
   Status s =
@@ -457,7 +598,7 @@ Status DbImpl::IsObjectSynced(ObjectIdView object_id, bool* is_synced) {
 }
 
 Status DbImpl::SetNodeSize(size_t node_size) {
-  ftl::StringView value(reinterpret_cast<char*>(&node_size), sizeof(int));
+  ftl::StringView value(reinterpret_cast<char*>(&node_size), sizeof(size_t));
   return Put(kNodeSizeKey, value);
 }
 
@@ -467,7 +608,38 @@ Status DbImpl::GetNodeSize(size_t* node_size) {
   if (s != Status::OK) {
     return s;
   }
-  *node_size = *reinterpret_cast<const size_t*>(value.data());
+  if (value.size() != sizeof(size_t)) {
+    return Status::FORMAT_ERROR;
+  }
+  memcpy(node_size, value.data(), sizeof(size_t));
+  return Status::OK;
+}
+
+Status DbImpl::SetTreeType(TreeType tree_type) {
+  switch (tree_type) {
+    case TreeType::BTREE:
+      return Put(kTreeTypeKey, "btree");
+    case TreeType::HASH_TREE:
+      return Put(kTreeTypeKey, "hash-tree");
+  }
+  FTL_NOTREACHED();
+  return Status::ILLEGAL_STATE;
+}
+
+Status DbImpl::GetTreeType(TreeType* tree_type) {
+  std::string value;
+  Status s = Get(kTreeTypeKey, &value);
+  if (s != Status::OK) {
+    return s;
+  }
+  if (value == "btree") {
+    *tree_type = TreeType::BTREE;
+  } else if (value == "hash-tree") {
+    *tree_type = TreeType::HASH_TREE;
+  } else {
+    FTL_LOG(ERROR) << "Unknown tree type: " << value;
+    return Status::FORMAT_ERROR;
+  }
   return Status::OK;
 }
 
@@ -479,6 +651,30 @@ Status DbImpl::GetSyncMetadata(std::string* sync_state) {
   return Get(kSyncMetadata, sync_state);
 }
 
+Status DbImpl::RemoveSyncMetadata() {
+  return Delete(kSyncMetadata);
+}
+
+Status DbImpl::SetSyncVersion(ftl::StringView version) {
+  return Put(kSyncVersionKey, version);
+}
+
+Status DbImpl::GetSyncVersion(std::string* version) {
+  return Get(kSyncVersionKey, version);
+}
+
+Status DbImpl::SetInlineObjectFilter(ftl::StringView filter) {
+  return Put(kInlineObjectFilterKey, filter);
+}
+
+Status DbImpl::GetInlineObjectFilter(std::string* filter) {
+  return Get(kInlineObjectFilterKey, filter);
+}
+
+Status DbImpl::RemoveInlineObjectFilter() {
+  return Delete(kInlineObjectFilterKey);
+}
+
 Status DbImpl::GetByPrefix(const leveldb::Slice& prefix,
                            std::vector<std::string>* key_suffixes) {
   std::vector<std::string> result;
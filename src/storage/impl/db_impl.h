@@ -32,6 +32,7 @@ class DbImpl : public DB {
   Status AddCommitStorageBytes(const CommitId& commit_id,
                                const std::string& storage_bytes) override;
   Status RemoveCommit(const CommitId& commit_id) override;
+  Status GetCommitIds(std::vector<CommitId>* commit_ids) override;
   Status CreateJournal(JournalType journal_type,
                        const CommitId& base,
                        std::unique_ptr<Journal>* journal) override;
@@ -52,6 +53,13 @@ class DbImpl : public DB {
                          std::string* value) override;
   Status RemoveJournalEntry(const JournalId& journal_id,
                             convert::ExtendedStringView key) override;
+  Status AddJournalRangeDeletion(
+      const JournalId& journal_id,
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::vector<ObjectId>* removed_object_ids) override;
+  Status GetJournalRangeDeletions(const JournalId& journal_id,
+                                  std::vector<KeyRange>* ranges) override;
   Status GetJournalValueCounter(const JournalId& journal_id,
                                 ftl::StringView value,
                                 int* counter) override;
@@ -63,6 +71,13 @@ class DbImpl : public DB {
   Status GetJournalEntries(
       const JournalId& journal_id,
       std::unique_ptr<Iterator<const EntryChange>>* entries) override;
+  Status GetJournalObjectIds(std::vector<ObjectId>* object_ids) override;
+  Status AddInlineObject(ObjectIdView object_id,
+                         ftl::StringView content) override;
+  Status GetInlineObject(ObjectIdView object_id,
+                         std::string* content) override;
+  Status GetInlineObjectIds(std::vector<ObjectId>* object_ids) override;
+  Status RemoveInlineObject(ObjectIdView object_id) override;
   Status GetUnsyncedCommitIds(std::vector<CommitId>* commit_ids) override;
   Status MarkCommitIdSynced(const CommitId& commit_id) override;
   Status MarkCommitIdUnsynced(const CommitId& commit_id,
@@ -74,8 +89,16 @@ class DbImpl : public DB {
   Status IsObjectSynced(ObjectIdView object_id, bool* is_synced) override;
   Status SetNodeSize(size_t node_size) override;
   Status GetNodeSize(size_t* node_size) override;
+  Status SetTreeType(TreeType tree_type) override;
+  Status GetTreeType(TreeType* tree_type) override;
   Status SetSyncMetadata(ftl::StringView sync_state) override;
   Status GetSyncMetadata(std::string* sync_state) override;
+  Status RemoveSyncMetadata() override;
+  Status SetSyncVersion(ftl::StringView version) override;
+  Status GetSyncVersion(std::string* version) override;
+  Status SetInlineObjectFilter(ftl::StringView filter) override;
+  Status GetInlineObjectFilter(std::string* filter) override;
+  Status RemoveInlineObjectFilter() override;
 
  private:
   Status GetByPrefix(const leveldb::Slice& prefix,
@@ -4,6 +4,7 @@
 
 #include "apps/ledger/src/storage/impl/db.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <utility>
@@ -188,6 +189,81 @@ TEST_F(DBTest, JournalEntries) {
   EXPECT_EQ(Status::OK, implicit_journal->Rollback());
 }
 
+TEST_F(DBTest, JournalRangeDeletions) {
+  JournalId journal_id = "E" + RandomId(15);
+  EXPECT_EQ(Status::OK,
+            db_.AddJournalEntry(journal_id, "a", "value1", KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK,
+            db_.AddJournalEntry(journal_id, "b1", "value2", KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK, db_.RemoveJournalEntry(journal_id, "b2"));
+  EXPECT_EQ(Status::OK,
+            db_.AddJournalEntry(journal_id, "c", "value3", KeyPriority::LAZY));
+
+  // The entries of the range are removed.
+  std::vector<ObjectId> removed_object_ids;
+  EXPECT_EQ(Status::OK, db_.AddJournalRangeDeletion(journal_id, "b", "c",
+                                                    &removed_object_ids));
+  EXPECT_EQ(std::vector<ObjectId>({"value2"}), removed_object_ids);
+  EntryChange expected_changes[] = {
+      NewEntryChange("a", "value1", KeyPriority::EAGER),
+      NewEntryChange("c", "value3", KeyPriority::LAZY),
+  };
+  std::unique_ptr<Iterator<const EntryChange>> entries;
+  EXPECT_EQ(Status::OK, db_.GetJournalEntries(journal_id, &entries));
+  for (const EntryChange& expected_change : expected_changes) {
+    ASSERT_TRUE(entries->Valid());
+    ExpectChangesEqual(expected_change, **entries);
+    entries->Next();
+  }
+  EXPECT_FALSE(entries->Valid());
+
+  // A deletion with the same start as a previous one is merged with it.
+  EXPECT_EQ(Status::OK, db_.AddJournalRangeDeletion(journal_id, "b", "bz",
+                                                    &removed_object_ids));
+  EXPECT_TRUE(removed_object_ids.empty());
+  EXPECT_EQ(Status::OK, db_.AddJournalRangeDeletion(journal_id, "x", "",
+                                                    &removed_object_ids));
+  std::vector<KeyRange> ranges;
+  EXPECT_EQ(Status::OK, db_.GetJournalRangeDeletions(journal_id, &ranges));
+  ASSERT_EQ(2u, ranges.size());
+  EXPECT_EQ("b", ranges[0].start);
+  EXPECT_EQ("c", ranges[0].end);
+  EXPECT_EQ("x", ranges[1].start);
+  EXPECT_EQ("", ranges[1].end);
+
+  EXPECT_EQ(Status::OK, db_.RemoveJournal(journal_id));
+  EXPECT_EQ(Status::OK, db_.GetJournalRangeDeletions(journal_id, &ranges));
+  EXPECT_TRUE(ranges.empty());
+}
+
+TEST_F(DBTest, JournalObjectIds) {
+  CommitId commit_id = RandomId(kCommitIdSize);
+  std::vector<ObjectId> object_ids;
+  EXPECT_EQ(Status::OK, db_.GetJournalObjectIds(&object_ids));
+  EXPECT_TRUE(object_ids.empty());
+
+  std::unique_ptr<Journal> implicit_journal;
+  std::unique_ptr<Journal> explicit_journal;
+  EXPECT_EQ(Status::OK, db_.CreateJournal(JournalType::IMPLICIT, commit_id,
+                                          &implicit_journal));
+  EXPECT_EQ(Status::OK, db_.CreateJournal(JournalType::EXPLICIT, commit_id,
+                                          &explicit_journal));
+  EXPECT_EQ(Status::OK,
+            implicit_journal->Put("key1", "value1", KeyPriority::LAZY));
+  EXPECT_EQ(Status::OK,
+            explicit_journal->Put("key2", "value2", KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK, explicit_journal->Delete("key3"));
+
+  EXPECT_EQ(Status::OK, db_.GetJournalObjectIds(&object_ids));
+  std::sort(object_ids.begin(), object_ids.end());
+  EXPECT_EQ(std::vector<ObjectId>({"value1", "value2"}), object_ids);
+
+  EXPECT_EQ(Status::OK, implicit_journal->Rollback());
+  EXPECT_EQ(Status::OK, explicit_journal->Rollback());
+  EXPECT_EQ(Status::OK, db_.GetJournalObjectIds(&object_ids));
+  EXPECT_TRUE(object_ids.empty());
+}
+
 TEST_F(DBTest, UnsyncedCommits) {
   CommitId commit_id = RandomId(kCommitIdSize);
   std::vector<CommitId> commit_ids;
@@ -247,6 +323,25 @@ TEST_F(DBTest, UnsyncedObjects) {
   EXPECT_TRUE(is_synced);
 }
 
+TEST_F(DBTest, InlineObjects) {
+  ObjectId object_id = RandomId(kObjectIdSize);
+  std::string content;
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetInlineObject(object_id, &content));
+
+  EXPECT_EQ(Status::OK, db_.AddInlineObject(object_id, "some content"));
+  EXPECT_EQ(Status::OK, db_.GetInlineObject(object_id, &content));
+  EXPECT_EQ("some content", content);
+
+  std::vector<ObjectId> object_ids;
+  EXPECT_EQ(Status::OK, db_.GetInlineObjectIds(&object_ids));
+  EXPECT_EQ(std::vector<ObjectId>({object_id}), object_ids);
+
+  EXPECT_EQ(Status::OK, db_.RemoveInlineObject(object_id));
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetInlineObject(object_id, &content));
+  EXPECT_EQ(Status::OK, db_.GetInlineObjectIds(&object_ids));
+  EXPECT_TRUE(object_ids.empty());
+}
+
 TEST_F(DBTest, Batch) {
   std::unique_ptr<DB::Batch> batch = db_.StartBatch();
 
@@ -273,6 +368,19 @@ TEST_F(DBTest, NodeSize) {
   EXPECT_EQ(1024u, node_size);
 }
 
+TEST_F(DBTest, TreeType) {
+  TreeType tree_type;
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetTreeType(&tree_type));
+
+  EXPECT_EQ(Status::OK, db_.SetTreeType(TreeType::HASH_TREE));
+  EXPECT_EQ(Status::OK, db_.GetTreeType(&tree_type));
+  EXPECT_EQ(TreeType::HASH_TREE, tree_type);
+
+  EXPECT_EQ(Status::OK, db_.SetTreeType(TreeType::BTREE));
+  EXPECT_EQ(Status::OK, db_.GetTreeType(&tree_type));
+  EXPECT_EQ(TreeType::BTREE, tree_type);
+}
+
 TEST_F(DBTest, SyncMetadata) {
   std::string sync_state;
   EXPECT_EQ(Status::NOT_FOUND, db_.GetSyncMetadata(&sync_state));
@@ -280,6 +388,30 @@ TEST_F(DBTest, SyncMetadata) {
   EXPECT_EQ(Status::OK, db_.SetSyncMetadata("bazinga"));
   EXPECT_EQ(Status::OK, db_.GetSyncMetadata(&sync_state));
   EXPECT_EQ("bazinga", sync_state);
+
+  EXPECT_EQ(Status::OK, db_.RemoveSyncMetadata());
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetSyncMetadata(&sync_state));
+}
+
+TEST_F(DBTest, SyncVersion) {
+  std::string version;
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetSyncVersion(&version));
+
+  EXPECT_EQ(Status::OK, db_.SetSyncVersion("3"));
+  EXPECT_EQ(Status::OK, db_.GetSyncVersion(&version));
+  EXPECT_EQ("3", version);
+}
+
+TEST_F(DBTest, InlineObjectFilter) {
+  std::string filter;
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetInlineObjectFilter(&filter));
+
+  EXPECT_EQ(Status::OK, db_.SetInlineObjectFilter("filter"));
+  EXPECT_EQ(Status::OK, db_.GetInlineObjectFilter(&filter));
+  EXPECT_EQ("filter", filter);
+
+  EXPECT_EQ(Status::OK, db_.RemoveInlineObjectFilter());
+  EXPECT_EQ(Status::NOT_FOUND, db_.GetInlineObjectFilter(&filter));
 }
 
 }  // namespace
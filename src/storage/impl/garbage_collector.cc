@@ -0,0 +1,222 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/garbage_collector.h"
+
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/public/commit.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/time/time_point.h"
+
+namespace storage {
+
+GarbageCollector::GarbageCollector(PageStorage* page_storage,
+                                   PackStore* pack_store,
+                                   ftl::RefPtr<ftl::TaskRunner> main_runner,
+                                   ftl::RefPtr<ftl::TaskRunner> io_runner)
+    : page_storage_(page_storage),
+      pack_store_(pack_store),
+      main_runner_(std::move(main_runner)),
+      io_runner_(std::move(io_runner)) {}
+
+GarbageCollector::~GarbageCollector() {}
+
+void GarbageCollector::Start(std::vector<ObjectId> root_ids,
+                             std::vector<CommitId> history_commit_ids,
+                             std::vector<ObjectId> live_object_ids,
+                             std::function<void(Status)> callback) {
+  FTL_DCHECK(main_runner_->RunsTasksOnCurrentThread());
+  FTL_DCHECK(!callback_);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_nodes_ = std::move(root_ids);
+    history_commit_ids_ = std::move(history_commit_ids);
+    live_object_ids_ = std::move(live_object_ids);
+  }
+  callback_ = std::move(callback);
+  io_runner_->PostTask(
+      [self = ftl::RefPtr<GarbageCollector>(this)] { self->RunSlice(); });
+}
+
+void GarbageCollector::Cancel() {
+  FTL_DCHECK(main_runner_->RunsTasksOnCurrentThread());
+  std::lock_guard<std::mutex> lock(mutex_);
+  cancelled_ = true;
+}
+
+size_t GarbageCollector::removed_object_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return removed_object_count_;
+}
+
+void GarbageCollector::RunSlice() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (cancelled_) {
+    return;
+  }
+  ftl::TimePoint deadline =
+      ftl::TimePoint::Now() + kGarbageCollectionSliceDuration;
+  Status status = Status::OK;
+  while (phase_ != Phase::DONE && ftl::TimePoint::Now() < deadline) {
+    switch (phase_) {
+      case Phase::MARK:
+        status = MarkNext();
+        break;
+      case Phase::SWEEP:
+        status = SweepNext();
+        break;
+      case Phase::COMPACT:
+        status = CompactNext();
+        break;
+      case Phase::DONE:
+        break;
+    }
+    if (status != Status::OK) {
+      FTL_LOG(ERROR) << "Garbage collection failed with status " << status;
+      Finish(status);
+      return;
+    }
+  }
+  if (phase_ == Phase::DONE) {
+    Finish(Status::OK);
+    return;
+  }
+  // Let the other tasks of the I/O thread run before the next step.
+  io_runner_->PostTask(
+      [self = ftl::RefPtr<GarbageCollector>(this)] { self->RunSlice(); });
+}
+
+Status GarbageCollector::MarkNext() {
+  // Looking an object up in the pack store marks it as used for the current
+  // collection.
+  if (!live_object_ids_.empty()) {
+    pack_store_->Contains(live_object_ids_.back());
+    live_object_ids_.pop_back();
+    return Status::OK;
+  }
+  if (pending_nodes_.empty() && pending_history_nodes_.empty()) {
+    if (!history_commit_ids_.empty()) {
+      std::unique_ptr<const Commit> commit;
+      Status status =
+          page_storage_->GetCommit(history_commit_ids_.back(), &commit);
+      history_commit_ids_.pop_back();
+      if (status == Status::NOT_FOUND) {
+        // The commit was removed since the collection started.
+        return Status::OK;
+      }
+      if (status != Status::OK) {
+        return status;
+      }
+      pending_history_nodes_.push_back(commit->GetRootId());
+      return Status::OK;
+    }
+    candidates_ = pack_store_->GetObjectIds();
+    phase_ = Phase::SWEEP;
+    return Status::OK;
+  }
+
+  // The values of a node are kept if it is reachable from a root, even if it
+  // is also part of a history tree: those are only visited last.
+  const bool keep_values = !pending_nodes_.empty();
+  std::vector<ObjectId>* pending =
+      keep_values ? &pending_nodes_ : &pending_history_nodes_;
+  ObjectId node_id = std::move(pending->back());
+  pending->pop_back();
+  if (!visited_nodes_.insert(node_id).second) {
+    return Status::OK;
+  }
+  pack_store_->Contains(node_id);
+  std::unique_ptr<const Object> object;
+  Status status = page_storage_->GetObjectSynchronous(node_id, &object);
+  if (status == Status::NOT_FOUND) {
+    // The node is not stored locally. It is fetched from the cloud when
+    // needed, and so are its children.
+    return Status::OK;
+  }
+  if (status != Status::OK) {
+    return status;
+  }
+  // Only the references of the node are needed: it is decoded directly rather
+  // than through |TreeNode|, which would add it to the tree node cache.
+  ftl::StringView data;
+  status = object->GetData(&data);
+  if (status != Status::OK) {
+    return status;
+  }
+  std::vector<Entry> entries;
+  std::vector<ObjectId> children;
+  std::vector<uint64_t> child_entry_counts;
+  if (!DecodeNode(data, &entries, &children, &child_entry_counts)) {
+    return Status::FORMAT_ERROR;
+  }
+  if (keep_values) {
+    for (const Entry& entry : entries) {
+      pack_store_->Contains(entry.object_id);
+    }
+  }
+  for (ObjectId& child_id : children) {
+    if (!child_id.empty() && visited_nodes_.count(child_id) == 0) {
+      pending->push_back(std::move(child_id));
+    }
+  }
+  return Status::OK;
+}
+
+Status GarbageCollector::SweepNext() {
+  if (next_candidate_ == candidates_.size()) {
+    candidates_.clear();
+    // Removals must be durable before the segments holding the removed objects
+    // are deleted.
+    Status status = pack_store_->Sync();
+    if (status != Status::OK) {
+      return status;
+    }
+    segments_to_compact_ = pack_store_->GetSegmentsToCompact();
+    phase_ = Phase::COMPACT;
+    return Status::OK;
+  }
+  bool removed;
+  Status status =
+      pack_store_->RemoveUnused(candidates_[next_candidate_++], &removed);
+  if (status != Status::OK) {
+    return status;
+  }
+  if (removed) {
+    ++removed_object_count_;
+  }
+  return Status::OK;
+}
+
+Status GarbageCollector::CompactNext() {
+  if (segments_to_compact_.empty()) {
+    phase_ = Phase::DONE;
+    return Status::OK;
+  }
+  bool done;
+  Status status = pack_store_->CompactSegment(
+      segments_to_compact_.back(), &compaction_offset_, &done);
+  if (status != Status::OK) {
+    return status;
+  }
+  if (done) {
+    segments_to_compact_.pop_back();
+    compaction_offset_ = 0;
+  }
+  return Status::OK;
+}
+
+void GarbageCollector::Finish(Status status) {
+  phase_ = Phase::DONE;
+  main_runner_->PostTask([ self = ftl::RefPtr<GarbageCollector>(this), status ] {
+    {
+      std::lock_guard<std::mutex> lock(self->mutex_);
+      if (self->cancelled_) {
+        return;
+      }
+    }
+    self->callback_(status);
+  });
+}
+
+}  // namespace storage
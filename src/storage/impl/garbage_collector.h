@@ -0,0 +1,122 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_GARBAGE_COLLECTOR_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_GARBAGE_COLLECTOR_H_
+
+#include <functional>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "apps/ledger/src/storage/impl/pack_store.h"
+#include "apps/ledger/src/storage/public/page_storage.h"
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+#include "lib/ftl/memory/ref_counted.h"
+#include "lib/ftl/tasks/task_runner.h"
+#include "lib/ftl/time/time_delta.h"
+
+namespace storage {
+
+// Maximal duration of a single step of a collection on the I/O thread.
+constexpr ftl::TimeDelta kGarbageCollectionSliceDuration =
+    ftl::TimeDelta::FromMilliseconds(10);
+
+// Removes the objects of a |PackStore| that are not reachable from a set of
+// roots, then compacts the segments mostly used by removed objects.
+//
+// The collection runs incrementally on the I/O thread, in steps of bounded
+// duration, so that it does not delay other I/O for long:
+// - Mark: all the tree nodes reachable from the roots, and the values they
+//   reference, are looked up in the pack store. The history commits are then
+//   read, and the nodes of their trees are looked up too, but not their
+//   values. Nodes are decoded without going through the tree node cache, so
+//   that the collection does not evict the nodes in use.
+// - Sweep: the objects that were not looked up, by the collector or by anyone
+//   else, since |PackStore::StartCollection()| was called are removed.
+// - Compact: segments of which less than half is live are rewritten, a few
+//   records at a time.
+// The caller is responsible for calling |PackStore::StartCollection()| before
+// computing the roots, and |PackStore::EndCollection()| once done.
+class GarbageCollector : public ftl::RefCountedThreadSafe<GarbageCollector> {
+ public:
+  static ftl::RefPtr<GarbageCollector> Create(
+      PageStorage* page_storage,
+      PackStore* pack_store,
+      ftl::RefPtr<ftl::TaskRunner> main_runner,
+      ftl::RefPtr<ftl::TaskRunner> io_runner) {
+    return ftl::AdoptRef(new GarbageCollector(
+        page_storage, pack_store, std::move(main_runner),
+        std::move(io_runner)));
+  }
+
+  // Starts the collection. The trees with the given |root_ids|, the nodes of
+  // the trees of the commits with the given |history_commit_ids|, and the
+  // |live_object_ids| are kept. |callback| is called on the main thread once
+  // the collection is done, unless the collection is cancelled before.
+  void Start(std::vector<ObjectId> root_ids,
+             std::vector<CommitId> history_commit_ids,
+             std::vector<ObjectId> live_object_ids,
+             std::function<void(Status)> callback);
+
+  // Stops the collection. Once this returns, the collector no longer accesses
+  // the page storage and the pack store. Must be called on the main thread.
+  void Cancel();
+
+  // Number of objects removed by the collection.
+  size_t removed_object_count() const;
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(GarbageCollector);
+
+  enum class Phase { MARK, SWEEP, COMPACT, DONE };
+
+  GarbageCollector(PageStorage* page_storage,
+                   PackStore* pack_store,
+                   ftl::RefPtr<ftl::TaskRunner> main_runner,
+                   ftl::RefPtr<ftl::TaskRunner> io_runner);
+  ~GarbageCollector();
+
+  // Runs the collection on the I/O thread for at most
+  // |kGarbageCollectionSliceDuration|, and schedules the next step.
+  void RunSlice();
+  // Runs a single unit of work of the current phase.
+  Status MarkNext();
+  Status SweepNext();
+  Status CompactNext();
+  void Finish(Status status);
+
+  PageStorage* const page_storage_;
+  PackStore* const pack_store_;
+  ftl::RefPtr<ftl::TaskRunner> main_runner_;
+  ftl::RefPtr<ftl::TaskRunner> io_runner_;
+  std::function<void(Status)> callback_;
+
+  // Held while running a step, so that |Cancel()| waits for the current one.
+  mutable std::mutex mutex_;
+  bool cancelled_ = false;
+  Phase phase_ = Phase::MARK;
+  std::vector<ObjectId> live_object_ids_;
+  // Commits whose trees are still to be visited as history trees.
+  std::vector<CommitId> history_commit_ids_;
+  // Tree nodes still to be visited, and nodes already visited. History nodes
+  // are only visited once all the other nodes have been.
+  std::vector<ObjectId> pending_nodes_;
+  std::vector<ObjectId> pending_history_nodes_;
+  std::unordered_set<ObjectId> visited_nodes_;
+  // Objects stored when the collection started, which are removed unless used.
+  std::vector<ObjectId> candidates_;
+  size_t next_candidate_ = 0;
+  std::vector<uint32_t> segments_to_compact_;
+  // Offset in the segment being compacted at which the next step starts.
+  uint64_t compaction_offset_ = 0;
+  size_t removed_object_count_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(GarbageCollector);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_GARBAGE_COLLECTOR_H_
@@ -0,0 +1,320 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/garbage_collector.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/hash.h"
+#include "apps/ledger/src/storage/impl/btree/encoding.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node_cache.h"
+#include "apps/ledger/src/storage/impl/object_impl.h"
+#include "apps/ledger/src/storage/test/commit_empty_impl.h"
+#include "apps/ledger/src/storage/test/page_storage_empty_impl.h"
+#include "apps/ledger/src/test/capture.h"
+#include "apps/ledger/src/test/test_with_message_loop.h"
+#include "gtest/gtest.h"
+#include "lib/ftl/files/scoped_temp_dir.h"
+#include "lib/ftl/strings/concatenate.h"
+
+namespace storage {
+namespace {
+
+// A commit of which only the root is known.
+class FakeCommit : public test::CommitEmptyImpl {
+ public:
+  explicit FakeCommit(ObjectId root_id) : root_id_(std::move(root_id)) {}
+
+  ObjectId GetRootId() const override { return root_id_; }
+
+ private:
+  const ObjectId root_id_;
+};
+
+// Reads the objects from the given pack store.
+class FakePageStorage : public test::PageStorageEmptyImpl {
+ public:
+  explicit FakePageStorage(PackStore* pack_store) : pack_store_(pack_store) {}
+
+  void AddCommit(const CommitId& commit_id, const ObjectId& root_id) {
+    commit_roots_[commit_id] = root_id;
+  }
+
+  Status GetCommit(const CommitId& commit_id,
+                   std::unique_ptr<const Commit>* commit) override {
+    auto it = commit_roots_.find(commit_id);
+    if (it == commit_roots_.end()) {
+      return Status::NOT_FOUND;
+    }
+    *commit = std::make_unique<FakeCommit>(it->second);
+    return Status::OK;
+  }
+
+  Status GetObjectSynchronous(ObjectIdView object_id,
+                              std::unique_ptr<const Object>* object) override {
+    PackStore::Location location;
+    Status status = pack_store_->Find(object_id, &location);
+    if (status != Status::OK) {
+      return status;
+    }
+    std::shared_ptr<SegmentFile> file;
+    status = pack_store_->GetSegmentFile(location.segment, &file);
+    if (status != Status::OK) {
+      return status;
+    }
+    *object = std::make_unique<ObjectImpl>(
+        object_id.ToString(), std::move(file), location.offset, location.size);
+    return Status::OK;
+  }
+
+  TreeNodeCache* GetTreeNodeCache() override { return &tree_node_cache_; }
+
+ private:
+  PackStore* const pack_store_;
+  std::map<CommitId, ObjectId> commit_roots_;
+  TreeNodeCache tree_node_cache_;
+};
+
+class GarbageCollectorTest : public ::test::TestWithMessageLoop {
+ public:
+  GarbageCollectorTest() {}
+
+  ~GarbageCollectorTest() override {}
+
+  // Test:
+  void SetUp() override {
+    ::test::TestWithMessageLoop::SetUp();
+    pack_store_ = std::make_unique<PackStore>(tmp_dir_.path(), false);
+    ASSERT_EQ(Status::OK, pack_store_->Init());
+    page_storage_ = std::make_unique<FakePageStorage>(pack_store_.get());
+  }
+
+ protected:
+  ObjectId AddObject(const std::string& data) {
+    ObjectId id = glue::SHA256Hash(data.data(), data.size());
+    EXPECT_EQ(Status::OK, pack_store_->Append(id, data));
+    return id;
+  }
+
+  // Adds a node with a single entry, pointing to |value_id|, and the given
+  // right child.
+  ObjectId AddNode(const std::string& key,
+                   const ObjectId& value_id,
+                   const ObjectId& right_child_id) {
+    return AddObject(
+        EncodeNode({Entry{key, value_id, KeyPriority::EAGER}},
+                   {"", right_child_id}, {0, kUnknownEntryCount}));
+  }
+
+  // Returns the total size of the segment files of the pack store.
+  uint64_t GetPackStoreSize() {
+    uint64_t size = 0;
+    DIR* dir = opendir(tmp_dir_.path().c_str());
+    EXPECT_NE(nullptr, dir);
+    for (struct dirent* entry = readdir(dir); entry != nullptr;
+         entry = readdir(dir)) {
+      struct stat st;
+      std::string path =
+          ftl::Concatenate({tmp_dir_.path(), "/", entry->d_name});
+      if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+        size += st.st_size;
+      }
+    }
+    closedir(dir);
+    return size;
+  }
+
+  ftl::RefPtr<GarbageCollector> StartCollection(
+      std::vector<ObjectId> root_ids,
+      std::vector<ObjectId> live_object_ids,
+      Status* status,
+      std::vector<CommitId> history_commit_ids = std::vector<CommitId>()) {
+    pack_store_->StartCollection();
+    ftl::RefPtr<GarbageCollector> collector = GarbageCollector::Create(
+        page_storage_.get(), pack_store_.get(), message_loop_.task_runner(),
+        message_loop_.task_runner());
+    collector->Start(
+        std::move(root_ids), std::move(history_commit_ids),
+        std::move(live_object_ids),
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, status));
+    return collector;
+  }
+
+  files::ScopedTempDir tmp_dir_;
+  std::unique_ptr<PackStore> pack_store_;
+  std::unique_ptr<FakePageStorage> page_storage_;
+
+ private:
+  FTL_DISALLOW_COPY_AND_ASSIGN(GarbageCollectorTest);
+};
+
+TEST_F(GarbageCollectorTest, RemoveUnreachableObjects) {
+  ObjectId value1 = AddObject("value1");
+  ObjectId value2 = AddObject("value2");
+  ObjectId value3 = AddObject("value3");
+  ObjectId live_value = AddObject("live value");
+  ObjectId child = AddNode("key2", value2, "");
+  ObjectId root = AddNode("key1", value1, child);
+  ObjectId unreachable_node = AddNode("key3", value3, "");
+
+  Status status;
+  ftl::RefPtr<GarbageCollector> collector =
+      StartCollection({root}, {live_value}, &status);
+  EXPECT_FALSE(RunLoopWithTimeout());
+  pack_store_->EndCollection();
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(2u, collector->removed_object_count());
+
+  for (const ObjectId& id : {value1, value2, live_value, child, root}) {
+    EXPECT_TRUE(pack_store_->Contains(id));
+  }
+  EXPECT_FALSE(pack_store_->Contains(value3));
+  EXPECT_FALSE(pack_store_->Contains(unreachable_node));
+
+  // The removals are durable.
+  pack_store_ = std::make_unique<PackStore>(tmp_dir_.path(), false);
+  ASSERT_EQ(Status::OK, pack_store_->Init());
+  EXPECT_TRUE(pack_store_->Contains(root));
+  EXPECT_FALSE(pack_store_->Contains(unreachable_node));
+}
+
+TEST_F(GarbageCollectorTest, HistoryRoots) {
+  ObjectId value1 = AddObject("value1");
+  ObjectId value2 = AddObject("value2");
+  ObjectId old_value = AddObject("old value");
+  ObjectId child = AddNode("key2", value2, "");
+  ObjectId root = AddNode("key1", value1, child);
+  // An older tree, sharing a node with the current one.
+  ObjectId old_child = AddNode("key3", old_value, child);
+  ObjectId old_root = AddNode("key1", value1, old_child);
+  page_storage_->AddCommit("old commit", old_root);
+
+  Status status;
+  ftl::RefPtr<GarbageCollector> collector = StartCollection(
+      {root}, std::vector<ObjectId>(), &status, {"old commit"});
+  EXPECT_FALSE(RunLoopWithTimeout());
+  pack_store_->EndCollection();
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(1u, collector->removed_object_count());
+
+  // All the nodes are kept, but only the values of the current tree.
+  for (const ObjectId& id :
+       {value1, value2, child, root, old_child, old_root}) {
+    EXPECT_TRUE(pack_store_->Contains(id));
+  }
+  EXPECT_FALSE(pack_store_->Contains(old_value));
+}
+
+TEST_F(GarbageCollectorTest, BypassTreeNodeCache) {
+  ObjectId child = AddNode("key2", AddObject("value2"), "");
+  ObjectId root = AddNode("key1", AddObject("value1"), child);
+  ObjectId old_root = AddNode("key0", AddObject("old value"), child);
+  page_storage_->AddCommit("old commit", old_root);
+
+  Status status;
+  ftl::RefPtr<GarbageCollector> collector = StartCollection(
+      {root}, std::vector<ObjectId>(), &status, {"old commit"});
+  EXPECT_FALSE(RunLoopWithTimeout());
+  pack_store_->EndCollection();
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(1u, collector->removed_object_count());
+
+  // The nodes were read without evicting the ones in use.
+  TreeNodeCache* cache = page_storage_->GetTreeNodeCache();
+  EXPECT_EQ(0u, cache->size());
+  EXPECT_EQ(0u, cache->hit_count());
+  EXPECT_EQ(0u, cache->miss_count());
+}
+
+TEST_F(GarbageCollectorTest, KeepObjectsUsedDuringCollection) {
+  ObjectId value = AddObject("value");
+  ObjectId root = AddNode("key", value, "");
+
+  Status status;
+  ftl::RefPtr<GarbageCollector> collector =
+      StartCollection(std::vector<ObjectId>(), std::vector<ObjectId>(),
+                      &status);
+  // The tree is used after the roots have been computed.
+  EXPECT_TRUE(pack_store_->Contains(root));
+  ObjectId new_value = AddObject("new value");
+  EXPECT_FALSE(RunLoopWithTimeout());
+  pack_store_->EndCollection();
+  EXPECT_EQ(Status::OK, status);
+
+  EXPECT_TRUE(pack_store_->Contains(root));
+  EXPECT_TRUE(pack_store_->Contains(new_value));
+  // The collector does not follow trees it is not given.
+  EXPECT_FALSE(pack_store_->Contains(value));
+}
+
+TEST_F(GarbageCollectorTest, MissingNode) {
+  ObjectId value = AddObject("value");
+  ObjectId child = AddNode("key2", value, "");
+  ObjectId root = AddNode("key1", AddObject("value1"), child);
+  EXPECT_EQ(Status::OK, pack_store_->Remove(root));
+
+  Status status;
+  ftl::RefPtr<GarbageCollector> collector =
+      StartCollection({root}, std::vector<ObjectId>(), &status);
+  EXPECT_FALSE(RunLoopWithTimeout());
+  pack_store_->EndCollection();
+  EXPECT_EQ(Status::OK, status);
+  // The subtree of a missing node is fetched again with it when needed.
+  EXPECT_FALSE(pack_store_->Contains(child));
+  EXPECT_FALSE(pack_store_->Contains(value));
+}
+
+TEST_F(GarbageCollectorTest, BoundedSize) {
+  // Small segments, so that each collection compacts some of them.
+  pack_store_ = std::make_unique<PackStore>(tmp_dir_.path(), false, 64 << 10);
+  ASSERT_EQ(Status::OK, pack_store_->Init());
+  page_storage_ = std::make_unique<FakePageStorage>(pack_store_.get());
+
+  // Each round replaces all the objects of the previous one: the objects and
+  // the tombstones of the removed ones must not accumulate.
+  const size_t kRoundCount = 50;
+  const size_t kObjectCount = 100;
+  uint64_t warm_size = 0;
+  for (size_t round = 0; round < kRoundCount; ++round) {
+    std::vector<ObjectId> live_ids;
+    for (size_t i = 0; i < kObjectCount; ++i) {
+      live_ids.push_back(AddObject(std::to_string(round) + "/" +
+                                   std::to_string(i) + std::string(1000, 'v')));
+    }
+    Status status;
+    ftl::RefPtr<GarbageCollector> collector =
+        StartCollection(std::vector<ObjectId>(), live_ids, &status);
+    EXPECT_FALSE(RunLoopWithTimeout());
+    pack_store_->EndCollection();
+    ASSERT_EQ(Status::OK, status);
+
+    uint64_t size = GetPackStoreSize();
+    if (round == kRoundCount / 5) {
+      warm_size = size;
+    } else if (round > kRoundCount / 5) {
+      EXPECT_LE(size, 2 * warm_size) << "round " << round;
+    }
+  }
+}
+
+TEST_F(GarbageCollectorTest, Cancel) {
+  ObjectId value = AddObject("value");
+
+  Status status = Status::OK;
+  ftl::RefPtr<GarbageCollector> collector = StartCollection(
+      std::vector<ObjectId>(), std::vector<ObjectId>(), &status);
+  collector->Cancel();
+  EXPECT_TRUE(RunLoopWithTimeout(ftl::TimeDelta::FromMilliseconds(100)));
+  pack_store_->EndCollection();
+  EXPECT_TRUE(pack_store_->Contains(value));
+}
+
+}  // namespace
+}  // namespace storage
@@ -0,0 +1,158 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/journal_changes.h"
+
+#include <utility>
+
+#include "lib/ftl/logging.h"
+
+namespace storage {
+
+namespace {
+
+// Approximate memory used by a map node and the strings it holds, besides
+// their contents.
+constexpr size_t kChangeOverhead = 128;
+
+size_t GetChangeSize(const EntryChange& change) {
+  // The key is held both by the map and by the change.
+  return 2 * change.entry.key.size() + change.entry.object_id.size() +
+         kChangeOverhead;
+}
+
+class JournalChangesIterator : public Iterator<const EntryChange> {
+ public:
+  JournalChangesIterator(std::map<std::string, EntryChange>::const_iterator it,
+                         std::map<std::string, EntryChange>::const_iterator end)
+      : it_(it), end_(end) {}
+
+  ~JournalChangesIterator() override {}
+
+  Iterator<const EntryChange>& Next() override {
+    FTL_DCHECK(Valid()) << "Iterator::Next iterator not valid";
+    ++it_;
+    return *this;
+  }
+
+  bool Valid() const override { return it_ != end_; }
+
+  Status GetStatus() const override { return Status::OK; }
+
+  const EntryChange& operator*() const override { return it_->second; }
+  const EntryChange* operator->() const override { return &it_->second; }
+
+ private:
+  std::map<std::string, EntryChange>::const_iterator it_;
+  std::map<std::string, EntryChange>::const_iterator end_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(JournalChangesIterator);
+};
+
+}  // namespace
+
+JournalChanges::JournalChanges(std::shared_ptr<LiveRoots> live_roots)
+    : live_roots_(std::move(live_roots)) {}
+
+JournalChanges::~JournalChanges() {
+  if (live_roots_) {
+    for (const auto& value_counter : value_counters_) {
+      live_roots_->RemoveObject(value_counter.first);
+    }
+  }
+}
+
+void JournalChanges::Put(convert::ExtendedStringView key,
+                         ObjectIdView object_id,
+                         KeyPriority priority) {
+  std::string key_str = key.ToString();
+  auto it = changes_.lower_bound(key_str);
+  if (it != changes_.end() && it->first == key_str) {
+    it = Erase(it);
+  }
+  EntryChange change{Entry{key_str, object_id.ToString(), priority}, false};
+  size_ += GetChangeSize(change);
+  AddValue(change.entry.object_id);
+  changes_.emplace_hint(it, std::move(key_str), std::move(change));
+}
+
+void JournalChanges::Delete(convert::ExtendedStringView key) {
+  std::string key_str = key.ToString();
+  auto it = changes_.lower_bound(key_str);
+  if (it != changes_.end() && it->first == key_str) {
+    it = Erase(it);
+  }
+  EntryChange change{Entry{key_str, "", KeyPriority::EAGER}, true};
+  size_ += GetChangeSize(change);
+  changes_.emplace_hint(it, std::move(key_str), std::move(change));
+}
+
+void JournalChanges::DeleteRange(convert::ExtendedStringView start,
+                                 convert::ExtendedStringView end) {
+  for (auto it = changes_.lower_bound(start.ToString());
+       it != changes_.end() &&
+       (end.empty() || convert::ExtendedStringView(it->first) < end);) {
+    it = Erase(it);
+  }
+
+  // A deletion with the same start as a previous one is merged with it.
+  auto range = deleted_ranges_.find(start.ToString());
+  if (range == deleted_ranges_.end()) {
+    size_ += start.size() + end.size() + kChangeOverhead;
+    deleted_ranges_.emplace(start.ToString(), end.ToString());
+    return;
+  }
+  bool covered = range->second.empty() ||
+                 (!end.empty() && convert::ExtendedStringView(range->second) >=
+                                      end);
+  if (!covered) {
+    size_ += end.size();
+    size_ -= range->second.size();
+    range->second = end.ToString();
+  }
+}
+
+std::unique_ptr<Iterator<const EntryChange>> JournalChanges::GetChanges()
+    const {
+  return std::make_unique<JournalChangesIterator>(changes_.begin(),
+                                                  changes_.end());
+}
+
+std::vector<KeyRange> JournalChanges::GetDeletedRanges() const {
+  std::vector<KeyRange> result;
+  result.reserve(deleted_ranges_.size());
+  for (const auto& range : deleted_ranges_) {
+    result.push_back(KeyRange{range.first, range.second});
+  }
+  return result;
+}
+
+std::map<std::string, EntryChange>::iterator JournalChanges::Erase(
+    std::map<std::string, EntryChange>::iterator it) {
+  size_ -= GetChangeSize(it->second);
+  if (!it->second.deleted) {
+    RemoveValue(it->second.entry.object_id);
+  }
+  return changes_.erase(it);
+}
+
+void JournalChanges::AddValue(const ObjectId& object_id) {
+  if (++value_counters_[object_id] == 1 && live_roots_) {
+    live_roots_->AddObject(object_id);
+  }
+}
+
+void JournalChanges::RemoveValue(const ObjectId& object_id) {
+  auto it = value_counters_.find(object_id);
+  FTL_DCHECK(it != value_counters_.end());
+  if (--it->second > 0) {
+    return;
+  }
+  value_counters_.erase(it);
+  if (live_roots_) {
+    live_roots_->RemoveObject(object_id);
+  }
+}
+
+}  // namespace storage
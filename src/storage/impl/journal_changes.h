@@ -0,0 +1,84 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_JOURNAL_CHANGES_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_JOURNAL_CHANGES_H_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/storage/impl/live_roots.h"
+#include "apps/ledger/src/storage/public/iterator.h"
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+
+// The changes of a journal, kept in memory: the last change of each key,
+// sorted by key, and the deleted ranges, with the same semantics as the
+// journal entries stored in the database.
+//
+// The values referenced by the entries are registered in |live_roots|, if not
+// null, so that they are not collected while the changes are held.
+class JournalChanges {
+ public:
+  explicit JournalChanges(std::shared_ptr<LiveRoots> live_roots);
+  ~JournalChanges();
+
+  // Adds an entry for |key|, replacing the previous change of |key|.
+  void Put(convert::ExtendedStringView key,
+           ObjectIdView object_id,
+           KeyPriority priority);
+
+  // Records the deletion of |key|, replacing the previous change of |key|.
+  void Delete(convert::ExtendedStringView key);
+
+  // Records the deletion of the keys in [|start|, |end|), and drops the
+  // changes of these keys. An empty |end| means that the range has no upper
+  // bound.
+  void DeleteRange(convert::ExtendedStringView start,
+                   convert::ExtendedStringView end);
+
+  // Returns the changes, sorted by key. The iterator is invalidated by any
+  // modification of the changes.
+  std::unique_ptr<Iterator<const EntryChange>> GetChanges() const;
+
+  // Returns the deleted ranges, sorted by start.
+  std::vector<KeyRange> GetDeletedRanges() const;
+
+  // Number of entries referencing each value.
+  const std::unordered_map<ObjectId, int>& value_counters() const {
+    return value_counters_;
+  }
+
+  // Number of changes, not counting the deleted ranges.
+  size_t change_count() const { return changes_.size(); }
+
+  // Approximate memory used by the changes, in bytes.
+  size_t GetSize() const { return size_; }
+
+ private:
+  // Removes the change at |it| and returns the next one.
+  std::map<std::string, EntryChange>::iterator Erase(
+      std::map<std::string, EntryChange>::iterator it);
+  void AddValue(const ObjectId& object_id);
+  void RemoveValue(const ObjectId& object_id);
+
+  const std::shared_ptr<LiveRoots> live_roots_;
+  std::map<std::string, EntryChange> changes_;
+  // Ends of the deleted ranges, by start.
+  std::map<std::string, std::string> deleted_ranges_;
+  std::unordered_map<ObjectId, int> value_counters_;
+  size_t size_ = 0;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(JournalChanges);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_JOURNAL_CHANGES_H_
@@ -0,0 +1,127 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/journal_changes.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+std::vector<std::string> GetKeys(const JournalChanges& changes,
+                                 bool deleted) {
+  std::vector<std::string> keys;
+  for (auto it = changes.GetChanges(); it->Valid(); it->Next()) {
+    if ((*it)->deleted == deleted) {
+      keys.push_back((*it)->entry.key);
+    }
+  }
+  return keys;
+}
+
+std::vector<ObjectId> GetLiveObjects(const LiveRoots& live_roots) {
+  std::vector<ObjectId> objects = live_roots.GetObjects();
+  std::sort(objects.begin(), objects.end());
+  return objects;
+}
+
+TEST(JournalChangesTest, PutAndDelete) {
+  JournalChanges changes(nullptr);
+  changes.Put("key2", "id2", KeyPriority::EAGER);
+  changes.Put("key1", "id1", KeyPriority::LAZY);
+  changes.Delete("key3");
+  changes.Put("key3", "id3", KeyPriority::EAGER);
+  changes.Delete("key2");
+
+  std::unique_ptr<Iterator<const EntryChange>> it = changes.GetChanges();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ((Entry{"key1", "id1", KeyPriority::LAZY}), (*it)->entry);
+  EXPECT_FALSE((*it)->deleted);
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ("key2", (*it)->entry.key);
+  EXPECT_TRUE((*it)->deleted);
+  it->Next();
+  ASSERT_TRUE(it->Valid());
+  EXPECT_EQ((Entry{"key3", "id3", KeyPriority::EAGER}), (*it)->entry);
+  it->Next();
+  EXPECT_FALSE(it->Valid());
+  EXPECT_EQ(Status::OK, it->GetStatus());
+
+  EXPECT_EQ(3u, changes.change_count());
+  EXPECT_EQ(2u, changes.value_counters().size());
+  EXPECT_EQ(0u, changes.value_counters().count("id2"));
+}
+
+TEST(JournalChangesTest, DeleteRange) {
+  JournalChanges changes(nullptr);
+  for (std::string key : {"a", "b", "c", "d", "e"}) {
+    changes.Put(key, "id", KeyPriority::EAGER);
+  }
+  changes.Delete("bb");
+  changes.DeleteRange("b", "d");
+  EXPECT_EQ(std::vector<std::string>({"a", "d", "e"}),
+            GetKeys(changes, false));
+  EXPECT_TRUE(GetKeys(changes, true).empty());
+  EXPECT_EQ(3, changes.value_counters().at("id"));
+
+  // Entries put after the deletion are kept.
+  changes.Put("c", "id", KeyPriority::EAGER);
+  EXPECT_EQ(std::vector<std::string>({"a", "c", "d", "e"}),
+            GetKeys(changes, false));
+
+  // Deletions with the same start are merged.
+  changes.DeleteRange("b", "c");
+  changes.DeleteRange("x", "");
+  std::vector<KeyRange> ranges = changes.GetDeletedRanges();
+  ASSERT_EQ(2u, ranges.size());
+  EXPECT_EQ("b", ranges[0].start);
+  EXPECT_EQ("d", ranges[0].end);
+  EXPECT_EQ("x", ranges[1].start);
+  EXPECT_EQ("", ranges[1].end);
+
+  changes.DeleteRange("b", "");
+  ranges = changes.GetDeletedRanges();
+  ASSERT_EQ(2u, ranges.size());
+  EXPECT_EQ("", ranges[0].end);
+  EXPECT_EQ(std::vector<std::string>({"a"}), GetKeys(changes, false));
+}
+
+TEST(JournalChangesTest, LiveObjects) {
+  auto live_roots = std::make_shared<LiveRoots>();
+  {
+    JournalChanges changes(live_roots);
+    changes.Put("key1", "id1", KeyPriority::EAGER);
+    changes.Put("key2", "id1", KeyPriority::EAGER);
+    changes.Put("key3", "id2", KeyPriority::EAGER);
+    EXPECT_EQ(std::vector<ObjectId>({"id1", "id2"}),
+              GetLiveObjects(*live_roots));
+
+    changes.Put("key3", "id3", KeyPriority::EAGER);
+    changes.Delete("key1");
+    EXPECT_EQ(std::vector<ObjectId>({"id1", "id3"}),
+              GetLiveObjects(*live_roots));
+  }
+  EXPECT_TRUE(live_roots->GetObjects().empty());
+}
+
+TEST(JournalChangesTest, Size) {
+  JournalChanges changes(nullptr);
+  EXPECT_EQ(0u, changes.GetSize());
+  changes.Put("key", "id", KeyPriority::EAGER);
+  size_t size = changes.GetSize();
+  EXPECT_LT(0u, size);
+  changes.Put("key", "id", KeyPriority::LAZY);
+  EXPECT_EQ(size, changes.GetSize());
+  changes.Put(std::string(1000, 'k'), "id", KeyPriority::EAGER);
+  EXPECT_LT(size + 1000, changes.GetSize());
+  changes.DeleteRange("", "");
+  changes.DeleteRange("", "");
+  EXPECT_GT(size, changes.GetSize());
+}
+
+}  // namespace
+}  // namespace storage
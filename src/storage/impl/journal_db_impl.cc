@@ -7,14 +7,29 @@
 #include <functional>
 #include <string>
 
+#include "apps/ledger/src/glue/crypto/hash.h"
 #include "apps/ledger/src/storage/impl/btree/btree_utils.h"
+#include "apps/ledger/src/storage/impl/btree/hash_tree.h"
 #include "apps/ledger/src/storage/impl/commit_impl.h"
+#include "apps/ledger/src/storage/impl/live_roots.h"
 #include "apps/ledger/src/storage/impl/db.h"
 #include "apps/ledger/src/storage/public/commit.h"
 #include "lib/ftl/functional/make_copyable.h"
 
 namespace storage {
 
+namespace {
+
+// Journals with at least one change for every |kEntriesPerChangeForRebuild|
+// entries of the base tree are committed by building a new tree.
+constexpr size_t kEntriesPerChangeForRebuild = 4;
+
+// Changes of EXPLICIT journals using more memory than this are written to the
+// database.
+constexpr size_t kMaxInMemoryJournalSize = 4 * 1024 * 1024;
+
+}  // namespace
+
 JournalDBImpl::JournalDBImpl(JournalType type,
                              PageStorageImpl* page_storage,
                              DB* db,
@@ -26,9 +41,25 @@ JournalDBImpl::JournalDBImpl(JournalType type,
       id_(id),
       base_(base),
       valid_(true),
-      failed_operation_(false) {}
+      failed_operation_(false),
+      live_roots_(page_storage_->GetLiveRoots()) {
+  // The contents of the base commit must not be collected while this journal
+  // is in progress.
+  if (live_roots_) {
+    live_roots_->AddCommit(base_);
+  }
+  if (type_ == JournalType::EXPLICIT) {
+    changes_ = std::make_unique<JournalChanges>(live_roots_);
+  }
+}
 
 JournalDBImpl::~JournalDBImpl() {
+  if (live_roots_) {
+    live_roots_->RemoveCommit(base_);
+    if (other_) {
+      live_roots_->RemoveCommit(*other_);
+    }
+  }
   // Log a warning if the journal was not committed or rolled back.
   if (valid_) {
     FTL_LOG(WARNING) << "Journal not committed or rolled back.";
@@ -52,6 +83,9 @@ std::unique_ptr<Journal> JournalDBImpl::Merge(PageStorageImpl* page_storage,
   JournalDBImpl* db_journal =
       new JournalDBImpl(JournalType::EXPLICIT, page_storage, db, id, base);
   db_journal->other_ = std::make_unique<CommitId>(other);
+  if (db_journal->live_roots_) {
+    db_journal->live_roots_->AddCommit(other);
+  }
   std::unique_ptr<Journal> journal(db_journal);
   return journal;
 }
@@ -78,16 +112,12 @@ Status JournalDBImpl::UpdateValueCounter(
   return s;
 }
 
-Status JournalDBImpl::Put(convert::ExtendedStringView key,
-                          ObjectIdView object_id,
-                          KeyPriority priority) {
-  if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
-    return Status::ILLEGAL_STATE;
-  }
+Status JournalDBImpl::PutInBatch(convert::ExtendedStringView key,
+                                 ObjectIdView object_id,
+                                 KeyPriority priority) {
   std::string prev_id;
   Status prev_entry_status = db_->GetJournalValue(id_, key, &prev_id);
 
-  std::unique_ptr<DB::Batch> batch = db_->StartBatch();
   Status s = db_->AddJournalEntry(id_, key, object_id, priority);
   if (s != Status::OK) {
     failed_operation_ = true;
@@ -97,13 +127,83 @@ Status JournalDBImpl::Put(convert::ExtendedStringView key,
   if (prev_entry_status == Status::OK) {
     UpdateValueCounter(prev_id, [](int counter) { return counter - 1; });
   }
+  return Status::OK;
+}
+
+Status JournalDBImpl::Put(convert::ExtendedStringView key,
+                          ObjectIdView object_id,
+                          KeyPriority priority) {
+  if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
+    return Status::ILLEGAL_STATE;
+  }
+  if (changes_) {
+    changes_->Put(key, object_id, priority);
+    return MaybeWriteChangesToDb();
+  }
+  std::unique_ptr<DB::Batch> batch = db_->StartBatch();
+  Status s = PutInBatch(key, object_id, priority);
+  if (s != Status::OK) {
+    return s;
+  }
   return batch->Execute();
 }
 
+Status JournalDBImpl::PutValue(convert::ExtendedStringView key,
+                               convert::ExtendedStringView value,
+                               KeyPriority priority) {
+  if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
+    return Status::ILLEGAL_STATE;
+  }
+  ObjectId object_id = glue::SHA256Hash(value.data(), value.size());
+  Status object_status = page_storage_->ContainsObject(object_id);
+  if (object_status != Status::OK && object_status != Status::NOT_FOUND) {
+    failed_operation_ = true;
+    return object_status;
+  }
+
+  std::unique_ptr<DB::Batch> batch = db_->StartBatch();
+  bool is_new_object = object_status == Status::NOT_FOUND;
+  if (is_new_object) {
+    // The object is new: store it together with the journal entry. As for
+    // objects added from local, it is untracked until the journal is
+    // committed, and only then marked as unsynced.
+    Status s = db_->AddInlineObject(object_id, value);
+    if (s != Status::OK) {
+      failed_operation_ = true;
+      return s;
+    }
+  }
+  if (!changes_) {
+    Status s = PutInBatch(key, object_id, priority);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  Status s = batch->Execute();
+  if (s != Status::OK) {
+    failed_operation_ = true;
+    return s;
+  }
+  // The object is only known to the storage once it is written.
+  if (is_new_object) {
+    page_storage_->MarkObjectInline(object_id);
+    page_storage_->MarkObjectUntracked(object_id);
+  }
+  if (changes_) {
+    changes_->Put(key, object_id, priority);
+    return MaybeWriteChangesToDb();
+  }
+  return Status::OK;
+}
+
 Status JournalDBImpl::Delete(convert::ExtendedStringView key) {
   if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
     return Status::ILLEGAL_STATE;
   }
+  if (changes_) {
+    changes_->Delete(key);
+    return MaybeWriteChangesToDb();
+  }
   std::string prev_id;
   Status prev_entry_status = db_->GetJournalValue(id_, key, &prev_id);
 
@@ -120,6 +220,28 @@ Status JournalDBImpl::Delete(convert::ExtendedStringView key) {
   return batch->Execute();
 }
 
+Status JournalDBImpl::DeleteRange(convert::ExtendedStringView start,
+                                  convert::ExtendedStringView end) {
+  if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
+    return Status::ILLEGAL_STATE;
+  }
+  if (changes_) {
+    changes_->DeleteRange(start, end);
+    return MaybeWriteChangesToDb();
+  }
+  std::unique_ptr<DB::Batch> batch = db_->StartBatch();
+  std::vector<ObjectId> removed_object_ids;
+  Status s = db_->AddJournalRangeDeletion(id_, start, end, &removed_object_ids);
+  if (s != Status::OK) {
+    failed_operation_ = true;
+    return s;
+  }
+  for (const ObjectId& object_id : removed_object_ids) {
+    UpdateValueCounter(object_id, [](int counter) { return counter - 1; });
+  }
+  return batch->Execute();
+}
+
 void JournalDBImpl::Commit(
     std::function<void(Status, const CommitId&)> callback) {
   if (!valid_ || (type_ == JournalType::EXPLICIT && failed_operation_)) {
@@ -127,7 +249,15 @@ void JournalDBImpl::Commit(
     return;
   }
   std::unique_ptr<Iterator<const EntryChange>> entries;
-  Status status = db_->GetJournalEntries(id_, &entries);
+  Status status = GetChanges(&entries);
+  if (status != Status::OK) {
+    callback(status, "");
+    return;
+  }
+  // Ranges are deleted from the base tree before the entries are applied:
+  // the entries of the journal in a range were all added after its deletion.
+  std::vector<KeyRange> deleted_ranges;
+  status = GetDeletedRanges(&deleted_ranges);
   if (status != Status::OK) {
     callback(status, "");
     return;
@@ -140,90 +270,141 @@ void JournalDBImpl::Commit(
     return;
   }
 
-  size_t node_size;
-  status = db_->GetNodeSize(&node_size);
+  TreeType tree_type;
+  status = db_->GetTreeType(&tree_type);
   if (status != Status::OK) {
     callback(status, "");
     return;
   }
 
-  const ObjectId& base_root_id = base_commit->GetRootId();
-  btree::ApplyChanges(
-      page_storage_, base_root_id, node_size, std::move(entries),
-      ftl::MakeCopyable([
-        this, callback, base_commit = std::move(base_commit)
-      ](Status status, ObjectId object_id,
-        std::unordered_set<ObjectId> new_nodes) mutable {
-        if (status != Status::OK) {
-          callback(status, "");
-          return;
-        }
-
-        std::vector<std::unique_ptr<const storage::Commit>> parents;
-        parents.emplace_back(std::move(base_commit));
-
-        if (other_) {
-          std::unique_ptr<const storage::Commit> other_commit;
-          Status commit_status =
-              page_storage_->GetCommit(*other_, &other_commit);
-          if (commit_status != Status::OK) {
-            callback(commit_status, "");
+  ObjectId base_root_id = base_commit->GetRootId();
+  auto on_done = ftl::MakeCopyable([
+    this, callback, tree_type, base_commit = std::move(base_commit)
+  ](Status status, ObjectId object_id,
+    std::unordered_set<ObjectId> new_nodes) mutable {
+    if (status != Status::OK) {
+      callback(status, "");
+      return;
+    }
+
+    std::vector<std::unique_ptr<const storage::Commit>> parents;
+    parents.emplace_back(std::move(base_commit));
+
+    if (other_) {
+      std::unique_ptr<const storage::Commit> other_commit;
+      Status commit_status = page_storage_->GetCommit(*other_, &other_commit);
+      if (commit_status != Status::OK) {
+        callback(commit_status, "");
+        return;
+      }
+      parents.emplace_back(std::move(other_commit));
+    }
+
+    std::unique_ptr<storage::Commit> commit =
+        CommitImpl::FromContentAndParents(page_storage_, object_id,
+                                          std::move(parents), tree_type);
+    ObjectId id = commit->GetId();
+
+    page_storage_->AddCommitFromLocal(
+        std::move(commit), ftl::MakeCopyable([
+          this, id = std::move(id), new_nodes = std::move(new_nodes),
+          callback
+        ](Status status) mutable {
+          valid_ = false;
+          if (status != Status::OK) {
+            callback(status, "");
             return;
           }
-          parents.emplace_back(std::move(other_commit));
-        }
-
-        std::unique_ptr<storage::Commit> commit =
-            CommitImpl::FromContentAndParents(page_storage_, object_id,
-                                              std::move(parents));
-        ObjectId id = commit->GetId();
-
-        page_storage_->AddCommitFromLocal(
-            std::move(commit), ftl::MakeCopyable([
-              this, id = std::move(id), new_nodes = std::move(new_nodes),
-              callback
-            ](Status status) mutable {
-              valid_ = false;
-              if (status != Status::OK) {
-                callback(status, "");
-                return;
-              }
-              // Mark objects as unsynced.
-              std::vector<ObjectId> objects_to_sync;
-              status = db_->GetJournalValues(id_, &objects_to_sync);
-              if (status != Status::OK) {
-                callback(status, "");
-                return;
-              }
-              // Mark unsynced objects in a single batch.
-              std::unique_ptr<DB::Batch> batch = db_->StartBatch();
-              for (const ObjectId& tree_node_id : new_nodes) {
-                status = db_->MarkObjectIdUnsynced(tree_node_id);
-                if (status != Status::OK) {
-                  callback(status, "");
-                  return;
-                }
-              }
-              for (const ObjectId& object_id : objects_to_sync) {
-                status = db_->MarkObjectIdUnsynced(object_id);
-                if (status != Status::OK) {
-                  callback(status, "");
-                  return;
-                }
-              }
-              status = batch->Execute();
-              if (status != Status::OK) {
-                callback(status, "");
-                return;
-              }
-              // Notify PageStorage that the objects are now tracked.
-              for (const ObjectId& object_id : objects_to_sync) {
-                page_storage_->MarkObjectTracked(object_id);
-              }
-              db_->RemoveJournal(id_);
-              callback(Status::OK, id);
-            }));
-      }));
+          // Mark objects as unsynced.
+          std::vector<ObjectId> objects_to_sync;
+          status = GetUntrackedValues(&objects_to_sync);
+          if (status != Status::OK) {
+            callback(status, "");
+            return;
+          }
+          // Mark unsynced objects in a single batch.
+          std::unique_ptr<DB::Batch> batch = db_->StartBatch();
+          for (const ObjectId& tree_node_id : new_nodes) {
+            status = db_->MarkObjectIdUnsynced(tree_node_id);
+            if (status != Status::OK) {
+              callback(status, "");
+              return;
+            }
+          }
+          for (const ObjectId& object_id : objects_to_sync) {
+            status = db_->MarkObjectIdUnsynced(object_id);
+            if (status != Status::OK) {
+              callback(status, "");
+              return;
+            }
+          }
+          status = batch->Execute();
+          if (status != Status::OK) {
+            callback(status, "");
+            return;
+          }
+          // Notify PageStorage that the objects are now tracked.
+          for (const ObjectId& object_id : objects_to_sync) {
+            page_storage_->MarkObjectTracked(object_id);
+          }
+          db_->RemoveJournal(id_);
+          changes_.reset();
+          callback(Status::OK, id);
+        }));
+  });
+
+  if (tree_type == TreeType::HASH_TREE) {
+    hash_tree::ApplyChanges(page_storage_, base_root_id,
+                            std::move(deleted_ranges), std::move(entries),
+                            std::move(on_done));
+    return;
+  }
+
+  size_t node_size;
+  status = db_->GetNodeSize(&node_size);
+  if (status != Status::OK) {
+    callback(status, "");
+    return;
+  }
+  bool rebuild;
+  status = ShouldRebuildTree(base_root_id, &rebuild);
+  if (status != Status::OK) {
+    callback(status, "");
+    return;
+  }
+  if (rebuild) {
+    btree::ApplyChangesByRebuilding(page_storage_, base_root_id, node_size,
+                                    std::move(deleted_ranges),
+                                    std::move(entries), std::move(on_done));
+    return;
+  }
+  btree::ApplyChanges(page_storage_, base_root_id, node_size,
+                      std::move(deleted_ranges), std::move(entries),
+                      std::move(on_done));
+}
+
+Status JournalDBImpl::ShouldRebuildTree(ObjectIdView base_root_id,
+                                        bool* rebuild) {
+  size_t entry_count;
+  Status status =
+      btree::EstimateEntryCount(page_storage_, base_root_id, &entry_count);
+  if (status != Status::OK) {
+    return status;
+  }
+  // Only count the changes up to the threshold, as the journal may be large.
+  size_t min_change_count = entry_count / kEntriesPerChangeForRebuild + 1;
+  std::unique_ptr<Iterator<const EntryChange>> changes;
+  status = GetChanges(&changes);
+  if (status != Status::OK) {
+    return status;
+  }
+  size_t change_count = 0;
+  for (; changes->Valid() && change_count < min_change_count;
+       changes->Next()) {
+    ++change_count;
+  }
+  *rebuild = change_count == min_change_count;
+  return changes->GetStatus();
 }
 
 Status JournalDBImpl::Rollback() {
@@ -233,8 +414,88 @@ Status JournalDBImpl::Rollback() {
   Status s = db_->RemoveJournal(id_);
   if (s == Status::OK) {
     valid_ = false;
+    changes_.reset();
   }
   return s;
 }
 
+Status JournalDBImpl::MaybeWriteChangesToDb() {
+  if (!changes_ || changes_->GetSize() <= kMaxInMemoryJournalSize) {
+    return Status::OK;
+  }
+  std::unique_ptr<DB::Batch> batch = db_->StartBatch();
+  // The ranges are written first: they only drop the entries already written,
+  // and the entries in memory were all added after the ranges.
+  for (const KeyRange& range : changes_->GetDeletedRanges()) {
+    std::vector<ObjectId> removed_object_ids;
+    Status s = db_->AddJournalRangeDeletion(id_, range.start, range.end,
+                                            &removed_object_ids);
+    if (s != Status::OK) {
+      failed_operation_ = true;
+      return s;
+    }
+  }
+  for (auto it = changes_->GetChanges(); it->Valid(); it->Next()) {
+    const EntryChange& change = **it;
+    Status s = change.deleted
+                   ? db_->RemoveJournalEntry(id_, change.entry.key)
+                   : db_->AddJournalEntry(id_, change.entry.key,
+                                          change.entry.object_id,
+                                          change.entry.priority);
+    if (s != Status::OK) {
+      failed_operation_ = true;
+      return s;
+    }
+  }
+  for (const auto& value_counter : changes_->value_counters()) {
+    if (!page_storage_->ObjectIsUntracked(value_counter.first)) {
+      continue;
+    }
+    Status s = db_->SetJournalValueCounter(id_, value_counter.first,
+                                           value_counter.second);
+    if (s != Status::OK) {
+      failed_operation_ = true;
+      return s;
+    }
+  }
+  Status s = batch->Execute();
+  if (s != Status::OK) {
+    failed_operation_ = true;
+    return s;
+  }
+  changes_.reset();
+  return Status::OK;
+}
+
+Status JournalDBImpl::GetChanges(
+    std::unique_ptr<Iterator<const EntryChange>>* changes) {
+  if (changes_) {
+    *changes = changes_->GetChanges();
+    return Status::OK;
+  }
+  return db_->GetJournalEntries(id_, changes);
+}
+
+Status JournalDBImpl::GetDeletedRanges(std::vector<KeyRange>* ranges) {
+  if (changes_) {
+    *ranges = changes_->GetDeletedRanges();
+    return Status::OK;
+  }
+  return db_->GetJournalRangeDeletions(id_, ranges);
+}
+
+Status JournalDBImpl::GetUntrackedValues(std::vector<ObjectId>* object_ids) {
+  if (!changes_) {
+    return db_->GetJournalValues(id_, object_ids);
+  }
+  std::vector<ObjectId> result;
+  for (const auto& value_counter : changes_->value_counters()) {
+    if (page_storage_->ObjectIsUntracked(value_counter.first)) {
+      result.push_back(value_counter.first);
+    }
+  }
+  object_ids->swap(result);
+  return Status::OK;
+}
+
 }  // namespace storage
@@ -11,8 +11,10 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #include "apps/ledger/src/storage/impl/db.h"
+#include "apps/ledger/src/storage/impl/journal_changes.h"
 #include "apps/ledger/src/storage/impl/page_storage_impl.h"
 #include "apps/ledger/src/storage/public/types.h"
 #include "lib/ftl/macros.h"
@@ -20,6 +22,10 @@
 namespace storage {
 
 // A |JournalDBImpl| represents a commit in progress.
+//
+// The changes of EXPLICIT journals, which do not survive a restart, are kept
+// in memory, and only written to the database if they grow too large. The
+// changes of IMPLICIT journals are written to the database as they are made.
 class JournalDBImpl : public Journal {
  public:
   ~JournalDBImpl() override;
@@ -45,7 +51,12 @@ class JournalDBImpl : public Journal {
   Status Put(convert::ExtendedStringView key,
              ObjectIdView object_id,
              KeyPriority priority) override;
+  Status PutValue(convert::ExtendedStringView key,
+                  convert::ExtendedStringView value,
+                  KeyPriority priority) override;
   Status Delete(convert::ExtendedStringView key) override;
+  Status DeleteRange(convert::ExtendedStringView start,
+                     convert::ExtendedStringView end) override;
   void Commit(std::function<void(Status, const CommitId&)> callback) override;
   Status Rollback() override;
 
@@ -56,8 +67,25 @@ class JournalDBImpl : public Journal {
                 const JournalId& id,
                 const CommitId& base);
 
+  // Adds the journal entry for |key| in the current batch and updates the
+  // value counters accordingly.
+  Status PutInBatch(convert::ExtendedStringView key,
+                    ObjectIdView object_id,
+                    KeyPriority priority);
   Status UpdateValueCounter(ObjectIdView object_id,
                             const std::function<int(int)>& operation);
+  // Writes the changes held in memory to the database, if they have grown
+  // beyond the memory threshold. The journal then uses the database for its
+  // next changes.
+  Status MaybeWriteChangesToDb();
+  Status GetChanges(std::unique_ptr<Iterator<const EntryChange>>* changes);
+  Status GetDeletedRanges(std::vector<KeyRange>* ranges);
+  // Returns the ids of the untracked values of the entries of the journal.
+  Status GetUntrackedValues(std::vector<ObjectId>* object_ids);
+  // Sets |rebuild| to whether the changes of this journal are numerous enough,
+  // relative to the size of the tree with the given root, for the new tree to
+  // be built from scratch rather than by mutating the existing one.
+  Status ShouldRebuildTree(ObjectIdView base_root_id, bool* rebuild);
 
   const JournalType type_;
   PageStorageImpl* const page_storage_;
@@ -73,6 +101,9 @@ class JournalDBImpl : public Journal {
   // other than rolling back will fail. IMPLICIT journals can still be commited
   // even if some operations have failed.
   bool failed_operation_;
+  std::shared_ptr<LiveRoots> live_roots_;
+  // The changes of the journal, while they are kept in memory.
+  std::unique_ptr<JournalChanges> changes_;
 };
 
 }  // namespace storage
@@ -0,0 +1,91 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/live_roots.h"
+
+#include "lib/ftl/logging.h"
+
+namespace storage {
+
+namespace {
+
+void Increment(std::unordered_map<std::string, size_t>* counts,
+               ftl::StringView id) {
+  ++(*counts)[id.ToString()];
+}
+
+void Decrement(std::unordered_map<std::string, size_t>* counts,
+               ftl::StringView id) {
+  auto it = counts->find(id.ToString());
+  FTL_DCHECK(it != counts->end());
+  if (it == counts->end()) {
+    return;
+  }
+  if (--it->second == 0) {
+    counts->erase(it);
+  }
+}
+
+std::vector<std::string> GetKeys(
+    const std::unordered_map<std::string, size_t>& counts) {
+  std::vector<std::string> result;
+  result.reserve(counts.size());
+  for (const auto& count : counts) {
+    result.push_back(count.first);
+  }
+  return result;
+}
+
+}  // namespace
+
+LiveRoots::LiveRoots() {}
+
+LiveRoots::~LiveRoots() {}
+
+void LiveRoots::AddRoot(ObjectIdView root_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Increment(&roots_, root_id);
+}
+
+void LiveRoots::RemoveRoot(ObjectIdView root_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Decrement(&roots_, root_id);
+}
+
+void LiveRoots::AddCommit(CommitIdView commit_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Increment(&commits_, commit_id);
+}
+
+void LiveRoots::RemoveCommit(CommitIdView commit_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Decrement(&commits_, commit_id);
+}
+
+void LiveRoots::AddObject(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Increment(&objects_, object_id);
+}
+
+void LiveRoots::RemoveObject(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Decrement(&objects_, object_id);
+}
+
+std::vector<ObjectId> LiveRoots::GetRoots() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetKeys(roots_);
+}
+
+std::vector<CommitId> LiveRoots::GetCommits() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetKeys(commits_);
+}
+
+std::vector<ObjectId> LiveRoots::GetObjects() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetKeys(objects_);
+}
+
+}  // namespace storage
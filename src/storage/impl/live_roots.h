@@ -0,0 +1,57 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_LIVE_ROOTS_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_LIVE_ROOTS_H_
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+
+// The roots of the trees currently in use in memory. The garbage collector
+// must keep these trees even if their commits are no longer heads. Commit
+// objects, e.g. held by watchers, and commit contents, e.g. held by snapshots,
+// register their root node.
+// Journals register the commits they are based on, as they only know their ids,
+// and journals kept in memory register the values of their entries. The same
+// id can be added several times, and is live until it is removed as many
+// times.
+//
+// This class is thread safe.
+class LiveRoots {
+ public:
+  LiveRoots();
+  ~LiveRoots();
+
+  void AddRoot(ObjectIdView root_id);
+  void RemoveRoot(ObjectIdView root_id);
+
+  void AddCommit(CommitIdView commit_id);
+  void RemoveCommit(CommitIdView commit_id);
+
+  void AddObject(ObjectIdView object_id);
+  void RemoveObject(ObjectIdView object_id);
+
+  // Returns the ids of the live root nodes, respectively commits and objects.
+  std::vector<ObjectId> GetRoots() const;
+  std::vector<CommitId> GetCommits() const;
+  std::vector<ObjectId> GetObjects() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<ObjectId, size_t> roots_;
+  std::unordered_map<CommitId, size_t> commits_;
+  std::unordered_map<ObjectId, size_t> objects_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(LiveRoots);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_LIVE_ROOTS_H_
@@ -0,0 +1,68 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/live_roots.h"
+
+#include <algorithm>
+
+#include "gtest/gtest.h"
+
+namespace storage {
+namespace {
+
+std::vector<std::string> Sorted(std::vector<std::string> ids) {
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+TEST(LiveRootsTest, AddAndRemove) {
+  LiveRoots live_roots;
+  EXPECT_TRUE(live_roots.GetRoots().empty());
+  EXPECT_TRUE(live_roots.GetCommits().empty());
+
+  live_roots.AddRoot("root1");
+  live_roots.AddRoot("root2");
+  live_roots.AddCommit("commit");
+  EXPECT_EQ(std::vector<ObjectId>({"root1", "root2"}),
+            Sorted(live_roots.GetRoots()));
+  EXPECT_EQ(std::vector<CommitId>({"commit"}), live_roots.GetCommits());
+
+  live_roots.RemoveRoot("root1");
+  EXPECT_EQ(std::vector<ObjectId>({"root2"}), live_roots.GetRoots());
+  live_roots.RemoveRoot("root2");
+  live_roots.RemoveCommit("commit");
+  EXPECT_TRUE(live_roots.GetRoots().empty());
+  EXPECT_TRUE(live_roots.GetCommits().empty());
+}
+
+TEST(LiveRootsTest, SameRootAddedTwice) {
+  LiveRoots live_roots;
+  live_roots.AddRoot("root");
+  live_roots.AddRoot("root");
+  EXPECT_EQ(std::vector<ObjectId>({"root"}), live_roots.GetRoots());
+
+  live_roots.RemoveRoot("root");
+  EXPECT_EQ(std::vector<ObjectId>({"root"}), live_roots.GetRoots());
+  live_roots.RemoveRoot("root");
+  EXPECT_TRUE(live_roots.GetRoots().empty());
+}
+
+TEST(LiveRootsTest, Objects) {
+  LiveRoots live_roots;
+  live_roots.AddObject("object1");
+  live_roots.AddObject("object2");
+  live_roots.AddObject("object2");
+  EXPECT_EQ(std::vector<ObjectId>({"object1", "object2"}),
+            Sorted(live_roots.GetObjects()));
+  EXPECT_TRUE(live_roots.GetRoots().empty());
+
+  live_roots.RemoveObject("object1");
+  live_roots.RemoveObject("object2");
+  EXPECT_EQ(std::vector<ObjectId>({"object2"}), live_roots.GetObjects());
+  live_roots.RemoveObject("object2");
+  EXPECT_TRUE(live_roots.GetObjects().empty());
+}
+
+}  // namespace
+}  // namespace storage
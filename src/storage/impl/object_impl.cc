@@ -5,18 +5,24 @@
 #include "apps/ledger/src/storage/impl/object_impl.h"
 
 #include <fcntl.h>
-#include <sys/mman.h>
 #include <unistd.h>
 
-#include <vector>
-
-#include "lib/ftl/files/file.h"
+#include "apps/tracing/lib/trace/event.h"
+#include "lib/ftl/files/eintr_wrapper.h"
+#include "lib/ftl/files/unique_fd.h"
 #include "lib/ftl/logging.h"
+#include "lib/ftl/time/time_point.h"
 
 namespace storage {
 
-ObjectImpl::ObjectImpl(ObjectId id, std::string file_path)
-    : id_(id), file_path_(file_path) {}
+ObjectImpl::ObjectImpl(ObjectId id,
+                       std::shared_ptr<SegmentFile> segment,
+                       uint64_t offset,
+                       uint64_t size)
+    : id_(std::move(id)),
+      segment_(std::move(segment)),
+      offset_(offset),
+      size_(size) {}
 
 ObjectImpl::~ObjectImpl() {}
 
@@ -25,16 +31,181 @@ ObjectId ObjectImpl::GetId() const {
 }
 
 Status ObjectImpl::GetData(ftl::StringView* data) const {
-  if (data_.empty()) {
-    std::string res;
-    // TODO(nellyv): Replace with mmap when supported.
-    if (!files::ReadFileToString(file_path_.data(), &res)) {
+  if (!loaded_) {
+    if (segment_->GetData(offset_, size_, &view_, &mapping_) != Status::OK) {
+      Status s = ReadData();
+      if (s != Status::OK) {
+        return s;
+      }
+      view_ = data_;
+    }
+    loaded_ = true;
+  }
+  *data = view_;
+  return Status::OK;
+}
+
+Status ObjectImpl::GetSize(uint64_t* size) const {
+  *size = size_;
+  return Status::OK;
+}
+
+Status ObjectImpl::ReadData() const {
+  std::string res;
+  res.resize(size_);
+  ftl::UniqueFD fd(open(segment_->path().c_str(), O_RDONLY));
+  if (!fd.is_valid()) {
+    FTL_LOG(ERROR) << "Unable to open " << segment_->path();
+    return Status::INTERNAL_IO_ERROR;
+  }
+  size_t read_bytes = 0;
+  while (read_bytes < size_) {
+    ssize_t result =
+        HANDLE_EINTR(pread(fd.get(), &res[read_bytes], size_ - read_bytes,
+                           offset_ + read_bytes));
+    if (result <= 0) {
+      FTL_LOG(ERROR) << "Unable to read object data from " << segment_->path();
       return Status::INTERNAL_IO_ERROR;
     }
+    read_bytes += result;
+  }
+  data_.swap(res);
+  return Status::OK;
+}
+
+InlineObjectImpl::InlineObjectImpl(ObjectId id, std::string data)
+    : id_(std::move(id)), data_(std::move(data)) {}
+
+InlineObjectImpl::~InlineObjectImpl() {}
+
+ObjectId InlineObjectImpl::GetId() const {
+  return id_;
+}
+
+Status InlineObjectImpl::GetData(ftl::StringView* data) const {
+  *data = data_;
+  return Status::OK;
+}
+
+CompressedObjectImpl::CompressedObjectImpl(
+    ObjectId id,
+    std::unique_ptr<const Object> stored,
+    std::shared_ptr<CompressionStats> stats)
+    : id_(std::move(id)), stored_(std::move(stored)), stats_(std::move(stats)) {}
+
+CompressedObjectImpl::~CompressedObjectImpl() {}
+
+ObjectId CompressedObjectImpl::GetId() const {
+  return id_;
+}
+
+Status CompressedObjectImpl::GetData(ftl::StringView* data) const {
+  if (!loaded_) {
+    ftl::StringView compressed;
+    Status s = stored_->GetData(&compressed);
+    if (s != Status::OK) {
+      return s;
+    }
+    TRACE_DURATION("storage", "decompress_object", "size", compressed.size());
+    ftl::TimePoint start = ftl::TimePoint::Now();
+    if (!Decompress(compressed, &data_)) {
+      FTL_LOG(ERROR) << "Unable to decompress object data.";
+      return Status::FORMAT_ERROR;
+    }
+    stats_->RecordDecompression(ftl::TimePoint::Now() - start);
+    loaded_ = true;
+  }
+  *data = data_;
+  return Status::OK;
+}
+
+Status CompressedObjectImpl::GetSize(uint64_t* size) const {
+  std::string header;
+  Status s = stored_->GetPartialData(0, kCompressedHeaderSize, &header);
+  if (s != Status::OK) {
+    return s;
+  }
+  if (!GetDecompressedSize(header, size)) {
+    return Status::FORMAT_ERROR;
+  }
+  return Status::OK;
+}
+
+ChunkedObjectImpl::ChunkedObjectImpl(
+    ObjectId id,
+    std::vector<std::unique_ptr<const Object>> chunks)
+    : id_(std::move(id)), chunks_(std::move(chunks)) {}
+
+ChunkedObjectImpl::~ChunkedObjectImpl() {}
+
+ObjectId ChunkedObjectImpl::GetId() const {
+  return id_;
+}
+
+Status ChunkedObjectImpl::GetData(ftl::StringView* data) const {
+  if (!loaded_) {
+    std::string res;
+    for (const auto& chunk : chunks_) {
+      ftl::StringView chunk_data;
+      Status s = chunk->GetData(&chunk_data);
+      if (s != Status::OK) {
+        return s;
+      }
+      res.append(chunk_data.data(), chunk_data.size());
+    }
     data_.swap(res);
+    loaded_ = true;
   }
   *data = data_;
   return Status::OK;
 }
 
+Status ChunkedObjectImpl::GetSize(uint64_t* size) const {
+  uint64_t total = 0;
+  for (const auto& chunk : chunks_) {
+    uint64_t chunk_size;
+    Status s = chunk->GetSize(&chunk_size);
+    if (s != Status::OK) {
+      return s;
+    }
+    total += chunk_size;
+  }
+  *size = total;
+  return Status::OK;
+}
+
+Status ChunkedObjectImpl::GetPartialDataViews(
+    uint64_t offset,
+    uint64_t max_size,
+    std::vector<ftl::StringView>* parts) const {
+  parts->clear();
+  uint64_t size = 0;
+  uint64_t chunk_start = 0;
+  for (const auto& chunk : chunks_) {
+    if (size >= max_size) {
+      break;
+    }
+    uint64_t chunk_size;
+    Status s = chunk->GetSize(&chunk_size);
+    if (s != Status::OK) {
+      return s;
+    }
+    uint64_t chunk_end = chunk_start + chunk_size;
+    if (chunk_end > offset) {
+      uint64_t start = offset > chunk_start ? offset - chunk_start : 0;
+      std::vector<ftl::StringView> chunk_parts;
+      s = chunk->GetPartialDataViews(start, max_size - size, &chunk_parts);
+      if (s != Status::OK) {
+        return s;
+      }
+      for (ftl::StringView part : chunk_parts) {
+        size += part.size();
+        parts->push_back(part);
+      }
+    }
+    chunk_start = chunk_end;
+  }
+  return Status::OK;
+}
+
 }  // namespace storage
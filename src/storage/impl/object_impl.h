@@ -7,23 +7,110 @@
 
 #include "apps/ledger/src/storage/public/object.h"
 
+#include <memory>
+#include <string>
 #include <vector>
 
+#include "apps/ledger/src/storage/impl/compression.h"
+#include "apps/ledger/src/storage/impl/segment_file.h"
+
 namespace storage {
 
+// An |Object| whose data is stored at |offset| in the given |segment|. The data
+// is accessed through the memory mapping of the segment when possible.
 class ObjectImpl : public Object {
  public:
-  ObjectImpl(ObjectId id, std::string file_path);
+  ObjectImpl(ObjectId id,
+             std::shared_ptr<SegmentFile> segment,
+             uint64_t offset,
+             uint64_t size);
   ~ObjectImpl() override;
 
   // Object:
   ObjectId GetId() const override;
   Status GetData(ftl::StringView* data) const override;
+  Status GetSize(uint64_t* size) const override;
+
+ private:
+  Status ReadData() const;
+
+  const ObjectId id_;
+  const std::shared_ptr<SegmentFile> segment_;
+  const uint64_t offset_;
+  const uint64_t size_;
+
+  mutable bool loaded_ = false;
+  mutable ftl::StringView view_;
+  // The mapping of the segment backing |view_|, if any.
+  mutable std::shared_ptr<const SegmentFile::Mapping> mapping_;
+  // Only used if the segment cannot be mapped.
+  mutable std::string data_;
+};
+
+// An |Object| whose data is held in memory. Used for small objects that are
+// stored inline in the page database.
+class InlineObjectImpl : public Object {
+ public:
+  InlineObjectImpl(ObjectId id, std::string data);
+  ~InlineObjectImpl() override;
+
+  // Object:
+  ObjectId GetId() const override;
+  Status GetData(ftl::StringView* data) const override;
+
+ private:
+  const ObjectId id_;
+  const std::string data_;
+};
+
+// An |Object| whose data is the decompressed data of the |stored| object. The
+// data is decompressed on first access, and the time spent doing so is
+// recorded in |stats|.
+class CompressedObjectImpl : public Object {
+ public:
+  CompressedObjectImpl(ObjectId id,
+                       std::unique_ptr<const Object> stored,
+                       std::shared_ptr<CompressionStats> stats);
+  ~CompressedObjectImpl() override;
+
+  // Object:
+  ObjectId GetId() const override;
+  Status GetData(ftl::StringView* data) const override;
+  Status GetSize(uint64_t* size) const override;
+
+ private:
+  const ObjectId id_;
+  const std::unique_ptr<const Object> stored_;
+  const std::shared_ptr<CompressionStats> stats_;
+
+  mutable bool loaded_ = false;
+  mutable std::string data_;
+};
+
+// An |Object| whose data is the concatenation of the data of its |chunks|.
+// The whole data is only assembled if requested by |GetData()|: partial reads
+// only access the chunks covering the requested range, and return views of
+// their data.
+class ChunkedObjectImpl : public Object {
+ public:
+  ChunkedObjectImpl(ObjectId id,
+                    std::vector<std::unique_ptr<const Object>> chunks);
+  ~ChunkedObjectImpl() override;
+
+  // Object:
+  ObjectId GetId() const override;
+  Status GetData(ftl::StringView* data) const override;
+  Status GetSize(uint64_t* size) const override;
+  Status GetPartialDataViews(
+      uint64_t offset,
+      uint64_t max_size,
+      std::vector<ftl::StringView>* parts) const override;
 
  private:
   const ObjectId id_;
-  const std::string file_path_;
+  const std::vector<std::unique_ptr<const Object>> chunks_;
 
+  mutable bool loaded_ = false;
   mutable std::string data_;
 };
 
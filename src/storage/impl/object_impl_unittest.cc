@@ -4,6 +4,8 @@
 
 #include "apps/ledger/src/storage/impl/object_impl.h"
 
+#include <fcntl.h>
+
 #include <algorithm>
 #include <memory>
 
@@ -11,7 +13,9 @@
 #include "apps/ledger/src/glue/crypto/rand.h"
 #include "gtest/gtest.h"
 #include "lib/ftl/files/file.h"
+#include "lib/ftl/files/file_descriptor.h"
 #include "lib/ftl/files/scoped_temp_dir.h"
+#include "lib/ftl/files/unique_fd.h"
 #include "lib/ftl/logging.h"
 
 namespace storage {
@@ -61,7 +65,9 @@ TEST_F(ObjectTest, Object) {
   std::string data = RandomString(kFileSize);
   EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
 
-  ObjectImpl object((std::string(object_id_)), std::string(object_file_path_));
+  ObjectImpl object((std::string(object_id_)),
+                    std::make_shared<SegmentFile>(object_file_path_), 0,
+                    kFileSize);
   EXPECT_EQ(object_id_, object.GetId());
   ftl::StringView found_data;
   EXPECT_EQ(Status::OK, object.GetData(&found_data));
@@ -69,5 +75,189 @@ TEST_F(ObjectTest, Object) {
   EXPECT_EQ(0, memcmp(data.data(), found_data.data(), kFileSize));
 }
 
+TEST_F(ObjectTest, ObjectAtOffset) {
+  std::string data = RandomString(kFileSize);
+  EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
+
+  const size_t offset = 16;
+  const size_t size = 64;
+  ObjectImpl object((std::string(object_id_)),
+                    std::make_shared<SegmentFile>(object_file_path_), offset,
+                    size);
+  ftl::StringView found_data;
+  EXPECT_EQ(Status::OK, object.GetData(&found_data));
+  EXPECT_EQ(data.substr(offset, size), found_data.ToString());
+}
+
+TEST_F(ObjectTest, ObjectOutOfBounds) {
+  std::string data = RandomString(kFileSize);
+  EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
+
+  ObjectImpl object((std::string(object_id_)),
+                    std::make_shared<SegmentFile>(object_file_path_),
+                    kFileSize - 1, 2);
+  ftl::StringView found_data;
+  EXPECT_EQ(Status::INTERNAL_IO_ERROR, object.GetData(&found_data));
+}
+
+TEST_F(ObjectTest, SharedMapping) {
+  std::string data = RandomString(kFileSize);
+  EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
+
+  auto segment = std::make_shared<SegmentFile>(object_file_path_);
+  ObjectImpl object1((std::string(object_id_)), segment, 0, kFileSize / 2);
+  ObjectImpl object2((std::string(object_id_)), segment, kFileSize / 2,
+                     kFileSize / 2);
+  ftl::StringView data1;
+  ftl::StringView data2;
+  EXPECT_EQ(Status::OK, object1.GetData(&data1));
+  EXPECT_EQ(Status::OK, object2.GetData(&data2));
+  EXPECT_EQ(data, data1.ToString() + data2.ToString());
+  // Both objects are backed by the same mapping.
+  EXPECT_EQ(data1.data() + kFileSize / 2, data2.data());
+}
+
+TEST_F(ObjectTest, GrowingSegment) {
+  std::string data = RandomString(kFileSize);
+  EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
+
+  auto segment = std::make_shared<SegmentFile>(object_file_path_);
+  ObjectImpl object1((std::string(object_id_)), segment, 0, kFileSize);
+  ftl::StringView data1;
+  EXPECT_EQ(Status::OK, object1.GetData(&data1));
+
+  // Append to the file, as the pack store does for the active segment.
+  std::string more_data = RandomString(kFileSize);
+  ftl::UniqueFD fd(open(object_file_path_.c_str(), O_WRONLY | O_APPEND));
+  EXPECT_TRUE(
+      ftl::WriteFileDescriptor(fd.get(), more_data.data(), more_data.size()));
+  ObjectImpl object2((std::string(object_id_)), segment, kFileSize,
+                     kFileSize);
+  ftl::StringView data2;
+  EXPECT_EQ(Status::OK, object2.GetData(&data2));
+  EXPECT_EQ(more_data, data2.ToString());
+  // Views of previous objects are still valid.
+  EXPECT_EQ(data, data1.ToString());
+}
+
+TEST_F(ObjectTest, PreviousMappingReleased) {
+  std::string data = RandomString(kFileSize);
+  EXPECT_TRUE(files::WriteFile(object_file_path_, data.data(), kFileSize));
+
+  SegmentFile segment(object_file_path_);
+  ftl::StringView data1;
+  std::shared_ptr<const SegmentFile::Mapping> mapping1;
+  EXPECT_EQ(Status::OK, segment.GetData(0, kFileSize, &data1, &mapping1));
+
+  // Grow the file past the current mapping, so that it is mapped again.
+  std::string more_data = RandomString(2 * kFileSize);
+  ftl::UniqueFD fd(open(object_file_path_.c_str(), O_WRONLY | O_APPEND));
+  EXPECT_TRUE(
+      ftl::WriteFileDescriptor(fd.get(), more_data.data(), more_data.size()));
+  ftl::StringView data2;
+  std::shared_ptr<const SegmentFile::Mapping> mapping2;
+  EXPECT_EQ(Status::OK,
+            segment.GetData(kFileSize, 2 * kFileSize, &data2, &mapping2));
+  EXPECT_NE(mapping1, mapping2);
+  EXPECT_EQ(more_data, data2.ToString());
+
+  // The previous mapping is only kept by its last user.
+  EXPECT_EQ(data, data1.ToString());
+  std::weak_ptr<const SegmentFile::Mapping> previous_mapping = mapping1;
+  mapping1.reset();
+  EXPECT_TRUE(previous_mapping.expired());
+}
+
+TEST_F(ObjectTest, InlineObject) {
+  std::string data = RandomString(kFileSize);
+
+  InlineObjectImpl object((std::string(object_id_)), std::string(data));
+  EXPECT_EQ(object_id_, object.GetId());
+  ftl::StringView found_data;
+  EXPECT_EQ(Status::OK, object.GetData(&found_data));
+  EXPECT_EQ(data, found_data.ToString());
+}
+
+TEST_F(ObjectTest, CompressedObject) {
+  std::string data(kFileSize, 'a');
+  std::string compressed;
+  ASSERT_TRUE(Compress(data, &compressed));
+  auto stats = std::make_shared<CompressionStats>();
+
+  CompressedObjectImpl object(
+      (std::string(object_id_)),
+      std::make_unique<InlineObjectImpl>(RandomString(32), compressed), stats);
+  EXPECT_EQ(object_id_, object.GetId());
+  uint64_t size;
+  EXPECT_EQ(Status::OK, object.GetSize(&size));
+  EXPECT_EQ(kFileSize, size);
+  EXPECT_EQ(0u, stats->GetSnapshot().decompressed_count);
+  ftl::StringView found_data;
+  EXPECT_EQ(Status::OK, object.GetData(&found_data));
+  EXPECT_EQ(data, found_data.ToString());
+  EXPECT_EQ(1u, stats->GetSnapshot().decompressed_count);
+
+  CompressedObjectImpl invalid_object(
+      (std::string(object_id_)),
+      std::make_unique<InlineObjectImpl>(RandomString(32), "invalid"), stats);
+  EXPECT_EQ(Status::FORMAT_ERROR, invalid_object.GetData(&found_data));
+}
+
+TEST_F(ObjectTest, ChunkedObject) {
+  std::string data = RandomString(kFileSize);
+  std::vector<std::unique_ptr<const Object>> chunks;
+  for (size_t i = 0; i < 4; ++i) {
+    chunks.push_back(std::make_unique<InlineObjectImpl>(
+        RandomString(32), data.substr(i * kFileSize / 4, kFileSize / 4)));
+  }
+
+  ChunkedObjectImpl object((std::string(object_id_)), std::move(chunks));
+  EXPECT_EQ(object_id_, object.GetId());
+  uint64_t size;
+  EXPECT_EQ(Status::OK, object.GetSize(&size));
+  EXPECT_EQ(kFileSize, size);
+  ftl::StringView found_data;
+  EXPECT_EQ(Status::OK, object.GetData(&found_data));
+  EXPECT_EQ(data, found_data.ToString());
+
+  // Partial reads within a chunk, across chunks and past the end.
+  std::string partial_data;
+  EXPECT_EQ(Status::OK, object.GetPartialData(10, 20, &partial_data));
+  EXPECT_EQ(data.substr(10, 20), partial_data);
+  EXPECT_EQ(Status::OK, object.GetPartialData(50, 100, &partial_data));
+  EXPECT_EQ(data.substr(50, 100), partial_data);
+  EXPECT_EQ(Status::OK,
+            object.GetPartialData(kFileSize - 10, 100, &partial_data));
+  EXPECT_EQ(data.substr(kFileSize - 10), partial_data);
+  EXPECT_EQ(Status::OK, object.GetPartialData(kFileSize, 100, &partial_data));
+  EXPECT_EQ("", partial_data);
+}
+
+TEST_F(ObjectTest, ChunkedObjectPartialViews) {
+  std::string data = RandomString(kFileSize);
+  std::vector<std::unique_ptr<const Object>> chunks;
+  std::vector<ftl::StringView> chunk_data;
+  for (size_t i = 0; i < 4; ++i) {
+    chunks.push_back(std::make_unique<InlineObjectImpl>(
+        RandomString(32), data.substr(i * kFileSize / 4, kFileSize / 4)));
+    chunk_data.emplace_back();
+    EXPECT_EQ(Status::OK, chunks.back()->GetData(&chunk_data.back()));
+  }
+  ChunkedObjectImpl object((std::string(object_id_)), std::move(chunks));
+
+  // A read across two chunks returns views of the data of both chunks,
+  // without copying it.
+  std::vector<ftl::StringView> parts;
+  EXPECT_EQ(Status::OK, object.GetPartialDataViews(50, 40, &parts));
+  ASSERT_EQ(2u, parts.size());
+  EXPECT_EQ(chunk_data[0].data() + 50, parts[0].data());
+  EXPECT_EQ(kFileSize / 4 - 50, parts[0].size());
+  EXPECT_EQ(chunk_data[1].data(), parts[1].data());
+  EXPECT_EQ(data.substr(50, 40), parts[0].ToString() + parts[1].ToString());
+
+  EXPECT_EQ(Status::OK, object.GetPartialDataViews(kFileSize, 100, &parts));
+  EXPECT_TRUE(parts.empty());
+}
+
 }  // namespace
 }  // namespace storage
@@ -0,0 +1,901 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/pack_store.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/hash.h"
+#include "apps/tracing/lib/trace/event.h"
+#include "lib/ftl/files/directory.h"
+#include "lib/ftl/files/eintr_wrapper.h"
+#include "lib/ftl/files/file.h"
+#include "lib/ftl/files/path.h"
+#include "lib/ftl/logging.h"
+#include "lib/ftl/strings/concatenate.h"
+#include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/time/time_point.h"
+
+namespace storage {
+
+namespace {
+
+const char kSegmentSuffix[] = ".pack";
+
+// Maximal number of bytes read by a single step of a segment compaction. At
+// least one record is copied per step, whatever its size.
+const uint64_t kCompactionStepSize = 256u << 10;
+
+// "LPK1" in little endian.
+const uint32_t kRecordMagic = 0x314b504c;
+
+const uint8_t kObjectRecord = 0;
+const uint8_t kTombstoneRecord = 1;
+// Written after each sync: all the records before it are durable.
+const uint8_t kSyncRecord = 2;
+// An object stored as a list of chunks. The data of the record is the SHA256
+// of the list, followed by the size (u64) and id (u8 size, then bytes) of each
+// chunk.
+const uint8_t kChunkedObjectRecord = 3;
+
+// Flags of the object records.
+const uint16_t kCompressedFlag = 1;
+
+struct RecordHeader {
+  uint32_t magic;
+  uint8_t type;
+  uint8_t id_size;
+  uint16_t flags;
+  uint64_t data_size;
+};
+
+static_assert(sizeof(RecordHeader) == 16, "RecordHeader must be packed.");
+
+uint64_t RecordSize(size_t id_size, uint64_t data_size) {
+  return sizeof(RecordHeader) + id_size + data_size;
+}
+
+bool WriteAt(int fd, const char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t written = HANDLE_EINTR(pwrite(fd, data, size, offset));
+    if (written < 0) {
+      return false;
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return true;
+}
+
+bool ReadAt(int fd, char* data, size_t size, uint64_t offset) {
+  while (size > 0) {
+    ssize_t read_bytes = HANDLE_EINTR(pread(fd, data, size, offset));
+    if (read_bytes <= 0) {
+      return false;
+    }
+    data += read_bytes;
+    size -= read_bytes;
+    offset += read_bytes;
+  }
+  return true;
+}
+
+bool ListDirectory(const std::string& path, std::vector<std::string>* names) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    return false;
+  }
+  std::vector<std::string> result;
+  for (struct dirent* entry = readdir(dir); entry != nullptr;
+       entry = readdir(dir)) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    result.push_back(std::move(name));
+  }
+  closedir(dir);
+  names->swap(result);
+  return true;
+}
+
+std::string EncodeChunkList(const std::vector<PackStore::Chunk>& chunks) {
+  std::string list;
+  for (const PackStore::Chunk& chunk : chunks) {
+    FTL_DCHECK(chunk.id.size() <= UINT8_MAX);
+    list.append(reinterpret_cast<const char*>(&chunk.size), sizeof(uint64_t));
+    list.push_back(static_cast<char>(chunk.id.size()));
+    list.append(chunk.id);
+  }
+  return glue::SHA256Hash(list.data(), list.size()) + list;
+}
+
+bool DecodeChunkList(ftl::StringView data,
+                     std::vector<PackStore::Chunk>* chunks) {
+  const size_t kHashSize = 32;
+  if (data.size() < kHashSize) {
+    return false;
+  }
+  ftl::StringView list = data.substr(kHashSize);
+  if (glue::SHA256Hash(list.data(), list.size()) != data.substr(0, kHashSize)) {
+    return false;
+  }
+  std::vector<PackStore::Chunk> result;
+  while (!list.empty()) {
+    if (list.size() < sizeof(uint64_t) + 1) {
+      return false;
+    }
+    PackStore::Chunk chunk;
+    memcpy(&chunk.size, list.data(), sizeof(uint64_t));
+    size_t id_size = static_cast<uint8_t>(list[sizeof(uint64_t)]);
+    list = list.substr(sizeof(uint64_t) + 1);
+    if (list.size() < id_size) {
+      return false;
+    }
+    chunk.id = list.substr(0, id_size).ToString();
+    list = list.substr(id_size);
+    result.push_back(std::move(chunk));
+  }
+  chunks->swap(result);
+  return true;
+}
+
+// Makes the creation of files in the directory at |path| durable.
+bool SyncDirectory(const std::string& path) {
+  ftl::UniqueFD fd(open(path.c_str(), O_RDONLY | O_DIRECTORY));
+  return fd.is_valid() && fsync(fd.get()) == 0;
+}
+
+bool FromHex(ftl::StringView hex, std::string* result) {
+  if (hex.size() % 2 != 0) {
+    return false;
+  }
+  std::string bytes;
+  bytes.reserve(hex.size() / 2);
+  for (size_t i = 0; i < hex.size(); i += 2) {
+    uint8_t byte;
+    if (!ftl::StringToNumberWithError<uint8_t>(hex.substr(i, 2), &byte,
+                                               ftl::Base::k16)) {
+      return false;
+    }
+    bytes.push_back(byte);
+  }
+  result->swap(bytes);
+  return true;
+}
+
+}  // namespace
+
+PackStore::PackStore(std::string dir,
+                     bool compression_enabled,
+                     uint64_t max_segment_size)
+    : dir_(std::move(dir)),
+      compression_enabled_(compression_enabled),
+      max_segment_size_(max_segment_size),
+      compression_stats_(std::make_shared<CompressionStats>()) {}
+
+PackStore::~PackStore() {}
+
+Status PackStore::Init() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!files::IsDirectory(dir_)) {
+    if (!files::CreateDirectory(dir_) ||
+        !SyncDirectory(files::GetDirectoryName(dir_))) {
+      FTL_LOG(ERROR) << "Unable to create pack directory " << dir_;
+      return Status::INTERNAL_IO_ERROR;
+    }
+  }
+
+  std::vector<std::string> names;
+  if (!ListDirectory(dir_, &names)) {
+    return Status::INTERNAL_IO_ERROR;
+  }
+  std::vector<uint32_t> segment_numbers;
+  const ftl::StringView suffix(kSegmentSuffix);
+  for (const std::string& name : names) {
+    ftl::StringView name_view(name);
+    if (name_view.size() <= suffix.size() ||
+        name_view.substr(name_view.size() - suffix.size()) != suffix) {
+      continue;
+    }
+    uint32_t segment;
+    if (ftl::StringToNumberWithError<uint32_t>(
+            name_view.substr(0, name_view.size() - suffix.size()), &segment)) {
+      segment_numbers.push_back(segment);
+    }
+  }
+  std::sort(segment_numbers.begin(), segment_numbers.end());
+
+  for (size_t i = 0; i < segment_numbers.size(); ++i) {
+    Status s =
+        LoadSegment(segment_numbers[i], i == segment_numbers.size() - 1);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+
+  active_segment_ = segment_numbers.empty() ? 0 : segment_numbers.back();
+  return OpenActiveSegmentLocked();
+}
+
+Status PackStore::Add(ObjectIdView object_id, ftl::StringView data) {
+  Status s = Append(object_id, data);
+  if (s != Status::OK) {
+    return s;
+  }
+  return Sync();
+}
+
+Status PackStore::Append(ObjectIdView object_id, ftl::StringView data) {
+  if (Contains(object_id)) {
+    return Status::OK;
+  }
+
+  // Compress outside of the lock, so that concurrent writers are not blocked.
+  std::string compressed_data;
+  bool compressed = false;
+  if (compression_enabled_ && data.size() >= kMinCompressedSize) {
+    TRACE_DURATION("storage", "compress_object", "size", data.size());
+    ftl::TimePoint start = ftl::TimePoint::Now();
+    compressed = Compress(data, &compressed_data);
+    compression_stats_->RecordCompression(
+        data.size(), compressed ? compressed_data.size() : data.size(),
+        compressed, ftl::TimePoint::Now() - start);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (index_.find(object_id.ToString()) != index_.end()) {
+    return Status::OK;
+  }
+  if (compressed) {
+    return AppendLocked(kObjectRecord, object_id, compressed_data,
+                        kCompressedFlag);
+  }
+  return AppendLocked(kObjectRecord, object_id, data);
+}
+
+Status PackStore::AppendChunked(ObjectIdView object_id,
+                                const std::vector<Chunk>& chunks) {
+  std::string list = EncodeChunkList(chunks);
+  std::lock_guard<std::mutex> lock(mutex_);
+  TouchLocked(object_id);
+  if (index_.find(object_id.ToString()) != index_.end()) {
+    return Status::OK;
+  }
+  return AppendLocked(kChunkedObjectRecord, object_id, list);
+}
+
+Status PackStore::GetChunks(ObjectIdView object_id,
+                            std::vector<Chunk>* chunks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TouchLocked(object_id);
+  auto it = index_.find(object_id.ToString());
+  if (it == index_.end() || !it->second.chunked) {
+    return Status::NOT_FOUND;
+  }
+  return ReadChunksLocked(it->second, chunks);
+}
+
+Status PackStore::Sync() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  const uint64_t target = appended_count_;
+  while (synced_count_ < target) {
+    if (sync_in_progress_) {
+      // Another caller is syncing; its fsync may cover our records too.
+      sync_done_.wait(lock);
+      continue;
+    }
+
+    // Sync all the records appended so far, including those of concurrent
+    // callers, without holding the lock during the fsync.
+    sync_in_progress_ = true;
+    const uint64_t sync_target = appended_count_;
+    ftl::UniqueFD fd(dup(active_fd_.get()));
+    lock.unlock();
+    if (on_sync_started_) {
+      on_sync_started_();
+    }
+    bool success = fd.is_valid() && fsync(fd.get()) == 0;
+    lock.lock();
+    sync_in_progress_ = false;
+    sync_done_.notify_all();
+
+    if (!success) {
+      FTL_LOG(ERROR) << "Unable to save segment "
+                     << GetSegmentPath(active_segment_) << " to disk: "
+                     << strerror(errno);
+      return Status::INTERNAL_IO_ERROR;
+    }
+    if (synced_count_ < sync_target) {
+      synced_count_ = sync_target;
+      // Records appended during the fsync are not covered by it: the marker
+      // can only be written at the end of the segment if there are none. If
+      // there are, the next sync writes it.
+      if (appended_count_ == sync_target) {
+        WriteSyncMarkerLocked();
+      }
+    }
+  }
+  return Status::OK;
+}
+
+Status PackStore::Find(ObjectIdView object_id, Location* location) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TouchLocked(object_id);
+  auto it = index_.find(object_id.ToString());
+  if (it == index_.end()) {
+    return Status::NOT_FOUND;
+  }
+  *location = it->second;
+  return Status::OK;
+}
+
+bool PackStore::Contains(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  TouchLocked(object_id);
+  return index_.find(object_id.ToString()) != index_.end();
+}
+
+Status PackStore::Remove(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(object_id.ToString());
+  if (it == index_.end()) {
+    return Status::NOT_FOUND;
+  }
+  Status s = RemoveLocked(object_id);
+  if (s != Status::OK) {
+    return s;
+  }
+  return SyncLocked();
+}
+
+void PackStore::StartCollection() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  collecting_ = true;
+  used_during_collection_.clear();
+}
+
+void PackStore::EndCollection() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  collecting_ = false;
+  used_during_collection_.clear();
+}
+
+bool PackStore::WasUsedDuringCollection(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return used_during_collection_.count(object_id.ToString()) > 0;
+}
+
+Status PackStore::RemoveUnused(ObjectIdView object_id, bool* removed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FTL_DCHECK(collecting_);
+  *removed = false;
+  if (used_during_collection_.count(object_id.ToString()) > 0 ||
+      index_.find(object_id.ToString()) == index_.end()) {
+    return Status::OK;
+  }
+  Status s = RemoveLocked(object_id);
+  if (s != Status::OK) {
+    return s;
+  }
+  *removed = true;
+  return Status::OK;
+}
+
+std::vector<ObjectId> PackStore::GetObjectIds() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<ObjectId> object_ids;
+  object_ids.reserve(index_.size());
+  for (const auto& entry : index_) {
+    object_ids.push_back(entry.first);
+  }
+  return object_ids;
+}
+
+std::vector<uint32_t> PackStore::GetSegmentsToCompact() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<uint32_t> result;
+  for (const auto& entry : segments_) {
+    const Segment& segment = entry.second;
+    if (entry.first != active_segment_ && segment.size > 0 &&
+        segment.live_bytes * 2 < segment.size) {
+      result.push_back(entry.first);
+    }
+  }
+  return result;
+}
+
+Status PackStore::CompactSegment(uint32_t segment,
+                                 uint64_t* offset,
+                                 bool* done) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (segment == active_segment_ || segments_.count(segment) == 0) {
+    *done = true;
+    return Status::OK;
+  }
+  *done = false;
+
+  std::string path = GetSegmentPath(segment);
+  ftl::UniqueFD fd(open(path.c_str(), O_RDONLY));
+  if (!fd.is_valid()) {
+    FTL_LOG(ERROR) << "Unable to open segment " << path;
+    return Status::INTERNAL_IO_ERROR;
+  }
+  // Records are checked against the index when they are read: the objects
+  // added or removed between two steps are handled like those of a single
+  // step.
+  uint64_t size = segments_[segment].size;
+  uint64_t read_bytes = 0;
+  while (*offset + sizeof(RecordHeader) <= size) {
+    if (read_bytes >= kCompactionStepSize) {
+      return Status::OK;
+    }
+    RecordHeader header;
+    ObjectId object_id;
+    if (!ReadAt(fd.get(), reinterpret_cast<char*>(&header), sizeof(header),
+                *offset)) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    object_id.resize(header.id_size);
+    if (!ReadAt(fd.get(), &object_id[0], object_id.size(),
+                *offset + sizeof(RecordHeader))) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    uint64_t data_offset = *offset + sizeof(RecordHeader) + header.id_size;
+    *offset += RecordSize(header.id_size, header.data_size);
+    read_bytes += sizeof(RecordHeader) + header.id_size;
+
+    // Copy the records still in use: the objects whose current version is in
+    // this segment, and the tombstones of removed objects that other segments
+    // still hold.
+    auto it = index_.find(object_id);
+    bool live;
+    if (header.type == kTombstoneRecord) {
+      live = it == index_.end() && IsTombstoneNeededLocked(object_id, segment);
+    } else {
+      live = header.type != kSyncRecord && it != index_.end() &&
+             it->second.segment == segment &&
+             it->second.offset == data_offset;
+    }
+    if (!live) {
+      continue;
+    }
+    std::string data;
+    data.resize(header.data_size);
+    if (!ReadAt(fd.get(), &data[0], data.size(), data_offset)) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    read_bytes += data.size();
+    Status s = AppendLocked(header.type, object_id, data, header.flags);
+    if (s != Status::OK) {
+      return s;
+    }
+    if (header.type != kTombstoneRecord) {
+      segments_[segment].dead_object_ids.insert(object_id);
+    }
+  }
+
+  // Delete the segment once the copies are durable. Objects already reading
+  // from it keep their mapping of the file.
+  Status s = SyncLocked();
+  if (s != Status::OK) {
+    return s;
+  }
+  segments_.erase(segment);
+  if (unlink(path.c_str()) != 0 || !SyncDirectory(dir_)) {
+    FTL_LOG(ERROR) << "Unable to delete segment " << path << ": "
+                   << strerror(errno);
+    return Status::INTERNAL_IO_ERROR;
+  }
+  *done = true;
+  return Status::OK;
+}
+
+std::string PackStore::GetSegmentPath(uint32_t segment) const {
+  return ftl::Concatenate(
+      {dir_, "/", ftl::NumberToString(segment), kSegmentSuffix});
+}
+
+Status PackStore::GetSegmentFile(uint32_t segment,
+                                 std::shared_ptr<SegmentFile>* file) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetSegmentFileLocked(segment, file);
+}
+
+Status PackStore::ImportLegacyObjects(const std::string& objects_dir) {
+  std::vector<std::string> prefixes;
+  if (!ListDirectory(objects_dir, &prefixes)) {
+    return Status::INTERNAL_IO_ERROR;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t imported = 0;
+  for (const std::string& prefix : prefixes) {
+    std::string prefix_dir = ftl::Concatenate({objects_dir, "/", prefix});
+    std::vector<std::string> suffixes;
+    if (!ListDirectory(prefix_dir, &suffixes)) {
+      continue;
+    }
+    for (const std::string& suffix : suffixes) {
+      ObjectId object_id;
+      if (!FromHex(ftl::Concatenate({prefix, suffix}), &object_id)) {
+        FTL_LOG(WARNING) << "Ignoring unexpected file " << prefix_dir << "/"
+                         << suffix;
+        continue;
+      }
+      if (index_.find(object_id) != index_.end()) {
+        continue;
+      }
+      std::string data;
+      if (!files::ReadFileToString(
+              ftl::Concatenate({prefix_dir, "/", suffix}), &data)) {
+        return Status::INTERNAL_IO_ERROR;
+      }
+      Status s = AppendLocked(kObjectRecord, object_id, data);
+      if (s != Status::OK) {
+        return s;
+      }
+      ++imported;
+    }
+  }
+  Status s = SyncLocked();
+  if (s != Status::OK) {
+    return s;
+  }
+  FTL_LOG(INFO) << "Imported " << imported << " objects from " << objects_dir;
+  if (!files::DeletePath(objects_dir, true)) {
+    FTL_LOG(WARNING) << "Unable to delete legacy object directory "
+                     << objects_dir;
+  }
+  return Status::OK;
+}
+
+Status PackStore::LoadSegment(uint32_t segment, bool is_last) {
+  std::string path = GetSegmentPath(segment);
+  ftl::UniqueFD fd(open(path.c_str(), O_RDWR));
+  if (!fd.is_valid()) {
+    FTL_LOG(ERROR) << "Unable to open segment " << path;
+    return Status::INTERNAL_IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd.get(), &st) != 0) {
+    return Status::INTERNAL_IO_ERROR;
+  }
+  uint64_t file_size = st.st_size;
+
+  struct Record {
+    uint64_t offset;
+    RecordHeader header;
+    ObjectId object_id;
+  };
+  std::vector<Record> records;
+  // Number of records up to, and including, the last sync marker.
+  size_t synced_records = 0;
+  uint64_t offset = 0;
+  while (offset + sizeof(RecordHeader) <= file_size) {
+    Record record;
+    record.offset = offset;
+    RecordHeader& header = record.header;
+    if (!ReadAt(fd.get(), reinterpret_cast<char*>(&header), sizeof(header),
+                offset)) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    if (header.magic != kRecordMagic ||
+        (header.type != kObjectRecord && header.type != kTombstoneRecord &&
+         header.type != kSyncRecord && header.type != kChunkedObjectRecord) ||
+        RecordSize(header.id_size, header.data_size) > file_size - offset) {
+      break;
+    }
+    record.object_id.resize(header.id_size);
+    if (!ReadAt(fd.get(), &record.object_id[0], header.id_size,
+                offset + sizeof(RecordHeader))) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    offset += RecordSize(header.id_size, header.data_size);
+    records.push_back(std::move(record));
+    if (header.type == kSyncRecord) {
+      synced_records = records.size();
+    }
+  }
+
+  if (offset != file_size) {
+    if (!is_last) {
+      FTL_LOG(ERROR) << "Segment " << path << " is corrupted after offset "
+                     << offset;
+    } else {
+      FTL_LOG(WARNING) << "Discarding incomplete record at the end of " << path;
+    }
+  }
+
+  // Only the objects written to the last segment after its last sync can have
+  // been partially persisted when the ledger was interrupted. Validate their
+  // content against their id, and discard everything from the first invalid
+  // one.
+  size_t valid_records = records.size();
+  if (is_last) {
+    for (size_t i = synced_records; i < records.size(); ++i) {
+      const Record& record = records[i];
+      if (record.header.type != kObjectRecord &&
+          record.header.type != kChunkedObjectRecord) {
+        continue;
+      }
+      std::string data;
+      data.resize(record.header.data_size);
+      if (!ReadAt(fd.get(), &data[0], data.size(),
+                  record.offset + sizeof(RecordHeader) +
+                      record.header.id_size)) {
+        return Status::INTERNAL_IO_ERROR;
+      }
+      bool valid;
+      if (record.header.type == kChunkedObjectRecord) {
+        std::vector<Chunk> chunks;
+        valid = DecodeChunkList(data, &chunks);
+      } else if (record.header.flags & kCompressedFlag) {
+        std::string decompressed;
+        valid = Decompress(data, &decompressed) &&
+                glue::SHA256Hash(decompressed.data(), decompressed.size()) ==
+                    record.object_id;
+      } else {
+        valid = glue::SHA256Hash(data.data(), data.size()) == record.object_id;
+      }
+      if (!valid) {
+        FTL_LOG(WARNING) << "Discarding corrupted object at the end of "
+                         << path;
+        valid_records = i;
+        offset = record.offset;
+        break;
+      }
+    }
+    if (offset != file_size && ftruncate(fd.get(), offset) != 0) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+  }
+
+  Segment& current = segments_[segment];
+  current.size = offset;
+  for (size_t i = 0; i < valid_records; ++i) {
+    const Record& record = records[i];
+    if (record.header.type == kSyncRecord) {
+      continue;
+    }
+    // Records found later in the segments supersede earlier ones.
+    auto it = index_.find(record.object_id);
+    if (it != index_.end()) {
+      Segment& previous = segments_[it->second.segment];
+      previous.live_bytes -=
+          RecordSize(record.object_id.size(), it->second.size);
+      previous.dead_object_ids.insert(record.object_id);
+      index_.erase(it);
+    }
+    if (record.header.type == kObjectRecord ||
+        record.header.type == kChunkedObjectRecord) {
+      index_[record.object_id] =
+          Location{segment,
+                   record.offset + sizeof(RecordHeader) + record.header.id_size,
+                   record.header.data_size,
+                   record.header.type == kChunkedObjectRecord,
+                   (record.header.flags & kCompressedFlag) != 0};
+      current.live_bytes +=
+          RecordSize(record.header.id_size, record.header.data_size);
+    }
+  }
+  return Status::OK;
+}
+
+Status PackStore::GetSegmentFileLocked(uint32_t segment,
+                                       std::shared_ptr<SegmentFile>* file) {
+  auto it = segments_.find(segment);
+  if (it == segments_.end()) {
+    return Status::NOT_FOUND;
+  }
+  if (!it->second.file) {
+    it->second.file = std::make_shared<SegmentFile>(GetSegmentPath(segment));
+  }
+  *file = it->second.file;
+  return Status::OK;
+}
+
+Status PackStore::ReadChunksLocked(const Location& location,
+                                   std::vector<Chunk>* chunks) {
+  FTL_DCHECK(location.chunked);
+  std::shared_ptr<SegmentFile> file;
+  ftl::StringView data;
+  std::shared_ptr<const SegmentFile::Mapping> mapping;
+  std::string buffer;
+  if (GetSegmentFileLocked(location.segment, &file) != Status::OK ||
+      file->GetData(location.offset, location.size, &data, &mapping) !=
+          Status::OK) {
+    // The segment cannot be mapped: read it instead.
+    ftl::UniqueFD fd(open(GetSegmentPath(location.segment).c_str(), O_RDONLY));
+    buffer.resize(location.size);
+    if (!fd.is_valid() ||
+        !ReadAt(fd.get(), &buffer[0], buffer.size(), location.offset)) {
+      return Status::INTERNAL_IO_ERROR;
+    }
+    data = buffer;
+  }
+  if (!DecodeChunkList(data, chunks)) {
+    FTL_LOG(ERROR) << "Invalid chunk list in "
+                   << GetSegmentPath(location.segment);
+    return Status::FORMAT_ERROR;
+  }
+  return Status::OK;
+}
+
+void PackStore::TouchLocked(ObjectIdView object_id) {
+  if (!collecting_) {
+    return;
+  }
+  ObjectId id = object_id.ToString();
+  if (!used_during_collection_.insert(id).second) {
+    return;
+  }
+  // The chunks of an object are used with it.
+  auto it = index_.find(id);
+  if (it == index_.end() || !it->second.chunked) {
+    return;
+  }
+  std::vector<Chunk> chunks;
+  if (ReadChunksLocked(it->second, &chunks) != Status::OK) {
+    return;
+  }
+  for (const Chunk& chunk : chunks) {
+    used_during_collection_.insert(chunk.id);
+  }
+}
+
+Status PackStore::RemoveLocked(ObjectIdView object_id) {
+  auto it = index_.find(object_id.ToString());
+  FTL_DCHECK(it != index_.end());
+  Location location = it->second;
+  Status s = AppendLocked(kTombstoneRecord, object_id, "");
+  if (s != Status::OK) {
+    return s;
+  }
+  Segment& segment = segments_[location.segment];
+  segment.live_bytes -= RecordSize(object_id.size(), location.size);
+  segment.dead_object_ids.insert(object_id.ToString());
+  index_.erase(object_id.ToString());
+  return Status::OK;
+}
+
+bool PackStore::IsTombstoneNeededLocked(const ObjectId& object_id,
+                                        uint32_t segment) {
+  for (const auto& entry : segments_) {
+    if (entry.first != segment &&
+        entry.second.dead_object_ids.count(object_id) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Status PackStore::OpenActiveSegmentLocked() {
+  std::string path = GetSegmentPath(active_segment_);
+  bool created = !files::IsFile(path);
+  active_fd_.reset(open(path.c_str(), O_RDWR | O_CREAT, 0600));
+  if (!active_fd_.is_valid()) {
+    FTL_LOG(ERROR) << "Unable to open segment " << path << ": "
+                   << strerror(errno);
+    return Status::INTERNAL_IO_ERROR;
+  }
+  // Make the new file durable, so that syncing its content is enough for the
+  // objects written to it to survive a crash.
+  if (created && !SyncDirectory(dir_)) {
+    FTL_LOG(ERROR) << "Unable to save directory " << dir_ << " to disk: "
+                   << strerror(errno);
+    return Status::INTERNAL_IO_ERROR;
+  }
+  // Make sure the segment is registered, even if empty.
+  segments_[active_segment_];
+  return Status::OK;
+}
+
+Status PackStore::AppendLocked(uint8_t type,
+                               ObjectIdView object_id,
+                               ftl::StringView data,
+                               uint16_t flags) {
+  FTL_DCHECK(object_id.size() <= UINT8_MAX);
+  uint64_t record_size = RecordSize(object_id.size(), data.size());
+  Segment* segment = &segments_[active_segment_];
+  if (segment->size > 0 && segment->size + record_size > max_segment_size_) {
+    Status s = SyncLocked();
+    if (s != Status::OK) {
+      return s;
+    }
+    ++active_segment_;
+    s = OpenActiveSegmentLocked();
+    if (s != Status::OK) {
+      return s;
+    }
+    segment = &segments_[active_segment_];
+  }
+
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.type = type;
+  header.id_size = object_id.size();
+  header.flags = flags;
+  header.data_size = data.size();
+
+  std::string prefix;
+  prefix.reserve(sizeof(header) + object_id.size());
+  prefix.append(reinterpret_cast<const char*>(&header), sizeof(header));
+  prefix.append(object_id.data(), object_id.size());
+
+  uint64_t offset = segment->size;
+  if (!WriteAt(active_fd_.get(), prefix.data(), prefix.size(), offset) ||
+      !WriteAt(active_fd_.get(), data.data(), data.size(),
+               offset + prefix.size())) {
+    FTL_LOG(ERROR) << "Unable to write to segment "
+                   << GetSegmentPath(active_segment_) << ": "
+                   << strerror(errno);
+    // Drop whatever was partially written so that the next record starts at
+    // a valid position.
+    if (ftruncate(active_fd_.get(), offset) != 0) {
+      FTL_LOG(ERROR) << "Unable to truncate segment: " << strerror(errno);
+    }
+    return Status::INTERNAL_IO_ERROR;
+  }
+  segment->size += record_size;
+  ++appended_count_;
+
+  if (type == kObjectRecord || type == kChunkedObjectRecord) {
+    segment->live_bytes += record_size;
+    index_[object_id.ToString()] =
+        Location{active_segment_, offset + prefix.size(), data.size(),
+                 type == kChunkedObjectRecord,
+                 (flags & kCompressedFlag) != 0};
+  }
+  return Status::OK;
+}
+
+Status PackStore::SyncLocked() {
+  if (synced_count_ == appended_count_) {
+    return Status::OK;
+  }
+  if (fsync(active_fd_.get()) != 0) {
+    FTL_LOG(ERROR) << "Unable to save segment "
+                   << GetSegmentPath(active_segment_) << " to disk: "
+                   << strerror(errno);
+    return Status::INTERNAL_IO_ERROR;
+  }
+  synced_count_ = appended_count_;
+  WriteSyncMarkerLocked();
+  return Status::OK;
+}
+
+void PackStore::WriteSyncMarkerLocked() {
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.type = kSyncRecord;
+  header.id_size = 0;
+  header.flags = 0;
+  header.data_size = 0;
+
+  // The marker is not synced itself: if it is lost, the records before it are
+  // validated on the next |Init()|.
+  Segment* segment = &segments_[active_segment_];
+  if (!WriteAt(active_fd_.get(), reinterpret_cast<const char*>(&header),
+               sizeof(header), segment->size)) {
+    FTL_LOG(WARNING) << "Unable to write sync marker: " << strerror(errno);
+    if (ftruncate(active_fd_.get(), segment->size) != 0) {
+      FTL_LOG(ERROR) << "Unable to truncate segment: " << strerror(errno);
+    }
+    return;
+  }
+  segment->size += sizeof(header);
+}
+
+}  // namespace storage
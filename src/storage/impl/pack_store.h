@@ -0,0 +1,229 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_PACK_STORE_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_PACK_STORE_H_
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "apps/ledger/src/storage/impl/compression.h"
+#include "apps/ledger/src/storage/impl/segment_file.h"
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/files/unique_fd.h"
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+
+namespace storage {
+
+// The size of the segments of a |PackStore| past which a new segment is
+// started, by default. An object larger than the limit is stored alone in its
+// own segment.
+constexpr uint64_t kDefaultMaxSegmentSize = 32u << 20;
+
+// |PackStore| stores the local objects of a page in a small number of
+// append-only segment files, instead of one file per object. Each object is
+// written as a self-describing record (header, id, data) at the end of the
+// active segment. An in-memory index, rebuilt from the segment headers on
+// |Init()|, maps object ids to their position in the segments.
+//
+// Objects can be appended without waiting for them to be durable, and then
+// made durable together by a single |Sync()|, so that writing many objects
+// does not cost one fsync each. After each sync, a marker record is appended:
+// on |Init()|, only the records following the last marker can have been
+// partially persisted, and they are validated against their ids.
+//
+// Objects that compress well are stored compressed. Their id is still
+// computed on the uncompressed data.
+//
+// All methods are thread safe.
+class PackStore {
+ public:
+  // Position of an object's data inside the segment files. If |chunked| is
+  // true, the data is the list of the object's chunks, see |GetChunks()|. If
+  // |compressed| is true, the data must be decompressed with |Decompress()|.
+  struct Location {
+    uint32_t segment;
+    uint64_t offset;
+    uint64_t size;
+    bool chunked = false;
+    bool compressed = false;
+  };
+
+  // A part of an object stored as a separate object.
+  struct Chunk {
+    ObjectId id;
+    uint64_t size;
+  };
+
+  explicit PackStore(std::string dir,
+                     bool compression_enabled = true,
+                     uint64_t max_segment_size = kDefaultMaxSegmentSize);
+  ~PackStore();
+
+  // Creates the pack directory if needed and rebuilds the index from the
+  // existing segments. Records at the end of the last segment that were not
+  // completely persisted, because of a crash during a write, are discarded.
+  Status Init();
+
+  // Appends the object with the given |object_id| and |data| and makes it
+  // durable before returning. Adding an object that is already present is a
+  // no-op.
+  Status Add(ObjectIdView object_id, ftl::StringView data);
+
+  // Appends the object with the given |object_id| and |data| without waiting
+  // for it to be durable. The object can be read right away, but is only
+  // guaranteed to survive a crash once |Sync()| has been called.
+  Status Append(ObjectIdView object_id, ftl::StringView data);
+
+  // Appends the object with the given |object_id|, whose data is the
+  // concatenation of the given |chunks|. The chunks must have been appended
+  // before. Like |Append()|, the object is only durable once |Sync()| has been
+  // called.
+  Status AppendChunked(ObjectIdView object_id, const std::vector<Chunk>& chunks);
+
+  // Finds the chunks of the object with the given |object_id|. Returns
+  // |NOT_FOUND| if the object is not stored locally, or is not chunked.
+  Status GetChunks(ObjectIdView object_id, std::vector<Chunk>* chunks);
+
+  // Makes all the objects appended so far durable. Concurrent calls are
+  // grouped: a single fsync covers all the objects appended before it starts,
+  // and callers whose objects it covers do not issue their own.
+  Status Sync();
+
+  // Finds the position of the object with the given |object_id|. Returns
+  // |NOT_FOUND| if the object is not stored locally.
+  Status Find(ObjectIdView object_id, Location* location);
+
+  // Returns whether the object with the given |object_id| is stored locally.
+  bool Contains(ObjectIdView object_id);
+
+  // Removes the object with the given |object_id|. The space it uses is only
+  // reclaimed when its segment is compacted.
+  Status Remove(ObjectIdView object_id);
+
+  // Garbage collection support. Between |StartCollection()| and
+  // |EndCollection()|, the store records the ids of all the objects that are
+  // looked up or added, including the chunks of chunked objects. A collection
+  // computes the live objects from a snapshot of the page, and must not remove
+  // objects that started being used after that snapshot.
+  void StartCollection();
+  void EndCollection();
+
+  // Returns whether the object with the given |object_id| was looked up or
+  // added since |StartCollection()|.
+  bool WasUsedDuringCollection(ObjectIdView object_id);
+
+  // Removes the object with the given |object_id|, unless it was used since
+  // |StartCollection()|. Unlike |Remove()|, the removal is only durable after
+  // the next |Sync()|: if it is lost, the object is found again on |Init()|.
+  Status RemoveUnused(ObjectIdView object_id, bool* removed);
+
+  // Returns the ids of all the objects stored locally.
+  std::vector<ObjectId> GetObjectIds();
+
+  // Returns the segments, other than the active one, of which less than half
+  // is used by live records.
+  std::vector<uint32_t> GetSegmentsToCompact();
+
+  // Copies the live records of the given |segment| to the active segment, and
+  // deletes the segment once the copies are durable. Each call only reads a
+  // bounded number of bytes, starting from |*offset|, so that the store is not
+  // locked for long: |*offset| is updated to where the next call resumes, and
+  // |*done| is set to true once the segment is deleted. |*offset| must be 0 on
+  // the first call for a segment.
+  Status CompactSegment(uint32_t segment, uint64_t* offset, bool* done);
+
+  // Returns the statistics about the compression of the objects of this
+  // store.
+  std::shared_ptr<CompressionStats> compression_stats() {
+    return compression_stats_;
+  }
+
+  // Returns the path of the segment file with the given number.
+  std::string GetSegmentPath(uint32_t segment) const;
+
+  // Finds the |SegmentFile| for the segment with the given number. The same
+  // instance, and thus the same memory mapping, is returned for all objects of
+  // a segment. Returns |NOT_FOUND| if the segment was deleted by a compaction,
+  // in which case the objects it held can be found again at their new
+  // location.
+  Status GetSegmentFile(uint32_t segment, std::shared_ptr<SegmentFile>* file);
+
+  // Imports all objects stored in the legacy one-file-per-object layout under
+  // |objects_dir| and deletes that directory once they are durably stored in
+  // this |PackStore|.
+  Status ImportLegacyObjects(const std::string& objects_dir);
+
+ private:
+  friend class PackStoreAccessorForTest;
+
+  struct Segment {
+    uint64_t size = 0;
+    uint64_t live_bytes = 0;
+    std::shared_ptr<SegmentFile> file;
+    // Ids of the objects of which this segment holds a record that is no
+    // longer used. The tombstones of these objects in other segments must be
+    // kept until this segment is deleted.
+    std::unordered_set<ObjectId> dead_object_ids;
+  };
+
+  Status LoadSegment(uint32_t segment, bool is_last);
+  Status OpenActiveSegmentLocked();
+  Status AppendLocked(uint8_t type,
+                      ObjectIdView object_id,
+                      ftl::StringView data,
+                      uint16_t flags = 0);
+  Status SyncLocked();
+  Status GetSegmentFileLocked(uint32_t segment,
+                              std::shared_ptr<SegmentFile>* file);
+  Status ReadChunksLocked(const Location& location, std::vector<Chunk>* chunks);
+  // Records that |object_id| is used, if a collection is in progress.
+  void TouchLocked(ObjectIdView object_id);
+  // Appends a tombstone for |object_id|, which must be present, and removes it
+  // from the index.
+  Status RemoveLocked(ObjectIdView object_id);
+  // Returns whether a segment other than |segment| holds a record of the
+  // removed object with the given |object_id|, that a tombstone of |segment|
+  // must keep from being found again on |Init()|.
+  bool IsTombstoneNeededLocked(const ObjectId& object_id, uint32_t segment);
+  // Appends a sync marker. All the records before it must be durable.
+  void WriteSyncMarkerLocked();
+
+  const std::string dir_;
+  const bool compression_enabled_;
+  const uint64_t max_segment_size_;
+  const std::shared_ptr<CompressionStats> compression_stats_;
+
+  std::mutex mutex_;
+  std::unordered_map<ObjectId, Location> index_;
+  std::map<uint32_t, Segment> segments_;
+  uint32_t active_segment_ = 0;
+  ftl::UniqueFD active_fd_;
+
+  // Number of records appended, and number of those known to be durable.
+  uint64_t appended_count_ = 0;
+  uint64_t synced_count_ = 0;
+  bool sync_in_progress_ = false;
+  std::condition_variable sync_done_;
+  // Called by |Sync()| before the fsync, without holding the lock. Used in
+  // tests.
+  std::function<void()> on_sync_started_;
+
+  bool collecting_ = false;
+  std::unordered_set<ObjectId> used_during_collection_;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(PackStore);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_PACK_STORE_H_
@@ -0,0 +1,623 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/pack_store.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "apps/ledger/src/glue/crypto/hash.h"
+#include "apps/ledger/src/glue/crypto/rand.h"
+#include "gtest/gtest.h"
+#include "lib/ftl/files/directory.h"
+#include "lib/ftl/files/file.h"
+#include "lib/ftl/files/scoped_temp_dir.h"
+#include "lib/ftl/macros.h"
+
+namespace storage {
+
+class PackStoreAccessorForTest {
+ public:
+  static void SetOnSyncStarted(PackStore* store,
+                               std::function<void()> on_sync_started) {
+    store->on_sync_started_ = std::move(on_sync_started);
+  }
+};
+
+namespace {
+
+std::string RandomString(size_t size) {
+  std::string result;
+  result.resize(size);
+  glue::RandBytes(&result[0], size);
+  return result;
+}
+
+class PackStoreTest : public ::testing::Test {
+ public:
+  PackStoreTest() {}
+
+  ~PackStoreTest() override {}
+
+  // Test:
+  void SetUp() override {
+    pack_dir_ = tmp_dir_.path() + "/packs";
+    ResetStore();
+  }
+
+ protected:
+  void ResetStore() {
+    store_ = std::make_unique<PackStore>(pack_dir_);
+    ASSERT_EQ(Status::OK, store_->Init());
+  }
+
+  // Reads the data of |object_id| from the segment files.
+  std::string ReadObject(ObjectIdView object_id) {
+    PackStore::Location location;
+    EXPECT_EQ(Status::OK, store_->Find(object_id, &location));
+    std::string segment;
+    EXPECT_TRUE(files::ReadFileToString(
+        store_->GetSegmentPath(location.segment), &segment));
+    EXPECT_LE(location.offset + location.size, segment.size());
+    std::string data = segment.substr(location.offset, location.size);
+    if (location.compressed) {
+      std::string decompressed;
+      EXPECT_TRUE(Decompress(data, &decompressed));
+      return decompressed;
+    }
+    return data;
+  }
+
+  ObjectId AddObject(const std::string& data) {
+    ObjectId object_id = glue::SHA256Hash(data.data(), data.size());
+    EXPECT_EQ(Status::OK, store_->Add(object_id, data));
+    return object_id;
+  }
+
+  ObjectId AppendObject(const std::string& data) {
+    ObjectId object_id = glue::SHA256Hash(data.data(), data.size());
+    EXPECT_EQ(Status::OK, store_->Append(object_id, data));
+    return object_id;
+  }
+
+  // Flips the last byte of the data of |object_id| in its segment.
+  void CorruptObject(ObjectIdView object_id) {
+    PackStore::Location location;
+    ASSERT_EQ(Status::OK, store_->Find(object_id, &location));
+    std::string segment_path = store_->GetSegmentPath(location.segment);
+    std::string segment;
+    ASSERT_TRUE(files::ReadFileToString(segment_path, &segment));
+    segment[location.offset + location.size - 1] ^= 0xff;
+    ASSERT_TRUE(
+        files::WriteFile(segment_path, segment.data(), segment.size()));
+  }
+
+  uint64_t GetSegmentSize(uint32_t segment) {
+    struct stat st;
+    EXPECT_EQ(0, stat(store_->GetSegmentPath(segment).c_str(), &st));
+    return st.st_size;
+  }
+
+  // Compacts |segment| and returns the number of steps it took.
+  size_t CompactSegment(uint32_t segment) {
+    uint64_t offset = 0;
+    bool done = false;
+    size_t steps = 0;
+    while (!done) {
+      EXPECT_EQ(Status::OK, store_->CompactSegment(segment, &offset, &done));
+      ++steps;
+    }
+    return steps;
+  }
+
+  files::ScopedTempDir tmp_dir_;
+  std::string pack_dir_;
+  std::unique_ptr<PackStore> store_;
+
+ private:
+  FTL_DISALLOW_COPY_AND_ASSIGN(PackStoreTest);
+};
+
+TEST_F(PackStoreTest, AddAndFind) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AddObject(data1);
+  ObjectId id2 = AddObject(data2);
+
+  EXPECT_TRUE(store_->Contains(id1));
+  EXPECT_TRUE(store_->Contains(id2));
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_EQ(data2, ReadObject(id2));
+
+  PackStore::Location location;
+  EXPECT_EQ(Status::NOT_FOUND, store_->Find(RandomString(32), &location));
+  EXPECT_FALSE(store_->Contains(RandomString(32)));
+}
+
+TEST_F(PackStoreTest, AddTwice) {
+  std::string data = RandomString(100);
+  ObjectId id = AddObject(data);
+  PackStore::Location location1;
+  EXPECT_EQ(Status::OK, store_->Find(id, &location1));
+
+  AddObject(data);
+  PackStore::Location location2;
+  EXPECT_EQ(Status::OK, store_->Find(id, &location2));
+  EXPECT_EQ(location1.segment, location2.segment);
+  EXPECT_EQ(location1.offset, location2.offset);
+}
+
+TEST_F(PackStoreTest, EmptyObject) {
+  ObjectId id = AddObject("");
+  EXPECT_EQ("", ReadObject(id));
+
+  ResetStore();
+  EXPECT_EQ("", ReadObject(id));
+}
+
+TEST_F(PackStoreTest, Reopen) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AddObject(data1);
+  ObjectId id2 = AddObject(data2);
+
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_EQ(data2, ReadObject(id2));
+
+  // New objects can be added after reopening.
+  std::string data3 = RandomString(300);
+  ObjectId id3 = AddObject(data3);
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_EQ(data3, ReadObject(id3));
+}
+
+TEST_F(PackStoreTest, Remove) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AddObject(data1);
+  ObjectId id2 = AddObject(data2);
+
+  EXPECT_EQ(Status::OK, store_->Remove(id1));
+  EXPECT_FALSE(store_->Contains(id1));
+  EXPECT_EQ(Status::NOT_FOUND, store_->Remove(id1));
+
+  ResetStore();
+  EXPECT_FALSE(store_->Contains(id1));
+  EXPECT_EQ(data2, ReadObject(id2));
+
+  // A removed object can be added again.
+  AddObject(data1);
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+}
+
+TEST_F(PackStoreTest, TruncatedRecord) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AddObject(data1);
+  ObjectId id2 = AddObject(data2);
+
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(id2, &location));
+  std::string segment_path = store_->GetSegmentPath(location.segment);
+  store_.reset();
+
+  // Simulate an interrupted write of the last record.
+  ASSERT_EQ(0, truncate(segment_path.c_str(), location.offset + 10));
+
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_FALSE(store_->Contains(id2));
+
+  // The store is still usable.
+  AddObject(data2);
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_EQ(data2, ReadObject(id2));
+}
+
+TEST_F(PackStoreTest, CorruptedLastRecord) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AddObject(data1);
+  // The second object is not synced, as if the ledger had been interrupted
+  // while writing it.
+  ObjectId id2 = AppendObject(data2);
+
+  // Overwrite the end of the last object, keeping the file size.
+  CorruptObject(id2);
+
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_FALSE(store_->Contains(id2));
+}
+
+TEST_F(PackStoreTest, AppendAndSync) {
+  std::vector<std::string> data;
+  std::vector<ObjectId> ids;
+  for (size_t i = 0; i < 10; ++i) {
+    data.push_back(RandomString(100 + i));
+    ids.push_back(AppendObject(data.back()));
+    // Appended objects can be read before being synced.
+    EXPECT_EQ(data.back(), ReadObject(ids.back()));
+  }
+  EXPECT_EQ(Status::OK, store_->Sync());
+  // Syncing again without new objects is a no-op.
+  EXPECT_EQ(Status::OK, store_->Sync());
+
+  ResetStore();
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(data[i], ReadObject(ids[i]));
+  }
+}
+
+TEST_F(PackStoreTest, CorruptedUnsyncedRecords) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  std::string data3 = RandomString(300);
+  std::string data4 = RandomString(400);
+  ObjectId id1 = AddObject(data1);
+  ObjectId id2 = AppendObject(data2);
+  ObjectId id3 = AppendObject(data3);
+  ObjectId id4 = AppendObject(data4);
+
+  // Only some of the unsynced records were persisted: the first invalid one
+  // and all the following records are discarded.
+  CorruptObject(id3);
+
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_EQ(data2, ReadObject(id2));
+  EXPECT_FALSE(store_->Contains(id3));
+  EXPECT_FALSE(store_->Contains(id4));
+}
+
+TEST_F(PackStoreTest, AppendDuringSync) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  ObjectId id1 = AppendObject(data1);
+  ObjectId id2;
+  PackStoreAccessorForTest::SetOnSyncStarted(
+      store_.get(), [this, &data2, &id2] { id2 = AppendObject(data2); });
+  EXPECT_EQ(Status::OK, store_->Sync());
+  PackStoreAccessorForTest::SetOnSyncStarted(store_.get(), nullptr);
+
+  // The object appended during the sync is not durable: if it was only
+  // partially persisted, it must be discarded.
+  CorruptObject(id2);
+
+  ResetStore();
+  EXPECT_EQ(data1, ReadObject(id1));
+  EXPECT_FALSE(store_->Contains(id2));
+}
+
+TEST_F(PackStoreTest, ConcurrentAdds) {
+  const size_t kThreadCount = 4;
+  const size_t kObjectsPerThread = 20;
+  std::vector<std::vector<std::string>> data(kThreadCount);
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    for (size_t j = 0; j < kObjectsPerThread; ++j) {
+      data[i].push_back(RandomString(50 + j));
+    }
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kThreadCount; ++i) {
+    threads.emplace_back([this, &data, i] {
+      for (const std::string& object_data : data[i]) {
+        ObjectId object_id =
+            glue::SHA256Hash(object_data.data(), object_data.size());
+        EXPECT_EQ(Status::OK, store_->Add(object_id, object_data));
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  ResetStore();
+  for (const auto& thread_data : data) {
+    for (const std::string& object_data : thread_data) {
+      EXPECT_EQ(object_data,
+                ReadObject(glue::SHA256Hash(object_data.data(),
+                                            object_data.size())));
+    }
+  }
+}
+
+TEST_F(PackStoreTest, ChunkedObject) {
+  std::string data1 = RandomString(100);
+  std::string data2 = RandomString(200);
+  std::vector<PackStore::Chunk> chunks = {{AppendObject(data1), data1.size()},
+                                          {AppendObject(data2), data2.size()}};
+  std::string data = data1 + data2;
+  ObjectId id = glue::SHA256Hash(data.data(), data.size());
+  EXPECT_EQ(Status::OK, store_->AppendChunked(id, chunks));
+  EXPECT_EQ(Status::OK, store_->Sync());
+
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(id, &location));
+  EXPECT_TRUE(location.chunked);
+  ASSERT_EQ(Status::OK, store_->Find(chunks[0].id, &location));
+  EXPECT_FALSE(location.chunked);
+  std::vector<PackStore::Chunk> found_chunks;
+  EXPECT_EQ(Status::NOT_FOUND, store_->GetChunks(chunks[0].id, &found_chunks));
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Status::OK, store_->GetChunks(id, &found_chunks));
+    ASSERT_EQ(2u, found_chunks.size());
+    for (size_t j = 0; j < chunks.size(); ++j) {
+      EXPECT_EQ(chunks[j].id, found_chunks[j].id);
+      EXPECT_EQ(chunks[j].size, found_chunks[j].size);
+    }
+    // The chunk list is found again after reopening.
+    ResetStore();
+  }
+}
+
+TEST_F(PackStoreTest, CorruptedUnsyncedChunkedObject) {
+  std::string data = RandomString(100);
+  ObjectId chunk_id = AppendObject(data);
+  ObjectId id = RandomString(32);
+  EXPECT_EQ(Status::OK, store_->AppendChunked(
+                            id, {PackStore::Chunk{chunk_id, data.size()}}));
+  CorruptObject(id);
+
+  ResetStore();
+  EXPECT_TRUE(store_->Contains(chunk_id));
+  EXPECT_FALSE(store_->Contains(id));
+}
+
+TEST_F(PackStoreTest, CompressedObject) {
+  std::string data;
+  for (size_t i = 0; i < 100; ++i) {
+    data += "{\"key\": \"value " + std::to_string(i) + "\"}";
+  }
+  std::string random_data = RandomString(1000);
+  ObjectId id = AddObject(data);
+  ObjectId random_id = AddObject(random_data);
+
+  for (int i = 0; i < 2; ++i) {
+    PackStore::Location location;
+    ASSERT_EQ(Status::OK, store_->Find(id, &location));
+    EXPECT_TRUE(location.compressed);
+    EXPECT_LT(location.size, data.size() / 2);
+    EXPECT_EQ(data, ReadObject(id));
+    // Data that does not compress well is stored as is.
+    ASSERT_EQ(Status::OK, store_->Find(random_id, &location));
+    EXPECT_FALSE(location.compressed);
+    EXPECT_EQ(random_data, ReadObject(random_id));
+    ResetStore();
+  }
+}
+
+TEST_F(PackStoreTest, CompressionStats) {
+  std::string data(1000, 'a');
+  AddObject(data);
+  AddObject(RandomString(1000));
+  // Small objects are not considered for compression.
+  AddObject("small");
+
+  CompressionStats::Snapshot stats = store_->compression_stats()->GetSnapshot();
+  EXPECT_EQ(1u, stats.compressed_count);
+  EXPECT_EQ(1u, stats.uncompressed_count);
+  EXPECT_EQ(2000u, stats.input_bytes);
+  EXPECT_LT(stats.stored_bytes, 1100u);
+  EXPECT_GT(stats.ratio(), 1.5);
+}
+
+TEST_F(PackStoreTest, CompressionDisabled) {
+  store_ = std::make_unique<PackStore>(pack_dir_, false);
+  ASSERT_EQ(Status::OK, store_->Init());
+  std::string data(1000, 'a');
+  ObjectId id = AddObject(data);
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(id, &location));
+  EXPECT_FALSE(location.compressed);
+  EXPECT_EQ(data, ReadObject(id));
+}
+
+TEST_F(PackStoreTest, CorruptedUnsyncedCompressedObject) {
+  ObjectId id1 = AppendObject(std::string(1000, 'a'));
+  ObjectId id2 = AppendObject(std::string(1000, 'b'));
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(id2, &location));
+  ASSERT_TRUE(location.compressed);
+  CorruptObject(id2);
+
+  ResetStore();
+  EXPECT_TRUE(store_->Contains(id1));
+  EXPECT_FALSE(store_->Contains(id2));
+}
+
+TEST_F(PackStoreTest, RemoveUnused) {
+  ObjectId id1 = AddObject(RandomString(100));
+  ObjectId id2 = AddObject(RandomString(100));
+  std::string chunk_data = RandomString(100);
+  ObjectId chunk_id = AppendObject(chunk_data);
+  ObjectId chunked_id = RandomString(32);
+  ASSERT_EQ(Status::OK,
+            store_->AppendChunked(
+                chunked_id, {PackStore::Chunk{chunk_id, chunk_data.size()}}));
+
+  store_->StartCollection();
+  EXPECT_EQ(5u, store_->GetObjectIds().size() + 1);
+  // Objects used after the start of the collection are kept, as are the
+  // chunks of the chunked objects used.
+  EXPECT_TRUE(store_->Contains(id2));
+  EXPECT_TRUE(store_->Contains(chunked_id));
+  ObjectId id3 = AppendObject(RandomString(100));
+  EXPECT_TRUE(store_->WasUsedDuringCollection(id3));
+  EXPECT_FALSE(store_->WasUsedDuringCollection(id1));
+
+  bool removed;
+  EXPECT_EQ(Status::OK, store_->RemoveUnused(id1, &removed));
+  EXPECT_TRUE(removed);
+  for (const ObjectId& id : {id2, id3, chunk_id}) {
+    EXPECT_EQ(Status::OK, store_->RemoveUnused(id, &removed));
+    EXPECT_FALSE(removed);
+  }
+  store_->EndCollection();
+  EXPECT_EQ(Status::OK, store_->Sync());
+
+  ResetStore();
+  EXPECT_FALSE(store_->Contains(id1));
+  EXPECT_TRUE(store_->Contains(id2));
+  EXPECT_TRUE(store_->Contains(id3));
+  EXPECT_TRUE(store_->Contains(chunk_id));
+}
+
+TEST_F(PackStoreTest, CompactSegment) {
+  // Fill the first segment, so that the next object starts a new one.
+  ObjectId large_id = AddObject(RandomString(20 << 20));
+  std::string data = RandomString(100);
+  ObjectId id = AddObject(data);
+  ObjectId other_large_id = AddObject(RandomString(20 << 20));
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(id, &location));
+  uint32_t first_segment = location.segment;
+  ASSERT_EQ(Status::OK, store_->Find(other_large_id, &location));
+  ASSERT_NE(first_segment, location.segment);
+  EXPECT_TRUE(store_->GetSegmentsToCompact().empty());
+
+  ASSERT_EQ(Status::OK, store_->Remove(large_id));
+  std::vector<uint32_t> segments = store_->GetSegmentsToCompact();
+  ASSERT_EQ(1u, segments.size());
+  EXPECT_EQ(first_segment, segments[0]);
+  EXPECT_EQ(1u, CompactSegment(first_segment));
+  EXPECT_FALSE(files::IsFile(store_->GetSegmentPath(first_segment)));
+  EXPECT_TRUE(store_->GetSegmentsToCompact().empty());
+
+  // A reader that found the object before the compaction does not get the
+  // deleted segment.
+  std::shared_ptr<SegmentFile> file;
+  EXPECT_EQ(Status::NOT_FOUND, store_->GetSegmentFile(first_segment, &file));
+  EXPECT_TRUE(store_->GetSegmentsToCompact().empty());
+
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Status::OK, store_->Find(id, &location));
+    EXPECT_NE(first_segment, location.segment);
+    EXPECT_EQ(data, ReadObject(id));
+    EXPECT_TRUE(store_->Contains(other_large_id));
+    EXPECT_FALSE(store_->Contains(large_id));
+    ResetStore();
+  }
+}
+
+TEST_F(PackStoreTest, CompactSegmentInSteps) {
+  ObjectId large_id = AddObject(RandomString(20 << 20));
+  std::vector<std::string> data;
+  std::vector<ObjectId> ids;
+  for (size_t i = 0; i < 10; ++i) {
+    data.push_back(RandomString(100 << 10));
+    ids.push_back(AddObject(data.back()));
+  }
+  ObjectId other_large_id = AddObject(RandomString(20 << 20));
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(ids[0], &location));
+  uint32_t first_segment = location.segment;
+  ASSERT_EQ(Status::OK, store_->Find(other_large_id, &location));
+  ASSERT_NE(first_segment, location.segment);
+  ASSERT_EQ(Status::OK, store_->Remove(large_id));
+
+  // A single step does not copy the whole segment: the objects can be read
+  // during the compaction, whether they were moved yet or not.
+  uint64_t offset = 0;
+  bool done;
+  ASSERT_EQ(Status::OK, store_->CompactSegment(first_segment, &offset, &done));
+  EXPECT_FALSE(done);
+  EXPECT_TRUE(files::IsFile(store_->GetSegmentPath(first_segment)));
+  ASSERT_EQ(Status::OK, store_->Find(ids[0], &location));
+  EXPECT_NE(first_segment, location.segment);
+  ASSERT_EQ(Status::OK, store_->Find(ids.back(), &location));
+  EXPECT_EQ(first_segment, location.segment);
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(data[i], ReadObject(ids[i]));
+  }
+
+  while (!done) {
+    ASSERT_EQ(Status::OK,
+              store_->CompactSegment(first_segment, &offset, &done));
+  }
+  EXPECT_FALSE(files::IsFile(store_->GetSegmentPath(first_segment)));
+  ResetStore();
+  for (size_t i = 0; i < ids.size(); ++i) {
+    EXPECT_EQ(data[i], ReadObject(ids[i]));
+  }
+  EXPECT_FALSE(store_->Contains(large_id));
+}
+
+TEST_F(PackStoreTest, CompactTombstones) {
+  ObjectId large_id = AddObject(RandomString(20 << 20));
+  ObjectId id = AddObject(RandomString(100));
+  ObjectId other_large_id = AddObject(RandomString(20 << 20));
+  ASSERT_EQ(Status::OK, store_->Remove(large_id));
+  ASSERT_EQ(Status::OK, store_->Remove(id));
+  ObjectId last_large_id = AddObject(RandomString(20 << 20));
+  ASSERT_EQ(Status::OK, store_->Remove(other_large_id));
+  PackStore::Location location;
+  ASSERT_EQ(Status::OK, store_->Find(last_large_id, &location));
+  uint32_t last_segment = location.segment;
+  ASSERT_EQ(2u, last_segment);
+
+  // The tombstones of the second segment are kept while the first one, which
+  // holds the removed objects, exists.
+  uint64_t size = GetSegmentSize(last_segment);
+  CompactSegment(1);
+  EXPECT_LT(size, GetSegmentSize(last_segment));
+  ResetStore();
+  EXPECT_FALSE(store_->Contains(large_id));
+  EXPECT_FALSE(store_->Contains(id));
+  EXPECT_FALSE(store_->Contains(other_large_id));
+
+  // Once it is deleted, they are dropped.
+  CompactSegment(0);
+  ASSERT_EQ(Status::OK, store_->Remove(last_large_id));
+  ObjectId next_large_id = AddObject(RandomString(20 << 20));
+  ASSERT_EQ(Status::OK, store_->Find(next_large_id, &location));
+  ASSERT_EQ(3u, location.segment);
+  size = GetSegmentSize(location.segment);
+  CompactSegment(last_segment);
+  EXPECT_EQ(size, GetSegmentSize(location.segment));
+  ResetStore();
+  EXPECT_FALSE(store_->Contains(large_id));
+  EXPECT_FALSE(store_->Contains(id));
+  EXPECT_FALSE(store_->Contains(other_large_id));
+  EXPECT_FALSE(store_->Contains(last_large_id));
+  EXPECT_TRUE(store_->Contains(next_large_id));
+}
+
+TEST_F(PackStoreTest, ImportLegacyObjects) {
+  std::string data = RandomString(100);
+  ObjectId id = glue::SHA256Hash(data.data(), data.size());
+
+  const char kHexDigits[] = "0123456789ABCDEF";
+  std::string hex;
+  for (unsigned char c : id) {
+    hex.push_back(kHexDigits[c >> 4]);
+    hex.push_back(kHexDigits[c & 0xf]);
+  }
+  std::string objects_dir = tmp_dir_.path() + "/objects";
+  std::string prefix_dir = objects_dir + "/" + hex.substr(0, 2);
+  ASSERT_TRUE(files::CreateDirectory(prefix_dir));
+  ASSERT_TRUE(files::WriteFile(prefix_dir + "/" + hex.substr(2), data.data(),
+                               data.size()));
+
+  EXPECT_EQ(Status::OK, store_->ImportLegacyObjects(objects_dir));
+  EXPECT_FALSE(files::IsDirectory(objects_dir));
+  EXPECT_EQ(data, ReadObject(id));
+
+  ResetStore();
+  EXPECT_EQ(data, ReadObject(id));
+}
+
+}  // namespace
+}  // namespace storage
@@ -4,13 +4,6 @@
 
 #include "apps/ledger/src/storage/impl/page_storage_impl.h"
 
-#include <errno.h>
-#include <fcntl.h>
-#include <stdio.h>
-#include <string.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-
 #include <algorithm>
 #include <iterator>
 #include <map>
@@ -18,15 +11,15 @@
 #include "apps/ledger/src/callback/waiter.h"
 #include "apps/ledger/src/glue/crypto/hash.h"
 #include "apps/ledger/src/storage/impl/btree/btree_utils.h"
+#include "apps/ledger/src/storage/impl/chunker.h"
 #include "apps/ledger/src/storage/impl/commit_impl.h"
+#include "apps/ledger/src/storage/impl/garbage_collector.h"
+#include "apps/ledger/src/storage/impl/live_roots.h"
 #include "apps/ledger/src/storage/impl/object_impl.h"
 #include "apps/ledger/src/storage/public/constants.h"
 #include "lib/ftl/arraysize.h"
 #include "lib/ftl/files/directory.h"
-#include "lib/ftl/files/file.h"
-#include "lib/ftl/files/file_descriptor.h"
 #include "lib/ftl/files/path.h"
-#include "lib/ftl/files/unique_fd.h"
 #include "lib/ftl/functional/make_copyable.h"
 #include "lib/ftl/logging.h"
 #include "lib/ftl/memory/weak_ptr.h"
@@ -39,11 +32,23 @@ namespace {
 
 const char kLevelDbDir[] = "/leveldb";
 const char kObjectDir[] = "/objects";
+const char kPackDir[] = "/packs";
+// Used by previous versions to stage objects before moving them into
+// |kObjectDir|.
 const char kStagingDir[] = "/staging";
 
 const char kHexDigits[] = "0123456789ABCDEF";
 
-const size_t kDefaultNodeSize = 64u;
+// Maximal size, in bytes, of the encoded entries of a tree node.
+const size_t kDefaultNodeSize = 4096u;
+
+// Number of commits added to the page between two automatic garbage
+// collections.
+const size_t kCommitsBetweenGarbageCollections = 1000u;
+
+// Minimal number of keys the filter over the objects stored in the database is
+// sized for. When it is full, a filter with twice the capacity is added.
+const size_t kMinInlineObjectFilterCapacity = 1024u;
 
 bool StringPointerComparator(const std::string* str1, const std::string* str2) {
   return *str1 < *str2;
@@ -59,87 +64,109 @@ std::string ToHex(convert::ExtendedStringView string) {
   return result;
 }
 
-std::string GetFilePath(ftl::StringView objects_dir,
-                        convert::ExtendedStringView object_id) {
-  std::string hex = ToHex(object_id);
+// Appends the object with the given |object_id| and |data| to |pack_store|.
+// Large objects are split into content-defined chunks, each stored as a
+// separate object, so that the chunks they have in common with other objects
+// are only stored once.
+Status AppendObject(PackStore* pack_store,
+                    ObjectIdView object_id,
+                    ftl::StringView data) {
+  if (data.size() <= kChunkingThreshold) {
+    return pack_store->Append(object_id, data);
+  }
+  if (pack_store->Contains(object_id)) {
+    return Status::OK;
+  }
 
-  FTL_DCHECK(hex.size() > 2);
-  ftl::StringView hex_view = hex;
-  return ftl::Concatenate(
-      {objects_dir, "/", hex_view.substr(0, 2), "/", hex_view.substr(2)});
+  std::vector<PackStore::Chunk> chunks;
+  size_t offset = 0;
+  for (size_t chunk_size : SplitIntoChunks(data)) {
+    ftl::StringView chunk_data = data.substr(offset, chunk_size);
+    ObjectId chunk_id = glue::SHA256Hash(chunk_data.data(), chunk_data.size());
+    Status status = pack_store->Append(chunk_id, chunk_data);
+    if (status != Status::OK) {
+      return status;
+    }
+    chunks.push_back(PackStore::Chunk{std::move(chunk_id), chunk_size});
+    offset += chunk_size;
+  }
+  return pack_store->AppendChunked(object_id, chunks);
 }
 
-Status StagingToDestination(size_t expected_size,
-                            std::string source_path,
-                            std::string destination_path) {
-  // Check if file already exists.
-  size_t size = 0;
-  if (files::GetFileSize(destination_path, &size)) {
-    if (size != expected_size) {
-      // If size is not the correct one, something is really wrong.
-      FTL_LOG(ERROR) << "Internal error. Path \"" << destination_path
-                     << "\" has wrong size. Expected: " << expected_size
-                     << ", but found: " << size;
+class FileWriterOnIOThread;
 
-      return Status::INTERNAL_IO_ERROR;
-    }
-    // Source path already existed at destination. Clear the source.
-    files::DeletePath(source_path, false);
-    return Status::OK;
-  }
+}  // namespace
 
-  std::string destination_dir = files::GetDirectoryName(destination_path);
-  if (!files::IsDirectory(destination_dir) &&
-      !files::CreateDirectory(destination_dir)) {
-    return Status::INTERNAL_IO_ERROR;
+// Groups the syncs of the objects written by |FileWriterOnIOThread|s. Writers
+// that appended an object register themselves with |WhenDurable()|, and a
+// single |PackStore::Sync()|, run from a task on the I/O thread, makes all the
+// objects appended before it durable. All methods must be called on the I/O
+// thread.
+class PackSyncBatcher : public ftl::RefCountedThreadSafe<PackSyncBatcher> {
+ public:
+  static ftl::RefPtr<PackSyncBatcher> Create(
+      PackStore* pack_store,
+      ftl::RefPtr<ftl::TaskRunner> io_runner) {
+    return ftl::AdoptRef(new PackSyncBatcher(pack_store, std::move(io_runner)));
   }
 
-  if (rename(source_path.c_str(), destination_path.c_str()) != 0) {
-    // If rename failed, the file might have been saved by another call.
-    if (!files::GetFileSize(destination_path, &size) || size != expected_size) {
-      FTL_LOG(ERROR) << "Internal error. Failed to rename \n\"" << source_path
-                     << "\" to \n\"" << destination_path << "\"";
-      return Status::INTERNAL_IO_ERROR;
-    }
-    // Source path already existed at destination. Clear the source.
-    files::DeletePath(source_path, false);
-  }
-  return Status::OK;
-}
+  // Calls |writer->OnDurable()| once all the objects appended so far are
+  // durable, unless |writer| is cancelled before.
+  void WhenDurable(FileWriterOnIOThread* writer);
+
+  // Cancels the notification of |writer|, which is being deleted.
+  void Cancel(FileWriterOnIOThread* writer);
+
+ private:
+  FRIEND_REF_COUNTED_THREAD_SAFE(PackSyncBatcher);
+
+  PackSyncBatcher(PackStore* pack_store,
+                  ftl::RefPtr<ftl::TaskRunner> io_runner);
+  ~PackSyncBatcher();
+
+  void SyncPending();
+
+  PackStore* const pack_store_;
+  ftl::RefPtr<ftl::TaskRunner> io_runner_;
+  // Writers waiting for the next sync.
+  std::vector<FileWriterOnIOThread*> pending_;
+  // Writers covered by the sync that just completed and not yet notified.
+  std::vector<FileWriterOnIOThread*> notifying_;
+  bool sync_scheduled_ = false;
+};
+
+namespace {
 
 class FileWriterOnIOThread : public mtl::SocketDrainer::Client {
  public:
-  FileWriterOnIOThread(const std::string& staging_dir,
-                       const std::string& object_dir)
-      : staging_dir_(staging_dir),
-        object_dir_(object_dir),
+  FileWriterOnIOThread(PackStore* pack_store,
+                       ftl::RefPtr<PackSyncBatcher> sync_batcher)
+      : pack_store_(pack_store),
+        sync_batcher_(std::move(sync_batcher)),
         drainer_(this),
         expected_size_(0),
         size_(0u) {}
 
-  ~FileWriterOnIOThread() override {
-    // Cleanup staging file.
-    if (!file_path_.empty()) {
-      fd_.reset();
-      unlink(file_path_.c_str());
-    }
-  }
+  ~FileWriterOnIOThread() override { sync_batcher_->Cancel(this); }
 
   void Start(mx::socket source,
              int64_t expected_size,
+             ObjectId expected_object_id,
              std::function<void(Status, ObjectId)> callback) {
     expected_size_ = expected_size;
+    expected_object_id_ = std::move(expected_object_id);
     callback_ = std::move(callback);
-    // Using mkstemp to create an unique file. XXXXXX will be replaced.
-    file_path_ = staging_dir_ + "/XXXXXX";
-    fd_.reset(mkstemp(&file_path_[0]));
-    if (!fd_.is_valid()) {
-      FTL_LOG(ERROR) << "Unable to create file in staging directory ("
-                     << staging_dir_ << ")";
+    drainer_.Start(std::move(source));
+  }
+
+  // Called by |PackSyncBatcher| once the object is durable, or if syncing
+  // failed.
+  void OnDurable(Status status) {
+    if (status != Status::OK) {
       callback_(Status::INTERNAL_IO_ERROR, "");
       return;
     }
-    drainer_.Start(std::move(source));
+    callback_(Status::OK, std::move(object_id_));
   }
 
  private:
@@ -147,22 +174,17 @@ class FileWriterOnIOThread : public mtl::SocketDrainer::Client {
   void OnDataAvailable(const void* data, size_t num_bytes) override {
     size_ += num_bytes;
     hash_.Update(data, num_bytes);
-    if (!ftl::WriteFileDescriptor(fd_.get(), static_cast<const char*>(data),
-                                  num_bytes)) {
-      FTL_LOG(ERROR) << "Error writing data to disk: " << strerror(errno);
-      callback_(Status::INTERNAL_IO_ERROR, "");
-      return;
+    data_.append(static_cast<const char*>(data), num_bytes);
+    // Past the chunking threshold, the object is stored as chunks: they are
+    // appended as soon as they are complete, so that only the data of the
+    // next chunk is buffered.
+    if (size_ > kChunkingThreshold) {
+      AppendChunks(false);
     }
   }
 
   // mtl::SocketDrainer::Client
   void OnDataComplete() override {
-    if (fsync(fd_.get()) != 0) {
-      FTL_LOG(ERROR) << "Unable to save to disk.";
-      callback_(Status::INTERNAL_IO_ERROR, "");
-      return;
-    }
-    fd_.reset();
     if (expected_size_ >= 0 && size_ != static_cast<size_t>(expected_size_)) {
       FTL_LOG(ERROR) << "Received incorrect number of bytes. Expected: "
                      << expected_size_ << ", but received: " << size_;
@@ -173,40 +195,136 @@ class FileWriterOnIOThread : public mtl::SocketDrainer::Client {
     std::string object_id;
     hash_.Finish(&object_id);
 
-    std::string final_path = storage::GetFilePath(object_dir_, object_id);
-    Status status =
-        StagingToDestination(size_, file_path_, std::move(final_path));
+    if (!expected_object_id_.empty() && object_id != expected_object_id_) {
+      FTL_LOG(ERROR) << "Object ID mismatch. Given ID: "
+                     << ToHex(expected_object_id_)
+                     << ". Found: " << ToHex(object_id);
+      callback_(Status::OBJECT_ID_MISMATCH, std::move(object_id));
+      return;
+    }
+
+    Status status = append_status_;
+    if (status == Status::OK) {
+      if (size_ > kChunkingThreshold) {
+        AppendChunks(true);
+        status = append_status_;
+        if (status == Status::OK) {
+          status = pack_store_->AppendChunked(object_id, chunks_);
+        }
+      } else {
+        status = pack_store_->Append(object_id, data_);
+      }
+    }
+    data_.clear();
+    chunks_.clear();
     if (status != Status::OK) {
       callback_(Status::INTERNAL_IO_ERROR, "");
       return;
     }
 
-    callback_(Status::OK, std::move(object_id));
+    // The callback is only called once the object is durable.
+    object_id_ = std::move(object_id);
+    sync_batcher_->WhenDurable(this);
   }
 
-  const std::string& staging_dir_;
-  const std::string& object_dir_;
+  // Appends the complete chunks of the buffered data, or all of it if |last|
+  // is true. The chunks are the same as the ones |AppendObject()| computes
+  // from the whole data. If the object turns out to be invalid, the chunks
+  // already appended are collected as unused objects.
+  void AppendChunks(bool last) {
+    size_t offset = 0;
+    while (append_status_ == Status::OK && offset < data_.size() &&
+           (last || data_.size() - offset >= kMaxChunkSize)) {
+      ftl::StringView chunk_data = ftl::StringView(data_).substr(offset);
+      chunk_data = chunk_data.substr(0, GetFirstChunkSize(chunk_data));
+      ObjectId chunk_id =
+          glue::SHA256Hash(chunk_data.data(), chunk_data.size());
+      append_status_ = pack_store_->Append(chunk_id, chunk_data);
+      chunks_.push_back(PackStore::Chunk{std::move(chunk_id),
+                                         chunk_data.size()});
+      offset += chunk_data.size();
+    }
+    if (append_status_ != Status::OK) {
+      // The object cannot be stored: the rest of its data is dropped.
+      data_.clear();
+      return;
+    }
+    data_.erase(0, offset);
+  }
+
+  PackStore* const pack_store_;
+  ftl::RefPtr<PackSyncBatcher> sync_batcher_;
+  ObjectId object_id_;
   std::function<void(Status, ObjectId)> callback_;
   mtl::SocketDrainer drainer_;
-  std::string file_path_;
-  ftl::UniqueFD fd_;
+  // Data received and not yet appended: the whole object while it is below
+  // the chunking threshold, then the data of the chunks not yet complete.
+  std::string data_;
+  std::vector<PackStore::Chunk> chunks_;
+  Status append_status_ = Status::OK;
   glue::SHA256StreamingHash hash_;
+  ObjectId expected_object_id_;
   int64_t expected_size_;
   uint64_t size_;
 };
 
 }  // namespace
 
+PackSyncBatcher::PackSyncBatcher(PackStore* pack_store,
+                                 ftl::RefPtr<ftl::TaskRunner> io_runner)
+    : pack_store_(pack_store), io_runner_(std::move(io_runner)) {}
+
+PackSyncBatcher::~PackSyncBatcher() {}
+
+void PackSyncBatcher::WhenDurable(FileWriterOnIOThread* writer) {
+  pending_.push_back(writer);
+  if (sync_scheduled_) {
+    return;
+  }
+  // Objects appended by tasks already queued on the I/O thread are covered by
+  // the same sync.
+  sync_scheduled_ = true;
+  io_runner_->PostTask([self = ftl::RefPtr<PackSyncBatcher>(this)] {
+    self->SyncPending();
+  });
+}
+
+void PackSyncBatcher::Cancel(FileWriterOnIOThread* writer) {
+  pending_.erase(std::remove(pending_.begin(), pending_.end(), writer),
+                 pending_.end());
+  notifying_.erase(std::remove(notifying_.begin(), notifying_.end(), writer),
+                   notifying_.end());
+}
+
+void PackSyncBatcher::SyncPending() {
+  sync_scheduled_ = false;
+  // If all writers have been cancelled, the |PageStorageImpl| owning the pack
+  // store may have been deleted.
+  if (pending_.empty()) {
+    return;
+  }
+  notifying_.swap(pending_);
+  Status status = pack_store_->Sync();
+  // Notifying a writer can delete other writers, which are then removed from
+  // |notifying_|.
+  while (!notifying_.empty()) {
+    FileWriterOnIOThread* writer = notifying_.back();
+    notifying_.pop_back();
+    writer->OnDurable(status);
+  }
+}
+
 class PageStorageImpl::FileWriter {
  public:
   FileWriter(ftl::RefPtr<ftl::TaskRunner> main_runner,
              ftl::RefPtr<ftl::TaskRunner> io_runner,
-             const std::string& staging_dir,
-             const std::string& object_dir)
+             PackStore* pack_store,
+             ftl::RefPtr<PackSyncBatcher> sync_batcher)
       : main_runner_(std::move(main_runner)),
         io_runner_(std::move(io_runner)),
-        file_writer_on_io_thread_(
-            std::make_unique<FileWriterOnIOThread>(staging_dir, object_dir)),
+        file_writer_on_io_thread_(std::make_unique<FileWriterOnIOThread>(
+            pack_store,
+            std::move(sync_batcher))),
         weak_ptr_factory_(this) {
     FTL_DCHECK(main_runner_->RunsTasksOnCurrentThread());
   }
@@ -225,25 +343,29 @@ class PageStorageImpl::FileWriter {
 
   void Start(mx::socket source,
              int64_t expected_size,
+             ObjectId expected_object_id,
              std::function<void(Status, ObjectId)> callback) {
     FTL_DCHECK(main_runner_->RunsTasksOnCurrentThread());
 
     if (io_runner_->RunsTasksOnCurrentThread()) {
       file_writer_on_io_thread_->Start(std::move(source), expected_size,
+                                       std::move(expected_object_id),
                                        std::move(callback));
       return;
     }
     callback_ = std::move(callback);
     io_runner_->PostTask(ftl::MakeCopyable([
       this, weak_this = weak_ptr_factory_.GetWeakPtr(),
-      source = std::move(source), expected_size
+      source = std::move(source), expected_size,
+      expected_object_id = std::move(expected_object_id)
     ]() mutable {
       // Called on the io runner.
 
       // |this| cannot be deleted here, because if the destructor of FileWriter
       // has been called after Start and before this has been run, it is still
       // waiting on the lock to be released as the posts are run in-order.
-      file_writer_on_io_thread_->Start(std::move(source), expected_size, [
+      file_writer_on_io_thread_->Start(std::move(source), expected_size,
+                                       std::move(expected_object_id), [
         weak_this, main_runner = main_runner_
       ](Status status, ObjectId object_id) {
         // Called on the io runner.
@@ -282,10 +404,26 @@ PageStorageImpl::PageStorageImpl(ftl::RefPtr<ftl::TaskRunner> task_runner,
       page_id_(std::move(page_id)),
       db_(this, page_dir_ + kLevelDbDir),
       objects_dir_(page_dir_ + kObjectDir),
-      staging_dir_(page_dir_ + kStagingDir),
-      page_sync_(nullptr) {}
-
-PageStorageImpl::~PageStorageImpl() {}
+      pack_store_(page_dir_ + kPackDir),
+      sync_batcher_(PackSyncBatcher::Create(&pack_store_, io_runner_)),
+      page_sync_(nullptr),
+      live_roots_(std::make_shared<LiveRoots>()) {}
+
+PageStorageImpl::~PageStorageImpl() {
+  if (garbage_collector_) {
+    garbage_collector_->Cancel();
+  }
+  // Save the filter for the next start, to avoid rebuilding it. If it grew
+  // into several filters, it is rebuilt with the right size instead.
+  if (inline_object_filters_.size() == 1) {
+    Status status =
+        db_.SetInlineObjectFilter(inline_object_filters_[0]->ToBytes());
+    if (status != Status::OK) {
+      FTL_LOG(WARNING) << "Unable to save the inline object filter: "
+                       << status;
+    }
+  }
+}
 
 Status PageStorageImpl::Init() {
   // Initialize DB.
@@ -293,12 +431,29 @@ Status PageStorageImpl::Init() {
   if (s != Status::OK) {
     return s;
   }
+  s = InitInlineObjectFilter();
+  if (s != Status::OK) {
+    return s;
+  }
 
-  // Initialize paths.
-  if (!files::CreateDirectory(objects_dir_) ||
-      !files::CreateDirectory(staging_dir_)) {
-    FTL_LOG(ERROR) << "Unable to create directories for PageStorageImpl.";
-    return Status::INTERNAL_IO_ERROR;
+  // Initialize the object store.
+  s = pack_store_.Init();
+  if (s != Status::OK) {
+    FTL_LOG(ERROR) << "Unable to initialize the pack store for PageStorageImpl.";
+    return s;
+  }
+
+  // Move objects stored one file per object by previous versions into the
+  // pack store.
+  if (files::IsDirectory(objects_dir_)) {
+    s = pack_store_.ImportLegacyObjects(objects_dir_);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  std::string staging_dir = page_dir_ + kStagingDir;
+  if (files::IsDirectory(staging_dir)) {
+    files::DeletePath(staging_dir, true);
   }
 
   // Add the default page head if this page is empty.
@@ -317,6 +472,22 @@ Status PageStorageImpl::Init() {
   // TODO(nellyv): The pages node size should be shared across devices.
   db_.SetNodeSize(kDefaultNodeSize);
 
+  // Pages use B-Trees unless another tree type is selected before their first
+  // commit, either through |SetTreeType| or by receiving commits from sync.
+  TreeType tree_type;
+  s = db_.GetTreeType(&tree_type);
+  if (s == Status::NOT_FOUND) {
+    s = db_.SetTreeType(TreeType::BTREE);
+  }
+  if (s != Status::OK) {
+    return s;
+  }
+
+  s = UpdateSyncVersion();
+  if (s != Status::OK) {
+    return s;
+  }
+
   // Remove uncommited explicit journals.
   db_.RemoveExplicitJournals();
 
@@ -376,6 +547,42 @@ Status PageStorageImpl::GetCommit(const CommitId& commit_id,
   return Status::OK;
 }
 
+Status PageStorageImpl::SetTreeType(TreeType tree_type) {
+  std::vector<CommitId> heads;
+  Status s = db_.GetHeads(&heads);
+  if (s != Status::OK) {
+    return s;
+  }
+  if (heads.size() != 1u || heads[0] != kFirstPageCommitId) {
+    return Status::ILLEGAL_STATE;
+  }
+  return db_.SetTreeType(tree_type);
+}
+
+Status PageStorageImpl::CheckTreeType(
+    const std::vector<std::unique_ptr<const Commit>>& commits) {
+  TreeType tree_type = CommitImpl::GetTreeType(*commits.front());
+  for (const auto& commit : commits) {
+    if (CommitImpl::GetTreeType(*commit) != tree_type) {
+      FTL_LOG(ERROR) << "Received commits of different tree types.";
+      return Status::FORMAT_ERROR;
+    }
+  }
+
+  TreeType page_tree_type;
+  Status s = db_.GetTreeType(&page_tree_type);
+  if (s != Status::OK || page_tree_type == tree_type) {
+    return s;
+  }
+  // A page without commits of its own adopts the tree type of its peers.
+  s = SetTreeType(tree_type);
+  if (s == Status::ILLEGAL_STATE) {
+    FTL_LOG(ERROR) << "Received commits of another tree type than the one of "
+                   << "page " << ToHex(page_id_);
+  }
+  return s;
+}
+
 void PageStorageImpl::AddCommitFromLocal(std::unique_ptr<const Commit> commit,
                                          std::function<void(Status)> callback) {
   std::vector<std::unique_ptr<const Commit>> commits;
@@ -421,6 +628,12 @@ void PageStorageImpl::AddCommitsFromSync(
     return;
   }
 
+  Status s = CheckTreeType(commits);
+  if (s != Status::OK) {
+    callback(s);
+    return;
+  }
+
   callback::StatusWaiter<Status> waiter(Status::OK);
   // Get all objects from sync and then add the commit objects.
   for (const auto& leaf : leaves) {
@@ -539,28 +752,23 @@ void PageStorageImpl::AddObjectFromSync(
     mx::socket data,
     size_t size,
     const std::function<void(Status)>& callback) {
-  AddObject(std::move(data), size, [
-    this, object_id = object_id.ToString(), callback
-  ](Status status, ObjectId found_id) {
-    if (status != Status::OK) {
-      callback(status);
-    } else if (found_id != object_id) {
-      FTL_LOG(ERROR) << "Object ID mismatch. Given ID: " << ToHex(object_id)
-                     << ". Found: " << ToHex(found_id);
-      files::DeletePath(GetFilePath(found_id), false);
-      callback(Status::OBJECT_ID_MISMATCH);
-    } else {
-      callback(Status::OK);
-    }
-  });
+  // Objects already stored do not need to be read and written again. The
+  // socket is closed right away, so that the sender stops writing the data.
+  if (ContainsObject(object_id) == Status::OK) {
+    data.reset();
+    callback(Status::OK);
+    return;
+  }
+  AddObject(std::move(data), size, object_id.ToString(),
+            [callback](Status status, ObjectId found_id) { callback(status); });
 }
 
 void PageStorageImpl::AddObjectFromLocal(
     mx::socket data,
     int64_t size,
     const std::function<void(Status, ObjectId)>& callback) {
-  AddObject(std::move(data), size, [ this, callback = std::move(callback) ](
-                                       Status status, ObjectId object_id) {
+  AddObject(std::move(data), size, "", [ this, callback = std::move(callback) ](
+                                           Status status, ObjectId object_id) {
     untracked_objects_.insert(object_id);
     callback(status, std::move(object_id));
   });
@@ -570,25 +778,62 @@ void PageStorageImpl::GetObject(
     ObjectIdView object_id,
     const std::function<void(Status, std::unique_ptr<const Object>)>&
         callback) {
-  std::string file_path = GetFilePath(object_id);
-  if (!files::IsFile(file_path)) {
+  std::unique_ptr<const Object> object;
+  Status status = GetObjectSynchronous(object_id, &object);
+  if (status == Status::NOT_FOUND) {
     GetObjectFromSync(object_id, callback);
     return;
   }
-  callback(Status::OK, std::make_unique<ObjectImpl>(object_id.ToString(),
-                                                    std::move(file_path)));
+  callback(status, std::move(object));
 }
 
 Status PageStorageImpl::GetObjectSynchronous(
     ObjectIdView object_id,
     std::unique_ptr<const Object>* object) {
-  std::string file_path = GetFilePath(object_id);
-  if (!files::IsFile(file_path))
-    return Status::NOT_FOUND;
+  PackStore::Location location;
+  Status status = pack_store_.Find(object_id, &location);
+  if (status == Status::NOT_FOUND) {
+    if (!MayBeInline(object_id)) {
+      return Status::NOT_FOUND;
+    }
+    // Small objects are stored in the database.
+    std::string content;
+    status = db_.GetInlineObject(object_id, &content);
+    if (status != Status::OK)
+      return status;
+    *object = std::make_unique<InlineObjectImpl>(object_id.ToString(),
+                                                 std::move(content));
+    return Status::OK;
+  }
+  if (status != Status::OK)
+    return status;
 
-  *object =
-      std::make_unique<ObjectImpl>(object_id.ToString(), std::move(file_path));
-  return Status::OK;
+  if (location.chunked) {
+    std::vector<PackStore::Chunk> chunks;
+    status = pack_store_.GetChunks(object_id, &chunks);
+    if (status != Status::OK)
+      return status;
+    std::vector<std::unique_ptr<const Object>> chunk_objects;
+    for (const PackStore::Chunk& chunk : chunks) {
+      PackStore::Location chunk_location;
+      std::unique_ptr<const Object> chunk_object;
+      status = pack_store_.Find(chunk.id, &chunk_location);
+      if (status == Status::OK) {
+        status = GetPackedObject(chunk.id, chunk_location, &chunk_object);
+      }
+      if (status != Status::OK) {
+        FTL_LOG(ERROR) << "Missing chunk " << ToHex(chunk.id) << " of object "
+                       << ToHex(object_id);
+        return Status::INTERNAL_IO_ERROR;
+      }
+      chunk_objects.push_back(std::move(chunk_object));
+    }
+    *object = std::make_unique<ChunkedObjectImpl>(object_id.ToString(),
+                                                  std::move(chunk_objects));
+    return Status::OK;
+  }
+
+  return GetPackedObject(object_id, location, object);
 }
 
 Status PageStorageImpl::AddObjectSynchronous(
@@ -596,16 +841,9 @@ Status PageStorageImpl::AddObjectSynchronous(
     std::unique_ptr<const Object>* object) {
   ObjectId object_id = glue::SHA256Hash(data.data(), data.size());
 
-  // Using mkstemp to create an unique file. XXXXXX will be replaced.
-  std::string staging_path = staging_dir_ + "/XXXXXX";
-  ftl::UniqueFD fd(mkstemp(&staging_path[0]));
-  if (!ftl::WriteFileDescriptor(fd.get(), data.data(), data.size()))
-    return Status::INTERNAL_IO_ERROR;
-  if (fsync(fd.get()) != 0)
-    return Status::INTERNAL_IO_ERROR;
-  fd.reset();
-  Status status =
-      StagingToDestination(data.size(), staging_path, GetFilePath(object_id));
+  // The object is only synced with the commit referencing it, see
+  // |AddCommits()|.
+  Status status = AppendObject(&pack_store_, object_id, data);
   if (status != Status::OK)
     return status;
   return GetObjectSynchronous(object_id, object);
@@ -619,6 +857,18 @@ Status PageStorageImpl::GetSyncMetadata(std::string* sync_state) {
   return db_.GetSyncMetadata(sync_state);
 }
 
+TreeNodeCache* PageStorageImpl::GetTreeNodeCache() {
+  return &tree_node_cache_;
+}
+
+std::shared_ptr<LiveRoots> PageStorageImpl::GetLiveRoots() {
+  return live_roots_;
+}
+
+CompressionStats::Snapshot PageStorageImpl::GetCompressionStats() {
+  return pack_store_.compression_stats()->GetSnapshot();
+}
+
 void PageStorageImpl::NotifyWatchers(
     const std::vector<std::unique_ptr<const Commit>>& commits,
     ChangeSource source) {
@@ -631,6 +881,14 @@ void PageStorageImpl::AddCommits(
     std::vector<std::unique_ptr<const Commit>> commits,
     ChangeSource source,
     std::function<void(Status)> callback) {
+  // Make the objects referenced by the commits durable first. This covers all
+  // the tree nodes added with |AddObjectSynchronous()| with a single sync.
+  Status sync_status = pack_store_.Sync();
+  if (sync_status != Status::OK) {
+    callback(sync_status);
+    return;
+  }
+
   // Apply all changes atomically.
   std::unique_ptr<DB::Batch> batch = db_.StartBatch();
   std::set<const CommitId*, decltype(&StringPointerComparator)> added_commits(
@@ -688,7 +946,17 @@ void PageStorageImpl::AddCommits(
     return;
   }
 
+  commits_since_collection_ += commits.size();
   NotifyWatchers(std::move(commits), source);
+
+  if (commits_since_collection_ >= kCommitsBetweenGarbageCollections) {
+    commits_since_collection_ = 0;
+    CollectGarbage([](Status status) {
+      if (status != Status::OK) {
+        FTL_LOG(ERROR) << "Garbage collection failed with status " << status;
+      }
+    });
+  }
 }
 
 Status PageStorageImpl::ContainsCommit(const CommitId& id) {
@@ -706,9 +974,11 @@ bool PageStorageImpl::IsFirstCommit(const CommitId& id) {
 void PageStorageImpl::AddObject(
     mx::socket data,
     int64_t size,
+    ObjectId expected_object_id,
     const std::function<void(Status, ObjectId)>& callback) {
-  auto file_writer = std::make_unique<FileWriter>(main_runner_, io_runner_,
-                                                  staging_dir_, objects_dir_);
+  auto file_writer =
+      std::make_unique<FileWriter>(main_runner_, io_runner_, &pack_store_,
+                                   sync_batcher_);
   FileWriter* file_writer_ptr = file_writer.get();
   writers_.push_back(std::move(file_writer));
 
@@ -720,9 +990,13 @@ void PageStorageImpl::AddObject(
                      });
     FTL_DCHECK(writer_it != writers_.end());
     writers_.erase(writer_it);
+    if (writers_.empty() && !garbage_collection_callbacks_.empty() &&
+        !garbage_collector_) {
+      StartGarbageCollection();
+    }
   };
 
-  file_writer_ptr->Start(std::move(data), size, [
+  file_writer_ptr->Start(std::move(data), size, std::move(expected_object_id), [
     this, cleanup = std::move(cleanup), callback = std::move(callback)
   ](Status status, ObjectId object_id) {
     callback(status, std::move(object_id));
@@ -730,6 +1004,160 @@ void PageStorageImpl::AddObject(
   });
 }
 
+void PageStorageImpl::CollectGarbage(std::function<void(Status)> callback) {
+  garbage_collection_callbacks_.push_back(std::move(callback));
+  if (!garbage_collector_ && garbage_collection_callbacks_.size() == 1) {
+    StartGarbageCollection();
+  }
+}
+
+void PageStorageImpl::StartGarbageCollection() {
+  FTL_DCHECK(!garbage_collector_);
+  // Objects being written are only known to be untracked once written: wait
+  // for them. The collection is started by the last writer.
+  if (!writers_.empty()) {
+    return;
+  }
+
+  // Objects used from now on are kept, so that the roots can be computed
+  // before the collection actually starts.
+  pack_store_.StartCollection();
+  std::vector<ObjectId> root_ids;
+  std::vector<CommitId> history_commit_ids;
+  std::vector<ObjectId> live_object_ids;
+  Status status = GetGarbageCollectionRoots(&root_ids, &history_commit_ids,
+                                            &live_object_ids);
+  if (status != Status::OK) {
+    OnGarbageCollectionDone(status);
+    return;
+  }
+  garbage_collector_ = GarbageCollector::Create(this, &pack_store_,
+                                                main_runner_, io_runner_);
+  garbage_collector_->Start(
+      std::move(root_ids), std::move(history_commit_ids),
+      std::move(live_object_ids),
+      [this](Status status) { OnGarbageCollectionDone(status); });
+}
+
+Status PageStorageImpl::GetGarbageCollectionRoots(
+    std::vector<ObjectId>* root_ids,
+    std::vector<CommitId>* history_commit_ids,
+    std::vector<ObjectId>* live_object_ids) {
+  std::vector<ObjectId> roots = live_roots_->GetRoots();
+
+  // Unsynced commits must be kept until uploaded.
+  std::vector<CommitId> heads;
+  Status s = db_.GetHeads(&heads);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::vector<CommitId> unsynced_commit_ids;
+  s = db_.GetUnsyncedCommitIds(&unsynced_commit_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::set<CommitId> commit_ids(heads.begin(), heads.end());
+  commit_ids.insert(unsynced_commit_ids.begin(), unsynced_commit_ids.end());
+  for (CommitId& commit_id : live_roots_->GetCommits()) {
+    commit_ids.insert(std::move(commit_id));
+  }
+  for (const CommitId& commit_id : commit_ids) {
+    std::unique_ptr<const Commit> commit;
+    s = GetCommit(commit_id, &commit);
+    if (s == Status::NOT_FOUND) {
+      // Journals can be based on unknown commits, but then fail to commit.
+      continue;
+    }
+    if (s != Status::OK) {
+      return s;
+    }
+    roots.push_back(commit->GetRootId());
+  }
+
+  // The trees of the other commits are read synchronously to diff and merge
+  // with them: their nodes are kept, but their values can be fetched again.
+  // Only their ids are listed here: the commits themselves are read by the
+  // collector, on the I/O thread.
+  std::vector<CommitId> all_commit_ids;
+  s = db_.GetCommitIds(&all_commit_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::vector<CommitId> history_commits;
+  for (CommitId& commit_id : all_commit_ids) {
+    if (commit_ids.count(commit_id) == 0) {
+      history_commits.push_back(std::move(commit_id));
+    }
+  }
+
+  // Objects referenced by journals, in the database or in memory, and objects
+  // not uploaded yet, are kept even if they are not part of the trees above.
+  std::vector<ObjectId> live_objects;
+  s = db_.GetJournalObjectIds(&live_objects);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::vector<ObjectId> unsynced_object_ids;
+  s = db_.GetUnsyncedObjectIds(&unsynced_object_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  live_objects.insert(live_objects.end(), unsynced_object_ids.begin(),
+                      unsynced_object_ids.end());
+  live_objects.insert(live_objects.end(), untracked_objects_.begin(),
+                      untracked_objects_.end());
+  for (ObjectId& object_id : live_roots_->GetObjects()) {
+    live_objects.push_back(std::move(object_id));
+  }
+
+  root_ids->swap(roots);
+  history_commit_ids->swap(history_commits);
+  live_object_ids->swap(live_objects);
+  return Status::OK;
+}
+
+Status PageStorageImpl::RemoveUnusedInlineObjects() {
+  // Objects stored in the database are looked up in the pack store first, so
+  // that their use is tracked in the same way.
+  std::vector<ObjectId> object_ids;
+  Status s = db_.GetInlineObjectIds(&object_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::vector<ObjectId> kept_object_ids;
+  std::unique_ptr<DB::Batch> batch = db_.StartBatch();
+  for (ObjectId& object_id : object_ids) {
+    if (pack_store_.WasUsedDuringCollection(object_id)) {
+      kept_object_ids.push_back(std::move(object_id));
+      continue;
+    }
+    s = db_.RemoveInlineObject(object_id);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  s = batch->Execute();
+  if (s != Status::OK) {
+    return s;
+  }
+  // Removed objects cannot be removed from the filter.
+  ResetInlineObjectFilter(kept_object_ids);
+  return Status::OK;
+}
+
+void PageStorageImpl::OnGarbageCollectionDone(Status status) {
+  if (status == Status::OK) {
+    status = RemoveUnusedInlineObjects();
+  }
+  pack_store_.EndCollection();
+  garbage_collector_ = nullptr;
+  std::vector<std::function<void(Status)>> callbacks;
+  callbacks.swap(garbage_collection_callbacks_);
+  for (const auto& callback : callbacks) {
+    callback(status);
+  }
+}
+
 void PageStorageImpl::GetObjectFromSync(
     ObjectIdView object_id,
     const std::function<void(Status, std::unique_ptr<const Object>)>&
@@ -752,22 +1180,178 @@ void PageStorageImpl::GetObjectFromSync(
         callback(status, nullptr);
         return;
       }
-      std::string file_path = GetFilePath(object_id);
-      FTL_DCHECK(files::IsFile(file_path));
-      callback(Status::OK, std::make_unique<ObjectImpl>(std::move(object_id),
-                                                        std::move(file_path)));
+      std::unique_ptr<const Object> object;
+      status = GetObjectSynchronous(object_id, &object);
+      FTL_DCHECK(status != Status::NOT_FOUND);
+      callback(status, std::move(object));
     });
   });
 }
 
-std::string PageStorageImpl::GetFilePath(ObjectIdView object_id) const {
-  return storage::GetFilePath(objects_dir_, object_id);
+Status PageStorageImpl::GetPackedObject(
+    ObjectIdView object_id,
+    PackStore::Location location,
+    std::unique_ptr<const Object>* object) {
+  std::shared_ptr<SegmentFile> file;
+  Status s = pack_store_.GetSegmentFile(location.segment, &file);
+  while (s == Status::NOT_FOUND) {
+    s = pack_store_.Find(object_id, &location);
+    if (s != Status::OK) {
+      return s;
+    }
+    s = pack_store_.GetSegmentFile(location.segment, &file);
+  }
+  if (s != Status::OK) {
+    return s;
+  }
+  FTL_DCHECK(!location.chunked);
+  auto packed_object = std::make_unique<ObjectImpl>(
+      object_id.ToString(), std::move(file), location.offset, location.size);
+  if (!location.compressed) {
+    *object = std::move(packed_object);
+    return Status::OK;
+  }
+  *object = std::make_unique<CompressedObjectImpl>(
+      object_id.ToString(), std::move(packed_object),
+      pack_store_.compression_stats());
+  return Status::OK;
+}
+
+Status PageStorageImpl::ContainsObject(ObjectIdView object_id) {
+  if (pack_store_.Contains(object_id)) {
+    return Status::OK;
+  }
+  if (!MayBeInline(object_id)) {
+    return Status::NOT_FOUND;
+  }
+  std::string content;
+  return db_.GetInlineObject(object_id, &content);
 }
 
 bool PageStorageImpl::ObjectIsUntracked(ObjectIdView object_id) {
   return untracked_objects_.find(object_id) != untracked_objects_.end();
 }
 
+void PageStorageImpl::MarkObjectInline(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(inline_object_filter_mutex_);
+  if (inline_object_filters_.empty()) {
+    return;
+  }
+  // A full filter is not rebuilt from the database, which would make each
+  // addition cost a scan of all the objects: a larger one is added instead.
+  BloomFilter* filter = inline_object_filters_.back().get();
+  if (filter->size() >= filter->capacity()) {
+    inline_object_filters_.push_back(
+        std::make_unique<BloomFilter>(2 * filter->capacity()));
+    filter = inline_object_filters_.back().get();
+  }
+  filter->Add(object_id);
+}
+
+Status PageStorageImpl::UpdateSyncVersion() {
+  std::string version;
+  Status s = db_.GetSyncVersion(&version);
+  if (s == Status::OK && version == kSyncSerializationVersion) {
+    return Status::OK;
+  }
+  if (s != Status::OK && s != Status::NOT_FOUND) {
+    return s;
+  }
+
+  std::vector<CommitId> commit_ids;
+  s = db_.GetCommitIds(&commit_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  std::unique_ptr<DB::Batch> batch = db_.StartBatch();
+  for (const CommitId& commit_id : commit_ids) {
+    std::unique_ptr<const Commit> commit;
+    s = GetCommit(commit_id, &commit);
+    if (s != Status::OK) {
+      return s;
+    }
+    // Unsynced commits are uploaded in the order of the given timestamps:
+    // the generation makes parents go before their children, and before the
+    // commits made from now on.
+    s = db_.MarkCommitIdUnsynced(commit_id, commit->GetGeneration());
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  // The commits of the new namespace are downloaded from the start.
+  s = db_.RemoveSyncMetadata();
+  if (s != Status::OK) {
+    return s;
+  }
+  s = db_.SetSyncVersion(kSyncSerializationVersion);
+  if (s != Status::OK) {
+    return s;
+  }
+  return batch->Execute();
+}
+
+Status PageStorageImpl::InitInlineObjectFilter() {
+  std::string bytes;
+  Status s = db_.GetInlineObjectFilter(&bytes);
+  if (s == Status::NOT_FOUND) {
+    return RebuildInlineObjectFilter();
+  }
+  if (s != Status::OK) {
+    return s;
+  }
+  // The saved filter misses the objects added after this point: remove it, so
+  // that it is not used if the page is not shut down cleanly. LevelDB keeps
+  // the order of writes, so no object can be stored without this removal.
+  s = db_.RemoveInlineObjectFilter();
+  if (s != Status::OK) {
+    return s;
+  }
+  std::unique_ptr<BloomFilter> filter = BloomFilter::FromBytes(bytes);
+  if (!filter) {
+    FTL_LOG(WARNING) << "Invalid inline object filter, rebuilding it.";
+    return RebuildInlineObjectFilter();
+  }
+  std::lock_guard<std::mutex> lock(inline_object_filter_mutex_);
+  inline_object_filters_.clear();
+  inline_object_filters_.push_back(std::move(filter));
+  return Status::OK;
+}
+
+void PageStorageImpl::ResetInlineObjectFilter(
+    const std::vector<ObjectId>& object_ids) {
+  auto filter = std::make_unique<BloomFilter>(
+      std::max(2 * object_ids.size(), kMinInlineObjectFilterCapacity));
+  for (const ObjectId& object_id : object_ids) {
+    filter->Add(object_id);
+  }
+  std::lock_guard<std::mutex> lock(inline_object_filter_mutex_);
+  inline_object_filters_.clear();
+  inline_object_filters_.push_back(std::move(filter));
+}
+
+Status PageStorageImpl::RebuildInlineObjectFilter() {
+  std::vector<ObjectId> object_ids;
+  Status s = db_.GetInlineObjectIds(&object_ids);
+  if (s != Status::OK) {
+    return s;
+  }
+  ResetInlineObjectFilter(object_ids);
+  return Status::OK;
+}
+
+bool PageStorageImpl::MayBeInline(ObjectIdView object_id) {
+  std::lock_guard<std::mutex> lock(inline_object_filter_mutex_);
+  if (inline_object_filters_.empty()) {
+    return true;
+  }
+  for (const auto& filter : inline_object_filters_) {
+    if (filter->MayContain(object_id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 void PageStorageImpl::MarkObjectTracked(ObjectIdView object_id) {
   auto it = untracked_objects_.find(object_id);
   if (it != untracked_objects_.end()) {
@@ -775,4 +1359,8 @@ void PageStorageImpl::MarkObjectTracked(ObjectIdView object_id) {
   }
 }
 
+void PageStorageImpl::MarkObjectUntracked(ObjectIdView object_id) {
+  untracked_objects_.insert(object_id.ToString());
+}
+
 }  // namespace storage
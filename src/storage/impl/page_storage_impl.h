@@ -7,10 +7,14 @@
 
 #include "apps/ledger/src/storage/public/page_storage.h"
 
+#include <mutex>
 #include <set>
 
 #include "apps/ledger/src/convert/convert.h"
+#include "apps/ledger/src/storage/impl/bloom_filter.h"
+#include "apps/ledger/src/storage/impl/btree/tree_node_cache.h"
 #include "apps/ledger/src/storage/impl/db_impl.h"
+#include "apps/ledger/src/storage/impl/pack_store.h"
 #include "apps/ledger/src/storage/public/page_sync_delegate.h"
 #include "lib/ftl/memory/ref_ptr.h"
 #include "lib/ftl/strings/string_view.h"
@@ -18,6 +22,10 @@
 
 namespace storage {
 
+class GarbageCollector;
+class LiveRoots;
+class PackSyncBatcher;
+
 class PageStorageImpl : public PageStorage {
  public:
   PageStorageImpl(ftl::RefPtr<ftl::TaskRunner> main_runner,
@@ -43,6 +51,24 @@ class PageStorageImpl : public PageStorage {
   // Marks the given object as tracked.
   void MarkObjectTracked(ObjectIdView object_id);
 
+  // Marks the given object, stored by a journal, as untracked: it is only
+  // marked as unsynced once a commit references it.
+  void MarkObjectUntracked(ObjectIdView object_id);
+
+  // Records that the object with the given |object_id| is stored in the
+  // database, so that it is looked up there.
+  void MarkObjectInline(ObjectIdView object_id);
+
+  // Removes the local objects that are not reachable from the heads, the
+  // unsynced commits and the commits in use, and are neither untracked,
+  // referenced by a journal nor waiting to be uploaded. Removed objects are
+  // fetched again from the cloud if needed. Commits themselves, and the tree
+  // nodes of all of them, are kept, as the history is needed to merge and
+  // sync and trees are read synchronously. The collection runs in the
+  // background; |callback| is called once it is done. If a collection is
+  // already running, |callback| is called when it completes.
+  void CollectGarbage(std::function<void(Status)> callback);
+
   // PageStorage:
   PageId GetId() override;
   void SetSyncDelegate(PageSyncDelegate* page_sync) override;
@@ -86,6 +112,13 @@ class PageStorageImpl : public PageStorage {
                               std::unique_ptr<const Object>* object) override;
   Status SetSyncMetadata(ftl::StringView sync_state) override;
   Status GetSyncMetadata(std::string* sync_state) override;
+  Status SetTreeType(TreeType tree_type) override;
+  TreeNodeCache* GetTreeNodeCache() override;
+  std::shared_ptr<LiveRoots> GetLiveRoots() override;
+  Status ContainsObject(ObjectIdView object_id) override;
+
+  // Returns the statistics about the compression of the objects of this page.
+  CompressionStats::Snapshot GetCompressionStats();
 
  private:
   friend class PageStorageImplAccessorForTest;
@@ -96,14 +129,54 @@ class PageStorageImpl : public PageStorage {
                   std::function<void(Status)> callback);
   Status ContainsCommit(const CommitId& id);
   bool IsFirstCommit(const CommitId& id);
+  // Checks that the given commits received from sync all use the tree type of
+  // this page, or selects their tree type if the page has no commit yet.
+  Status CheckTreeType(
+      const std::vector<std::unique_ptr<const Commit>>& commits);
+  // Marks all commits as unsynced and removes the sync metadata if the page
+  // was synced under another serialization version, so that its history is
+  // uploaded again to the namespace of the current version.
+  Status UpdateSyncVersion();
+  // Adds the content of |data| to the pack store. If |expected_object_id| is
+  // not empty and does not match the computed id, the object is not stored and
+  // |OBJECT_ID_MISMATCH| is returned.
   void AddObject(mx::socket data,
                  int64_t size,
+                 ObjectId expected_object_id,
                  const std::function<void(Status, ObjectId)>& callback);
   void GetObjectFromSync(
       ObjectIdView object_id,
       const std::function<void(Status, std::unique_ptr<const Object>)>&
           callback);
-  std::string GetFilePath(ObjectIdView object_id) const;
+  // Finds the object with the given |object_id|, stored at |location| in the
+  // pack store and not chunked. If a compaction moved the object since
+  // |location| was found, the object is looked up again.
+  Status GetPackedObject(ObjectIdView object_id,
+                         PackStore::Location location,
+                         std::unique_ptr<const Object>* object);
+
+  // Starts the pending garbage collection, unless objects are being written.
+  void StartGarbageCollection();
+  // Computes the roots of the trees to keep, the commits of the trees of which
+  // only the nodes are kept, and the other objects to keep.
+  Status GetGarbageCollectionRoots(std::vector<ObjectId>* root_ids,
+                                   std::vector<CommitId>* history_commit_ids,
+                                   std::vector<ObjectId>* live_object_ids);
+  // Removes the objects stored in the database that were not used during the
+  // garbage collection.
+  Status RemoveUnusedInlineObjects();
+  void OnGarbageCollectionDone(Status status);
+
+  // Loads the filter over the objects stored in the database saved on the last
+  // shutdown, or rebuilds it.
+  Status InitInlineObjectFilter();
+  // Replaces the filters over the objects stored in the database with one
+  // containing |object_ids|.
+  void ResetInlineObjectFilter(const std::vector<ObjectId>& object_ids);
+  Status RebuildInlineObjectFilter();
+  // Returns false if the object with the given |object_id| is definitely not
+  // stored in the database.
+  bool MayBeInline(ObjectIdView object_id);
 
   // Notifies the registered watchers with the given |commits|.
   void NotifyWatchers(const std::vector<std::unique_ptr<const Commit>>& commits,
@@ -117,9 +190,24 @@ class PageStorageImpl : public PageStorage {
   std::vector<CommitWatcher*> watchers_;
   std::set<ObjectId, convert::StringViewComparator> untracked_objects_;
   std::string objects_dir_;
-  std::string staging_dir_;
+  PackStore pack_store_;
+  ftl::RefPtr<PackSyncBatcher> sync_batcher_;
+  TreeNodeCache tree_node_cache_;
   std::vector<std::unique_ptr<FileWriter>> writers_;
   PageSyncDelegate* page_sync_;
+  std::shared_ptr<LiveRoots> live_roots_;
+  ftl::RefPtr<GarbageCollector> garbage_collector_;
+  // Callbacks waiting for the running or pending garbage collection.
+  std::vector<std::function<void(Status)>> garbage_collection_callbacks_;
+  size_t commits_since_collection_ = 0;
+  // Filters over the ids of the objects stored in the database, so that
+  // looking up an object that is not stored locally does not require a
+  // database read. Objects are added to the last filter; once it is full, a
+  // larger one is added, until the filters are replaced by a single one on
+  // startup or after a garbage collection. Guarded by
+  // |inline_object_filter_mutex_|, as objects are read from the I/O thread too.
+  std::mutex inline_object_filter_mutex_;
+  std::vector<std::unique_ptr<BloomFilter>> inline_object_filters_;
 };
 
 }  // namespace storage
@@ -4,8 +4,6 @@
 
 #include "apps/ledger/src/storage/impl/page_storage_impl.h"
 
-#include <dirent.h>
-
 #include <chrono>
 #include <memory>
 #include <mutex>
@@ -13,6 +11,7 @@
 
 #include "apps/ledger/src/glue/crypto/hash.h"
 #include "apps/ledger/src/glue/crypto/rand.h"
+#include "apps/ledger/src/glue/socket/socket_pair.h"
 #include "apps/ledger/src/storage/impl/btree/tree_node.h"
 #include "apps/ledger/src/storage/impl/commit_impl.h"
 #include "apps/ledger/src/storage/impl/db_empty_impl.h"
@@ -30,6 +29,7 @@
 #include "lib/ftl/functional/make_copyable.h"
 #include "lib/ftl/macros.h"
 #include "lib/ftl/strings/string_number_conversions.h"
+#include "lib/ftl/strings/string_printf.h"
 #include "lib/mtl/socket/strings.h"
 #include "lib/mtl/tasks/message_loop.h"
 #include "lib/mtl/threading/create_thread.h"
@@ -38,40 +38,36 @@ namespace storage {
 
 class PageStorageImplAccessorForTest {
  public:
-  static std::string GetFilePath(const PageStorageImpl& storage,
-                                 ObjectIdView object_id) {
-    return storage.GetFilePath(object_id);
+  static Status AddObjectToPackStore(PageStorageImpl* storage,
+                                     ObjectIdView object_id,
+                                     ftl::StringView data) {
+    return storage->pack_store_.Add(object_id, data);
   }
-};
 
-namespace {
+  static Status RemoveObjectFromPackStore(PageStorageImpl* storage,
+                                          ObjectIdView object_id) {
+    return storage->pack_store_.Remove(object_id);
+  }
 
-void SafeCloseDir(DIR* dir) {
-  if (dir)
-    closedir(dir);
-}
-
-bool IsDirectoryEmpty(const std::string& directory) {
-  std::unique_ptr<DIR, decltype(&SafeCloseDir)> dir(opendir(directory.c_str()),
-                                                    SafeCloseDir);
-  if (!dir.get())
-    return true;
-
-  for (struct dirent* entry = readdir(dir.get()); entry != nullptr;
-       entry = readdir(dir.get())) {
-    char* name = entry->d_name;
-    if (name[0]) {
-      if (name[0] == '.') {
-        if (!name[1] || (name[1] == '.' && !name[2])) {
-          // . or ..
-          continue;
-        }
-      }
-    }
-    return false;
+  static Status GetChunksFromPackStore(PageStorageImpl* storage,
+                                       ObjectIdView object_id,
+                                       std::vector<PackStore::Chunk>* chunks) {
+    return storage->pack_store_.GetChunks(object_id, chunks);
+  }
+
+  static Status IsObjectSynced(PageStorageImpl* storage,
+                               ObjectIdView object_id,
+                               bool* is_synced) {
+    return storage->db_.IsObjectSynced(object_id, is_synced);
   }
-  return true;
-}
+
+  static Status SetSyncVersion(PageStorageImpl* storage,
+                               ftl::StringView version) {
+    return storage->db_.SetSyncVersion(version);
+  }
+};
+
+namespace {
 
 std::string RandomId(size_t size) {
   std::string result;
@@ -80,6 +76,16 @@ std::string RandomId(size_t size) {
   return result;
 }
 
+std::string ToHex(ftl::StringView bytes) {
+  const char kHexDigits[] = "0123456789ABCDEF";
+  std::string result;
+  for (unsigned char c : bytes) {
+    result.push_back(kHexDigits[c >> 4]);
+    result.push_back(kHexDigits[c & 0xf]);
+  }
+  return result;
+}
+
 std::vector<PageStorage::CommitIdAndBytes> CommitAndBytesFromCommit(
     const Commit& commit) {
   std::vector<PageStorage::CommitIdAndBytes> result;
@@ -185,9 +191,8 @@ class PageStorageTest : public ::test::TestWithMessageLoop {
   }
 
   void TearDown() override {
-    std::string staging_directory = tmp_dir_.path() + "/staging";
-    EXPECT_TRUE(files::IsDirectory(staging_directory));
-    EXPECT_TRUE(IsDirectoryEmpty(staging_directory));
+    EXPECT_TRUE(files::IsDirectory(tmp_dir_.path() + "/packs"));
+    EXPECT_FALSE(files::IsDirectory(tmp_dir_.path() + "/objects"));
 
     io_runner_->PostTask([] { mtl::MessageLoop::GetCurrent()->QuitNow(); });
     io_thread_.join();
@@ -196,8 +201,41 @@ class PageStorageTest : public ::test::TestWithMessageLoop {
   }
 
  protected:
-  std::string GetFilePath(ObjectIdView object_id) {
-    return PageStorageImplAccessorForTest::GetFilePath(*storage_, object_id);
+  Status AddObjectToPackStore(ObjectIdView object_id, ftl::StringView data) {
+    return PageStorageImplAccessorForTest::AddObjectToPackStore(
+        storage_.get(), object_id, data);
+  }
+
+  Status RemoveObjectFromPackStore(ObjectIdView object_id) {
+    return PageStorageImplAccessorForTest::RemoveObjectFromPackStore(
+        storage_.get(), object_id);
+  }
+
+  Status GetChunksFromPackStore(ObjectIdView object_id,
+                                std::vector<PackStore::Chunk>* chunks) {
+    return PageStorageImplAccessorForTest::GetChunksFromPackStore(
+        storage_.get(), object_id, chunks);
+  }
+
+  Status IsObjectSynced(ObjectIdView object_id, bool* is_synced) {
+    return PageStorageImplAccessorForTest::IsObjectSynced(storage_.get(),
+                                                          object_id, is_synced);
+  }
+
+  Status SetSyncVersion(ftl::StringView version) {
+    return PageStorageImplAccessorForTest::SetSyncVersion(storage_.get(),
+                                                          version);
+  }
+
+  std::string GetObjectContent(ObjectIdView object_id) {
+    std::unique_ptr<const Object> object;
+    EXPECT_EQ(Status::OK, storage_->GetObjectSynchronous(object_id, &object));
+    if (!object) {
+      return "";
+    }
+    ftl::StringView data;
+    EXPECT_EQ(Status::OK, object->GetData(&data));
+    return data.ToString();
   }
 
   std::unique_ptr<const Commit> GetFirstHead() {
@@ -355,8 +393,7 @@ TEST_F(PageStorageTest, AddGetSyncedCommits) {
   sync.AddObject(root_id, root_data.ToString());
 
   // Remove the root from the local storage. The two values were never added.
-  std::string file_path = GetFilePath(root_id);
-  files::DeletePath(file_path, false);
+  EXPECT_EQ(Status::OK, RemoveObjectFromPackStore(root_id));
 
   std::vector<std::unique_ptr<const Commit>> parent;
   parent.emplace_back(GetFirstHead());
@@ -463,11 +500,11 @@ TEST_F(PageStorageTest, JournalCommitFailsAfterFailedOperation) {
 
   std::unique_ptr<Journal> journal;
   // Explicit journals.
-  // The first call will fail because FakeDBImpl::AddJournalEntry() returns an
+  // The first call will fail because FakeDBImpl::AddInlineObject() returns an
   // error. After a failed call all other Put/Delete/Commit operations should
   // fail with ILLEGAL_STATE. Rollback should not fail with ILLEGAL_STATE.
   db.CreateJournal(JournalType::EXPLICIT, RandomId(kCommitIdSize), &journal);
-  EXPECT_NE(Status::OK, journal->Put("key", "value", KeyPriority::EAGER));
+  EXPECT_NE(Status::OK, journal->PutValue("key", "value", KeyPriority::EAGER));
   EXPECT_EQ(Status::ILLEGAL_STATE,
             journal->Put("key", "value", KeyPriority::EAGER));
   EXPECT_EQ(Status::ILLEGAL_STATE, journal->Delete("key"));
@@ -504,6 +541,355 @@ TEST_F(PageStorageTest, DestroyUncommittedJournal) {
             journal->Put("key", RandomId(kObjectIdSize), KeyPriority::EAGER));
 }
 
+TEST_F(PageStorageTest, JournalPutValue) {
+  ObjectData data("Some data");
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK, journal->PutValue("key", data.value,
+                                          KeyPriority::EAGER));
+
+  // The value is stored inline, not in the pack store.
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(data.object_id));
+  EXPECT_EQ(Status::NOT_FOUND, RemoveObjectFromPackStore(data.object_id));
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
+  // It is only marked as unsynced when the journal is committed.
+  EXPECT_TRUE(storage_->ObjectIsUntracked(data.object_id));
+  bool is_synced;
+  ASSERT_EQ(Status::OK, IsObjectSynced(data.object_id, &is_synced));
+  EXPECT_TRUE(is_synced);
+
+  CommitId commit_id;
+  journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+    EXPECT_EQ(Status::OK, status);
+    commit_id = id;
+    message_loop_.PostQuitTask();
+  });
+  EXPECT_FALSE(RunLoopWithTimeout());
+
+  std::unique_ptr<const Commit> commit;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+  std::unique_ptr<Iterator<const Entry>> contents =
+      commit->GetContents()->find("key");
+  ASSERT_TRUE(contents->Valid());
+  EXPECT_EQ(data.object_id, (*contents)->object_id);
+
+  // The value must be synced with the commit.
+  Status status;
+  std::vector<ObjectId> objects;
+  storage_->GetUnsyncedObjectIds(
+      commit_id,
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &objects));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_TRUE(std::find(objects.begin(), objects.end(), data.object_id) !=
+              objects.end());
+  EXPECT_FALSE(storage_->ObjectIsUntracked(data.object_id));
+}
+
+TEST_F(PageStorageTest, JournalPutValueRollback) {
+  ObjectData data("Some data");
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK, journal->PutValue("key", data.value,
+                                          KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK, journal->Rollback());
+
+  // The value of a rolled back journal is never uploaded.
+  bool is_synced;
+  ASSERT_EQ(Status::OK, IsObjectSynced(data.object_id, &is_synced));
+  EXPECT_TRUE(is_synced);
+}
+
+TEST_F(PageStorageTest, CommitManyEntries) {
+  // The first journal is large relative to the empty tree, and is committed by
+  // building a new tree. The second one updates the existing tree.
+  std::vector<ObjectId> object_ids;
+  for (int step = 0; step < 2; ++step) {
+    std::unique_ptr<Journal> journal;
+    EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                                JournalType::EXPLICIT,
+                                                &journal));
+    int key_count = step == 0 ? 1000 : 1;
+    for (int i = 0; i < key_count; ++i) {
+      ObjectId object_id = RandomId(kObjectIdSize);
+      EXPECT_EQ(Status::OK, journal->Put(ftl::StringPrintf("key%04d", i),
+                                         object_id, KeyPriority::EAGER));
+      if (step == 0) {
+        object_ids.push_back(object_id);
+      } else {
+        object_ids[i] = object_id;
+      }
+    }
+
+    CommitId commit_id;
+    journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+      EXPECT_EQ(Status::OK, status);
+      commit_id = id;
+      message_loop_.PostQuitTask();
+    });
+    EXPECT_FALSE(RunLoopWithTimeout());
+
+    std::unique_ptr<const Commit> commit;
+    ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+    std::unique_ptr<Iterator<const Entry>> contents =
+        commit->GetContents()->begin();
+    for (size_t i = 0; i < object_ids.size(); ++i) {
+      ASSERT_TRUE(contents->Valid());
+      EXPECT_EQ(ftl::StringPrintf("key%04zu", i), (*contents)->key);
+      EXPECT_EQ(object_ids[i], (*contents)->object_id);
+      contents->Next();
+    }
+    EXPECT_FALSE(contents->Valid());
+  }
+}
+
+TEST_F(PageStorageTest, LargeExplicitJournal) {
+  // The changes of the journal outgrow the memory and are written to the
+  // database halfway through.
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  std::string key_prefix(1000, 'k');
+  EXPECT_EQ(Status::OK, journal->DeleteRange(key_prefix + "3000", ""));
+  for (int i = 0; i < 5000; ++i) {
+    EXPECT_EQ(Status::OK,
+              journal->Put(key_prefix + ftl::StringPrintf("%04d", i),
+                           RandomId(kObjectIdSize), KeyPriority::EAGER));
+  }
+  EXPECT_EQ(Status::OK, journal->Delete(key_prefix + "0000"));
+  EXPECT_EQ(Status::OK, journal->DeleteRange(key_prefix + "4000", ""));
+  CommitId commit_id;
+  journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+    EXPECT_EQ(Status::OK, status);
+    commit_id = id;
+    message_loop_.PostQuitTask();
+  });
+  EXPECT_FALSE(RunLoopWithTimeout());
+
+  std::unique_ptr<const Commit> commit;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+  std::unique_ptr<Iterator<const Entry>> contents =
+      commit->GetContents()->begin();
+  for (int i = 1; i < 4000; ++i) {
+    ASSERT_TRUE(contents->Valid());
+    EXPECT_EQ(key_prefix + ftl::StringPrintf("%04d", i), (*contents)->key);
+    contents->Next();
+  }
+  EXPECT_FALSE(contents->Valid());
+}
+
+TEST_F(PageStorageTest, JournalDeleteRange) {
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_EQ(Status::OK, journal->Put(ftl::StringPrintf("key%04d", i),
+                                       RandomId(kObjectIdSize),
+                                       KeyPriority::EAGER));
+  }
+  CommitId commit_id;
+  journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+    EXPECT_EQ(Status::OK, status);
+    commit_id = id;
+    message_loop_.PostQuitTask();
+  });
+  EXPECT_FALSE(RunLoopWithTimeout());
+
+  // Entries put before the deletion of their range are dropped, and those put
+  // after it are kept.
+  EXPECT_EQ(Status::OK,
+            storage_->StartCommit(commit_id, JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK, journal->Put("key0150", RandomId(kObjectIdSize),
+                                     KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK, journal->DeleteRange("key0100", "key0900"));
+  ObjectId object_id = RandomId(kObjectIdSize);
+  EXPECT_EQ(Status::OK,
+            journal->Put("key0500", object_id, KeyPriority::EAGER));
+  journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+    EXPECT_EQ(Status::OK, status);
+    commit_id = id;
+    message_loop_.PostQuitTask();
+  });
+  EXPECT_FALSE(RunLoopWithTimeout());
+
+  std::vector<std::string> expected_keys;
+  for (int i = 0; i < 1000; ++i) {
+    if (i < 100 || i == 500 || i >= 900) {
+      expected_keys.push_back(ftl::StringPrintf("key%04d", i));
+    }
+  }
+  std::unique_ptr<const Commit> commit;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+  std::unique_ptr<Iterator<const Entry>> contents =
+      commit->GetContents()->begin();
+  for (const std::string& key : expected_keys) {
+    ASSERT_TRUE(contents->Valid());
+    EXPECT_EQ(key, (*contents)->key);
+    if (key == "key0500") {
+      EXPECT_EQ(object_id, (*contents)->object_id);
+    }
+    contents->Next();
+  }
+  EXPECT_FALSE(contents->Valid());
+}
+
+TEST_F(PageStorageTest, HashTreePage) {
+  EXPECT_EQ(Status::OK, storage_->SetTreeType(TreeType::HASH_TREE));
+  std::unique_ptr<const Commit> first_head = GetFirstHead();
+
+  // Builds a commit on top of |parent_id| holding the keys in [begin, end).
+  auto commit_keys = [this](const CommitId& parent_id, int begin, int end) {
+    std::unique_ptr<Journal> journal;
+    EXPECT_EQ(Status::OK, storage_->StartCommit(
+                              parent_id, JournalType::EXPLICIT, &journal));
+    for (int i = begin; i < end; ++i) {
+      EXPECT_EQ(Status::OK,
+                journal->Put(ftl::StringPrintf("key%04d", i),
+                             ftl::StringPrintf(
+                                 "%0*d", static_cast<int>(kObjectIdSize), i),
+                             KeyPriority::EAGER));
+    }
+    CommitId commit_id;
+    journal->Commit([this, &commit_id](Status status, const CommitId& id) {
+      EXPECT_EQ(Status::OK, status);
+      commit_id = id;
+      message_loop_.PostQuitTask();
+    });
+    EXPECT_FALSE(RunLoopWithTimeout());
+    std::unique_ptr<const Commit> commit;
+    EXPECT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+    return commit;
+  };
+
+  std::unique_ptr<const Commit> commit =
+      commit_keys(first_head->GetId(), 0, 200);
+  std::unique_ptr<Iterator<const Entry>> contents =
+      commit->GetContents()->begin();
+  for (int i = 0; i < 200; ++i) {
+    ASSERT_TRUE(contents->Valid());
+    EXPECT_EQ(ftl::StringPrintf("key%04d", i), (*contents)->key);
+    contents->Next();
+  }
+  EXPECT_FALSE(contents->Valid());
+  EXPECT_EQ(TreeType::HASH_TREE, CommitImpl::GetTreeType(*commit));
+
+  // The same contents, built in two steps, give the same tree.
+  std::unique_ptr<const Commit> half =
+      commit_keys(first_head->GetId(), 100, 200);
+  EXPECT_EQ(commit->GetRootId(),
+            commit_keys(half->GetId(), 0, 100)->GetRootId());
+
+  // The tree type cannot be changed once the page has commits.
+  EXPECT_EQ(Status::ILLEGAL_STATE, storage_->SetTreeType(TreeType::BTREE));
+}
+
+TEST_F(PageStorageTest, SyncTreeType) {
+  FakeSyncDelegate sync;
+  storage_->SetSyncDelegate(&sync);
+
+  ObjectId root_id;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromEntries(storage_.get(), std::vector<Entry>(),
+                                  std::vector<ObjectId>(1), &root_id));
+  auto make_commit = [this, &root_id](TreeType tree_type) {
+    std::vector<std::unique_ptr<const Commit>> parent;
+    parent.emplace_back(GetFirstHead());
+    return CommitImpl::FromContentAndParents(storage_.get(), root_id,
+                                             std::move(parent), tree_type);
+  };
+  auto add_commit = [this](const Commit& commit) {
+    Status result;
+    storage_->AddCommitsFromSync(CommitAndBytesFromCommit(commit),
+                                 [this, &result](Status status) {
+                                   result = status;
+                                   message_loop_.PostQuitTask();
+                                 });
+    EXPECT_FALSE(RunLoopWithTimeout());
+    return result;
+  };
+
+  // B-Tree commits keep their format, and the tree type is part of the others.
+  std::unique_ptr<Commit> btree_commit = make_commit(TreeType::BTREE);
+  std::unique_ptr<Commit> hash_tree_commit = make_commit(TreeType::HASH_TREE);
+  EXPECT_EQ(btree_commit->GetStorageBytes().size() + 1,
+            hash_tree_commit->GetStorageBytes().size());
+  std::unique_ptr<const Commit> parsed = CommitImpl::FromStorageBytes(
+      storage_.get(), hash_tree_commit->GetId(),
+      hash_tree_commit->GetStorageBytes());
+  ASSERT_TRUE(parsed);
+  EXPECT_EQ(TreeType::HASH_TREE, CommitImpl::GetTreeType(*parsed));
+  EXPECT_EQ(TreeType::BTREE, CommitImpl::GetTreeType(*btree_commit));
+
+  // A page without commits adopts the tree type of the commits it receives.
+  EXPECT_EQ(Status::OK, add_commit(*hash_tree_commit));
+  EXPECT_EQ(Status::ILLEGAL_STATE, storage_->SetTreeType(TreeType::BTREE));
+
+  // Commits of another tree type are then rejected.
+  EXPECT_EQ(Status::ILLEGAL_STATE, add_commit(*btree_commit));
+  std::unique_ptr<const Commit> found;
+  EXPECT_EQ(Status::NOT_FOUND,
+            storage_->GetCommit(btree_commit->GetId(), &found));
+}
+
+TEST_F(PageStorageTest, InlineObjectsAfterRestart) {
+  ObjectData data("Some data");
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK, journal->PutValue("key", data.value,
+                                          KeyPriority::EAGER));
+  journal.reset();
+
+  // The filter over the objects stored in the database is saved on shutdown,
+  // and must still know of the value once loaded.
+  PageId id = storage_->GetId();
+  storage_.reset();
+  storage_ = std::make_unique<PageStorageImpl>(
+      message_loop_.task_runner(), io_runner_, tmp_dir_.path(), id);
+  ASSERT_EQ(Status::OK, storage_->Init());
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(data.object_id));
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
+  EXPECT_EQ(Status::NOT_FOUND,
+            storage_->ContainsObject(RandomId(kObjectIdSize)));
+}
+
+TEST_F(PageStorageTest, InlineObjectsFilterGrowth) {
+  // More values than the initial capacity of the filter over the objects
+  // stored in the database.
+  const size_t kValueCount = 3000;
+  std::vector<ObjectData> data;
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  for (size_t i = 0; i < kValueCount; ++i) {
+    data.emplace_back("Some data " + std::to_string(i));
+    EXPECT_EQ(Status::OK, journal->PutValue("key" + std::to_string(i),
+                                            data.back().value,
+                                            KeyPriority::EAGER));
+  }
+  journal.reset();
+
+  auto check_values = [this, &data] {
+    for (const ObjectData& value : data) {
+      EXPECT_EQ(Status::OK, storage_->ContainsObject(value.object_id));
+    }
+    EXPECT_EQ(Status::NOT_FOUND,
+              storage_->ContainsObject(RandomId(kObjectIdSize)));
+  };
+  check_values();
+
+  // The grown filter is not saved, and is rebuilt on the next start.
+  PageId id = storage_->GetId();
+  storage_.reset();
+  storage_ = std::make_unique<PageStorageImpl>(
+      message_loop_.task_runner(), io_runner_, tmp_dir_.path(), id);
+  ASSERT_EQ(Status::OK, storage_->Init());
+  check_values();
+}
+
 TEST_F(PageStorageTest, AddObjectFromLocal) {
   ObjectData data("Some data");
 
@@ -519,13 +905,117 @@ TEST_F(PageStorageTest, AddObjectFromLocal) {
 
   EXPECT_EQ(data.object_id, object_id);
 
-  std::string file_path = GetFilePath(object_id);
-  std::string file_content;
-  EXPECT_TRUE(files::ReadFileToString(file_path, &file_content));
-  EXPECT_EQ(data.value, file_content);
+  EXPECT_EQ(data.value, GetObjectContent(object_id));
   EXPECT_TRUE(storage_->ObjectIsUntracked(object_id));
 }
 
+TEST_F(PageStorageTest, AddManyObjectsFromLocal) {
+  const size_t kObjectCount = 50;
+  std::vector<ObjectData> data;
+  for (size_t i = 0; i < kObjectCount; ++i) {
+    data.emplace_back("Some data " + std::to_string(i));
+  }
+
+  size_t done_count = 0;
+  for (size_t i = 0; i < kObjectCount; ++i) {
+    storage_->AddObjectFromLocal(
+        mtl::WriteStringToSocket(data[i].value), data[i].size,
+        [this, &data, &done_count, i](Status returned_status,
+                                      ObjectId returned_object_id) {
+          EXPECT_EQ(Status::OK, returned_status);
+          EXPECT_EQ(data[i].object_id, returned_object_id);
+          if (++done_count == kObjectCount) {
+            message_loop_.PostQuitTask();
+          }
+        });
+  }
+  EXPECT_FALSE(RunLoopWithTimeout());
+
+  EXPECT_EQ(kObjectCount, done_count);
+  for (const ObjectData& object_data : data) {
+    EXPECT_EQ(object_data.value, GetObjectContent(object_data.object_id));
+  }
+}
+
+TEST_F(PageStorageTest, AddLargeObjectFromLocal) {
+  std::string value1 = RandomId(256 * 1024);
+  // The same value, with a few bytes changed in the middle.
+  std::string value2 = value1;
+  for (size_t i = 0; i < 16; ++i) {
+    value2[value2.size() / 2 + i] ^= 0xff;
+  }
+
+  std::vector<ObjectId> object_ids;
+  for (const std::string& value : {value1, value2}) {
+    storage_->AddObjectFromLocal(
+        mtl::WriteStringToSocket(value), value.size(),
+        [this, &object_ids](Status returned_status,
+                            ObjectId returned_object_id) {
+          EXPECT_EQ(Status::OK, returned_status);
+          object_ids.push_back(std::move(returned_object_id));
+          message_loop_.PostQuitTask();
+        });
+    EXPECT_FALSE(RunLoopWithTimeout());
+  }
+  ASSERT_EQ(2u, object_ids.size());
+  EXPECT_EQ(glue::SHA256Hash(value1.data(), value1.size()), object_ids[0]);
+  EXPECT_EQ(glue::SHA256Hash(value2.data(), value2.size()), object_ids[1]);
+
+  // Both values are chunked, and share all the chunks not covering the
+  // modified bytes.
+  std::vector<PackStore::Chunk> chunks1;
+  std::vector<PackStore::Chunk> chunks2;
+  ASSERT_EQ(Status::OK, GetChunksFromPackStore(object_ids[0], &chunks1));
+  ASSERT_EQ(Status::OK, GetChunksFromPackStore(object_ids[1], &chunks2));
+  EXPECT_GT(chunks1.size(), 1u);
+  size_t shared_count = 0;
+  for (const PackStore::Chunk& chunk : chunks2) {
+    for (const PackStore::Chunk& other : chunks1) {
+      if (chunk.id == other.id) {
+        ++shared_count;
+        break;
+      }
+    }
+  }
+  EXPECT_GE(shared_count + 2, chunks2.size());
+
+  EXPECT_EQ(value1, GetObjectContent(object_ids[0]));
+  EXPECT_EQ(value2, GetObjectContent(object_ids[1]));
+
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK,
+            storage_->GetObjectSynchronous(object_ids[1], &object));
+  uint64_t size;
+  EXPECT_EQ(Status::OK, object->GetSize(&size));
+  EXPECT_EQ(value2.size(), size);
+  std::string partial_data;
+  EXPECT_EQ(Status::OK,
+            object->GetPartialData(value2.size() / 2, 100, &partial_data));
+  EXPECT_EQ(value2.substr(value2.size() / 2, 100), partial_data);
+}
+
+TEST_F(PageStorageTest, CompressedObject) {
+  std::string value;
+  for (size_t i = 0; i < 1000; ++i) {
+    value += "{\"name\": \"entry " + std::to_string(i) + "\"}, ";
+  }
+
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK, storage_->AddObjectSynchronous(value, &object));
+  ObjectId object_id = object->GetId();
+  EXPECT_EQ(glue::SHA256Hash(value.data(), value.size()), object_id);
+  EXPECT_EQ(value, GetObjectContent(object_id));
+  uint64_t size;
+  ASSERT_EQ(Status::OK,
+            storage_->GetObjectSynchronous(object_id, &object));
+  EXPECT_EQ(Status::OK, object->GetSize(&size));
+  EXPECT_EQ(value.size(), size);
+
+  CompressionStats::Snapshot stats = storage_->GetCompressionStats();
+  EXPECT_GE(stats.compressed_count, 1u);
+  EXPECT_GT(stats.ratio(), 2.0);
+}
+
 TEST_F(PageStorageTest, InterruptAddObjectFromLocal) {
   ObjectData data("Some data");
 
@@ -577,13 +1067,31 @@ TEST_F(PageStorageTest, AddObjectFromSync) {
                               });
   message_loop_.Run();
 
-  std::string file_path = GetFilePath(data.object_id);
-  std::string file_content;
-  EXPECT_TRUE(files::ReadFileToString(file_path, &file_content));
-  EXPECT_EQ(data.value, file_content);
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
   EXPECT_FALSE(storage_->ObjectIsUntracked(data.object_id));
 }
 
+TEST_F(PageStorageTest, AddObjectFromSyncExistingObject) {
+  ObjectData data("Some data");
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK, storage_->AddObjectSynchronous(data.value, &object));
+
+  // The content of an object already stored is not read again, and the socket
+  // is closed.
+  glue::SocketPair socket;
+  Status status;
+  storage_->AddObjectFromSync(
+      data.object_id, std::move(socket.socket2), data.size,
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
+  size_t written;
+  EXPECT_EQ(ERR_REMOTE_CLOSED,
+            socket.socket1.write(0u, data.value.data(), data.value.size(),
+                                 &written));
+}
+
 TEST_F(PageStorageTest, AddObjectFromSyncWrongObjectId) {
   ObjectData data("Some data");
   ObjectId wrong_id = RandomId(kObjectIdSize);
@@ -595,6 +1103,10 @@ TEST_F(PageStorageTest, AddObjectFromSyncWrongObjectId) {
                                 message_loop_.PostQuitTask();
                               });
   message_loop_.Run();
+
+  std::unique_ptr<const Object> object;
+  EXPECT_EQ(Status::NOT_FOUND,
+            storage_->GetObjectSynchronous(data.object_id, &object));
 }
 
 TEST_F(PageStorageTest, AddObjectFromSyncWrongSize) {
@@ -611,9 +1123,7 @@ TEST_F(PageStorageTest, AddObjectFromSyncWrongSize) {
 
 TEST_F(PageStorageTest, GetObject) {
   ObjectData data("Some data");
-  std::string file_path = GetFilePath(data.object_id);
-  ASSERT_TRUE(files::CreateDirectory(files::GetDirectoryName(file_path)));
-  ASSERT_TRUE(files::WriteFile(file_path, data.value.data(), data.size));
+  ASSERT_EQ(Status::OK, AddObjectToPackStore(data.object_id, data.value));
 
   Status status;
   std::unique_ptr<const Object> object;
@@ -675,17 +1185,12 @@ TEST_F(PageStorageTest, AddObjectSynchronous) {
   EXPECT_EQ(Status::OK, status);
   EXPECT_EQ(data.object_id, object->GetId());
 
-  std::string file_path = GetFilePath(data.object_id);
-  std::string file_content;
-  EXPECT_TRUE(files::ReadFileToString(file_path, &file_content));
-  EXPECT_EQ(data.value, file_content);
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
 }
 
 TEST_F(PageStorageTest, GetObjectSynchronous) {
   ObjectData data("Some data");
-  std::string file_path = GetFilePath(data.object_id);
-  ASSERT_TRUE(files::CreateDirectory(files::GetDirectoryName(file_path)));
-  ASSERT_TRUE(files::WriteFile(file_path, data.value.data(), data.size));
+  ASSERT_EQ(Status::OK, AddObjectToPackStore(data.object_id, data.value));
 
   std::unique_ptr<const Object> object;
   Status status = storage_->GetObjectSynchronous(data.object_id, &object);
@@ -697,6 +1202,27 @@ TEST_F(PageStorageTest, GetObjectSynchronous) {
   EXPECT_EQ(data.value, convert::ToString(object_data));
 }
 
+TEST_F(PageStorageTest, ImportLegacyObjects) {
+  ObjectData data("Some data");
+  files::ScopedTempDir page_dir;
+  std::string hex = ToHex(data.object_id);
+  std::string legacy_dir = page_dir.path() + "/objects/" + hex.substr(0, 2);
+  ASSERT_TRUE(files::CreateDirectory(legacy_dir));
+  ASSERT_TRUE(files::WriteFile(legacy_dir + "/" + hex.substr(2),
+                               data.value.data(), data.size));
+
+  PageStorageImpl storage(message_loop_.task_runner(), io_runner_,
+                          page_dir.path(), RandomId(16));
+  ASSERT_EQ(Status::OK, storage.Init());
+  EXPECT_FALSE(files::IsDirectory(page_dir.path() + "/objects"));
+
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK, storage.GetObjectSynchronous(data.object_id, &object));
+  ftl::StringView object_data;
+  ASSERT_EQ(Status::OK, object->GetData(&object_data));
+  EXPECT_EQ(data.value, convert::ToString(object_data));
+}
+
 TEST_F(PageStorageTest, UnsyncedObjects) {
   int size = 3;
   ObjectData data[] = {
@@ -911,6 +1437,74 @@ TEST_F(PageStorageTest, SyncMetadata) {
   EXPECT_EQ("bazinga", sync_state);
 }
 
+TEST_F(PageStorageTest, SyncVersionUpgrade) {
+  // A page synced under an older serialization version.
+  CommitId commit_id1 = TryCommitFromLocal(JournalType::EXPLICIT, 10);
+  CommitId commit_id2 = TryCommitFromLocal(JournalType::EXPLICIT, 10);
+  CommitId commit_id3 = TryCommitFromSync();
+  EXPECT_EQ(Status::OK, storage_->MarkCommitSynced(commit_id1));
+  EXPECT_EQ(Status::OK, storage_->MarkCommitSynced(commit_id2));
+  EXPECT_EQ(Status::OK, storage_->SetSyncMetadata("timestamp"));
+  EXPECT_EQ(Status::OK, SetSyncVersion("2"));
+
+  auto restart = [this] {
+    PageId id = storage_->GetId();
+    storage_.reset();
+    storage_ = std::make_unique<PageStorageImpl>(
+        message_loop_.task_runner(), io_runner_, tmp_dir_.path(), id);
+    ASSERT_EQ(Status::OK, storage_->Init());
+  };
+  restart();
+
+  // The whole history is uploaded again, parents first, and the commits of the
+  // new namespace are downloaded from the start.
+  std::vector<std::unique_ptr<const Commit>> commits;
+  EXPECT_EQ(Status::OK, storage_->GetUnsyncedCommits(&commits));
+  ASSERT_EQ(3u, commits.size());
+  EXPECT_EQ(commit_id1, commits[0]->GetId());
+  EXPECT_EQ(commit_id2, commits[1]->GetId());
+  EXPECT_EQ(commit_id3, commits[2]->GetId());
+  std::string sync_state;
+  EXPECT_EQ(Status::NOT_FOUND, storage_->GetSyncMetadata(&sync_state));
+
+  // Once synced under the current version, the page is not reset again.
+  for (const auto& commit : commits) {
+    EXPECT_EQ(Status::OK, storage_->MarkCommitSynced(commit->GetId()));
+  }
+  EXPECT_EQ(Status::OK, storage_->SetSyncMetadata("timestamp"));
+  restart();
+  EXPECT_EQ(Status::OK, storage_->GetUnsyncedCommits(&commits));
+  EXPECT_TRUE(commits.empty());
+  EXPECT_EQ(Status::OK, storage_->GetSyncMetadata(&sync_state));
+  EXPECT_EQ("timestamp", sync_state);
+}
+
+TEST_F(PageStorageTest, TreeNodeCache) {
+  std::vector<Entry> entries = {
+      Entry{"key", RandomId(kObjectIdSize), KeyPriority::EAGER}};
+  ObjectId node_id;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromEntries(storage_.get(), entries,
+                                  std::vector<ObjectId>(2), &node_id));
+
+  TreeNodeCache* cache = storage_->GetTreeNodeCache();
+  ASSERT_NE(nullptr, cache);
+  size_t hit_count = cache->hit_count();
+
+  std::unique_ptr<const TreeNode> node1;
+  std::unique_ptr<const TreeNode> node2;
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromIdSynchronous(storage_.get(), node_id, &node1));
+  ASSERT_EQ(Status::OK,
+            TreeNode::FromIdSynchronous(storage_.get(), node_id, &node2));
+  EXPECT_EQ(hit_count + 2, cache->hit_count());
+
+  Entry entry;
+  ASSERT_EQ(Status::OK, node2->GetEntry(0, &entry));
+  EXPECT_EQ(entries[0], entry);
+  EXPECT_EQ(node_id, node2->GetId());
+}
+
 TEST_F(PageStorageTest, AddMultipleCommitsFromSync) {
   FakeSyncDelegate sync;
   storage_->SetSyncDelegate(&sync);
@@ -939,8 +1533,7 @@ TEST_F(PageStorageTest, AddMultipleCommitsFromSync) {
     sync.AddObject(object_ids[i], root_data.ToString());
 
     // Remove the root from the local storage. The value was never added.
-    std::string file_path = GetFilePath(object_ids[i]);
-    files::DeletePath(file_path, false);
+    EXPECT_EQ(Status::OK, RemoveObjectFromPackStore(object_ids[i]));
   }
 
   std::vector<std::unique_ptr<const Commit>> parent;
@@ -998,6 +1591,155 @@ TEST_F(PageStorageTest, Generation) {
   ASSERT_FALSE(RunLoopWithTimeout());
 }
 
+TEST_F(PageStorageTest, CollectGarbage) {
+  // An object not referenced by any commit.
+  ObjectData unreferenced("unreferenced");
+  std::unique_ptr<const Object> object;
+  ASSERT_EQ(Status::OK,
+            storage_->AddObjectSynchronous(unreferenced.value, &object));
+  object.reset();
+  // An object not yet referenced by any commit.
+  ObjectData untracked("untracked");
+  TryAddFromLocal(untracked.value, untracked.object_id);
+
+  // A synced commit, superseded by a new one.
+  CommitId commit_id1 = TryCommitFromLocal(JournalType::EXPLICIT, 10);
+  std::unique_ptr<const Commit> commit1;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id1, &commit1));
+  ObjectId root_id1 = commit1->GetRootId();
+  EXPECT_EQ(Status::OK, storage_->MarkCommitSynced(commit_id1));
+  EXPECT_EQ(Status::OK, storage_->MarkObjectSynced(root_id1));
+  CommitId commit_id2 = TryCommitFromLocal(JournalType::EXPLICIT, 10);
+  std::unique_ptr<const Commit> commit2;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id2, &commit2));
+  ObjectId root_id2 = commit2->GetRootId();
+  commit2.reset();
+  ASSERT_NE(root_id1, root_id2);
+
+  auto collect_garbage = [this] {
+    Status status;
+    storage_->CollectGarbage(
+        ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+    EXPECT_FALSE(RunLoopWithTimeout());
+    EXPECT_EQ(Status::OK, status);
+  };
+
+  // The first commit is still in use.
+  collect_garbage();
+  EXPECT_EQ(Status::NOT_FOUND, storage_->ContainsObject(unreferenced.object_id));
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(untracked.object_id));
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(root_id1));
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(root_id2));
+
+  commit1.reset();
+  collect_garbage();
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(untracked.object_id));
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(root_id2));
+  // Commits are kept, and so are their trees, which are read synchronously.
+  EXPECT_EQ(Status::OK, storage_->GetCommit(commit_id1, &commit1));
+  EXPECT_EQ(Status::OK, storage_->ContainsObject(root_id1));
+
+  // Both commits can still be diffed and merged.
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id2, &commit2));
+  Status status;
+  std::unique_ptr<Iterator<const EntryChange>> changes;
+  commit2->GetContents()->diff(
+      commit1->GetContents(),
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status,
+                      &changes));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  EXPECT_TRUE(changes->Valid());
+
+  std::unique_ptr<Journal> journal;
+  ASSERT_EQ(Status::OK,
+            storage_->StartMergeCommit(commit_id1, commit_id2, &journal));
+  EXPECT_EQ(Status::OK,
+            journal->Put("key", RandomId(kObjectIdSize), KeyPriority::EAGER));
+  journal->Commit(
+      [this, &status](Status commit_status, const CommitId& commit_id) {
+        status = commit_status;
+        message_loop_.PostQuitTask();
+      });
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+}
+
+TEST_F(PageStorageTest, CollectGarbageKeepsJournalValues) {
+  ObjectData data("Some data");
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK,
+            journal->PutValue("key", data.value, KeyPriority::EAGER));
+  EXPECT_EQ(Status::OK, storage_->MarkObjectSynced(data.object_id));
+
+  Status status;
+  storage_->CollectGarbage(
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(data.value, GetObjectContent(data.object_id));
+
+  // Once the journal is rolled back, the value is no longer referenced.
+  EXPECT_EQ(Status::OK, journal->Rollback());
+  storage_->CollectGarbage(
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(Status::NOT_FOUND, storage_->ContainsObject(data.object_id));
+}
+
+TEST_F(PageStorageTest, CollectGarbageKeepsContentsInUse) {
+  ObjectData data("Some data");
+  std::unique_ptr<Journal> journal;
+  EXPECT_EQ(Status::OK, storage_->StartCommit(GetFirstHead()->GetId(),
+                                              JournalType::EXPLICIT, &journal));
+  EXPECT_EQ(Status::OK,
+            journal->PutValue("key", data.value, KeyPriority::EAGER));
+  Status status;
+  CommitId commit_id;
+  journal->Commit(::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                  &status, &commit_id));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+  EXPECT_EQ(Status::OK, storage_->MarkCommitSynced(commit_id));
+  EXPECT_EQ(Status::OK, storage_->MarkObjectSynced(data.object_id));
+
+  // Only the contents of the commit are kept, as a snapshot does.
+  std::unique_ptr<const Commit> commit;
+  ASSERT_EQ(Status::OK, storage_->GetCommit(commit_id, &commit));
+  std::unique_ptr<CommitContents> contents = commit->GetContents();
+  commit.reset();
+
+  // Supersede the commit.
+  EXPECT_EQ(Status::OK, storage_->StartCommit(commit_id, JournalType::EXPLICIT,
+                                              &journal));
+  EXPECT_EQ(Status::OK, journal->Delete("key"));
+  journal->Commit(::test::Capture([this] { message_loop_.PostQuitTask(); },
+                                  &status, &commit_id));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  ASSERT_EQ(Status::OK, status);
+
+  storage_->CollectGarbage(
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  std::unique_ptr<Iterator<const Entry>> entries = contents->find("key");
+  ASSERT_TRUE(entries->Valid());
+  EXPECT_EQ("key", (*entries)->key);
+  EXPECT_EQ(data.value, GetObjectContent((*entries)->object_id));
+
+  // Once the contents are released, the value is no longer referenced.
+  entries.reset();
+  contents.reset();
+  storage_->CollectGarbage(
+      ::test::Capture([this] { message_loop_.PostQuitTask(); }, &status));
+  EXPECT_FALSE(RunLoopWithTimeout());
+  EXPECT_EQ(Status::OK, status);
+  EXPECT_EQ(Status::NOT_FOUND, storage_->ContainsObject(data.object_id));
+}
+
 TEST_F(PageStorageTest, DeletionOnIOThread) {
   std::timed_mutex mutex;
   // Need a local io_thread because mutex must outlive it.
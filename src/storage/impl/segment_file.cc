@@ -0,0 +1,88 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/impl/segment_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "lib/ftl/files/unique_fd.h"
+#include "lib/ftl/logging.h"
+
+namespace storage {
+
+SegmentFile::Mapping::Mapping(char* address, size_t size)
+    : address_(address), size_(size) {}
+
+SegmentFile::Mapping::~Mapping() {
+  munmap(address_, size_);
+}
+
+SegmentFile::SegmentFile(std::string path) : path_(std::move(path)) {}
+
+SegmentFile::~SegmentFile() {}
+
+Status SegmentFile::GetData(uint64_t offset,
+                            uint64_t size,
+                            ftl::StringView* data,
+                            std::shared_ptr<const Mapping>* mapping) {
+  if (size == 0) {
+    *data = ftl::StringView();
+    mapping->reset();
+    return Status::OK;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (mapping_failed_) {
+    return Status::INTERNAL_IO_ERROR;
+  }
+  if (!mapping_ || mapping_->size() < offset + size) {
+    Status s = MapLocked(offset + size);
+    if (s != Status::OK) {
+      return s;
+    }
+  }
+  *data = ftl::StringView(mapping_->address() + offset, size);
+  *mapping = mapping_;
+  return Status::OK;
+}
+
+Status SegmentFile::MapLocked(uint64_t min_size) {
+  ftl::UniqueFD fd(open(path_.c_str(), O_RDONLY));
+  if (!fd.is_valid()) {
+    FTL_LOG(ERROR) << "Unable to open " << path_ << ": " << strerror(errno);
+    return Status::INTERNAL_IO_ERROR;
+  }
+  struct stat st;
+  if (fstat(fd.get(), &st) != 0) {
+    return Status::INTERNAL_IO_ERROR;
+  }
+  if (static_cast<uint64_t>(st.st_size) < min_size) {
+    FTL_LOG(ERROR) << "Segment " << path_ << " is too small: " << st.st_size
+                   << " < " << min_size;
+    return Status::INTERNAL_IO_ERROR;
+  }
+
+  // The active segment keeps growing. Map past the end of the file, doubling
+  // the size of the mapping each time, so that recently added objects do not
+  // require a new mapping each. Only pages backed by the file are accessed.
+  size_t size = st.st_size;
+  if (mapping_) {
+    size = std::max(size, 2 * mapping_->size());
+  }
+  void* address = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd.get(), 0);
+  if (address == MAP_FAILED) {
+    FTL_LOG(WARNING) << "Unable to map " << path_ << ": " << strerror(errno);
+    mapping_failed_ = true;
+    return Status::INTERNAL_IO_ERROR;
+  }
+  mapping_ = std::make_shared<Mapping>(static_cast<char*>(address), size);
+  return Status::OK;
+}
+
+}  // namespace storage
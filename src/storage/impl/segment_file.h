@@ -0,0 +1,74 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#ifndef APPS_LEDGER_SRC_STORAGE_IMPL_SEGMENT_FILE_H_
+#define APPS_LEDGER_SRC_STORAGE_IMPL_SEGMENT_FILE_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "apps/ledger/src/storage/public/types.h"
+#include "lib/ftl/macros.h"
+#include "lib/ftl/strings/string_view.h"
+
+namespace storage {
+
+// A segment file of a |PackStore|. The file is memory-mapped on first access
+// and the mapping is shared by all the objects stored in the segment. As
+// segments are append-only, the file is mapped again when it grew past the
+// current mapping. Previous mappings are released once no view returned by
+// |GetData()| uses them anymore.
+//
+// This class is thread safe.
+class SegmentFile {
+ public:
+  // A read-only memory mapping of the file, released when deleted.
+  class Mapping {
+   public:
+    Mapping(char* address, size_t size);
+    ~Mapping();
+
+    const char* address() const { return address_; }
+    size_t size() const { return size_; }
+
+   private:
+    char* const address_;
+    const size_t size_;
+
+    FTL_DISALLOW_COPY_AND_ASSIGN(Mapping);
+  };
+
+  explicit SegmentFile(std::string path);
+  ~SegmentFile();
+
+  const std::string& path() const { return path_; }
+
+  // Returns in |data| a view of the |size| bytes at |offset| in the file, and
+  // in |mapping| the mapping holding it. |data| is valid as long as |mapping|
+  // is kept. Returns |INTERNAL_IO_ERROR| if the file cannot be mapped, in which
+  // case the caller should read the file instead.
+  Status GetData(uint64_t offset,
+                 uint64_t size,
+                 ftl::StringView* data,
+                 std::shared_ptr<const Mapping>* mapping);
+
+ private:
+  Status MapLocked(uint64_t min_size);
+
+  const std::string path_;
+
+  std::mutex mutex_;
+  // The current mapping of the file. Previous mappings are owned by the
+  // callers of |GetData()| still using them.
+  std::shared_ptr<const Mapping> mapping_;
+  // Whether mapping the file already failed. Mapping is not attempted again.
+  bool mapping_failed_ = false;
+
+  FTL_DISALLOW_COPY_AND_ASSIGN(SegmentFile);
+};
+
+}  // namespace storage
+
+#endif  // APPS_LEDGER_SRC_STORAGE_IMPL_SEGMENT_FILE_H_
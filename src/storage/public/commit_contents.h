@@ -5,8 +5,11 @@
 #ifndef APPS_LEDGER_SRC_STORAGE_PUBLIC_COMMIT_CONTENTS_H_
 #define APPS_LEDGER_SRC_STORAGE_PUBLIC_COMMIT_CONTENTS_H_
 
+#include <functional>
 #include <iterator>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "apps/ledger/src/convert/convert.h"
 #include "apps/ledger/src/storage/public/iterator.h"
@@ -29,6 +32,58 @@ class CommitContents {
   virtual std::unique_ptr<Iterator<const Entry>> find(
       convert::ExtendedStringView key) const = 0;
 
+  // Returns an iterator over the entries with keys in [|start|, |end|), in
+  // increasing key order, or in decreasing key order if |reverse| is true. An
+  // empty |end| means that the range has no upper bound.
+  virtual std::unique_ptr<Iterator<const Entry>> range(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      bool reverse) const = 0;
+
+  // Calls |on_next| on the entries with keys in [|start|, |end|), in
+  // increasing key order, or in decreasing key order if |reverse| is true. An
+  // empty |end| means that the range has no upper bound. Returning false from
+  // |on_next| stops the iteration. |on_done| is called once, when there are no
+  // more entries, the iteration was stopped, or an error occurs. Unlike
+  // |range()|, the contents are read asynchronously: prefer this method for
+  // scans, which then do not fail on data not yet synced.
+  virtual void ForEachEntry(convert::ExtendedStringView start,
+                            convert::ExtendedStringView end,
+                            bool reverse,
+                            std::function<bool(Entry)> on_next,
+                            std::function<void(Status)> on_done) const = 0;
+
+  // Calls |callback| with the number of entries with keys in [|start|,
+  // |end|). An empty |end| means that the range has no upper bound.
+  virtual void GetEntryCount(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::function<void(Status, uint64_t)> callback) const = 0;
+
+  // Calls |callback| with the entry at position |offset|, counting from 0,
+  // among the entries with keys in [|start|, |end|). The status is |NOT_FOUND|
+  // if there are |offset| such entries or less.
+  virtual void GetEntryAtOffset(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      uint64_t offset,
+      std::function<void(Status, Entry)> callback) const = 0;
+
+  // Looks up the entry with the given |key| and calls |callback| with it. The
+  // status is |NOT_FOUND| if |key| is not present. Unlike |find|, no iterator
+  // is built: prefer this method for point lookups.
+  virtual void GetEntry(convert::ExtendedStringView key,
+                        std::function<void(Status, Entry)> callback) const = 0;
+
+  // Looks up the entries with the given |keys|, in any order, and calls
+  // |callback| with, for each key, its entry, or null if the key is not
+  // present. The keys are looked up together: prefer this method to
+  // successive calls to |GetEntry| when reading many keys.
+  virtual void GetEntries(
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback) const = 0;
+
   // Returns an iterator over the difference between this object and other
   // object.
   virtual void diff(
@@ -20,9 +20,18 @@ constexpr char kFirstPageCommitIdArray[kCommitIdSize] = {0};
 constexpr const ftl::StringView kFirstPageCommitId(kFirstPageCommitIdArray,
                                                    kCommitIdSize);
 
-// The serialization version of the ledger.
+// The serialization version of the local storage of the ledger. Tree nodes
+// written in older formats are still read, so this does not change with them.
 constexpr const ftl::StringView kSerializationVersion = "1";
 
+// The serialization version of the data synced through the cloud. Peers cannot
+// read objects written in a newer format, so each version syncs in its own
+// namespace. Version 1 encodes tree nodes in JSON, version 2 in the first
+// binary format and version 3 in the binary format with the entry counts of
+// the children. Pages synced under an older version upload their whole history
+// again to the namespace of the current one.
+constexpr const ftl::StringView kSyncSerializationVersion = "3";
+
 }  // namespace storage
 
 #endif  // APPS_LEDGER_SRC_STORAGE_PUBLIC_CONSTANTS_H_
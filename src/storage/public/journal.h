@@ -24,10 +24,26 @@ class Journal {
                      ObjectIdView object_id,
                      KeyPriority priority) = 0;
 
+  // Adds an entry with the given |key| and |value| to this |Journal|. |value|
+  // is stored as a new object, together with the journal entry. This is
+  // intended for small values: larger ones should be added to the storage
+  // first and then referenced through |Put()|. Returns |OK| on success or the
+  // error code otherwise.
+  virtual Status PutValue(convert::ExtendedStringView key,
+                          convert::ExtendedStringView value,
+                          KeyPriority priority) = 0;
+
   // Deletes the entry with the given |key| from this |Journal|. Returns |OK|
   // on success or the error code otherwise.
   virtual Status Delete(convert::ExtendedStringView key) = 0;
 
+  // Deletes the entries with keys in [|start|, |end|) from this |Journal|,
+  // both those of the base commit and those added to this |Journal|. An empty
+  // |end| means that the range has no upper bound. Entries put in the range
+  // afterwards are kept. Returns |OK| on success or the error code otherwise.
+  virtual Status DeleteRange(convert::ExtendedStringView start,
+                             convert::ExtendedStringView end) = 0;
+
   // Commits the changes of this |Journal|. Trying to update entries or rollback
   // will fail after a successful commit. The id of the created commit is
   // returned in |commit_id|.
@@ -0,0 +1,49 @@
+// Copyright 2016 The Fuchsia Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include "apps/ledger/src/storage/public/object.h"
+
+namespace storage {
+
+Status Object::GetSize(uint64_t* size) const {
+  ftl::StringView data;
+  Status status = GetData(&data);
+  if (status != Status::OK) {
+    return status;
+  }
+  *size = data.size();
+  return Status::OK;
+}
+
+Status Object::GetPartialData(uint64_t offset,
+                              uint64_t max_size,
+                              std::string* data) const {
+  std::vector<ftl::StringView> parts;
+  Status status = GetPartialDataViews(offset, max_size, &parts);
+  if (status != Status::OK) {
+    return status;
+  }
+  data->clear();
+  for (ftl::StringView part : parts) {
+    data->append(part.data(), part.size());
+  }
+  return Status::OK;
+}
+
+Status Object::GetPartialDataViews(uint64_t offset,
+                                   uint64_t max_size,
+                                   std::vector<ftl::StringView>* parts) const {
+  parts->clear();
+  ftl::StringView view;
+  Status status = GetData(&view);
+  if (status != Status::OK) {
+    return status;
+  }
+  if (offset < view.size() && max_size > 0) {
+    parts->push_back(view.substr(offset, max_size));
+  }
+  return Status::OK;
+}
+
+}  // namespace storage
@@ -5,6 +5,7 @@
 #ifndef APPS_LEDGER_SRC_STORAGE_PUBLIC_OBJECT_H_
 #define APPS_LEDGER_SRC_STORAGE_PUBLIC_OBJECT_H_
 
+#include <string>
 #include <vector>
 
 #include "apps/ledger/src/storage/public/types.h"
@@ -24,6 +25,25 @@ class Object {
   // Returns the data of this object.
   virtual Status GetData(ftl::StringView* data) const = 0;
 
+  // Returns the size of the data of this object. The default implementation
+  // loads the data.
+  virtual Status GetSize(uint64_t* size) const;
+
+  // Returns in |data| at most |max_size| bytes of the data of this object,
+  // starting at |offset|. The data is copied from |GetPartialDataViews()|.
+  Status GetPartialData(uint64_t offset,
+                        uint64_t max_size,
+                        std::string* data) const;
+
+  // Returns in |parts| views of the consecutive parts of the data of this
+  // object that hold at most |max_size| bytes starting at |offset|, so that
+  // they can be copied without being assembled first. The views are valid as
+  // long as this object is. Implementations can override this to avoid loading
+  // the whole data.
+  virtual Status GetPartialDataViews(uint64_t offset,
+                                     uint64_t max_size,
+                                     std::vector<ftl::StringView>* parts) const;
+
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(Object);
 };
@@ -22,6 +22,9 @@
 
 namespace storage {
 
+class LiveRoots;
+class TreeNodeCache;
+
 // |PageStorage| manages the local storage of a single page.
 class PageStorage {
  public:
@@ -143,6 +146,28 @@ class PageStorage {
   // Retrieves the opaque sync metadata associated with this page.
   virtual Status GetSyncMetadata(std::string* sync_state) = 0;
 
+  // Selects the type of the tree holding the contents of the commits of this
+  // page. Each commit records the type of its tree, and a page that has no
+  // commit of its own adopts the type of the first commits received through
+  // sync. Returns |ILLEGAL_STATE| if the page already has commits other than
+  // the first, empty one, as existing trees cannot be converted.
+  virtual Status SetTreeType(TreeType tree_type) = 0;
+
+  // Returns the cache of decoded tree nodes of this page, or nullptr if tree
+  // nodes should be decoded on each access.
+  virtual TreeNodeCache* GetTreeNodeCache() { return nullptr; }
+
+  // Returns the set in which commits register their root node while they are
+  // in memory, or nullptr if the objects of this page are never collected.
+  virtual std::shared_ptr<LiveRoots> GetLiveRoots() { return nullptr; }
+
+  // Returns |OK| if the object with the given |object_id| is stored locally,
+  // |NOT_FOUND| if not, |NOT_IMPLEMENTED| if this is not known, or an error
+  // code otherwise.
+  virtual Status ContainsObject(ObjectIdView object_id) {
+    return Status::NOT_IMPLEMENTED;
+  }
+
  private:
   FTL_DISALLOW_COPY_AND_ASSIGN(PageStorage);
 };
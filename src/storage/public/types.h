@@ -44,10 +44,26 @@ struct EntryChange {
   bool deleted;
 };
 
+// A range of keys [start, end). An empty |end| means that the range has no
+// upper bound.
+struct KeyRange {
+  std::string start;
+  std::string end;
+};
+
 enum class ChangeSource { LOCAL, SYNC };
 
 enum class JournalType { IMPLICIT, EXPLICIT };
 
+// The implementation of the tree holding the contents of the commits of a page.
+enum class TreeType {
+  // The B-Tree of |btree/btree_utils.h|, whose shape depends on the order in
+  // which changes were applied.
+  BTREE,
+  // The history-independent tree of |btree/hash_tree.h|.
+  HASH_TREE,
+};
+
 enum class Status {
   // User visible status.
   OK,
@@ -22,6 +22,63 @@ std::unique_ptr<Iterator<const Entry>> CommitContentsEmptyImpl::find(
   return nullptr;
 }
 
+// Returns an iterator over the entries with keys in [|start|, |end|).
+std::unique_ptr<Iterator<const Entry>> CommitContentsEmptyImpl::range(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    bool reverse) const {
+  FTL_NOTIMPLEMENTED();
+  return nullptr;
+}
+
+// Calls |on_next| on the entries with keys in [|start|, |end|).
+void CommitContentsEmptyImpl::ForEachEntry(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    bool reverse,
+    std::function<bool(Entry)> on_next,
+    std::function<void(Status)> on_done) const {
+  FTL_NOTIMPLEMENTED();
+  on_done(Status::NOT_IMPLEMENTED);
+}
+
+// Calls |callback| with the number of entries with keys in [|start|, |end|).
+void CommitContentsEmptyImpl::GetEntryCount(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    std::function<void(Status, uint64_t)> callback) const {
+  FTL_NOTIMPLEMENTED();
+  callback(Status::NOT_IMPLEMENTED, 0);
+}
+
+// Calls |callback| with the entry at position |offset| among the entries with
+// keys in [|start|, |end|).
+void CommitContentsEmptyImpl::GetEntryAtOffset(
+    convert::ExtendedStringView start,
+    convert::ExtendedStringView end,
+    uint64_t offset,
+    std::function<void(Status, Entry)> callback) const {
+  FTL_NOTIMPLEMENTED();
+  callback(Status::NOT_IMPLEMENTED, Entry());
+}
+
+// Looks up the entry with the given |key| and calls |callback| with it.
+void CommitContentsEmptyImpl::GetEntry(
+    convert::ExtendedStringView key,
+    std::function<void(Status, Entry)> callback) const {
+  FTL_NOTIMPLEMENTED();
+  callback(Status::NOT_IMPLEMENTED, Entry());
+}
+
+// Looks up the entries with the given |keys|.
+void CommitContentsEmptyImpl::GetEntries(
+    std::vector<std::string> keys,
+    std::function<void(Status, std::vector<std::unique_ptr<Entry>>)> callback)
+    const {
+  FTL_NOTIMPLEMENTED();
+  callback(Status::NOT_IMPLEMENTED, std::vector<std::unique_ptr<Entry>>());
+}
+
 // Returns an iterator over the difference between this object and other
 // object.
 void CommitContentsEmptyImpl::diff(
@@ -29,6 +29,44 @@ class CommitContentsEmptyImpl : public CommitContents {
   std::unique_ptr<Iterator<const Entry>> find(
       convert::ExtendedStringView key) const override;
 
+  // Returns an iterator over the entries with keys in [|start|, |end|).
+  std::unique_ptr<Iterator<const Entry>> range(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      bool reverse) const override;
+
+  // Calls |on_next| on the entries with keys in [|start|, |end|).
+  void ForEachEntry(convert::ExtendedStringView start,
+                    convert::ExtendedStringView end,
+                    bool reverse,
+                    std::function<bool(Entry)> on_next,
+                    std::function<void(Status)> on_done) const override;
+
+  // Calls |callback| with the number of entries with keys in [|start|,
+  // |end|).
+  void GetEntryCount(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      std::function<void(Status, uint64_t)> callback) const override;
+
+  // Calls |callback| with the entry at position |offset| among the entries
+  // with keys in [|start|, |end|).
+  void GetEntryAtOffset(
+      convert::ExtendedStringView start,
+      convert::ExtendedStringView end,
+      uint64_t offset,
+      std::function<void(Status, Entry)> callback) const override;
+
+  // Looks up the entry with the given |key| and calls |callback| with it.
+  void GetEntry(convert::ExtendedStringView key,
+                std::function<void(Status, Entry)> callback) const override;
+
+  // Looks up the entries with the given |keys|.
+  void GetEntries(
+      std::vector<std::string> keys,
+      std::function<void(Status, std::vector<std::unique_ptr<Entry>>)>
+          callback) const override;
+
   // Returns an iterator over the difference between this object and other
   // object.
   void diff(
@@ -140,5 +140,10 @@ Status PageStorageEmptyImpl::GetSyncMetadata(std::string* sync_state) {
   return Status::NOT_IMPLEMENTED;
 }
 
+Status PageStorageEmptyImpl::SetTreeType(TreeType tree_type) {
+  FTL_NOTIMPLEMENTED();
+  return Status::NOT_IMPLEMENTED;
+}
+
 }  // namespace test
 }  // namespace storage
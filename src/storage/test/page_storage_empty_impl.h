@@ -84,6 +84,8 @@ class PageStorageEmptyImpl : public PageStorage {
   Status SetSyncMetadata(ftl::StringView sync_state) override;
 
   Status GetSyncMetadata(std::string* sync_state) override;
+
+  Status SetTreeType(TreeType tree_type) override;
 };
 
 }  // namespace test